@@ -0,0 +1,279 @@
+#include <fcntl.h>
+#include <mman.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include <trace.h>
+#include <unistd.h>
+
+#include "string.h"
+
+// This program's name in /bin, for the exec benchmark
+#define SELF "bench"
+
+// Samples taken per benchmark, unless it says otherwise
+#define ITERATIONS 1000
+
+// Pages mapped and touched per mmap/touch sample
+#define MMAP_PAGES 16
+#define PAGE_SIZE 4096
+
+// A file whose pages the page fault benchmark maps, warm in the page cache
+// after the first pass
+#define FAULT_FILE "/lib/libc.so"
+#define FAULT_PASSES 20
+
+// Bytes per memcpy sample
+#define MEMCPY_SIZE (64 * 1024)
+
+// Bytes per console write sample, a line of text
+#define CONSOLE_LINE 80
+#define CONSOLE_ITERATIONS 100
+
+// Bytes tools/bench.py types after the ready line, one at a time
+#define INPUT_BYTES 16
+#define INPUT_RECORDS 256
+
+// Interrupt vectors input arrives on, see kernel/include/idt.h
+#define KEYBOARD_VECTOR 0x21
+#define SERIAL_VECTOR 0x24
+
+// Results go between these lines, for tools/bench.py to pick out
+#define JSON_BEGIN "BENCH-JSON-BEGIN"
+#define JSON_END "BENCH-JSON-END"
+
+// Most samples one benchmark may take
+#define MAX_SAMPLES 8192
+
+static uint64_t samples[MAX_SAMPLES];
+
+static inline uint64_t rdtsc() {
+    // Keep the read from running ahead of the work before it
+    uint32_t lo, hi;
+    __asm__ volatile("lfence\nrdtsc" : "=a"(lo), "=d"(hi)::"memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Shell sort, there is no qsort
+static void sort(uint64_t *values, size_t count) {
+    for (size_t gap = count / 2; gap > 0; gap /= 2) {
+        for (size_t i = gap; i < count; i++) {
+            uint64_t value = values[i];
+            size_t j = i;
+            for (; j >= gap && values[j - gap] > value; j -= gap) {
+                values[j] = values[j - gap];
+            }
+            values[j] = value;
+        }
+    }
+}
+
+// Print one result as a JSON object, with its median and 99th percentile in
+// TSC cycles
+static void report_values(const char *name, size_t count, uint64_t bytes, uint64_t median,
+                          uint64_t p99) {
+    static bool first = true;
+    if (count == 0) {
+        return;
+    }
+    printf("%s    {\"name\": \"%s\", \"samples\": %lu, \"bytes\": %lu, "
+           "\"median_cycles\": %lu, \"p99_cycles\": %lu}",
+           first ? "" : ",\n", name, count, bytes, median, p99);
+    first = false;
+}
+
+// Print the first count entries of samples[] as one result
+static void report(const char *name, size_t count, uint64_t bytes) {
+    sort(samples, count);
+    report_values(name, count, bytes, samples[count / 2], samples[count * 99 / 100]);
+}
+
+// A trap into the kernel that does next to nothing
+static size_t bench_null_syscall() {
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        uint64_t start = rdtsc();
+        syscall(SYS_getpid);
+        samples[i] = rdtsc() - start;
+    }
+    return ITERATIONS;
+}
+
+// Spawn a copy of this program that exits right away, and wait for it
+static size_t bench_exec() {
+    char *argv[] = {SELF, "--exit", NULL};
+    size_t count = 0;
+    for (size_t i = 0; i < ITERATIONS / 10; i++) {
+        uint64_t start = rdtsc();
+        int pid = spawn(SELF, argv);
+        if (pid < 0) {
+            return 0;
+        }
+        waitpid(pid, NULL, 0);
+        samples[count++] = rdtsc() - start;
+    }
+    return count;
+}
+
+// Map anonymous memory and write to each page. There is no munmap, so each
+// sample leaves its pages behind.
+static size_t bench_mmap_touch() {
+    size_t count = 0;
+    for (size_t i = 0; i < ITERATIONS / 5; i++) {
+        uint64_t start = rdtsc();
+        volatile char *p = mmap(NULL, MMAP_PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            break;
+        }
+        for (size_t page = 0; page < MMAP_PAGES; page++) {
+            p[page * PAGE_SIZE] = 1;
+        }
+        samples[count++] = rdtsc() - start;
+    }
+    return count;
+}
+
+// Map a file and time the first read of each page, which faults it in from
+// the page cache
+static size_t bench_page_fault() {
+    int fd = open(FAULT_FILE, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    size_t pages = size / PAGE_SIZE;
+
+    size_t count = 0;
+    for (size_t pass = 0; pass < FAULT_PASSES; pass++) {
+        volatile char *p = mmap(NULL, pages * PAGE_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            break;
+        }
+        for (size_t page = 0; page < pages && count < MAX_SAMPLES; page++) {
+            uint64_t start = rdtsc();
+            (void)p[page * PAGE_SIZE];
+            samples[count++] = rdtsc() - start;
+        }
+    }
+    close(fd);
+    return count;
+}
+
+// Copy between two buffers that fit in the L2 cache
+static size_t bench_memcpy() {
+    char *src = malloc(MEMCPY_SIZE);
+    char *dst = malloc(MEMCPY_SIZE);
+    if (src == NULL || dst == NULL) {
+        return 0;
+    }
+    memset(src, 0x5A, MEMCPY_SIZE);
+    memcpy(dst, src, MEMCPY_SIZE);
+
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        uint64_t start = rdtsc();
+        memcpy(dst, src, MEMCPY_SIZE);
+        samples[i] = rdtsc() - start;
+    }
+    free(src);
+    free(dst);
+    return ITERATIONS;
+}
+
+// Write lines to the console, which draws them and queues them for serial
+static size_t bench_console_write() {
+    char line[CONSOLE_LINE];
+    memset(line, '.', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\n';
+
+    for (size_t i = 0; i < CONSOLE_ITERATIONS; i++) {
+        uint64_t start = rdtsc();
+        write(1, line, sizeof(line));
+        samples[i] = rdtsc() - start;
+    }
+    return CONSOLE_ITERATIONS;
+}
+
+// Read bytes typed into the serial console one at a time, timing each from
+// the interrupt that brought it in, as traced, to read returning it
+static size_t bench_input() {
+    static struct trace_record records[INPUT_RECORDS];
+    uint64_t read_done[INPUT_BYTES];
+
+    trace(TRACE_START, 1 << TRACE_IRQ, 0);
+    printf("BENCH-INPUT %d\n", INPUT_BYTES);
+    for (size_t i = 0; i < INPUT_BYTES; i++) {
+        char c;
+        if (read(0, &c, 1) != 1) {
+            trace(TRACE_STOP, 0, 0);
+            return 0;
+        }
+        read_done[i] = rdtsc();
+    }
+    trace(TRACE_STOP, 0, 0);
+    long records_read = trace(TRACE_READ, (uint64_t)records, INPUT_RECORDS);
+
+    // Each byte came in with the last input interrupt before its read
+    // returned. Nothing is printed meanwhile, so serial interrupts are all
+    // for input.
+    size_t count = 0;
+    uint64_t after = 0;
+    for (size_t i = 0; i < INPUT_BYTES; i++) {
+        uint64_t irq = 0;
+        for (long r = 0; r < records_read; r++) {
+            struct trace_record *record = &records[r];
+            if (record->event != TRACE_IRQ ||
+                (record->args[0] != KEYBOARD_VECTOR && record->args[0] != SERIAL_VECTOR)) {
+                continue;
+            }
+            if (record->tsc > after && record->tsc < read_done[i] && record->tsc > irq) {
+                irq = record->tsc;
+            }
+        }
+        if (irq != 0) {
+            samples[count++] = read_done[i] - irq;
+        }
+        after = read_done[i];
+    }
+    return count;
+}
+
+void _start(int argc, char **argv) {
+    // The exec benchmark's child
+    if (argc > 1 && strcmp(argv[1], "--exit") == 0) {
+        exit(0);
+    }
+
+    // Each benchmark leaves its samples in samples[], so the console ones,
+    // whose output would land inside the JSON, go first and are kept aside
+    size_t count = bench_console_write();
+    sort(samples, count);
+    uint64_t console_median = count ? samples[count / 2] : 0;
+    uint64_t console_p99 = count ? samples[count * 99 / 100] : 0;
+    size_t console_count = count;
+    printf("\n");
+
+    count = bench_input();
+    sort(samples, count);
+    uint64_t input_median = count ? samples[count / 2] : 0;
+    uint64_t input_p99 = count ? samples[count * 99 / 100] : 0;
+    size_t input_count = count;
+
+    printf("%s\n{\n  \"tsc_hz\": %ld,\n  \"results\": [\n", JSON_BEGIN,
+           trace(TRACE_TSC_HZ, 0, 0));
+    report("null_syscall", bench_null_syscall(), 0);
+    report("exec", bench_exec(), 0);
+    report("mmap_touch", bench_mmap_touch(), MMAP_PAGES * PAGE_SIZE);
+    report("page_fault", bench_page_fault(), PAGE_SIZE);
+    report("memcpy", bench_memcpy(), MEMCPY_SIZE);
+    report_values("console_write", console_count, CONSOLE_LINE, console_median, console_p99);
+    report_values("input_latency", input_count, 1, input_median, input_p99);
+    printf("\n  ]\n}\n%s\n", JSON_END);
+
+    // Ends QEMU when this runs as init, from tools/bench.py. Run from a shell,
+    // it fails and the program exits as usual.
+    poweroff(0);
+    exit(0);
+}
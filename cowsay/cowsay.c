@@ -6,15 +6,38 @@
 
 #include "string.h"
 
-void _start() {
-    char input_buffer[512];
-    memset(input_buffer, 0, 512);
+// Print a one-line speech bubble around the arguments, joined by spaces
+static void say(int argc, char **argv) {
+    size_t width = 0;
+    for (int i = 1; i < argc; i++) {
+        width += strlen(argv[i]) + (i > 1);
+    }
 
-    // source: https://en.wikipedia.org/wiki/Cowsay
-    printf(" ________________________________________\n");
-    printf("/ You have Egyptian flu: you're going to \\\n");
-    printf("\\ be a mummy.                            /\n");
-    printf(" ----------------------------------------\n");
+    printf(" ");
+    for (size_t i = 0; i < width + 2; i++) {
+        printf("_");
+    }
+    printf("\n< ");
+    for (int i = 1; i < argc; i++) {
+        printf(i > 1 ? " %s" : "%s", argv[i]);
+    }
+    printf(" >\n ");
+    for (size_t i = 0; i < width + 2; i++) {
+        printf("-");
+    }
+    printf("\n");
+}
+
+void _start(int argc, char **argv) {
+    if (argc > 1) {
+        say(argc, argv);
+    } else {
+        // source: https://en.wikipedia.org/wiki/Cowsay
+        printf(" ________________________________________\n");
+        printf("/ You have Egyptian flu: you're going to \\\n");
+        printf("\\ be a mummy.                            /\n");
+        printf(" ----------------------------------------\n");
+    }
     printf("        \\   ^__^\n");
     printf("         \\  (oo)\\_______\n");
     printf("            (__)\\       )\\/\\\n");
@@ -0,0 +1,13 @@
+#include <dmesg.h>
+#include <unistd.h>
+
+// Enough for the whole kernel log ring
+static char buf[64 * 1024];
+
+void _start() {
+    long len = dmesg(buf, sizeof(buf));
+    if (len > 0) {
+        write(1, buf, len);
+    }
+    exit(0);
+}
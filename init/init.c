@@ -1,36 +1,170 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include "string.h"
 
+// Longest command line
+#define LINE_MAX 512
+
+// Most stages a pipeline may have
+#define MAX_STAGES 8
+
+// Most words in one stage, the program's name included
+#define MAX_ARGS 16
+
+// Where the shell keeps its own stdin and stdout while wiring up a pipeline
+#define SAVED_STDIN 10
+#define SAVED_STDOUT 11
+
+static bool is_space(char ch) { return ch == ' ' || ch == '\t'; }
+
+/**
+ * @brief parse splits a command line into stages of words. Words are
+ * separated by blanks, quotes group blanks and '|' into a word and are
+ * dropped, and a '|' outside quotes ends a stage.
+ *
+ * @param line the command line
+ * @param words where to store the words, at least as long as line
+ * @param argvs filled with each stage's NULL-terminated words
+ * @return int the number of stages, 0 for a blank line, or -1 on a syntax error
+ */
+static int parse(const char *line, char *words, char *argvs[MAX_STAGES][MAX_ARGS + 1]) {
+    int stages = 0;
+    size_t argc = 0;
+
+    while (true) {
+        while (is_space(*line)) {
+            line++;
+        }
+
+        // End of a stage, which must not be empty unless the whole line is
+        if (*line == '\0' || *line == '|') {
+            argvs[stages][argc] = NULL;
+            if (argc == 0) {
+                return *line == '\0' && stages == 0 ? 0 : -1;
+            }
+            stages++;
+            argc = 0;
+            if (*line++ == '\0') {
+                return stages;
+            }
+            if (stages == MAX_STAGES) {
+                return -1;
+            }
+            continue;
+        }
+
+        if (argc == MAX_ARGS) {
+            return -1;
+        }
+        argvs[stages][argc++] = words;
+
+        char quote = '\0';
+        while (*line != '\0' && (quote != '\0' || (!is_space(*line) && *line != '|'))) {
+            if (quote == '\0' && (*line == '"' || *line == '\'')) {
+                quote = *line++;
+            } else if (*line == quote) {
+                quote = '\0';
+                line++;
+            } else {
+                *words++ = *line++;
+            }
+        }
+        if (quote != '\0') {
+            return -1;
+        }
+        *words++ = '\0';
+    }
+}
+
+// Run a command line of stages separated by '|'. Every stage runs as a child
+// process reading the previous stage's pipe and writing the next, and the
+// shell waits for all of them before prompting again.
+static void run_line(const char *line) {
+    char words[LINE_MAX];
+    char *argvs[MAX_STAGES][MAX_ARGS + 1];
+    int count = parse(line, words, argvs);
+    if (count < 0) {
+        printf("syntax error\n");
+        return;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    dup2(0, SAVED_STDIN);
+    dup2(1, SAVED_STDOUT);
+
+    int pids[MAX_STAGES];
+    int spawned = 0;
+    int prev_read = -1;
+    for (int i = 0; i < count; i++) {
+        int fds[2] = {-1, -1};
+        bool last = i + 1 == count;
+        if (!last && pipe(fds) != 0) {
+            printf("pipe failed\n");
+            break;
+        }
+
+        if (prev_read >= 0) {
+            dup2(prev_read, 0);
+            close(prev_read);
+        }
+        if (!last) {
+            dup2(fds[1], 1);
+            close(fds[1]);
+        }
+
+        int pid = spawn(argvs[i][0], argvs[i]);
+
+        // Keep no write ends, so readers see end of file when the writers exit
+        dup2(SAVED_STDIN, 0);
+        dup2(SAVED_STDOUT, 1);
+        prev_read = fds[0];
+
+        if (pid < 0) {
+            printf("%s not found\n", argvs[i][0]);
+            break;
+        }
+        pids[spawned++] = pid;
+    }
+
+    if (prev_read >= 0) {
+        close(prev_read);
+    }
+    close(SAVED_STDIN);
+    close(SAVED_STDOUT);
+
+    for (int i = 0; i < spawned; i++) {
+        waitpid(pids[i], NULL, 0);
+    }
+}
+
 void _start() {
     for (;;) {
         // init the input buffer
-        char input_buffer[512];
-        int next = 0;
-        memset(input_buffer, 0, 512);
+        char input_buffer[LINE_MAX];
+        size_t next = 0;
+        memset(input_buffer, 0, LINE_MAX);
 
         // input prompt
         printf("$ ");
 
         char ch;
-        while (read(1, &ch, 1)) {
-            input_buffer[next] = ch;
+        while (read(0, &ch, 1) && next < sizeof(input_buffer) - 1) {
             printf("%c", ch);
 
             // user done with input
             if (ch == '\n') {
-                input_buffer[next] = '\0';
-                if (exec(input_buffer, NULL) != 0) {
-                    printf("%s not found\n", input_buffer);
-                    break;
-                }
+                run_line(input_buffer);
+                break;
             }
 
-            next += 1;
+            input_buffer[next++] = ch;
         }
     }
 }
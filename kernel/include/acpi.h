@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "stivale2.h"
+
+// Header shared by every ACPI system description table
+typedef struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+/**
+ * @brief acpi_init locates the root table through the bootloader's RSDP tag
+ *
+ * @param tag the stivale2 RSDP tag, or NULL if the bootloader found none
+ */
+void acpi_init(struct stivale2_struct_tag_rsdp *tag);
+
+/**
+ * @brief acpi_find_table finds a system description table by signature
+ *
+ * @param signature the four-character table signature, e.g. "APIC"
+ * @return acpi_sdt_header_t* the table with a valid checksum, or NULL
+ */
+acpi_sdt_header_t *acpi_find_table(const char *signature);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stivale2.h"
+
+// Interrupt vectors raised by the local APIC
+#define APIC_TIMER_VECTOR 0x30
+#define APIC_RESCHEDULE_VECTOR 0xF0
+#define APIC_TLB_VECTOR 0xF1
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+/**
+ * @brief apic_init finds the interrupt controllers in the ACPI MADT, enables
+ * this CPU's local APIC and masks every IOAPIC input. The 8259 PICs must
+ * already be remapped and masked.
+ *
+ * @param rsdp the bootloader's RSDP tag
+ * @return true if the APICs were found and set up
+ */
+bool apic_init(struct stivale2_struct_tag_rsdp *rsdp);
+
+// enable the local APIC of the calling CPU, in x2APIC mode when supported
+void lapic_init();
+
+// acknowledge the interrupt being handled on this CPU
+void lapic_eoi();
+
+/**
+ * @brief lapic_timer_start starts this CPU's periodic APIC timer. The first
+ * call calibrates the timer against the TSC, so clock_init must come first.
+ *
+ * @param hz interrupts per second
+ */
+void lapic_timer_start(uint32_t hz);
+
+/**
+ * @brief lapic_send_ipi sends an interrupt to another CPU
+ *
+ * @param lapic_id the target's local APIC id
+ * @param vector the vector to raise on the target
+ */
+void lapic_send_ipi(uint32_t lapic_id, uint8_t vector);
+
+/**
+ * @brief ioapic_route_irq delivers a legacy ISA IRQ to one CPU, honoring the
+ * MADT's source overrides
+ *
+ * @param irq the ISA IRQ number (0-15)
+ * @param vector the vector to raise
+ * @param lapic_id the local APIC id of the CPU that handles it
+ * @return true if an IOAPIC serves the IRQ
+ */
+bool ioapic_route_irq(uint8_t irq, uint8_t vector, uint32_t lapic_id);
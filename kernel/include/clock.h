@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "idt.h"
+
+// Frequency of the tick interrupt
+#define HZ 1000
+#define NS_PER_SEC 1000000000ULL
+#define NS_PER_TICK (NS_PER_SEC / HZ)
+
+// Clock ids accepted by clock_gettime
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+#define CLOCK_MONOTONIC_COARSE 6  // CLOCK_MONOTONIC as of the last tick, as on Linux
+
+// Longest time clock_timespec_ns converts, so deadlines built from it can't
+// overflow. It is well past any uptime.
+#define CLOCK_MAX_SEC (1ULL << 32)
+
+typedef struct timespec {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+} timespec_t;
+
+// calibrate the TSC against the PIT, publish it on the vDSO's data page and
+// start the tick interrupt, after apic_init and vdso_init
+void clock_init();
+
+// nanoseconds since clock_init, from the TSC
+uint64_t clock_monotonic_ns();
+
+// clock_monotonic_ns as of the last tick, cheaper and less precise
+uint64_t clock_coarse_ns();
+
+// convert a TSC cycle count to nanoseconds
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+// TSC cycles per second, measured by clock_init
+uint64_t clock_tsc_hz();
+
+// convert a validated, non-negative timespec to nanoseconds, clamping it to
+// CLOCK_MAX_SEC
+uint64_t clock_timespec_ns(const timespec_t *ts);
+
+/**
+ * @brief clock_sleep_ns parks the calling task until at least ns nanoseconds
+ * have passed, or until the task is interrupted
+ *
+ * @param ns how long to sleep
+ */
+void clock_sleep_ns(uint64_t ns);
+
+void timer_handler(interrupt_context_t *ctx);
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "vfs.h"
+
+/**
+ * @brief console_open returns the console as an open file. Reads block for
+ * keyboard or serial input, writes go to the terminal.
+ *
+ * @return file_t* a new reference to the shared console file
+ */
+file_t *console_open();
@@ -1,11 +1,7 @@
 #pragma once
 
-#define DEBUG 0
-#define debug(fmt)               \
-    do {                         \
-        if (DEBUG) kprintf(fmt); \
-    } while (0)
-#define debugf(fmt, ...)                      \
-    do {                                      \
-        if (DEBUG) kprintf(fmt, __VA_ARGS__); \
-    } while (0)
\ No newline at end of file
+#include "klog.h"
+
+// Debug output is logged at KLOG_DEBUG, which klog drops unless klog_level allows it
+#define debug(fmt) klog(KLOG_DEBUG, fmt)
+#define debugf(fmt, ...) klog(KLOG_DEBUG, fmt, __VA_ARGS__)
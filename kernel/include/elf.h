@@ -1,25 +1,86 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "stivale2.h"
+#include "vfs.h"
 
 typedef void (*void_function_t)();
 
+// Bytes of argument and environment strings exec passes on, terminators included
+#define EXEC_ARG_MAX 2048
+
+// Auxiliary vector entry types placed after the environment, as in the SysV ABI
+#define AT_NULL 0
+#define AT_PAGESZ 6
+#define AT_ENTRY 9
+
+// Arguments and environment for a new image, packed as consecutive strings:
+// argc arguments followed by envc environment entries. It lives in kernel
+// memory, since exec tears down the user memory it came from.
+typedef struct exec_args {
+    size_t argc;
+    size_t envc;
+    size_t size;  // bytes of strings used
+    char strings[EXEC_ARG_MAX];
+} exec_args_t;
+
+// register the exec counters
+void elf_init();
+
+// name of the module loaded in the current task's user space
+const char *exec_current_image();
+
 /**
  * @brief load the elf format into memory and return entry point
- * of the loaded binary.
+ * of the loaded binary. The header and segments are checked first, and each
+ * page is mapped once with its segment's final permissions. Position-independent
+ * (ET_DYN) images are placed at a fixed base and their relocations applied.
+ * An image with a PT_INTERP segment is linked against the shared library it
+ * names, whose read-only pages are shared by every process.
  *
  * @param p pointer points to the start of the elf file
- * @param size the size of the elf file, not used
- * @return void_function_t the entry of the loaded binary
+ * @param size the size of the elf file
+ * @param file the file the image came from, whose page cache backs read-only
+ * pages, or NULL to copy every page
+ * @return void_function_t the entry of the loaded binary, or NULL if the image
+ * is malformed or linking failed
  */
-void_function_t load(uintptr_t p, size_t size);
+void_function_t load(uintptr_t p, size_t size, inode_t *file);
+
+/**
+ * @brief exec_args_copy gathers argv and envp from user memory into args in a
+ * single pass, stopping at EXEC_ARG_MAX bytes
+ *
+ * @param args where to store the strings
+ * @param argv NULL-terminated arguments, or NULL for none
+ * @param envp NULL-terminated environment, or NULL for none
+ * @return true on success, false if the strings don't fit
+ */
+bool exec_args_copy(exec_args_t *args, char *const argv[], char *const envp[]);
 
 /**
  * @brief exec_module load and execute the stivale2 submodule
  *
  * @param module the stivale2 submodule
  */
-void exec_module(struct stivale2_module module);
\ No newline at end of file
+void exec_module(struct stivale2_module module);
+
+/**
+ * @brief exec_image replaces the current task's user space with an ELF image
+ * and enters it; it never returns. Called from a process's main thread, it
+ * stops the other threads first. The new stack is laid out as the SysV ABI
+ * describes: argc, argv, envp and the auxiliary vector, with the strings
+ * above them. argc, argv and envp are also passed in rdi, rsi and rdx so a
+ * C entry point can take them as parameters.
+ *
+ * @param name the program's name, which must outlive the task
+ * @param image the ELF file in memory
+ * @param size the size of the ELF file
+ * @param file the file the image came from, or NULL for a boot module
+ * @param args arguments and environment, or NULL to pass just the name as argv[0]
+ */
+void exec_image(const char *name, uintptr_t image, size_t size, inode_t *file,
+                const exec_args_t *args);
\ No newline at end of file
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "stivale2.h"
+
+/**
+ * @brief fbcon_init sets up a text console on the bootloader's framebuffer,
+ * with 8x16 character cells. Text is drawn from pre-rendered glyphs into a
+ * back buffer, and each write copies only the cells it changed to the
+ * framebuffer, which is mapped write-combining. Needs init_alloc and
+ * pat_init on every CPU.
+ *
+ * @param fb the framebuffer tag, or NULL if the bootloader gave none
+ * @return true if the console is ready, false without a 32-bit RGB framebuffer
+ * or the memory for it
+ */
+bool fbcon_init(struct stivale2_struct_tag_framebuffer *fb);
+
+// write text to the framebuffer console, as a term_write_t
+void fbcon_write(const char *s, size_t size);
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+// The printable ASCII characters the font covers
+#define FONT_FIRST 0x20
+#define FONT_LAST 0x7E
+#define FONT_GLYPHS (FONT_LAST - FONT_FIRST + 1)
+
+// Glyphs are 8x8 bitmaps, one byte per row with the leftmost pixel in bit 0
+extern const uint8_t font8x8[FONT_GLYPHS][8];
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "clock.h"
+
+// Operations accepted by futex
+#define FUTEX_WAIT 0     // sleep while *addr == val, until woken or the timeout passes
+#define FUTEX_WAKE 1     // wake up to val tasks waiting on addr
+#define FUTEX_REQUEUE 2  // wake up to val tasks on addr and move up to val2 more to addr2
+
+// Buckets in the futex hash, a power of two
+#define FUTEX_HASH_BITS 6
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+// register the futex counters
+void futex_init();
+
+/**
+ * @brief futex blocks and wakes tasks on a 32-bit word in user memory.
+ * Waiters are keyed by the word's physical address, so tasks that map the
+ * same frame at different addresses meet on it. The word must be 4-byte
+ * aligned and in mapped, writable memory.
+ *
+ * @param addr the futex word
+ * @param op FUTEX_WAIT, FUTEX_WAKE or FUTEX_REQUEUE
+ * @param val the value expected for FUTEX_WAIT, or how many tasks to wake
+ * @param timeout how long FUTEX_WAIT may sleep, NULL for no limit
+ * @param addr2 where FUTEX_REQUEUE moves waiters it doesn't wake
+ * @param val2 how many waiters FUTEX_REQUEUE may move
+ * @return long 0 when FUTEX_WAIT was woken; the number of tasks woken, or
+ * woken and moved, by FUTEX_WAKE and FUTEX_REQUEUE; -1 if *addr != val, the
+ * timeout passed, or the arguments are invalid
+ */
+long futex(uint32_t *addr, int op, uint32_t val, const timespec_t *timeout, uint32_t *addr2,
+           uint32_t val2);
@@ -7,5 +7,15 @@
 #define USER_DATA_SELECTOR 0x20
 #define TSS_SELECTOR 0x28
 
-// Set up and load the GDT
-void gdt_setup();
+// A user data segment whose limit is the CPU's index, which user mode reads
+// with lsl to learn where it runs. The TSS descriptor takes two slots.
+#define CPU_NUMBER_SELECTOR 0x38
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Set up and load the GDT and TSS for a CPU, must run on that CPU
+void gdt_setup(size_t cpu);
+
+// Set the stack this CPU switches to when an interrupt arrives from user mode
+void gdt_set_kernel_stack(uintptr_t rsp0);
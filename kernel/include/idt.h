@@ -12,6 +12,10 @@
 #define IDT_TYPE_INTERRUPT 0xE
 #define IDT_TYPE_TRAP 0xF
 
+// Lowest privilege level that may raise a vector with an int instruction
+#define IDT_DPL_KERNEL 0
+#define IDT_DPL_USER 3
+
 // 64-bit IDT Gate Descriptor
 typedef struct idt_entry {
     uint16_t offset_0;
@@ -42,11 +46,30 @@ typedef struct idt_record {
 
 void idt_setup();
 
+// load the IDT built by idt_setup on this CPU
+void idt_load();
+
 /**
- * @brief idt_se_handler adds a handler to idt
+ * @brief idt_set_handler adds a handler to idt. The handler is an ordinary
+ * function, void fn(interrupt_context_t *ctx, uint64_t ec), called from the
+ * vector's entry stub with the GS base already switched to the kernel's. ec
+ * is 0 for vectors without an error code.
  *
  * @param index index of idt
  * @param fn the idt handler to add
+ * @param type handler type. Vectors user mode can reach must use
+ * IDT_TYPE_INTERRUPT, so nothing interrupts the entry before its swapgs.
+ */
+void idt_set_handler(uint8_t index, void *fn, uint8_t type);
+
+/**
+ * @brief idt_set_gate points a vector straight at entry code, which must
+ * swapgs itself on entry from and return to user mode
+ *
+ * @param index index of idt
+ * @param fn the entry code
  * @param type handler type
+ * @param dpl IDT_DPL_USER to let user mode raise the vector with int, as for
+ * system calls, or IDT_DPL_KERNEL
  */
-void idt_set_handler(uint8_t index, void *fn, uint8_t type);
\ No newline at end of file
+void idt_set_gate(uint8_t index, void *fn, uint8_t type, uint8_t dpl);
\ No newline at end of file
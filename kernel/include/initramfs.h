@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "stivale2.h"
+
+/**
+ * @brief initramfs_init unpacks the ustar archive loaded as the "initramfs"
+ * module into the VFS. File contents stay in the module, only the directory
+ * tree is built. Call after vfs_init.
+ *
+ * @param modules the bootloader's module list
+ * @return true if the archive was found and read to its end
+ */
+bool initramfs_init(struct stivale2_struct_tag_modules *modules);
@@ -2,12 +2,24 @@
 
 #include "idt.h"
 
-__attribute__((interrupt)) void keyboard_handler(interrupt_context_t *ctx);
+// register the keyboard's counters and route its IRQ, after apic_init
+void keyboard_init();
+
+void keyboard_handler(interrupt_context_t *ctx);
+
+/**
+ * @brief keyboard_inject queues a character as if it had been typed. Safe
+ * from interrupt handlers and task context.
+ *
+ * @param c the character to queue
+ */
+void keyboard_inject(char c);
 
 /**
  * @brief kgetc returns a character input from the keyboard.
  * The function blocks until a keyboard input is received.
  *
- * @return char the character input by keyboard
+ * @return int the character input by keyboard, or -1 if the task was
+ * interrupted while it waited
  */
-char kgetc();
\ No newline at end of file
+int kgetc();
\ No newline at end of file
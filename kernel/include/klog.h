@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Severity of a log record, most severe first
+#define KLOG_ERR 0
+#define KLOG_WARN 1
+#define KLOG_INFO 2
+#define KLOG_DEBUG 3
+
+// Records below this severity are dropped before they are formatted. Raise
+// it to KLOG_DEBUG to keep debug() output without rebuilding.
+#define KLOG_DEFAULT_LEVEL KLOG_INFO
+
+// Number of records the ring holds, a power of two
+#define KLOG_RECORDS 256
+
+// Longest message a record holds, including the terminator
+#define KLOG_TEXT_MAX 232
+
+// the least severe level currently recorded
+extern volatile int klog_level;
+
+// register the log's counters
+void klog_init();
+
+/**
+ * @brief klog appends a message to the kernel log ring without touching any
+ * device, so it is safe from interrupt handlers and any CPU. Errors are also
+ * written to the console before klog returns; everything else reaches it
+ * when a CPU goes idle or the tick hands the drain to a worker.
+ *
+ * @param level the message's severity, KLOG_ERR through KLOG_DEBUG
+ * @param format printf-style format, see format.h
+ */
+void klog(int level, const char *format, ...);
+
+// klog with a va_list, returning the length of the formatted message or 0 if it was filtered
+int vklog(int level, const char *format, va_list args);
+
+// write records that haven't reached the console yet, unless another CPU already is
+void klog_drain();
+
+// write every record logged so far to the console before returning, waiting
+// for another CPU's drain if needed. Used for errors and before halting.
+void klog_flush();
+
+// true if records are waiting for klog_drain
+bool klog_pending();
+
+// have this CPU's worker drain the log if records are waiting, so it reaches
+// the console while every CPU is busy, not only when one goes idle
+void klog_drain_later();
+
+/**
+ * @brief klog_read formats the records still in the ring as text, oldest
+ * first, each line prefixed with its timestamp and severity. Reading does not
+ * consume records.
+ *
+ * @param buf where to write the text, in user memory
+ * @param size size of buf in bytes
+ * @return int64_t the number of bytes written, or -1 if buf can't be written
+ */
+int64_t klog_read(char *buf, size_t size);
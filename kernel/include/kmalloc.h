@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Set to 1 to surround every object with red zones that are checked on free,
+// and to poison freed objects
+#define KMEM_DEBUG 0
+
+// Largest request served from a slab. Larger requests up to a page get a
+// whole frame, and anything bigger must use pmem_alloc directly.
+#define KMALLOC_MAX_SLAB_SIZE 2048
+
+typedef struct kmem_cache kmem_cache_t;
+
+// Called once on each object when its slab is created. Objects must be
+// returned to the cache in their constructed state.
+typedef void (*kmem_ctor_t)(void *obj);
+
+// Usage statistics for one cache
+typedef struct kmem_cache_stats {
+    const char *name;
+    size_t object_size;  // requested object size
+    size_t stride;       // bytes each object occupies in its slab
+    size_t slabs;        // slabs (pages) currently owned by the cache
+    size_t objects;      // object slots across all slabs
+    size_t in_use;       // objects handed out and not yet freed
+    uint64_t allocs;     // total allocations
+    uint64_t frees;      // total frees
+} kmem_cache_stats_t;
+
+// set up the general-purpose kmalloc caches, must be called after init_alloc
+void kmalloc_init();
+
+/**
+ * @brief kmem_cache_create creates a cache of equally sized objects
+ *
+ * @param name name reported in statistics, must outlive the cache
+ * @param size size of each object in bytes, at most KMALLOC_MAX_SLAB_SIZE
+ * @param align required alignment of each object, 0 for the default of 8
+ * @param ctor constructor run on new objects, or NULL
+ * @return kmem_cache_t* the new cache, or NULL on error
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor);
+
+/**
+ * @brief kmem_cache_alloc allocates an object from a cache
+ *
+ * @param cache the cache to allocate from
+ * @return void* the object, or NULL when out of memory
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/**
+ * @brief kmem_cache_free returns an object to the cache it came from
+ *
+ * @param cache the cache obj was allocated from
+ * @param obj the object to free
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/**
+ * @brief kmem_cache_get_stats reads the usage statistics of a cache
+ *
+ * @param cache the cache to inspect
+ * @param stats filled in with the cache's statistics
+ */
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats);
+
+/**
+ * @brief kmem_cache_foreach calls fn with the statistics of every cache
+ *
+ * @param fn called once per cache
+ */
+void kmem_cache_foreach(void (*fn)(const kmem_cache_stats_t *stats));
+
+/**
+ * @brief kmalloc allocates kernel memory
+ *
+ * @param size the number of bytes to allocate, at most PAGE_SIZE
+ * @return void* memory aligned to at least 8 bytes, or NULL on error
+ */
+void *kmalloc(size_t size);
+
+/**
+ * @brief kzalloc allocates zeroed kernel memory
+ *
+ * @param size the number of bytes to allocate, at most PAGE_SIZE
+ * @return void* the zeroed memory, or NULL on error
+ */
+void *kzalloc(size_t size);
+
+/**
+ * @brief kfree frees memory returned by kmalloc or kzalloc
+ *
+ * @param ptr the memory to free, NULL is ignored
+ */
+void kfree(void *ptr);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdarg.h>
 #include <stddef.h>
 
 typedef void (*term_write_t)(const char *, size_t);
@@ -8,6 +9,14 @@ typedef void (*term_write_t)(const char *, size_t);
 // must be called before calling kprintf
 void set_term_write(term_write_t fn);
 
-// kernel implementation of printf
-// support %c %x %d %x %p format character
-void kprintf(const char *format, ...);
\ No newline at end of file
+// write len bytes of str to the terminal in one call
+void kwrite(const char *str, size_t len);
+
+// kernel implementation of printf, see format.h for the supported conversions.
+// The text goes to the kernel log at KLOG_INFO and reaches the console from there.
+int kprintf(const char *format, ...);
+
+// format into buf, writing at most size bytes including the terminator
+int ksnprintf(char *buf, size_t size, const char *format, ...);
+
+int kvsnprintf(char *buf, size_t size, const char *format, va_list args);
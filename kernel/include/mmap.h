@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vfs.h"
+
+// Protections and flags accepted by mmap, matching stdlib/mman.h
+#define MMAP_PROT_READ 0x1
+#define MMAP_PROT_WRITE 0x2
+#define MMAP_PROT_EXEC 0x4
+
+#define MMAP_SHARED 0x01
+#define MMAP_PRIVATE 0x02
+#define MMAP_FIXED 0x10
+#define MMAP_ANONYMOUS 0x20
+
+// Kernel-only: the kernel uses the mapping through its user addresses, so
+// MMAP_FIXED may not replace it. mmap from user space rejects it.
+#define MMAP_PINNED 0x1000
+
+// Mappings without an address hint are placed upward from here
+#define MMAP_BASE 0x100000000000
+
+// Page fault error code bits
+#define PF_PRESENT 0x1
+#define PF_WRITE 0x2
+#define PF_USER 0x4
+#define PF_FETCH 0x10
+
+// A range of user addresses and what backs it
+typedef struct vma {
+    uintptr_t start;   // first byte, page-aligned
+    uintptr_t end;     // one past the last byte, page-aligned
+    int prot;          // MMAP_PROT_*
+    int flags;         // MMAP_SHARED or MMAP_PRIVATE, MMAP_ANONYMOUS
+    inode_t *inode;    // file behind the range, NULL for anonymous memory
+    size_t offset;     // file offset of start, page-aligned
+    struct vma *next;  // next range of the task, in no particular order
+} vma_t;
+
+// register the mmap counters
+void mmap_init();
+
+/**
+ * @brief vm_mmap maps a range into the current process's user space. Anonymous
+ * memory is mapped right away; file pages are faulted in from the page cache
+ * on first touch, shared with every other mapping of the file. MMAP_FIXED
+ * replaces whatever was mapped in the range; otherwise the range must be
+ * free of mappings and mapped pages.
+ *
+ * @param addr where to map, or 0 to pick an address. Must be page-aligned
+ * and not 0 with MMAP_FIXED.
+ * @param length bytes to map, rounded up to whole pages
+ * @param prot MMAP_PROT_* bits
+ * @param flags MMAP_SHARED or MMAP_PRIVATE, optionally MMAP_ANONYMOUS and MMAP_FIXED
+ * @param file the file to map, ignored for anonymous mappings
+ * @param offset page-aligned offset in the file
+ * @return intptr_t the mapped address, or -1 on error
+ */
+intptr_t vm_mmap(uintptr_t addr, size_t length, int prot, int flags, file_t *file, off_t offset);
+
+/**
+ * @brief vm_fault resolves a page fault on a user address of the current task
+ *
+ * @param address the faulting address
+ * @param error_code the error code the CPU pushed
+ * @return true if the page is now mapped and the access can be retried
+ */
+bool vm_fault(uintptr_t address, uint64_t error_code);
+
+// forget the current task's mappings, after its user space was torn down
+void vm_release_all();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "stdbool.h"
@@ -7,8 +8,47 @@
 
 #define PAGE_SIZE 0x1000
 
+// End of the lower half, where every user mapping lives
+#define USER_HALF_END 0x800000000000
+
+// true if [ptr, ptr + size) lies in the lower half. Syscalls check every
+// pointer from user space with it, and reach the memory behind it only with
+// copy_to_user and copy_from_user, since it may not be mapped.
+static inline bool user_range_ok(const void *ptr, size_t size) {
+    uintptr_t start = (uintptr_t)ptr;
+    return start <= USER_HALF_END && size <= USER_HALF_END - start;
+}
+
+// user_range_ok for an array of count elements of size bytes each
+static inline bool user_array_ok(const void *ptr, size_t count, size_t size) {
+    return count <= USER_HALF_END / size && user_range_ok(ptr, count * size);
+}
+
+// Copy size bytes, where a fault on a user page that can't be resolved ends
+// the copy instead of the machine. Returns the bytes left uncopied. See
+// src/user_copy.s.
+size_t user_copy(void *dst, const void *src, size_t size);
+
+// Copy from the kernel to user memory. false if dst isn't all mapped user
+// memory the kernel may write, in which case part of it may be written.
+static inline bool copy_to_user(void *dst, const void *src, size_t size) {
+    return user_range_ok(dst, size) && user_copy(dst, src, size) == 0;
+}
+
+// Copy from user memory to the kernel. false if src isn't all mapped user
+// memory.
+static inline bool copy_from_user(void *dst, const void *src, size_t size) {
+    return user_range_ok(src, size) && user_copy(dst, src, size) == 0;
+}
+
 uintptr_t read_cr3();
 
+// the linear address that caused the last page fault
+uintptr_t read_cr2();
+
+// switch to the page tables rooted at the physical address value
+void write_cr3(uint64_t value);
+
 /**
  * Translate a virtual address to its mapped physical address
  *
@@ -19,6 +59,9 @@ void translate(void* address);
 // convert physical address to virtual address
 uintptr_t add_virtual_offset(uintptr_t ptr);
 
+// convert a virtual address in the higher-half direct map back to physical
+uintptr_t sub_virtual_offset(uintptr_t ptr);
+
 void init_alloc(struct stivale2_struct_tag_memmap* mmemap, struct stivale2_struct_tag_hhdm* hhdm);
 
 /**
@@ -28,6 +71,14 @@ void init_alloc(struct stivale2_struct_tag_memmap* mmemap, struct stivale2_struc
  */
 uintptr_t pmem_alloc();
 
+/**
+ * Allocate a zeroed page of physical memory, from the pool a worker keeps
+ * zeroed in the background when it can.
+ * \returns the physical address of the allocated physical memory or 0 on
+ * error.
+ */
+uintptr_t pmem_alloc_zeroed();
+
 /**
  * Free a page of physical memory.
  * \param p is the physical address of the page to free, which must be
@@ -47,6 +98,74 @@ void pmem_free(uintptr_t p);
  */
 bool vm_map(uintptr_t root, uintptr_t address, bool user, bool writable, bool executable);
 
+/**
+ * Map a single page of memory to an existing physical frame, so the frame can
+ * be shared between address spaces.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address to map, must be page-aligned
+ * \param phys The physical address of the frame to map, must be page-aligned
+ * \param user Should the page be user-accessible?
+ * \param writable Should the page be writable?
+ * \param executable Should the page be executable?
+ * \returns true if the mapping succeeded, or false if there was an error
+ */
+bool vm_map_page(uintptr_t root, uintptr_t address, uintptr_t phys, bool user, bool writable,
+                 bool executable);
+
+/**
+ * Map a single page of memory to a frame the caller allocated, handing the
+ * frame over to the address space so it is freed along with it.
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address to map, must be page-aligned
+ * \param phys The physical address of the frame to map, must be page-aligned
+ * \param user Should the page be user-accessible?
+ * \param writable Should the page be writable?
+ * \param executable Should the page be executable?
+ * \returns true if the mapping succeeded, or false if there was an error
+ */
+bool vm_map_owned(uintptr_t root, uintptr_t address, uintptr_t phys, bool user, bool writable,
+                  bool executable);
+
+// Make page attribute table entry 1, which a set write-through bit selects,
+// write-combining. Every CPU runs this before using such mappings.
+void pat_init();
+
+// Memory types for vm_set_cache, numbered as the page attribute table entries
+// the write-through and cache-disable bits select
+#define VM_CACHE_WRITE_BACK 0
+#define VM_CACHE_WRITE_COMBINING 1  // after pat_init
+#define VM_CACHE_UNCACHED 3
+
+/**
+ * Change the memory type of mapped pages, splitting any large page that only
+ * partly overlaps them. Used to give device memory in the higher-half direct
+ * map the type it needs, so the kernel never maps it with two.
+ * \param root The physical address of the top-level page table structure
+ * \param address The first virtual address to change
+ * \param size How many bytes from address to change
+ * \param cache One of the VM_CACHE_ types
+ * \returns true if every page was mapped and changed, false otherwise
+ */
+bool vm_set_cache(uintptr_t root, uintptr_t address, size_t size, uint8_t cache);
+
+/**
+ * Find the first mapped page in a range, skipping whole tables that aren't
+ * there, so a sparse range costs little to scan
+ * \param root The physical address of the top-level page table structure
+ * \param address The start of the range, page-aligned
+ * \param end The end of the range
+ * \returns the address of the first mapped page, or end if there is none
+ */
+uintptr_t vm_next_mapped(uintptr_t root, uintptr_t address, uintptr_t end);
+
+/**
+ * Remove the mapping of a single page, if it has one, and free its frame if
+ * the address space owns it
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address to unmap, must be page-aligned
+ */
+void vm_unmap(uintptr_t root, uintptr_t address);
+
 /**
  * Change the protections for a page in a virtual address space
  * \param root The physical address of the top-level page table structure
@@ -58,5 +177,41 @@ bool vm_map(uintptr_t root, uintptr_t address, bool user, bool writable, bool ex
  */
 bool vm_protect(uintptr_t root, uintptr_t address, bool user, bool writable, bool executable);
 
-// Unmap everything in the lower half of an address space with level 4 page table at address root
-void unmap_lower_half(uintptr_t root);
\ No newline at end of file
+/**
+ * Check whether an address is mapped, without faulting
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address to check
+ * \param user Also require the page to be user-accessible
+ * \returns true if a read of address would not fault
+ */
+bool vm_is_mapped(uintptr_t root, uintptr_t address, bool user);
+
+/**
+ * Find the frame behind a page
+ * \param root The physical address of the top-level page table structure
+ * \param address The virtual address of the page, must be page-aligned
+ * \returns the physical address of the page's frame, or 0 if it isn't mapped
+ * with a 4 KiB page
+ */
+uintptr_t vm_frame(uintptr_t root, uintptr_t address);
+
+// Unmap everything in the lower half of an address space with level 4 page table at address root,
+// freeing its page tables and the frames it owns
+void unmap_lower_half(uintptr_t root);
+
+/**
+ * Create an address space with an empty lower half that shares the kernel's
+ * higher half.
+ * \param kernel_root The top-level page table to take the higher half from.
+ * Its higher-half level 4 entries are shared, not copied, so kernel mappings
+ * added later must go under entries that already exist.
+ * \returns the physical address of the new top-level page table, or 0 on error
+ */
+uintptr_t vm_create_root(uintptr_t kernel_root);
+
+/**
+ * Tear down an address space made by vm_create_root. It must not be active on
+ * any CPU.
+ * \param root The physical address of the top-level page table structure
+ */
+void vm_destroy_root(uintptr_t root);
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vfs.h"
+
+/**
+ * @brief pagecache_get returns the frame caching one page of a file, filling
+ * it from the file on the first request. Frames are shared by every mapping
+ * of the page and stay cached for good, since files never change.
+ *
+ * @param inode the file
+ * @param index the page's offset in the file, in pages
+ * @return uintptr_t the frame's physical address, or 0 if the page lies
+ * past the end of the file or memory ran out
+ */
+uintptr_t pagecache_get(inode_t *inode, size_t index);
+
+// register the page cache's counters
+void pagecache_init();
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Upper bound on the number of CPUs the kernel will manage
+#define MAX_CPUS 32
+
+#define CACHE_LINE_SIZE 64
+
+// Pad a per-CPU structure out to its own cache line(s)
+#define __cacheline_aligned __attribute__((aligned(CACHE_LINE_SIZE)))
+
+struct task;
+
+// Data private to one CPU, reachable through the GS base while in the kernel
+typedef struct cpu {
+    struct cpu *self;                // must stay first, this_cpu() reads it from %gs:0
+    uint32_t id;                     // index into cpus[]
+    uint32_t lapic_id;               // local APIC id reported by the bootloader
+    struct task *current;            // task running on this CPU
+    struct task *idle;               // this CPU's scheduler loop
+    volatile uintptr_t active_root;  // page tables in CR3, 0 until TLB shootdowns can reach us
+    volatile int online;             // set once the CPU has loaded its GDT and IDT
+    uintptr_t fs_base;               // user FS base loaded in the MSR
+} __cacheline_aligned cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+
+// number of CPUs the kernel has started
+extern size_t cpu_count;
+
+// Point this CPU's GS base at its entry in cpus[]
+void percpu_init(size_t id, uint32_t lapic_id);
+
+static inline cpu_t *this_cpu() {
+    cpu_t *cpu;
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Index of the CPU running this code
+static inline size_t cpu_id() {
+    uint32_t id;
+    __asm__ volatile("movl %%gs:%c1, %0" : "=r"(id) : "i"(offsetof(cpu_t, id)));
+    return id;
+}
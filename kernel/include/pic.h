@@ -31,7 +31,7 @@
 #define IRQ14_INTERRUPT 0x2e
 #define IRQ15_INTERRUPT 0x2f
 
-/// Initialize the PICs to pass IRQs starting at 0x20
+/// Initialize the PICs to pass IRQs starting at 0x20, with every IRQ masked
 void pic_init();
 
 /// Mask an IRQ by number (0-15)
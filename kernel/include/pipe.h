@@ -0,0 +1,20 @@
+#pragma once
+
+#include "vfs.h"
+
+// Bytes a pipe buffers before writers block, in whole pages
+#define PIPE_SIZE (4 * 0x1000)
+
+// register the pipe counters
+void pipe_init();
+
+/**
+ * @brief pipe_create makes a pipe. Reads block until data arrives and return
+ * 0 once every write end is closed; writes block until all the data fits and
+ * fail once every read end is closed.
+ *
+ * @param read_end set to the new read end
+ * @param write_end set to the new write end
+ * @return true on success, false when out of memory
+ */
+bool pipe_create(file_t **read_end, file_t **write_end);
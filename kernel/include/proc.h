@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "sched.h"
+#include "vfs.h"
+
+// Processes that may exist at once, zombies included
+#define PROC_MAX 64
+
+// The first user task, which has no parent and is restarted when it exits
+#define PROC_INIT_PID 1
+
+// A process killed by a fault exits with 128 plus the number of the POSIX
+// signal the fault raises, the status a shell reports for it
+#define PROC_SIGILL 4
+#define PROC_SIGTRAP 5
+#define PROC_SIGBUS 7
+#define PROC_SIGFPE 8
+#define PROC_SIGSEGV 11
+#define PROC_STATUS_SIGNALED(signal) (128 + (signal))
+
+// register the process counters
+void proc_init();
+
+/**
+ * @brief proc_attach gives a task a PID and a slot in the process table
+ *
+ * @param task the task, which isn't running user code yet
+ * @param parent PID of the process that waits for it, or 0 for none
+ * @return int the new PID, or -1 if the table is full
+ */
+int proc_attach(task_t *task, int parent);
+
+/**
+ * @brief proc_spawn starts a program as a child of the current process, in
+ * an address space of its own. The child shares the parent's stdin, stdout
+ * and stderr and no other descriptors.
+ *
+ * @param program a regular file holding an ELF image, which must stay put
+ * @param argv the child's NULL-terminated arguments in user memory, or NULL
+ * @param envp the child's NULL-terminated environment in user memory, or NULL
+ * @return int the child's PID, or -1 when out of memory or PIDs, or if the
+ * arguments don't fit in EXEC_ARG_MAX
+ */
+int proc_spawn(dentry_t *program, char *const argv[], char *const envp[]);
+
+/**
+ * @brief proc_exit ends the current process from its main thread: its other
+ * threads are stopped, its files are closed, its address space and frames
+ * are freed, and it stays a zombie holding status until its parent reaps it
+ * with proc_wait. Never returns.
+ *
+ * @param status exit status reported to the parent
+ */
+void proc_exit(int status);
+
+/**
+ * @brief proc_wait reaps an exited child of the current process, sleeping
+ * until one exits
+ *
+ * @param pid the child to wait for, or -1 for any child
+ * @param status where to store the child's exit status, or NULL
+ * @return int the reaped child's PID, or -1 if there is no such child
+ */
+int proc_wait(int pid, int *status);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "idt.h"
+
+// Deepest call chain recorded per sample, including the sampled instruction
+#define PROFILE_MAX_DEPTH 12
+
+// Samples buffered per CPU before the oldest are overwritten
+#define PROFILE_RING_SIZE 256
+
+// Longest image name carried in a sample, including the terminator
+#define PROFILE_IMAGE_MAX 16
+
+// Operations accepted by the profile syscall
+#define PROFILE_START 0  // arg: sample every arg ticks (0 means every tick)
+#define PROFILE_STOP 1   // returns 1 if the profiler was running
+#define PROFILE_READ 2   // arg: buffer, arg2: capacity in samples; returns samples copied
+
+// One sample as copied out to user space
+typedef struct profile_sample {
+    uint64_t tsc;                     // when the sample was taken
+    uint64_t cr3;                     // address space that was running
+    uint32_t cpu;                     // CPU that took the sample
+    uint16_t depth;                   // valid entries in pcs
+    uint8_t user;                     // 1 if the CPU was in user mode
+    uint8_t _unused;
+    char image[PROFILE_IMAGE_MAX];    // name of the running program
+    uint64_t pcs[PROFILE_MAX_DEPTH];  // sampled instruction, then return addresses
+} profile_sample_t;
+
+/**
+ * @brief profile_tick records a sample if the profiler is running. Called
+ * from the tick interrupt on each CPU.
+ *
+ * @param ctx the interrupted context
+ * @param fp the interrupted frame pointer (%rbp)
+ */
+void profile_tick(interrupt_context_t *ctx, uintptr_t fp);
+
+// start sampling every interval ticks, discarding old samples
+void profile_start(uint64_t interval);
+
+// stop sampling, returning whether the profiler was running
+int profile_stop();
+
+/**
+ * @brief profile_read moves buffered samples out of the per-CPU rings. Stop
+ * the profiler first for a consistent dump.
+ *
+ * @param samples where to copy the samples, in user memory
+ * @param count the capacity of samples
+ * @return int64_t the number of samples copied, or -1 if samples can't be
+ * written
+ */
+int64_t profile_read(profile_sample_t *samples, size_t count);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+// Most entries a ring's queues may hold, a power of two
+#define RING_MAX_ENTRIES 1024
+
+// Flags accepted by ring_setup
+#define RING_SETUP_SQPOLL 0x1  // a kernel thread takes submissions, so none need ring_enter
+
+// Flags accepted by ring_enter
+#define RING_ENTER_WAKEUP 0x1  // wake the polling thread after it set RING_NEED_WAKEUP
+
+// Flags the kernel sets in a ring's header
+#define RING_NEED_WAKEUP 0x1  // the polling thread sleeps until ring_enter wakes it
+
+// How long the polling thread keeps looking at an empty queue before sleeping
+#define RING_POLL_IDLE_NS 2000000
+
+// The start of a ring's shared memory, as laid out in stdlib/ring.h. The
+// submission and completion indices sit on cache lines of their own, since
+// each is written by one side and read by the other.
+typedef struct ring_header {
+    uint32_t sq_head;  // next submission the kernel takes, written by the kernel
+    uint32_t sq_tail;  // one past the last submission, written by the program
+    uint32_t flags;    // RING_NEED_WAKEUP, written by the kernel
+    uint32_t entries;  // capacity of each queue
+    uint8_t _pad[48];
+    uint32_t cq_head;  // next completion the program takes, written by the program
+    uint32_t cq_tail;  // one past the last completion, written by the kernel
+    uint8_t _pad2[56];
+} ring_header_t;
+
+// A request: one of the system calls allowed in a ring, and its arguments.
+// The submission queue follows the header.
+typedef struct ring_sqe {
+    uint64_t nr;
+    uint64_t args[6];
+    uint64_t user_data;  // handed back in the completion
+} ring_sqe_t;
+
+// The result of a request. The completion queue follows the submissions.
+typedef struct ring_cqe {
+    uint64_t user_data;
+    int64_t res;  // what the system call returned
+} ring_cqe_t;
+
+// register the ring counters
+void ring_init();
+
+/**
+ * @brief ring_setup maps a submission and a completion ring into the current
+ * process, which may have one. Requests are system calls that would
+ * otherwise each take an int 0x80: read, write, mmap, open, close, lseek,
+ * stat, getdents, pipe, dup2, futex, clock_gettime and nanosleep.
+ *
+ * @param entries capacity of each queue, a power of two up to RING_MAX_ENTRIES
+ * @param flags RING_SETUP_SQPOLL to start a kernel thread that takes
+ * submissions as they appear, sleeping after RING_POLL_IDLE_NS without any
+ * @return intptr_t the address of the ring's header, or -1 if the process
+ * already has a ring, entries is invalid or memory runs out
+ */
+intptr_t ring_setup(uint32_t entries, uint32_t flags);
+
+/**
+ * @brief ring_enter runs submitted requests and waits for completions. A
+ * request whose completion wouldn't fit stays queued until the program has
+ * made room.
+ *
+ * @param to_submit most requests to run; ignored with RING_SETUP_SQPOLL,
+ * where the polling thread runs them
+ * @param min_complete completions to wait for before returning
+ * @param flags RING_ENTER_WAKEUP or 0
+ * @return long the number of requests run, or -1 without a ring
+ */
+long ring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags);
+
+// forget the current process's ring, after its threads have stopped and
+// before its address space goes
+void ring_release();
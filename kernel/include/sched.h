@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spinlock.h"
+
+// Size of each task's kernel stack, not counting its guard page
+#define KSTACK_SIZE (4 * 0x1000)
+
+// Open files a task may hold at once
+#define TASK_MAX_FILES 16
+
+// Ticks a user task may run before it is preempted for another runnable task
+#define SCHED_SLICE_TICKS 10
+
+typedef enum task_state {
+    TASK_RUNNABLE,  // on a run queue, or about to be put back on one
+    TASK_RUNNING,   // running on a CPU
+    TASK_BLOCKED,   // waiting for sched_wake
+    TASK_DEAD,      // exited, freed once its CPU has switched away
+} task_state_t;
+
+typedef void (*task_entry_t)(void *arg);
+
+typedef struct task {
+    uintptr_t rsp;                // saved kernel stack pointer while switched out
+    uintptr_t kstack;             // lowest address of the kernel stack
+    uintptr_t root;               // top-level page table loaded while the task runs
+    volatile task_state_t state;  // protected by lock
+    volatile bool on_cpu;         // a CPU is still using the task's stack
+    spinlock_t lock;
+    struct task *next;   // run queue or wait queue link
+    size_t cpu;          // CPU whose run queue the task was last placed on
+    uint64_t slice;      // ticks left before the task may be preempted
+    const char *image;   // module loaded in the task's user space
+    char name[16];
+    struct file *files[TASK_MAX_FILES];  // open files by descriptor
+    struct vma *vmas;                    // mmap'd ranges of the task's user space
+    uintptr_t mmap_next;                 // where the next mapping without a hint goes
+    int pid;                             // process ID, 0 for kernel tasks
+    bool pinned;                         // runs only on cpu, never stolen by another CPU
+
+    // Threads of a process share its main task's files, mappings and page
+    // tables; the fields above are only used in the main task
+    struct task *group;              // the process's main task, the task itself for that one
+    struct thread_group *threads;    // other threads of the process, NULL until one is started
+    struct ring *ring;               // the process's ring from ring_setup, or NULL
+    spinlock_t files_lock;           // protects files
+    spinlock_t vm_lock;              // protects vmas, mmap_next and the user page tables
+    int tid;                         // thread ID within the process, 0 for the main thread
+    uintptr_t fs_base;               // FS base in user mode, pointing at thread-local storage
+    volatile bool interrupted;       // must leave at its next return to user mode
+    bool interruptible;              // blocked in a sleep an interruption may end early
+} task_t;
+
+// A task's place on a wait queue, on its kernel stack while it sleeps
+typedef struct wait_entry {
+    struct wait_entry *next;
+    task_t *task;
+} wait_entry_t;
+
+// A list of tasks waiting for some event
+typedef struct wait_queue {
+    spinlock_t lock;
+    wait_entry_t *head;
+    wait_entry_t *tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT \
+    { .lock = SPINLOCK_INIT, .head = NULL, .tail = NULL }
+
+// set up the scheduler and adopt the running code as this CPU's idle task
+void sched_init();
+
+// adopt the running code as the idle task of an application processor
+void sched_init_cpu();
+
+/**
+ * @brief sched_spawn creates a kernel task and places it on the least loaded CPU
+ *
+ * @param name the task's name, truncated to fit
+ * @param entry the function the task runs with interrupts enabled. The task
+ * exits when it returns.
+ * @param arg passed to entry
+ * @return task_t* the new task, or NULL when out of memory
+ */
+task_t *sched_spawn(const char *name, task_entry_t entry, void *arg);
+
+/**
+ * @brief sched_create creates a kernel task like sched_spawn but doesn't
+ * queue it, so the caller can fill in its address space and files first
+ *
+ * @param name the task's name, truncated to fit
+ * @param entry the function the task runs with interrupts enabled
+ * @param arg passed to entry
+ * @return task_t* the new task, or NULL when out of memory
+ */
+task_t *sched_create(const char *name, task_entry_t entry, void *arg);
+
+// place a task made by sched_create on the least loaded CPU
+void sched_start(task_t *task);
+
+// place a task made by sched_create on one CPU for good, such as a per-CPU worker
+void sched_start_on(task_t *task, size_t cpu);
+
+// free a task made by sched_create that was never started
+void sched_destroy(task_t *task);
+
+// the address space kernel tasks run in, whose higher half every task shares
+uintptr_t sched_kernel_root();
+
+// move the current task to another address space and load it on this CPU
+void sched_switch_root(uintptr_t root);
+
+// the task running on this CPU
+task_t *sched_current();
+
+// run this CPU's scheduler loop, never returns
+void sched_run();
+
+// give up the CPU to another runnable task, or sleep if the task is blocked
+void sched_yield();
+
+// mark the current task dead and switch away for good
+void sched_exit();
+
+/**
+ * @brief sched_set_blocked marks the current task blocked. It keeps running
+ * until its next sched_yield, which sleeps until sched_wake. A wakeup that
+ * arrives in between makes that sched_yield return right away, so mark the
+ * task before arming the wakeup. Interrupts must stay disabled in between.
+ */
+void sched_set_blocked();
+
+// sched_set_blocked for a sleep that sched_interrupt may end early, such as
+// a futex wait. Does nothing if the task has already been interrupted.
+void sched_set_blocked_interruptible();
+
+/**
+ * @brief sched_interrupt tells a task to leave the kernel at its next chance,
+ * waking it if it is in an interruptible sleep. The flag stays set, so a
+ * sleep started afterwards ends right away too.
+ *
+ * @param task the task to interrupt
+ */
+void sched_interrupt(task_t *task);
+
+// set the current task's FS base and load it on this CPU
+void sched_set_fs_base(uintptr_t base);
+
+/**
+ * @brief sched_wake makes a blocked task runnable again
+ *
+ * @param task the task to wake, nothing happens if it is not blocked
+ */
+void sched_wake(task_t *task);
+
+/**
+ * @brief sched_tick charges the running task for a tick, called from the tick interrupt
+ * after the interrupt has been acknowledged
+ *
+ * @param user true if the tick interrupted user mode, the only place tasks are preempted
+ */
+void sched_tick(bool user);
+
+/**
+ * @brief wait_queue_sleep blocks the current task on a wait queue. The
+ * caller holds wq->lock with interrupts disabled; the lock is released while
+ * the task sleeps and held again when this returns. Callers re-check their
+ * condition in a loop, and give up once the task is interrupted, which ends
+ * the sleep early.
+ *
+ * @param wq the queue to wait on
+ */
+void wait_queue_sleep(wait_queue_t *wq);
+
+/**
+ * @brief wake_up wakes every task sleeping on a wait queue
+ *
+ * @param wq the queue to wake
+ */
+void wake_up(wait_queue_t *wq);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "idt.h"
+
+// Size of the transmit ring. Output beyond this waits for the UART to catch up.
+#define SERIAL_TX_RING_SIZE 8192
+
+// set up COM1 at 115200 8N1 with its FIFOs and route its IRQ, after apic_init
+void serial_init();
+
+/**
+ * @brief serial_write queues bytes for COM1 and returns without waiting for
+ * the line, unless the ring is full. Newlines go out as CRLF. Does nothing
+ * before serial_init.
+ *
+ * @param s the bytes to send
+ * @param size the number of bytes
+ */
+void serial_write(const char *s, size_t size);
+
+// wait until every queued byte has left the UART
+void serial_flush();
+
+void serial_handler(interrupt_context_t *ctx);
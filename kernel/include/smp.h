@@ -0,0 +1,16 @@
+#pragma once
+
+#include "stivale2.h"
+
+/**
+ * @brief smp_init starts the application processors listed by the bootloader.
+ * Each one loads its own GDT, TSS and the shared IDT, then waits for
+ * smp_release. Must run before init_alloc unmaps the bootloader's identity
+ * mapping, which the waiting processors are still executing from.
+ *
+ * @param smp the bootloader's SMP tag, or NULL to run on the BSP alone
+ */
+void smp_init(struct stivale2_struct_tag_smp *smp);
+
+// let the application processors enter their scheduler loops, after sched_init
+void smp_release();
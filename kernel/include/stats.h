@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "percpu.h"
+
+// Maximum number of counters that can be registered
+#define STATS_MAX_COUNTERS 128
+
+// Longest counter name, including the terminator
+#define STATS_NAME_MAX 32
+
+// Handle for a registered counter. Id 0 is a scratch slot that is never
+// reported, so bumping a counter before its subsystem registers it is harmless.
+typedef uint32_t stat_id_t;
+
+// One record returned by the stats syscall
+typedef struct stat_entry {
+    char name[STATS_NAME_MAX];
+    int64_t value;
+} stat_entry_t;
+
+// Each CPU updates its own cache-line-aligned row, so counters never bounce
+// between CPUs. Readers sum the rows.
+typedef struct stats_cpu {
+    int64_t values[STATS_MAX_COUNTERS];
+} __cacheline_aligned stats_cpu_t;
+
+extern stats_cpu_t stats_percpu[MAX_CPUS];
+
+/**
+ * @brief stats_register registers a named counter
+ *
+ * @param name counter name, conventionally "subsystem.counter"; must outlive the kernel
+ * @return stat_id_t handle to pass to stats_add, or 0 if the table is full
+ */
+stat_id_t stats_register(const char *name);
+
+/**
+ * @brief stats_read sums a counter across all CPUs
+ *
+ * @param id the counter to read
+ * @return int64_t the counter's value
+ */
+int64_t stats_read(stat_id_t id);
+
+/**
+ * @brief stats_snapshot copies counters into entries, in registration order
+ *
+ * @param entries where to write the counters, in user memory
+ * @param count the number of entries available
+ * @return int64_t the number of registered counters, which may exceed count,
+ * or -1 if entries can't be written
+ */
+int64_t stats_snapshot(stat_entry_t *entries, size_t count);
+
+// Add delta to a counter on this CPU. A single add instruction cannot be torn
+// by an interrupt, so no lock or atomic is needed.
+static inline void stats_add(stat_id_t id, int64_t delta) {
+    __asm__ volatile("addq %1, %0" : "+m"(stats_percpu[cpu_id()].values[id]) : "er"(delta));
+}
+
+static inline void stats_inc(stat_id_t id) { stats_add(id, 1); }
+
+static inline void stats_dec(stat_id_t id) { stats_add(id, -1); }
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "page.h"
+#include "sched.h"
+
+// Threads a process may run besides its main one
+#define THREAD_MAX 64
+
+// Each thread's user stack sits in a slot of its own below the main
+// thread's stack, under an unmapped guard page
+#define THREAD_STACK_BASE 0x60000000000
+#define THREAD_STACK_SIZE (16 * PAGE_SIZE)
+
+// Codes accepted by arch_prctl, as on Linux
+#define ARCH_SET_FS 0x1002
+#define ARCH_GET_FS 0x1003
+
+// register the thread counters
+void thread_init();
+
+/**
+ * @brief thread_create starts a thread in the current process. It shares the
+ * process's address space, files and PID, and gets a kernel stack and a user
+ * stack of its own. entry must not return; the thread ends with thread_exit.
+ *
+ * @param entry the user function the thread starts in
+ * @param arg passed to entry as its only argument
+ * @param tls the thread's FS base
+ * @param tid_word user word set to the thread ID before the thread starts,
+ * and cleared and woken with FUTEX_WAKE once it has exited, or NULL
+ * @return long the thread ID, or -1 when out of memory or thread slots
+ */
+long thread_create(uintptr_t entry, uintptr_t arg, uintptr_t tls, uint32_t *tid_word);
+
+/**
+ * @brief thread_create_kernel starts a thread of the current process that
+ * runs entry in kernel mode, sharing the address space and files like a user
+ * thread and counting as one. It must watch its task's interrupted flag and
+ * call thread_exit once it is set.
+ *
+ * @param name the task's name
+ * @param entry the kernel function the thread runs
+ * @param arg passed to entry
+ * @return task_t* the thread, or NULL when out of memory or thread slots
+ */
+task_t *thread_create_kernel(const char *name, task_entry_t entry, void *arg);
+
+// end the current thread, which must not be a process's main thread
+void thread_exit();
+
+// end the current process from a thread other than the main one, which is
+// interrupted to tear it down with status
+void thread_exit_group(int status);
+
+/**
+ * @brief thread_stop_others ends every thread of the current process but the
+ * main one, which calls it before exec or exit. Threads leave at their next
+ * return to user mode; ones in a futex wait are woken for it, while ones
+ * blocked elsewhere in the kernel hold this up until their call returns. If
+ * a thread asked for the process to exit meanwhile, this exits instead of
+ * returning.
+ */
+void thread_stop_others();
+
+// leave the kernel for good if the current thread was interrupted, called
+// on the way back to user mode
+void thread_check_exit();
+
+/**
+ * @brief thread_arch_prctl sets or reads the current thread's FS base
+ *
+ * @param code ARCH_SET_FS or ARCH_GET_FS
+ * @param addr the new base, or where to store the current one
+ * @return long 0, or -1 for an unknown code or a base outside user space
+ */
+long thread_arch_prctl(int code, uintptr_t addr);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Slots in the timer wheel. Timers further out than this many ticks wrap
+// around and are skipped until their round comes up.
+#define TIMER_WHEEL_SLOTS 256
+
+typedef void (*timer_fn_t)(void *arg);
+
+// A one-shot timer, owned by the caller and linked into the wheel while pending
+typedef struct ktimer {
+    struct ktimer *next;
+    struct ktimer *prev;
+    uint64_t expires;  // tick at which the timer fires
+    timer_fn_t fn;
+    void *arg;
+    bool pending;
+} ktimer_t;
+
+/**
+ * @brief timer_add arms a timer. fn runs in interrupt context.
+ *
+ * @param timer the timer to arm, which must not already be pending
+ * @param ticks how many ticks from now the timer should fire, at least 1
+ * @param fn the function to call when the timer fires
+ * @param arg passed to fn
+ */
+void timer_add(ktimer_t *timer, uint64_t ticks, timer_fn_t fn, void *arg);
+
+/**
+ * @brief timer_cancel disarms a pending timer. If its callback is running on
+ * another CPU, this waits for it to return, so the timer and its argument may
+ * be freed afterwards.
+ *
+ * @param timer the timer to cancel
+ * @return true if the timer was pending, false if it already fired
+ */
+bool timer_cancel(ktimer_t *timer);
+
+// advance the wheel by one tick and run any expired timers, called from the tick interrupt
+void timer_tick();
+
+// the number of ticks since the tick interrupt started
+uint64_t timer_ticks();
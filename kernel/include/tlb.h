@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "spinlock.h"
+
+// Batches spanning more pages than this flush the whole TLB instead
+#define TLB_FLUSH_ALL_PAGES 32
+
+// register the shootdown IPI handler and counters, after apic_init
+void tlb_init();
+
+/**
+ * @brief tlb_invalidate drops the translation for one page on every CPU that
+ * may cache it: CPUs with the address space active for user addresses, and
+ * all CPUs for kernel addresses. Inside a batch on this CPU the page is only
+ * recorded. Must not be called with a spinlock held, since remote CPUs have
+ * to take the IPI, unless everyone waiting for the lock takes it with tlb_lock.
+ *
+ * @param root the top-level page table whose entry changed
+ * @param address the virtual address of the page
+ */
+void tlb_invalidate(uintptr_t root, uintptr_t address);
+
+/**
+ * @brief tlb_flush_all drops every translation of an address space on every
+ * CPU that has it active
+ *
+ * @param root the top-level page table that changed
+ */
+void tlb_flush_all(uintptr_t root);
+
+/**
+ * @brief tlb_batch_begin starts collecting invalidations for root on this
+ * CPU, so a run of page table changes costs one round of IPIs
+ *
+ * @param root the address space being changed
+ */
+void tlb_batch_begin(uintptr_t root);
+
+// flush everything collected since tlb_batch_begin
+void tlb_batch_end();
+
+/**
+ * @brief tlb_lock takes a spinlock with interrupts disabled, answering TLB
+ * shootdowns aimed at this CPU while it waits. Locks held across page table
+ * changes are taken this way, so a holder waiting on our flush can't deadlock.
+ *
+ * @param lock the lock to take
+ * @return uint64_t the flags to hand to spin_unlock_irqrestore
+ */
+uint64_t tlb_lock(spinlock_t *lock);
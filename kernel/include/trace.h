@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Events recorded by tracepoints, and what their two arguments carry
+#define TRACE_SYSCALL_ENTER 0  // syscall number, first argument
+#define TRACE_SYSCALL_EXIT 1   // syscall number, return value
+#define TRACE_EXEC 2           // entry point, first 8 bytes of the module name
+#define TRACE_VM_MAP 3         // top-level page table, virtual address
+#define TRACE_PMEM_ALLOC 4     // physical frame, 0
+#define TRACE_PAGE_FAULT 5     // faulting address, instruction pointer
+#define TRACE_IRQ 6            // vector, device data (scancode, IIR)
+
+// One past the highest event id
+#define TRACE_EVENT_COUNT 7
+
+// Records buffered per CPU before the oldest are overwritten
+#define TRACE_RING_SIZE 1024
+
+// Operations accepted by the trace syscall
+#define TRACE_START 0   // arg: bit mask of events to record (0 means all)
+#define TRACE_STOP 1    // returns 1 if tracing was running
+#define TRACE_READ 2    // arg: buffer, arg2: capacity in records; returns records copied
+#define TRACE_TSC_HZ 3  // returns the TSC frequency the timestamps count at
+
+// One event as copied out to user space
+typedef struct trace_record {
+    uint64_t tsc;      // when the event happened
+    uint32_t cpu;      // CPU it happened on
+    uint16_t event;    // TRACE_* event id
+    uint16_t _unused;
+    uint64_t args[2];  // event specific, see above
+} trace_record_t;
+
+// Events currently being recorded, one bit per event id
+extern volatile uint32_t trace_mask;
+
+/**
+ * @brief TRACE records an event if it is enabled. A disabled tracepoint costs
+ * one load and a branch predicted not taken; the arguments are only
+ * evaluated when the event is recorded.
+ *
+ * @param event one of the TRACE_* event ids
+ * @param arg0 first argument, converted to uint64_t
+ * @param arg1 second argument, converted to uint64_t
+ */
+#define TRACE(event, arg0, arg1)                                     \
+    do {                                                             \
+        if (__builtin_expect(trace_mask & (1U << (event)), 0)) {     \
+            trace_emit((event), (uint64_t)(arg0), (uint64_t)(arg1)); \
+        }                                                            \
+    } while (0)
+
+// append a record to this CPU's ring, use TRACE instead
+void trace_emit(uint16_t event, uint64_t arg0, uint64_t arg1);
+
+// pack the first 8 bytes of a string into a trace argument
+uint64_t trace_pack_string(const char *s);
+
+// start recording the events in mask (0 means all), discarding old records
+void trace_start(uint32_t mask);
+
+// stop recording, returning whether tracing was running
+int trace_stop();
+
+/**
+ * @brief trace_read moves buffered records out of the per-CPU rings. Stop
+ * tracing first for a consistent dump.
+ *
+ * @param records where to copy the records, in user memory
+ * @param count the capacity of records
+ * @return int64_t the number of records copied, or -1 if records can't be
+ * written
+ */
+int64_t trace_read(trace_record_t *records, size_t count);
@@ -1,11 +1,19 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "stivale2.h"
 
+// Read the CPU's time-stamp counter
+static inline uint64_t rdtsc() {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
 // Halt the CPU in an infinite loop
-static void halt() {
+static inline void halt() {
     while (1) {
         __asm__("hlt");
     }
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Where the vDSO's pages sit in every user address space, just under the top
+// of the lower half: kernel code that runs in user mode, data shared by every
+// process, and a page of the process's own
+#define VDSO_CODE_ADDRESS 0x7FFFFFFD000
+#define VDSO_PROC_ADDRESS 0x7FFFFFFE000
+#define VDSO_DATA_ADDRESS 0x7FFFFFFF000
+
+// Entry points, at these offsets in the code page, taking no arguments:
+#define VDSO_MONOTONIC_NS 0x00  // uint64_t: nanoseconds since boot, from the TSC
+#define VDSO_COARSE_NS 0x08     // uint64_t: nanoseconds since boot as of the last tick
+#define VDSO_GETCPU 0x10        // int: the CPU the caller was running on
+#define VDSO_GETPID 0x18        // int: the caller's process ID
+
+/**
+ * @brief The data page shared by every process. The kernel bumps seq to odd
+ * before changing the rest and back to even after, so readers retry until
+ * they see the same even seq on both sides of their reads. src/vdso.s reads
+ * the fields at fixed offsets, checked in src/vdso.c.
+ *
+ * Monotonic nanoseconds are ns_base + ((rdtsc() - tsc_base) * mult >> shift).
+ */
+typedef struct vdso_data {
+    volatile uint32_t seq;
+    uint32_t _pad;
+    uint64_t tsc_hz;
+    uint64_t tsc_base;
+    uint64_t ns_base;
+    uint32_t mult;
+    uint32_t shift;
+    uint64_t ticks;    // tick interrupts on the BSP since they started
+    uint64_t tick_ns;  // monotonic nanoseconds at the last of them
+} vdso_data_t;
+
+// The page of each process's own
+typedef struct vdso_proc {
+    int32_t pid;
+} vdso_proc_t;
+
+// set up the code and data pages, before clock_init
+void vdso_init();
+
+// the kernel's view of the data page
+vdso_data_t *vdso_data();
+
+// start changing the data page; only one CPU may do so at a time
+void vdso_write_begin();
+
+// publish the changes made since vdso_write_begin
+void vdso_write_end();
+
+// count a tick on the data page, called by the BSP's tick interrupt
+void vdso_tick();
+
+/**
+ * @brief vdso_map maps the vDSO into the current process's address space,
+ * with a fresh page of its own that goes with the address space
+ *
+ * @param root the physical address of the process's top-level page table
+ * @param pid the process's ID
+ * @return true if every page was mapped
+ */
+bool vdso_map(uintptr_t root, int pid);
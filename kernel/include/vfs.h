@@ -0,0 +1,174 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef long ssize_t;  // signed size_t
+typedef long long off_t;
+
+// Longest name of a directory entry, including the terminator
+#define VFS_NAME_MAX 64
+
+// Longest path accepted from user space, including the terminator
+#define VFS_PATH_MAX 256
+
+// File types kept in the top bits of an inode's mode, as in POSIX
+#define VFS_S_IFMT 0170000
+#define VFS_S_IFDIR 0040000
+#define VFS_S_IFREG 0100000
+
+// Directory entry types reported by getdents
+#define VFS_DT_DIR 4
+#define VFS_DT_REG 8
+
+// Flags accepted by open. The filesystem is read-only.
+#define VFS_O_RDONLY 0
+
+// Origins accepted by lseek
+#define VFS_SEEK_SET 0
+#define VFS_SEEK_CUR 1
+#define VFS_SEEK_END 2
+
+typedef struct dentry dentry_t;
+
+// A file or directory
+typedef struct inode {
+    uint64_t ino;
+    uint32_t mode;        // type and permission bits
+    size_t size;          // bytes in a file, entries in a directory
+    const uint8_t *data;  // contents of a regular file, never written
+    dentry_t *children;   // entries of a directory
+} inode_t;
+
+// A name in a directory. Every dentry is also on a hash chain keyed by its
+// parent and name, so path lookups never scan directories.
+struct dentry {
+    char name[VFS_NAME_MAX];
+    inode_t *inode;
+    dentry_t *parent;
+    dentry_t *sibling;    // next entry in the parent directory
+    dentry_t *hash_next;  // next entry on the same hash chain
+};
+
+// What stat reports about a path
+typedef struct vfs_stat {
+    uint64_t ino;
+    uint32_t mode;
+    uint32_t _unused;
+    uint64_t size;
+} vfs_stat_t;
+
+// One record filled in by getdents
+typedef struct vfs_dirent {
+    uint64_t ino;
+    uint8_t type;  // VFS_DT_*
+    char name[VFS_NAME_MAX];
+} vfs_dirent_t;
+
+typedef struct file file_t;
+
+// What a kind of open file does with reads and writes
+typedef struct file_ops {
+    ssize_t (*read)(file_t *file, void *buf, size_t count);
+    ssize_t (*write)(file_t *file, const void *buf, size_t count);
+    void (*release)(file_t *file);  // called with the last reference, may be NULL
+} file_ops_t;
+
+// An open file, shared by the descriptors that refer to it
+struct file {
+    const file_ops_t *ops;
+    dentry_t *dentry;        // NULL for devices
+    size_t offset;           // next byte of a file, or next entry of a directory
+    volatile uint32_t refs;  // descriptors and kernel code holding the file
+    void *private;           // owned by the file's ops, such as a pipe
+};
+
+// set up the dentry cache and the root directory
+void vfs_init();
+
+// the root directory
+dentry_t *vfs_root();
+
+/**
+ * @brief vfs_lookup resolves a path, relative paths starting at the root
+ *
+ * @param path '/'-separated path; empty components and "." are skipped, ".." goes up
+ * @return dentry_t* the entry, or NULL if any component is missing
+ */
+dentry_t *vfs_lookup(const char *path);
+
+/**
+ * @brief vfs_create adds an entry to a directory
+ *
+ * @param parent the directory to add to
+ * @param name the entry's name, truncated to VFS_NAME_MAX - 1 bytes
+ * @param mode type and permission bits
+ * @param data contents of a regular file, which must outlive the kernel
+ * @param size length of data
+ * @return dentry_t* the new entry, the existing one if name is taken by a
+ * directory and mode asks for one, or NULL on failure
+ */
+dentry_t *vfs_create(dentry_t *parent, const char *name, uint32_t mode, const uint8_t *data,
+                     size_t size);
+
+// allocate an open file with the given ops, holding one reference
+file_t *file_alloc(const file_ops_t *ops, dentry_t *dentry);
+
+// take another reference to an open file
+file_t *file_get(file_t *file);
+
+// drop a reference to an open file, freeing it with the last one
+void file_put(file_t *file);
+
+// open a path for reading, returning NULL if it doesn't exist
+file_t *vfs_open(const char *path, int flags);
+
+/**
+ * @brief vfs_seek moves an open file's offset
+ *
+ * @param file the file to move
+ * @param offset distance from whence
+ * @param whence VFS_SEEK_SET, VFS_SEEK_CUR or VFS_SEEK_END
+ * @return off_t the new offset, or -1 if it would be negative, whence is
+ * invalid or the file is a device
+ */
+off_t vfs_seek(file_t *file, off_t offset, int whence);
+
+// fill st with what is known about dentry
+void vfs_stat(dentry_t *dentry, vfs_stat_t *st);
+
+/**
+ * @brief vfs_getdents reads the next entries of an open directory
+ *
+ * @param file an open directory
+ * @param dirents where to store the entries, in user memory
+ * @param count capacity of dirents in entries
+ * @return ssize_t the number of entries stored, 0 at the end, -1 if file isn't a directory
+ * or dirents can't be written
+ */
+ssize_t vfs_getdents(file_t *file, vfs_dirent_t *dirents, size_t count);
+
+/**
+ * @brief fd_install gives an open file the lowest free descriptor of the current process
+ *
+ * @param file the file to install; the descriptor takes over the caller's reference
+ * @return int the descriptor, or -1 if the table is full
+ */
+int fd_install(file_t *file);
+
+// the open file behind a descriptor of the current process with a reference
+// the caller drops with file_put, or NULL
+file_t *fd_get(int fd);
+
+// close a descriptor of the current process, returning -1 if it wasn't open
+int fd_close(int fd);
+
+/**
+ * @brief fd_dup2 makes a descriptor of the current process refer to another's open file
+ *
+ * @param old_fd an open descriptor
+ * @param new_fd the descriptor to point at it, closed first if it was open
+ * @return int new_fd, or -1 if either descriptor is invalid
+ */
+int fd_dup2(int old_fd, int new_fd);
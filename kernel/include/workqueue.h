@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*work_fn_t)(void *arg);
+
+// A deferred call, owned by the caller. It may be queued again once it has
+// started running, including by its own function.
+typedef struct work {
+    struct work *next;
+    work_fn_t fn;
+    void *arg;
+    volatile bool pending;  // queued and not yet started
+} work_t;
+
+#define WORK_INIT(work_fn, work_arg) \
+    { .next = NULL, .fn = (work_fn), .arg = (work_arg), .pending = false }
+
+// start a worker thread for each online CPU, after sched_init and smp_init
+void workqueue_init();
+
+/**
+ * @brief queue_work defers a call to the current CPU's worker thread, which
+ * runs it in task context with interrupts enabled. Safe from interrupt
+ * handlers, so they can do the minimum and leave the rest here.
+ *
+ * @param work the call to make
+ * @return true if it was queued, false if it was already pending
+ */
+bool queue_work(work_t *work);
+
+// queue_work on a given CPU's worker instead of the current one
+bool queue_work_on(size_t cpu, work_t *work);
@@ -0,0 +1,78 @@
+#include "acpi.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "page.h"
+
+// Root System Description Pointer, with the fields added in ACPI 2.0
+typedef struct acpi_rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+// The root table lists the others, with 32-bit (RSDT) or 64-bit (XSDT) entries
+static acpi_sdt_header_t *root = NULL;
+static size_t entry_size;
+
+// ACPI structures are valid when their bytes sum to zero
+static bool checksum_ok(const void *p, size_t length) {
+    const uint8_t *bytes = p;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+void acpi_init(struct stivale2_struct_tag_rsdp *tag) {
+    if (tag == NULL) {
+        return;
+    }
+
+    acpi_rsdp_t *rsdp = (acpi_rsdp_t *)tag->rsdp;
+    if (!checksum_ok(rsdp, 20)) {
+        return;
+    }
+
+    // Prefer the XSDT when the firmware provides one
+    if (rsdp->revision >= 2 && rsdp->xsdt_address != 0) {
+        root = (acpi_sdt_header_t *)add_virtual_offset(rsdp->xsdt_address);
+        entry_size = sizeof(uint64_t);
+    } else {
+        root = (acpi_sdt_header_t *)add_virtual_offset(rsdp->rsdt_address);
+        entry_size = sizeof(uint32_t);
+    }
+
+    if (!checksum_ok(root, root->length)) {
+        root = NULL;
+    }
+}
+
+acpi_sdt_header_t *acpi_find_table(const char *signature) {
+    if (root == NULL) {
+        return NULL;
+    }
+
+    size_t entries = (root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    uint8_t *entry = (uint8_t *)(root + 1);
+    for (size_t i = 0; i < entries; i++, entry += entry_size) {
+        // Entries are unaligned physical addresses
+        uint64_t phys = 0;
+        memcpy(&phys, entry, entry_size);
+
+        acpi_sdt_header_t *table = (acpi_sdt_header_t *)add_virtual_offset(phys);
+        if (memcmp(table->signature, signature, 4) == 0 && checksum_ok(table, table->length)) {
+            return table;
+        }
+    }
+    return NULL;
+}
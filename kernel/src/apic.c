@@ -0,0 +1,307 @@
+#include "apic.h"
+
+#include <stddef.h>
+
+#include "acpi.h"
+#include "clock.h"
+#include "idt.h"
+#include "msr.h"
+#include "page.h"
+#include "percpu.h"
+#include "spinlock.h"
+
+#define MSR_APIC_BASE 0x1B
+#define APIC_BASE_ENABLE (1 << 11)
+#define APIC_BASE_X2APIC (1 << 10)
+
+// x2APIC registers are MSRs at this base plus the xAPIC offset / 16
+#define MSR_X2APIC_BASE 0x800
+
+// Local APIC register offsets
+#define LAPIC_ID 0x20
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE (1 << 8)
+#define LAPIC_ICR_PENDING (1 << 12)
+#define LAPIC_TIMER_PERIODIC (1 << 17)
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+// How long to count APIC timer ticks against the TSC
+#define TIMER_CALIBRATE_NS (10 * 1000 * 1000)
+
+// IOAPIC registers, reached through a select/window pair
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION 0x10
+
+#define IOAPIC_ACTIVE_LOW (1 << 13)
+#define IOAPIC_LEVEL (1 << 15)
+#define IOAPIC_MASKED (1 << 16)
+
+// MADT entry types
+#define MADT_IOAPIC 1
+#define MADT_SOURCE_OVERRIDE 2
+
+// MPS INTI flags in source overrides
+#define MPS_POLARITY_LOW 0x3
+#define MPS_TRIGGER_LEVEL (0x3 << 2)
+
+#define MAX_IOAPICS 8
+#define ISA_IRQS 16
+
+typedef struct madt {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__((packed)) madt_t;
+
+typedef struct madt_entry {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+typedef struct madt_ioapic {
+    madt_entry_t header;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed)) madt_ioapic_t;
+
+typedef struct madt_source_override {
+    madt_entry_t header;
+    uint8_t bus;
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) madt_source_override_t;
+
+typedef struct ioapic {
+    volatile uint32_t *regs;
+    uint32_t gsi_base;
+    uint32_t inputs;
+} ioapic_t;
+
+// Where each ISA IRQ arrives at the IOAPICs, and how it is signalled
+typedef struct isa_route {
+    uint32_t gsi;
+    uint16_t flags;
+} isa_route_t;
+
+static bool ready = false;
+static bool x2apic = false;
+static volatile uint32_t *lapic_regs;
+static uint32_t timer_initial_count = 0;
+
+static ioapic_t ioapics[MAX_IOAPICS];
+static size_t ioapic_count = 0;
+static isa_route_t isa_routes[ISA_IRQS];
+
+static uint32_t lapic_read(uint32_t reg) {
+    if (x2apic) {
+        return rdmsr(MSR_X2APIC_BASE + reg / 16);
+    }
+    return lapic_regs[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    if (x2apic) {
+        wrmsr(MSR_X2APIC_BASE + reg / 16, value);
+    } else {
+        lapic_regs[reg / 4] = value;
+    }
+}
+
+static uint32_t ioapic_read(ioapic_t *ioapic, uint32_t reg) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->regs[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t *ioapic, uint32_t reg, uint32_t value) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    ioapic->regs[IOAPIC_WINDOW / 4] = value;
+}
+
+static bool cpu_has_x2apic() {
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    return ecx & (1 << 21);
+}
+
+// Interrupts the local APIC raises on its own when it drops one, no EOI needed
+void spurious_handler(interrupt_context_t *ctx) {}
+
+// Sent to wake an idle CPU when a task is queued on it; the scheduler loop does the rest
+void reschedule_handler(interrupt_context_t *ctx) { lapic_eoi(); }
+
+void lapic_init() {
+    uint64_t base = rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE;
+    if (x2apic) {
+        base |= APIC_BASE_X2APIC;
+    }
+    wrmsr(MSR_APIC_BASE, base);
+
+    // Accept every priority and turn the APIC on
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+
+    uint32_t id = lapic_read(LAPIC_ID);
+    this_cpu()->lapic_id = x2apic ? id : id >> 24;
+}
+
+void lapic_eoi() { lapic_write(LAPIC_EOI, 0); }
+
+void lapic_send_ipi(uint32_t lapic_id, uint8_t vector) {
+    if (!ready) {
+        return;  // no other CPU takes interrupts yet
+    }
+
+    if (x2apic) {
+        // One MSR write with the destination in the high half
+        wrmsr(MSR_X2APIC_BASE + LAPIC_ICR_LOW / 16, ((uint64_t)lapic_id << 32) | vector);
+        return;
+    }
+
+    // An interrupt handler sending its own IPI between the two writes would
+    // replace our destination
+    uint64_t flags = irq_save();
+    lapic_write(LAPIC_ICR_HIGH, lapic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, vector);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ volatile("pause");
+    }
+    irq_restore(flags);
+}
+
+void lapic_timer_start(uint32_t hz) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+
+    // Every CPU's timer runs off the same bus clock, so measure it once
+    if (timer_initial_count == 0) {
+        lapic_write(LAPIC_TIMER_INITIAL, UINT32_MAX);
+        uint64_t deadline = clock_monotonic_ns() + TIMER_CALIBRATE_NS;
+        while (clock_monotonic_ns() < deadline) {
+            __asm__ volatile("pause");
+        }
+        uint64_t elapsed = UINT32_MAX - lapic_read(LAPIC_TIMER_CURRENT);
+        timer_initial_count = elapsed * NS_PER_SEC / TIMER_CALIBRATE_NS / hz;
+    }
+
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | APIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, timer_initial_count);
+}
+
+// The IOAPIC whose inputs include gsi
+static ioapic_t *ioapic_for(uint32_t gsi) {
+    for (size_t i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].inputs) {
+            return &ioapics[i];
+        }
+    }
+    return NULL;
+}
+
+bool ioapic_route_irq(uint8_t irq, uint8_t vector, uint32_t lapic_id) {
+    if (irq >= ISA_IRQS) {
+        return false;
+    }
+
+    isa_route_t *route = &isa_routes[irq];
+    ioapic_t *ioapic = ioapic_for(route->gsi);
+    if (ioapic == NULL) {
+        return false;
+    }
+
+    uint32_t low = vector;
+    if ((route->flags & MPS_POLARITY_LOW) == MPS_POLARITY_LOW) {
+        low |= IOAPIC_ACTIVE_LOW;
+    }
+    if ((route->flags & MPS_TRIGGER_LEVEL) == MPS_TRIGGER_LEVEL) {
+        low |= IOAPIC_LEVEL;
+    }
+
+    // Write the destination first so the entry is never live with a stale one
+    uint32_t reg = IOAPIC_REDIRECTION + 2 * (route->gsi - ioapic->gsi_base);
+    ioapic_write(ioapic, reg, IOAPIC_MASKED);
+    ioapic_write(ioapic, reg + 1, lapic_id << 24);
+    ioapic_write(ioapic, reg, low);
+    return true;
+}
+
+bool apic_init(struct stivale2_struct_tag_rsdp *rsdp) {
+    acpi_init(rsdp);
+    madt_t *madt = (madt_t *)acpi_find_table("APIC");
+    if (madt == NULL) {
+        return false;
+    }
+
+    // The registers are reached through the higher-half direct map, which
+    // caches memory write-back. Device registers must be uncached.
+    uintptr_t root = read_cr3() & 0xFFFFFFFFFFFFF000;
+
+    // ISA IRQs map straight to GSIs unless an override says otherwise
+    for (size_t i = 0; i < ISA_IRQS; i++) {
+        isa_routes[i].gsi = i;
+        isa_routes[i].flags = 0;
+    }
+
+    uint8_t *p = madt->entries;
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+    while (p + sizeof(madt_entry_t) <= end) {
+        madt_entry_t *entry = (madt_entry_t *)p;
+        if (entry->length == 0) {
+            break;
+        }
+
+        if (entry->type == MADT_IOAPIC && ioapic_count < MAX_IOAPICS) {
+            madt_ioapic_t *info = (madt_ioapic_t *)entry;
+            ioapic_t *ioapic = &ioapics[ioapic_count++];
+            ioapic->regs = (volatile uint32_t *)add_virtual_offset(info->address);
+            if (!vm_set_cache(root, (uintptr_t)ioapic->regs, PAGE_SIZE, VM_CACHE_UNCACHED)) {
+                return false;
+            }
+            ioapic->gsi_base = info->gsi_base;
+            ioapic->inputs = ((ioapic_read(ioapic, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+        } else if (entry->type == MADT_SOURCE_OVERRIDE) {
+            madt_source_override_t *override = (madt_source_override_t *)entry;
+            if (override->bus == 0 && override->source < ISA_IRQS) {
+                isa_routes[override->source].gsi = override->gsi;
+                isa_routes[override->source].flags = override->flags;
+            }
+        }
+
+        p += entry->length;
+    }
+
+    // Nothing reaches the CPUs until a driver routes it
+    for (size_t i = 0; i < ioapic_count; i++) {
+        for (uint32_t input = 0; input < ioapics[i].inputs; input++) {
+            ioapic_write(&ioapics[i], IOAPIC_REDIRECTION + 2 * input, IOAPIC_MASKED);
+        }
+    }
+
+    x2apic = cpu_has_x2apic();
+    if (!x2apic) {
+        lapic_regs = (volatile uint32_t *)add_virtual_offset(madt->lapic_address);
+        if (!vm_set_cache(root, (uintptr_t)lapic_regs, PAGE_SIZE, VM_CACHE_UNCACHED)) {
+            return false;
+        }
+    }
+
+    idt_set_handler(APIC_SPURIOUS_VECTOR, spurious_handler, IDT_TYPE_INTERRUPT);
+    idt_set_handler(APIC_RESCHEDULE_VECTOR, reschedule_handler, IDT_TYPE_INTERRUPT);
+    lapic_init();
+
+    ready = true;
+    return true;
+}
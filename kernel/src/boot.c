@@ -1,30 +1,65 @@
 #include <stddef.h>
 #include <string.h>
 
+#include "apic.h"
+#include "clock.h"
+#include "console.h"
 #include "debug.h"
 #include "elf.h"
+#include "fbcon.h"
+#include "futex.h"
 #include "gdt.h"
 #include "idt.h"
+#include "initramfs.h"
 #include "keyboard.h"
+#include "klog.h"
+#include "kmalloc.h"
+#include "mmap.h"
 #include "kstdio.h"
 #include "page.h"
+#include "pagecache.h"
+#include "percpu.h"
 #include "pic.h"
+#include "pipe.h"
 #include "port.h"
+#include "proc.h"
+#include "ring.h"
+#include "sched.h"
+#include "serial.h"
+#include "smp.h"
 #include "stivale2.h"
 #include "syscall.h"
 #include "term_write.h"
+#include "thread.h"
+#include "tlb.h"
 #include "usermode_entry.h"
 #include "util.h"
+#include "vdso.h"
+#include "vfs.h"
+#include "workqueue.h"
 
 // Reserve space for the stack
 static uint8_t stack[8192];
 
+// Ask the bootloader to park the other CPUs until we give them an entry point
+static struct stivale2_header_tag_smp smp_hdr_tag = {
+    .tag = {.identifier = STIVALE2_HEADER_TAG_SMP_ID, .next = 0}, .flags = 0};
+
 static struct stivale2_tag unmap_null_hdr_tag = {.identifier = STIVALE2_HEADER_TAG_UNMAP_NULL_ID,
-                                                 .next = 0};
+                                                 .next = (uintptr_t)&smp_hdr_tag};
+
+// Ask for a 32-bit framebuffer at the bootloader's preferred resolution
+static struct stivale2_header_tag_framebuffer framebuffer_hdr_tag = {
+    .tag = {.identifier = STIVALE2_HEADER_TAG_FRAMEBUFFER_ID,
+            .next = (uintptr_t)&unmap_null_hdr_tag},
+    .framebuffer_width = 0,
+    .framebuffer_height = 0,
+    .framebuffer_bpp = 32};
 
 // Request a terminal from the bootloader
 static struct stivale2_header_tag_terminal terminal_hdr_tag = {
-    .tag = {.identifier = STIVALE2_HEADER_TAG_TERMINAL_ID, .next = (uintptr_t)&unmap_null_hdr_tag},
+    .tag = {.identifier = STIVALE2_HEADER_TAG_TERMINAL_ID,
+            .next = (uintptr_t)&framebuffer_hdr_tag},
     .flags = 0};
 
 // Declare the header for the bootloader
@@ -64,32 +99,86 @@ void *find_tag(struct stivale2_struct *hdr, uint64_t id) {
     return NULL;
 }
 
+// The screen console output goes to: the framebuffer console, or the VGA
+// text buffer when the bootloader gave no framebuffer
+static term_write_t screen_write = term_putstr;
+
+// Mirror console output to the screen and the serial port
+static void console_write(const char *s, size_t size) {
+    screen_write(s, size);
+    serial_write(s, size);
+}
+
+// Body of the init task
+static void run_init(void *module) {
+    proc_attach(sched_current(), 0);
+
+    // stdin, stdout and stderr
+    for (int fd = 0; fd < 3; fd++) {
+        fd_install(console_open());
+    }
+    exec_module(*(struct stivale2_module *)module);
+}
+
 void _start(struct stivale2_struct *hdr) {
     // Get virutal memory struct
     struct stivale2_struct_tag_hhdm *hhdm = find_tag(hdr, STIVALE2_STRUCT_TAG_HHDM_ID);
     // Get memmap struct
     struct stivale2_struct_tag_memmap *memmap = find_tag(hdr, STIVALE2_STRUCT_TAG_MEMMAP_ID);
 
-    pic_init();                // init programmable interrupt controller
+    percpu_init(0, 0);         // per-CPU data, which interrupt handlers use
+    gdt_setup(0);              // segments and task state segment
+    pat_init();                // write-combining memory type for the framebuffer
+    klog_init();               // kernel log ring
+    pic_init();                // remap and mask the legacy PICs
     idt_setup();               // set up interrupt descriptor table
+    smp_init(find_tag(hdr, STIVALE2_STRUCT_TAG_SMP_ID));  // park the other CPUs in the kernel
     init_alloc(memmap, hhdm);  // page allocator
-    term_init();
-    set_term_write(term_putstr);
+    kmalloc_init();            // kernel heap
+    sched_init();
+    if (fbcon_init(find_tag(hdr, STIVALE2_STRUCT_TAG_FRAMEBUFFER_ID))) {
+        screen_write = fbcon_write;
+    } else {
+        term_init();
+    }
+    set_term_write(console_write);
+    if (!apic_init(find_tag(hdr, STIVALE2_STRUCT_TAG_RSDP_ID))) {
+        klog(KLOG_ERR, "No APIC found in the ACPI tables\n");
+        halt();
+    }
+    tlb_init();
+    serial_init();
+    keyboard_init();
+    elf_init();
+    vdso_init();
+    clock_init();
     syscall_init(find_tag(hdr, STIVALE2_STRUCT_TAG_MODULES_ID));
-    gdt_setup();
+    vfs_init();
+    pagecache_init();
+    pipe_init();
+    futex_init();
+    proc_init();
+    thread_init();
+    ring_init();
+    mmap_init();
+    workqueue_init();
+    initramfs_init(find_tag(hdr, STIVALE2_STRUCT_TAG_MODULES_ID));
 
     // Print a greeting
     debug("Hello Kernel!\n");
+    debugf("smp: %lu CPUs online\n", cpu_count);
 
     struct stivale2_struct_tag_modules *modules = find_tag(hdr, STIVALE2_STRUCT_TAG_MODULES_ID);
-    debugf("module_count: %d\n", modules->module_count);
+    debugf("module_count: %lu\n", modules->module_count);
     for (uint64_t i = 0; i < modules->module_count; i++) {
         struct stivale2_module module = modules->modules[i];
         debugf("module: %s\n", module.string);
         if (strcmp(module.string, "init") == 0) {
-            exec_module(module);
+            sched_spawn("init", run_init, &modules->modules[i]);
         }
     }
 
-    halt();
+    // Become this CPU's scheduler loop and let the others start theirs
+    smp_release();
+    sched_run();
 }
\ No newline at end of file
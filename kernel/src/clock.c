@@ -0,0 +1,165 @@
+#include "clock.h"
+
+#include <stddef.h>
+
+#include "apic.h"
+#include "debug.h"
+#include "klog.h"
+#include "kstdio.h"
+#include "percpu.h"
+#include "port.h"
+#include "profile.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "thread.h"
+#include "timer.h"
+#include "util.h"
+#include "vdso.h"
+
+// PIT ports and input clock
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE 0x61
+#define PIT_HZ 1193182
+
+// PIT command byte: channel 2, lobyte/hibyte, mode 0 (one-shot)
+#define PIT_CMD_CHANNEL2_ONESHOT 0xB0
+
+// Port 0x61 bits controlling and reporting PIT channel 2
+#define PIT_GATE_ENABLE 0x01
+#define PIT_GATE_SPEAKER 0x02
+#define PIT_GATE_OUT2 0x20
+
+// Length of the calibration window
+#define CALIBRATE_MS 50
+
+// Sleeps shorter than this spin on the TSC instead of parking on the wheel
+#define SLEEP_SPIN_NS NS_PER_TICK
+
+static vdso_data_t *clock;  // the vDSO's data page, once the TSC is calibrated
+
+static stat_id_t stat_ticks;
+
+// Count TSC cycles across a fixed window timed by PIT channel 2
+static uint64_t calibrate_tsc() {
+    uint16_t latch = PIT_HZ * CALIBRATE_MS / 1000;
+
+    // Raise the channel 2 gate with the speaker disconnected
+    outb(PIT_GATE, (inb(PIT_GATE) & ~PIT_GATE_SPEAKER) | PIT_GATE_ENABLE);
+
+    // Start a one-shot countdown; OUT2 goes high when it reaches zero
+    outb(PIT_COMMAND, PIT_CMD_CHANNEL2_ONESHOT);
+    outb(PIT_CHANNEL2, latch & 0xFF);
+    outb(PIT_CHANNEL2, latch >> 8);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE) & PIT_GATE_OUT2)) {
+    }
+    uint64_t end = rdtsc();
+
+    return (end - start) * 1000 / CALIBRATE_MS;
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return ((unsigned __int128)cycles * clock->mult) >> clock->shift;
+}
+
+uint64_t clock_tsc_hz() { return clock == NULL ? 0 : clock->tsc_hz; }
+
+uint64_t clock_timespec_ns(const timespec_t *ts) {
+    if ((uint64_t)ts->tv_sec >= CLOCK_MAX_SEC) {
+        return CLOCK_MAX_SEC * NS_PER_SEC;
+    }
+    return ts->tv_sec * NS_PER_SEC + ts->tv_nsec;
+}
+
+uint64_t clock_monotonic_ns() {
+    // The log asks for timestamps before the TSC is calibrated
+    if (clock == NULL) {
+        return 0;
+    }
+    return clock->ns_base + clock_cycles_to_ns(rdtsc() - clock->tsc_base);
+}
+
+uint64_t clock_coarse_ns() {
+    // Only the BSP writes it, and a 64-bit load can't tear
+    return clock == NULL ? 0 : __atomic_load_n(&clock->tick_ns, __ATOMIC_RELAXED);
+}
+
+void timer_handler(interrupt_context_t *ctx) {
+    stats_inc(stat_ticks);
+
+    // Every CPU ticks, but the wheel only advances on the BSP
+    if (cpu_id() == 0) {
+        vdso_tick();
+        timer_tick();
+        klog_drain_later();
+    }
+
+    // The saved %rbp at our frame pointer is the interrupted code's frame pointer
+    profile_tick(ctx, *(uintptr_t *)__builtin_frame_address(0));
+    lapic_eoi();  // end of interrupt message
+
+    // This may switch tasks, so it comes after the EOI. A thread of an
+    // exiting process running in user mode leaves here.
+    bool user = (ctx->cs & 0x3) != 0;
+    sched_tick(user);
+    if (user) {
+        thread_check_exit();
+    }
+}
+
+void clock_init() {
+    stat_ticks = stats_register("clock.ticks");
+
+    // Pick the largest shift that keeps mult in 32 bits, for the best precision
+    uint64_t tsc_hz = calibrate_tsc();
+    uint32_t shift = 32;
+    while (shift > 0 && (NS_PER_SEC << shift) / tsc_hz > UINT32_MAX) {
+        shift--;
+    }
+
+    // Publish the parameters where user space can read them too
+    vdso_data_t *data = vdso_data();
+    vdso_write_begin();
+    data->tsc_hz = tsc_hz;
+    data->mult = (NS_PER_SEC << shift) / tsc_hz;
+    data->shift = shift;
+    data->ns_base = 0;
+    data->tsc_base = rdtsc();
+    vdso_write_end();
+    clock = data;
+
+    debugf("clock: TSC runs at %lu.%03lu MHz\n", tsc_hz / 1000000, tsc_hz / 1000 % 1000);
+
+    // Each CPU's local APIC timer is its tick source. The other CPUs start
+    // theirs when they come online.
+    idt_set_handler(APIC_TIMER_VECTOR, timer_handler, IDT_TYPE_INTERRUPT);
+    lapic_timer_start(HZ);
+}
+
+// Timer callback that ends a sleep
+static void sleep_wakeup(void *arg) { sched_wake((task_t *)arg); }
+
+void clock_sleep_ns(uint64_t ns) {
+    uint64_t deadline = clock_monotonic_ns() + ns;
+
+    if (ns >= SLEEP_SPIN_NS) {
+        // Block on the timer wheel for whole ticks. The extra tick covers the
+        // part of the current tick already gone. A process that is exiting
+        // interrupts the sleep, so the timer may still be pending.
+        uint64_t flags = irq_save();
+        ktimer_t timer;
+        sched_set_blocked_interruptible();
+        timer_add(&timer, ns / NS_PER_TICK + 1, sleep_wakeup, sched_current());
+        sched_yield();
+        timer_cancel(&timer);
+        irq_restore(flags);
+    }
+
+    // Spin out the remainder
+    while (clock_monotonic_ns() < deadline && !sched_current()->interrupted) {
+        __asm__ volatile("pause");
+    }
+}
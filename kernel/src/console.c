@@ -0,0 +1,53 @@
+#include "console.h"
+
+#include "keyboard.h"
+#include "kstdio.h"
+#include "page.h"
+
+static ssize_t console_read(file_t *file, void *buf, size_t count) {
+    size_t index = 0;
+    char *buffer = (char *)buf;
+
+    while (index < count) {
+        int ch = kgetc();
+
+        // A process that is exiting keeps what it has read so far
+        if (ch < 0) {
+            return index > 0 ? (ssize_t)index : -1;
+        } else if (ch == 8) {  // backspace
+            index = index == 0 ? 0 : index - 1;
+        } else {
+            char c = ch;
+            if (!copy_to_user(&buffer[index], &c, 1)) {
+                return -1;
+            }
+            index += 1;
+        }
+    }
+
+    return index;
+}
+
+static ssize_t console_write(file_t *file, const void *buf, size_t count) {
+    // Hand the buffer to the terminal a chunk at a time, as it may not be mapped
+    char chunk[256];
+    size_t written = 0;
+
+    while (written < count) {
+        size_t n = count - written < sizeof(chunk) ? count - written : sizeof(chunk);
+        if (!copy_from_user(chunk, (const char *)buf + written, n)) {
+            return written > 0 ? (ssize_t)written : -1;
+        }
+        kwrite(chunk, n);
+        written += n;
+    }
+
+    return written;
+}
+
+static const file_ops_t console_ops = {.read = console_read, .write = console_write};
+
+// Every task shares one console file. Its own reference keeps it from being freed.
+static file_t console = {.ops = &console_ops, .dentry = NULL, .offset = 0, .refs = 1};
+
+file_t *console_open() { return file_get(&console); }
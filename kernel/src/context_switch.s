@@ -0,0 +1,39 @@
+.global context_switch
+.global task_trampoline
+.global sched_exit
+
+# void context_switch(uintptr_t *save_rsp, uintptr_t next_rsp)
+# Save the callee-saved registers on the current stack, store the stack
+# pointer in the first argument, and resume the task whose stack pointer is
+# in the second argument.
+context_switch:
+  push %rbp
+  push %rbx
+  push %r12
+  push %r13
+  push %r14
+  push %r15
+
+  # Swap stacks
+  mov %rsp, (%rdi)
+  mov %rsi, %rsp
+
+  pop %r15
+  pop %r14
+  pop %r13
+  pop %r12
+  pop %rbx
+  pop %rbp
+  ret
+
+# The first context_switch into a new task returns here, with the entry point
+# in %r12 and its argument in %r13
+task_trampoline:
+  mov %r13, %rdi
+
+  # The scheduler loop switched to us with interrupts off
+  sti
+  call *%r12
+
+  # The task returned, so it is done
+  call sched_exit
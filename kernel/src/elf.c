@@ -2,15 +2,72 @@
 
 #include <string.h>
 
+#include "clock.h"
 #include "debug.h"
 #include "gdt.h"
-#include "kstdio.h"
+#include "klog.h"
+#include "mmap.h"
 #include "page.h"
+#include "pagecache.h"
+#include "proc.h"
+#include "ring.h"
+#include "sched.h"
+#include "stats.h"
 #include "stivale2.h"
+#include "thread.h"
+#include "trace.h"
+#include "util.h"
+#include "vdso.h"
+#include "vfs.h"
+
+/* ELF identification */
+#define ELFMAG "\177ELF"
+#define EI_CLASS 4
+#define EI_DATA 5
+#define EI_VERSION 6
+#define ELFCLASS64 2
+#define ELFDATA2LSB 1
+#define EV_CURRENT 1
+
+/* Object file types and machines */
+#define ET_EXEC 2
+#define ET_DYN 3
+#define EM_X86_64 62
 
 /* Program header */
 #define PT_NULL 0
 #define PT_LOAD 1
+#define PT_DYNAMIC 2
+#define PT_INTERP 3
+
+/* Dynamic section tags */
+#define DT_NULL 0
+#define DT_PLTRELSZ 2
+#define DT_HASH 4
+#define DT_STRTAB 5
+#define DT_SYMTAB 6
+#define DT_RELA 7
+#define DT_RELASZ 8
+#define DT_STRSZ 10
+#define DT_JMPREL 23
+
+/* Relocation types */
+#define R_X86_64_64 1
+#define R_X86_64_GLOB_DAT 6
+#define R_X86_64_JUMP_SLOT 7
+#define R_X86_64_RELATIVE 8
+
+#define ELF64_R_SYM(i) ((i) >> 32)
+#define ELF64_R_TYPE(i) ((i)&0xffffffff)
+
+/* Undefined symbol section index */
+#define SHN_UNDEF 0
+
+// Where the shared library named by PT_INTERP is placed in every process
+#define ELF_SHARED_BASE 0x7F0000000000
+
+// Where position-independent programs are placed, the address the fixed ones link at
+#define ELF_PIE_BASE 0x500000000
 
 /* These constants define the permissions on sections in the program
    header, p_flags. */
@@ -57,53 +114,586 @@ typedef struct elf_program {
     Elf64_Xword p_align;  /* Alignment of segment */
 } elf_program_t;
 
-void_function_t load(uintptr_t p, size_t size) {
-    elf_header_t *header = (elf_header_t *)(p);
-    elf_program_t *program = p + header->e_phoff;
+typedef struct elf_dyn {
+    Elf64_Sxword d_tag; /* Dynamic entry type */
+    Elf64_Xword d_val;  /* Integer or address value */
+} elf_dyn_t;
+
+typedef struct elf_sym {
+    Elf64_Word st_name;     /* Symbol name, index in string table */
+    unsigned char st_info;  /* Type and binding attributes */
+    unsigned char st_other; /* No defined meaning, 0 */
+    Elf64_Half st_shndx;    /* Associated section index */
+    Elf64_Addr st_value;    /* Value of the symbol */
+    Elf64_Xword st_size;    /* Associated symbol size */
+} elf_sym_t;
 
-    // iterate and load program segment to memory
-    for (size_t i = 0; i < header->e_phnum; i++) {
-        if (program[i].p_type != PT_LOAD) {  // not loadable
+typedef struct elf_rela {
+    Elf64_Addr r_offset;   /* Location at which to apply the action */
+    Elf64_Xword r_info;    /* index and type of relocation */
+    Elf64_Sxword r_addend; /* Constant addend used to compute value */
+} elf_rela_t;
+
+// An image being loaded, with the dynamic tables found in its file. Every
+// table has been checked to lie inside the file.
+typedef struct elf_object {
+    uintptr_t image;  // the file in kernel memory
+    size_t size;      // bytes in the file
+    uintptr_t base;   // added to the file's addresses, 0 for fixed-address images
+    const elf_header_t *header;
+    const elf_program_t *programs;
+    const elf_sym_t *symtab;
+    size_t nsyms;
+    const char *strtab;
+    size_t strsz;
+    const uint32_t *hash;  // DT_HASH table of symtab
+    const elf_rela_t *rela;
+    size_t rela_count;
+    const elf_rela_t *jmprel;
+    size_t jmprel_count;
+} elf_object_t;
+
+static stat_id_t stat_exec_count;
+static stat_id_t stat_exec_cycles;
+static stat_id_t stat_shared_pages;
+static stat_id_t stat_relocations;
+
+const char *exec_current_image() { return sched_current()->image; }
+
+void elf_init() {
+    stat_exec_count = stats_register("exec.count");
+    stat_exec_cycles = stats_register("exec.cycles");
+    stat_shared_pages = stats_register("exec.shared_pages");
+    stat_relocations = stats_register("exec.relocations");
+}
+
+// The file contents behind len bytes at a virtual address of the object, or
+// NULL unless one segment holds all of them in the file
+static const void *file_range(const elf_object_t *obj, uintptr_t vaddr, size_t len) {
+    for (size_t i = 0; i < obj->header->e_phnum; i++) {
+        const elf_program_t *ph = &obj->programs[i];
+        if (ph->p_type == PT_LOAD && vaddr >= ph->p_vaddr && vaddr - ph->p_vaddr <= ph->p_filesz &&
+            len <= ph->p_filesz - (vaddr - ph->p_vaddr)) {
+            return (const void *)(obj->image + ph->p_offset + (vaddr - ph->p_vaddr));
+        }
+    }
+    return NULL;
+}
+
+// Find the object's segment of the given type
+static const elf_program_t *find_program(const elf_object_t *obj, Elf64_Word type) {
+    for (size_t i = 0; i < obj->header->e_phnum; i++) {
+        if (obj->programs[i].p_type == type) {
+            return &obj->programs[i];
+        }
+    }
+    return NULL;
+}
+
+// Check the ELF header: a little-endian x86-64 executable or shared object
+// whose program headers are inside the file
+static bool check_header(const elf_header_t *header, size_t size) {
+    const unsigned char *ident = header->e_ident;
+    if (size < sizeof(elf_header_t) || memcmp(ident, ELFMAG, 4) != 0 ||
+        ident[EI_CLASS] != ELFCLASS64 || ident[EI_DATA] != ELFDATA2LSB ||
+        ident[EI_VERSION] != EV_CURRENT || header->e_version != EV_CURRENT ||
+        header->e_machine != EM_X86_64) {
+        return false;
+    }
+    if (header->e_type != ET_EXEC && header->e_type != ET_DYN) {
+        return false;
+    }
+    if (header->e_phentsize != sizeof(elf_program_t) || header->e_phnum == 0 ||
+        header->e_phoff > size ||
+        (size - header->e_phoff) / sizeof(elf_program_t) < header->e_phnum) {
+        return false;
+    }
+    return true;
+}
+
+// Check that every segment's file contents are inside the file, and that
+// loadable segments fit in user space once moved by base and can be mapped
+// page by page
+static bool check_segments(const elf_object_t *obj) {
+    size_t loads = 0;
+    for (size_t i = 0; i < obj->header->e_phnum; i++) {
+        const elf_program_t *ph = &obj->programs[i];
+        if (ph->p_offset > obj->size || ph->p_filesz > obj->size - ph->p_offset) {
+            return false;
+        }
+        // Empty loadable segments map nothing, so their addresses don't matter
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0) {
             continue;
         }
-        if (program[i].p_memsz == 0) {  // no size
+
+        loads++;
+        if (ph->p_filesz > ph->p_memsz || ph->p_vaddr % PAGE_SIZE != ph->p_offset % PAGE_SIZE) {
+            return false;
+        }
+        // User segments must stay in the lower half
+        if (obj->base > USER_HALF_END || ph->p_vaddr > USER_HALF_END - obj->base ||
+            ph->p_memsz > USER_HALF_END - obj->base - ph->p_vaddr) {
+            return false;
+        }
+    }
+    return loads > 0;
+}
+
+// Find and check the tables the dynamic segment points at, if there is one
+static bool find_dynamic(elf_object_t *obj) {
+    const elf_program_t *dynamic = find_program(obj, PT_DYNAMIC);
+    if (dynamic == NULL) {
+        return true;
+    }
+
+    uintptr_t hash = 0, strtab = 0, symtab = 0, rela = 0, jmprel = 0;
+    size_t relasz = 0, pltrelsz = 0;
+    const elf_dyn_t *d = (const elf_dyn_t *)(obj->image + dynamic->p_offset);
+    for (size_t i = 0; i < dynamic->p_filesz / sizeof(elf_dyn_t) && d[i].d_tag != DT_NULL; i++) {
+        switch (d[i].d_tag) {
+            case DT_HASH:
+                hash = d[i].d_val;
+                break;
+            case DT_STRTAB:
+                strtab = d[i].d_val;
+                break;
+            case DT_STRSZ:
+                obj->strsz = d[i].d_val;
+                break;
+            case DT_SYMTAB:
+                symtab = d[i].d_val;
+                break;
+            case DT_RELA:
+                rela = d[i].d_val;
+                break;
+            case DT_RELASZ:
+                relasz = d[i].d_val;
+                break;
+            case DT_JMPREL:
+                jmprel = d[i].d_val;
+                break;
+            case DT_PLTRELSZ:
+                pltrelsz = d[i].d_val;
+                break;
+        }
+    }
+
+    // The hash table's chain has an entry per symbol, which sizes symtab
+    if (hash != 0) {
+        const uint32_t *counts = file_range(obj, hash, 2 * sizeof(uint32_t));
+        if (counts == NULL || counts[0] == 0) {
+            return false;
+        }
+        obj->nsyms = counts[1];
+        obj->hash = file_range(obj, hash, (2 + (size_t)counts[0] + counts[1]) * sizeof(uint32_t));
+        obj->symtab = file_range(obj, symtab, obj->nsyms * sizeof(elf_sym_t));
+        if (obj->hash == NULL || obj->symtab == NULL) {
+            return false;
+        }
+    }
+    if (strtab != 0) {
+        obj->strtab = file_range(obj, strtab, obj->strsz);
+        if (obj->strtab == NULL || obj->strsz == 0 || obj->strtab[obj->strsz - 1] != '\0') {
+            return false;
+        }
+    }
+    if (rela != 0) {
+        obj->rela = file_range(obj, rela, relasz);
+        obj->rela_count = relasz / sizeof(elf_rela_t);
+        if (obj->rela == NULL) {
+            return false;
+        }
+    }
+    if (jmprel != 0) {
+        obj->jmprel = file_range(obj, jmprel, pltrelsz);
+        obj->jmprel_count = pltrelsz / sizeof(elf_rela_t);
+        if (obj->jmprel == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Set up obj for the ELF file at image after checking it is one we can load.
+// A position-independent object is placed at pie_base, anything else at the
+// addresses it was linked for.
+static bool elf_object_init(elf_object_t *obj, uintptr_t image, size_t size, uintptr_t pie_base) {
+    memset(obj, 0, sizeof(elf_object_t));
+    obj->image = image;
+    obj->size = size;
+    obj->header = (const elf_header_t *)image;
+    if (!check_header(obj->header, size)) {
+        klog(KLOG_WARN, "elf: not an x86-64 executable\n");
+        return false;
+    }
+
+    obj->base = obj->header->e_type == ET_DYN ? pie_base : 0;
+    obj->programs = (const elf_program_t *)(image + obj->header->e_phoff);
+    if (!check_segments(obj) || !find_dynamic(obj)) {
+        klog(KLOG_WARN, "elf: malformed segments or dynamic tables\n");
+        return false;
+    }
+    return true;
+}
+
+// The SysV ABI's symbol hash
+static uint32_t elf_hash(const char *name) {
+    uint32_t h = 0;
+    for (; *name != '\0'; name++) {
+        h = (h << 4) + (uint8_t)*name;
+        uint32_t g = h & 0xf0000000;
+        h ^= g >> 24;
+        h &= ~g;
+    }
+    return h;
+}
+
+// Look up a symbol the object defines, returning its address or 0
+static uintptr_t elf_lookup(const elf_object_t *obj, const char *name) {
+    if (obj == NULL || obj->hash == NULL || obj->strtab == NULL) {
+        return 0;
+    }
+
+    // Chains can't be longer than the symbol table, which stops a looped one
+    uint32_t nbucket = obj->hash[0];
+    const uint32_t *bucket = &obj->hash[2];
+    const uint32_t *chain = &bucket[nbucket];
+    uint32_t i = bucket[elf_hash(name) % nbucket];
+    for (size_t steps = 0; i != 0 && i < obj->nsyms && steps < obj->nsyms; i = chain[i], steps++) {
+        const elf_sym_t *sym = &obj->symtab[i];
+        if (sym->st_shndx != SHN_UNDEF && sym->st_name < obj->strsz &&
+            strcmp(obj->strtab + sym->st_name, name) == 0) {
+            return obj->base + sym->st_value;
+        }
+    }
+    return 0;
+}
+
+// Is the address inside a writable segment of the object?
+static bool in_writable_segment(const elf_object_t *obj, uintptr_t vaddr) {
+    for (size_t i = 0; i < obj->header->e_phnum; i++) {
+        const elf_program_t *ph = &obj->programs[i];
+        if (ph->p_type == PT_LOAD && (ph->p_flags & PF_W) && vaddr >= ph->p_vaddr &&
+            vaddr - ph->p_vaddr < ph->p_memsz &&
+            ph->p_memsz - (vaddr - ph->p_vaddr) >= sizeof(uint64_t)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Apply a table of relocations to the loaded object, resolving symbols it
+// doesn't define in lib. Targets must be in writable segments, so shared
+// read-only pages are never written.
+static bool relocate_table(const elf_object_t *obj, const elf_object_t *lib,
+                           const elf_rela_t *table, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const elf_rela_t *rela = &table[i];
+        if (!in_writable_segment(obj, rela->r_offset)) {
+            klog(KLOG_WARN, "elf: relocation at %p outside writable segments\n", rela->r_offset);
+            return false;
+        }
+        uint64_t *target = (uint64_t *)(obj->base + rela->r_offset);
+
+        uint32_t type = ELF64_R_TYPE(rela->r_info);
+        if (type == R_X86_64_RELATIVE) {
+            *target = obj->base + rela->r_addend;
+            continue;
+        }
+        if (type != R_X86_64_64 && type != R_X86_64_GLOB_DAT && type != R_X86_64_JUMP_SLOT) {
+            klog(KLOG_WARN, "elf: unsupported relocation type %u\n", type);
+            return false;
+        }
+
+        size_t index = ELF64_R_SYM(rela->r_info);
+        if (index >= obj->nsyms || obj->strtab == NULL ||
+            obj->symtab[index].st_name >= obj->strsz) {
+            klog(KLOG_WARN, "elf: relocation against a bad symbol\n");
+            return false;
+        }
+
+        // The object's own definition wins, then the shared library's
+        const elf_sym_t *sym = &obj->symtab[index];
+        const char *name = obj->strtab + sym->st_name;
+        uintptr_t value = sym->st_shndx != SHN_UNDEF ? obj->base + sym->st_value
+                                                     : elf_lookup(lib, name);
+        if (value == 0) {
+            klog(KLOG_WARN, "elf: undefined symbol %s\n", name);
+            return false;
+        }
+        *target = type == R_X86_64_64 ? value + rela->r_addend : value;
+    }
+
+    stats_add(stat_relocations, count);
+    return true;
+}
+
+// Resolve every relocation of a loaded object, eagerly
+static bool relocate(const elf_object_t *obj, const elf_object_t *lib) {
+    return relocate_table(obj, lib, obj->rela, obj->rela_count) &&
+           relocate_table(obj, lib, obj->jmprel, obj->jmprel_count);
+}
+
+// Does a loadable segment cover part of the page at vaddr?
+static bool touches_page(const elf_program_t *ph, uintptr_t page) {
+    return ph->p_type == PT_LOAD && ph->p_memsz != 0 && page + PAGE_SIZE > ph->p_vaddr &&
+           page < ph->p_vaddr + ph->p_memsz;
+}
+
+// Can the page at vaddr map the page cache's frame of the file? Only if no
+// segment on it is writable or has bss there, and they all agree on which
+// page of the file it is.
+static bool page_from_cache(const elf_object_t *obj, uintptr_t page, size_t *index) {
+    bool found = false;
+    for (size_t i = 0; i < obj->header->e_phnum; i++) {
+        const elf_program_t *ph = &obj->programs[i];
+        if (!touches_page(ph, page)) {
             continue;
         }
 
-        uintptr_t src = p + program[i].p_offset;  // source of the program segment
-        uintptr_t dest = program[i].p_vaddr;      // virutal address destination
-        bool executable = program[i].p_flags & PF_X;
-        bool writable = program[i].p_flags & PF_W;
-        bool readable = program[i].p_flags & PF_R;
+        uintptr_t end = page + PAGE_SIZE < ph->p_vaddr + ph->p_memsz ? page + PAGE_SIZE
+                                                                     : ph->p_vaddr + ph->p_memsz;
+        size_t file_page = (ph->p_offset - (ph->p_vaddr - page)) / PAGE_SIZE;
+        if ((ph->p_flags & PF_W) || end > ph->p_vaddr + ph->p_filesz ||
+            (found && file_page != *index)) {
+            return false;
+        }
+        *index = file_page;
+        found = true;
+    }
+    return found;
+}
+
+// Map the object's loadable segments into the current address space with
+// their final permissions, in one pass. Read-only pages map the page cache's
+// frames of file, so one physical copy serves every process that maps it;
+// the rest get private frames filled from the image. file is NULL for images
+// outside the filesystem, such as boot modules, which are always copied.
+static bool map_segments(const elf_object_t *obj, inode_t *file) {
+    uintptr_t root = read_cr3();
+
+    for (size_t i = 0; i < obj->header->e_phnum; i++) {
+        const elf_program_t *ph = &obj->programs[i];
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0) {
+            continue;
+        }
+
+        bool writable = ph->p_flags & PF_W;
+        bool executable = ph->p_flags & PF_X;
+        debugf("type: %u  vaddr: %p fsize: %lu msize: %lu offset: %lu\n", ph->p_type, ph->p_vaddr,
+               ph->p_filesz, ph->p_memsz, ph->p_offset);
+
+        for (uintptr_t page = ph->p_vaddr / PAGE_SIZE * PAGE_SIZE; page < ph->p_vaddr + ph->p_memsz;
+             page += PAGE_SIZE) {
+            uintptr_t address = obj->base + page;
+            size_t index = 0;
+            bool cached = file != NULL && page_from_cache(obj, page, &index);
 
-        // prepare the page (by allocate enough space and page-aligned it)
-        for (uintptr_t begin = (dest & 0xFFFFFFFFFFFFF000); begin < dest + program[i].p_memsz;
-             begin += PAGE_SIZE) {
-            if (!vm_map(read_cr3(), begin, true, true, true)) {
-                kprintf("vm_map failed!\n");
+            // A page already mapped must be one an earlier segment shares,
+            // which gets the union of their permissions
+            uintptr_t frame = vm_frame(root, address);
+            if (frame != 0) {
+                bool shared = false;
+                for (size_t j = 0; j < i; j++) {
+                    shared |= touches_page(&obj->programs[j], page);
+                }
+                if (!shared || !vm_protect(root, address, true, writable, executable)) {
+                    klog(KLOG_WARN, "elf: segment overlaps a mapping at %p\n", address);
+                    return false;
+                }
+                if (cached) {
+                    continue;
+                }
+            } else if (cached) {
+                frame = pagecache_get(file, index);
+                if (frame == 0 || !vm_map_page(root, address, frame, true, false, executable)) {
+                    return false;
+                }
+                stats_inc(stat_shared_pages);
+                continue;
+            } else {
+                frame = pmem_alloc_zeroed();
+                if (frame == 0) {
+                    return false;
+                }
+                if (!vm_map_owned(root, address, frame, true, writable, executable)) {
+                    pmem_free(frame);
+                    return false;
+                }
             }
+
+            // Copy this segment's part of the page through the kernel's
+            // mapping, since the user one may be read-only
+            uintptr_t from = page > ph->p_vaddr ? page : ph->p_vaddr;
+            uintptr_t file_end = ph->p_vaddr + ph->p_filesz;
+            uintptr_t to = page + PAGE_SIZE < file_end ? page + PAGE_SIZE : file_end;
+            if (from < to) {
+                memcpy((void *)(add_virtual_offset(frame) + (from - page)),
+                       (void *)(obj->image + ph->p_offset + (from - ph->p_vaddr)), to - from);
+            }
+        }
+    }
+    return true;
+}
+
+// Map and relocate the shared library in file at ELF_SHARED_BASE
+static bool load_shared(elf_object_t *lib, inode_t *file) {
+    if (!elf_object_init(lib, (uintptr_t)file->data, file->size, ELF_SHARED_BASE)) {
+        return false;
+    }
+    if (lib->header->e_type != ET_DYN) {
+        klog(KLOG_WARN, "elf: shared library isn't position-independent\n");
+        return false;
+    }
+    return map_segments(lib, file) && relocate(lib, NULL);
+}
+
+// Is the address inside an executable segment of the object?
+static bool in_executable_segment(const elf_object_t *obj, uintptr_t vaddr) {
+    for (size_t i = 0; i < obj->header->e_phnum; i++) {
+        const elf_program_t *ph = &obj->programs[i];
+        if (ph->p_type == PT_LOAD && (ph->p_flags & PF_X) && vaddr >= ph->p_vaddr &&
+            vaddr - ph->p_vaddr < ph->p_memsz) {
+            return true;
         }
+    }
+    return false;
+}
+
+void_function_t load(uintptr_t p, size_t size, inode_t *file) {
+    elf_object_t exe;
+    if (!elf_object_init(&exe, p, size, ELF_PIE_BASE)) {
+        return NULL;
+    }
+    if (!in_executable_segment(&exe, exe.header->e_entry)) {
+        klog(KLOG_WARN, "elf: entry point %p isn't executable\n", exe.header->e_entry);
+        return NULL;
+    }
+    if (!map_segments(&exe, file)) {
+        return NULL;
+    }
+
+    // Link against the shared library the image asks for. It is found by
+    // path; any DT_NEEDED entries are assumed to name the same library.
+    const elf_program_t *interp = find_program(&exe, PT_INTERP);
+    if (interp != NULL) {
+        const char *path = (const char *)(p + interp->p_offset);
+        if (interp->p_filesz == 0 || interp->p_filesz > VFS_PATH_MAX ||
+            path[interp->p_filesz - 1] != '\0') {
+            klog(KLOG_WARN, "elf: bad interpreter path\n");
+            return NULL;
+        }
+
+        elf_object_t lib;
+        dentry_t *d = vfs_lookup(path);
+        if (d == NULL || (d->inode->mode & VFS_S_IFMT) != VFS_S_IFREG) {
+            klog(KLOG_WARN, "elf: can't find %s\n", path);
+            return NULL;
+        }
+        if (!load_shared(&lib, d->inode) || !relocate(&exe, &lib)) {
+            klog(KLOG_WARN, "elf: can't link against %s\n", path);
+            return NULL;
+        }
+    } else if (!relocate(&exe, NULL)) {
+        return NULL;
+    }
+
+    return (void_function_t)(exe.base + exe.header->e_entry);
+}
+
+bool exec_args_copy(exec_args_t *args, char *const argv[], char *const envp[]) {
+    args->argc = 0;
+    args->envc = 0;
+    args->size = 0;
 
-        // copy program to position
-        memcpy(dest, src, program[i].p_memsz);
+    for (int list = 0; list < 2; list++) {
+        char *const *strings = list == 0 ? argv : envp;
+        for (size_t i = 0; strings != NULL; i++) {
+            const char *s;
+            if (!copy_from_user(&s, &strings[i], sizeof(s))) {
+                return false;
+            }
+            if (s == NULL) {
+                break;
+            }
+
+            do {
+                if (args->size == EXEC_ARG_MAX ||
+                    !copy_from_user(&args->strings[args->size], s, 1)) {
+                    return false;
+                }
+                s++;
+            } while (args->strings[args->size++] != '\0');
 
-        for (uintptr_t begin = (dest & 0xFFFFFFFFFFFFF000); begin < dest + program[i].p_memsz;
-             begin += PAGE_SIZE) {
-            if (!vm_protect(read_cr3(), begin, readable, writable, executable)) {
-                kprintf("vm_protect failed!\n");
+            if (list == 0) {
+                args->argc++;
+            } else {
+                args->envc++;
             }
         }
+    }
+    return true;
+}
 
-        debugf("type: %d  vaddr: %p fsize: %d msize: %d offset: %d\n", program[i].p_type,
-               program[i].p_vaddr, program[i].p_filesz, program[i].p_memsz, program[i].p_offset);
+// Lay out size bytes of strings, holding argc arguments and then envc
+// environment entries, below top together with argc, argv, envp and the
+// auxiliary vector. Returns the 16-byte-aligned stack pointer, which points at argc.
+static uintptr_t push_args(uintptr_t top, const char *strings, size_t size, size_t argc,
+                           size_t envc, uintptr_t entry) {
+    uintptr_t user_strings = (top - size) & ~0xFUL;
+    memcpy((void *)user_strings, strings, size);
+
+    // argc, argv and its NULL, envp and its NULL, then the auxiliary pairs
+    size_t words = 1 + (argc + 1) + (envc + 1) + 2 * 3;
+    uintptr_t *sp = (uintptr_t *)((user_strings - words * sizeof(uintptr_t)) & ~0xFUL);
+
+    uintptr_t *out = sp;
+    const char *s = (const char *)user_strings;
+    *out++ = argc;
+    for (size_t i = 0; i < argc; i++, s += strlen(s) + 1) {
+        *out++ = (uintptr_t)s;
     }
+    *out++ = 0;
+    for (size_t i = 0; i < envc; i++, s += strlen(s) + 1) {
+        *out++ = (uintptr_t)s;
+    }
+    *out++ = 0;
+    *out++ = AT_PAGESZ;
+    *out++ = PAGE_SIZE;
+    *out++ = AT_ENTRY;
+    *out++ = entry;
+    *out++ = AT_NULL;
+    *out++ = 0;
 
-    return header->e_entry;
+    return (uintptr_t)sp;
 }
 
 void exec_module(struct stivale2_module module) {
+    exec_image(module.string, module.begin, module.end - module.begin, NULL, NULL);
+}
+
+void exec_image(const char *name, uintptr_t image, size_t size, inode_t *file,
+                const exec_args_t *args) {
+    uint64_t start = rdtsc();
+
+    // The new image starts with one thread and no thread-local storage
+    thread_stop_others();
+    ring_release();
+    sched_set_fs_base(0);
+
     unmap_lower_half(read_cr3());
-    void_function_t entry = load(module.begin, module.end - module.begin);
+    vm_release_all();
+    void_function_t entry = NULL;
+    if (vdso_map(read_cr3(), sched_current()->pid)) {
+        entry = load(image, size, file);
+    }
+    if (entry == NULL) {
+        // The old image is gone, so there is nothing to return to
+        klog(KLOG_ERR, "exec: can't load %s\n", name);
+        proc_exit(-1);
+    }
+    sched_current()->image = name;
+    TRACE(TRACE_EXEC, entry, trace_pack_string(name));
 
     // Pick an arbitrary location and size for the user-mode stack
     uintptr_t user_stack = 0x70000000000;
@@ -115,10 +705,27 @@ void exec_module(struct stivale2_module module) {
         vm_map(read_cr3() & 0xFFFFFFFFFFFFF000, p, true, true, false);
     }
 
+    // Without arguments the program still gets its name as argv[0]
+    uintptr_t sp;
+    if (args != NULL) {
+        sp = push_args(user_stack + user_stack_size, args->strings, args->size, args->argc,
+                       args->envc, (uintptr_t)entry);
+    } else {
+        sp = push_args(user_stack + user_stack_size, name, strlen(name) + 1, 1, 0,
+                       (uintptr_t)entry);
+    }
+    uintptr_t *argc = (uintptr_t *)sp;
+    uintptr_t argv = sp + sizeof(uintptr_t);
+    uintptr_t envp = argv + (*argc + 1) * sizeof(uintptr_t);
+
+    // Exec latency covers tearing down the old image through laying out the new stack
+    stats_inc(stat_exec_count);
+    stats_add(stat_exec_cycles, rdtsc() - start);
+
     // And now jump to the entry point
-    usermode_entry(
-        USER_DATA_SELECTOR | 0x3,          // User data selector with priv=3
-        user_stack + user_stack_size - 8,  // Stack starts at the high address minus 8 bytes
-        USER_CODE_SELECTOR | 0x3,          // User code selector with priv=3
-        entry);                            // Jump to the entry point}
+    usermode_entry(USER_DATA_SELECTOR | 0x3,  // User data selector with priv=3
+                   sp,                        // Stack starts at argc
+                   USER_CODE_SELECTOR | 0x3,  // User code selector with priv=3
+                   entry,                     // Jump to the entry point
+                   *argc, argv, envp);        // Arguments of a C entry point
 }
\ No newline at end of file
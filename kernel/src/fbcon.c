@@ -0,0 +1,249 @@
+#include "fbcon.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "font.h"
+#include "page.h"
+#include "spinlock.h"
+#include "stats.h"
+
+// The back buffer lives in a slice of the higher half of its own
+#define FBCON_REGION 0xFFFFFD0000000000
+
+// Each font row is drawn twice, for the 8x16 cells of a VGA text console
+#define CELL_WIDTH 8
+#define CELL_HEIGHT 16
+
+// The cursor is an underline this many pixels tall
+#define CURSOR_HEIGHT 2
+
+static bool ready = false;
+
+// Writers on several CPUs would otherwise race on the cursor and buffers
+static spinlock_t lock = SPINLOCK_INIT;
+
+static uint32_t *front;     // the framebuffer, write-combining in the direct map
+static size_t front_pitch;  // pixels from one framebuffer row to the next
+
+// Every text row, drawn, in a ring. Scrolling moves top instead of copying
+// the screen up, and the flush puts each row back where it belongs.
+static uint32_t *back;
+static size_t back_pitch;  // pixels from one back buffer row to the next
+static size_t top;         // ring index of the row at the top of the screen
+
+static size_t cols;
+static size_t rows;
+
+// The cursor position, in cells from the top left of the screen
+static size_t cursor_col = 0;
+static size_t cursor_row = 0;
+
+// Cells changed since the last flush: screen rows [dirty_top, dirty_bottom)
+// and columns [dirty_left, dirty_right). Empty when dirty_top == dirty_bottom.
+static size_t dirty_top, dirty_bottom, dirty_left, dirty_right;
+
+// Every glyph rendered in the console's colors, so drawing a character is a
+// copy. Characters the font lacks are drawn as spaces.
+static uint32_t glyphs[FONT_GLYPHS][CELL_HEIGHT][CELL_WIDTH];
+static uint32_t fg_pixel;
+
+static stat_id_t stat_bytes_written;
+static stat_id_t stat_flushes;
+static stat_id_t stat_scrolls;
+
+// Encode a color for the framebuffer's layout
+static uint32_t make_pixel(struct stivale2_struct_tag_framebuffer *fb, uint8_t r, uint8_t g,
+                           uint8_t b) {
+    return ((uint32_t)(r >> (8 - fb->red_mask_size)) << fb->red_mask_shift) |
+           ((uint32_t)(g >> (8 - fb->green_mask_size)) << fb->green_mask_shift) |
+           ((uint32_t)(b >> (8 - fb->blue_mask_size)) << fb->blue_mask_shift);
+}
+
+static void mark_dirty(size_t row, size_t left, size_t right) {
+    if (dirty_top == dirty_bottom) {
+        dirty_top = row;
+        dirty_bottom = row + 1;
+        dirty_left = left;
+        dirty_right = right;
+        return;
+    }
+    dirty_top = row < dirty_top ? row : dirty_top;
+    dirty_bottom = row + 1 > dirty_bottom ? row + 1 : dirty_bottom;
+    dirty_left = left < dirty_left ? left : dirty_left;
+    dirty_right = right > dirty_right ? right : dirty_right;
+}
+
+// The top left pixel of a cell in the back buffer
+static uint32_t *back_cell(size_t row, size_t col) {
+    size_t ring_row = (top + row) % rows;
+    return back + ring_row * CELL_HEIGHT * back_pitch + col * CELL_WIDTH;
+}
+
+static void draw_cell(size_t row, size_t col, char c) {
+    size_t glyph = (c >= FONT_FIRST && c <= FONT_LAST) ? c - FONT_FIRST : ' ' - FONT_FIRST;
+    uint32_t *dst = back_cell(row, col);
+    for (size_t y = 0; y < CELL_HEIGHT; y++) {
+        memcpy(dst + y * back_pitch, glyphs[glyph][y], sizeof(glyphs[glyph][y]));
+    }
+    mark_dirty(row, col, col + 1);
+}
+
+static void clear_row(size_t row) {
+    for (size_t col = 0; col < cols; col++) {
+        draw_cell(row, col, ' ');
+    }
+}
+
+// Copy the dirty cells to the framebuffer and draw the cursor over them
+static void flush() {
+    if (dirty_top == dirty_bottom) {
+        return;
+    }
+    stats_inc(stat_flushes);
+
+    size_t bytes = (dirty_right - dirty_left) * CELL_WIDTH * sizeof(uint32_t);
+    for (size_t row = dirty_top; row < dirty_bottom; row++) {
+        uint32_t *src = back_cell(row, dirty_left);
+        uint32_t *dst = front + row * CELL_HEIGHT * front_pitch + dirty_left * CELL_WIDTH;
+        for (size_t y = 0; y < CELL_HEIGHT; y++) {
+            memcpy(dst + y * front_pitch, src + y * back_pitch, bytes);
+        }
+    }
+    dirty_top = dirty_bottom = 0;
+
+    // The cursor only lives in the framebuffer. Marking its cell dirty before
+    // the next write moves it puts the character back.
+    size_t col = cursor_col < cols ? cursor_col : cols - 1;
+    uint32_t *cursor = front + ((cursor_row + 1) * CELL_HEIGHT - CURSOR_HEIGHT) * front_pitch +
+                       col * CELL_WIDTH;
+    for (size_t y = 0; y < CURSOR_HEIGHT; y++) {
+        for (size_t x = 0; x < CELL_WIDTH; x++) {
+            cursor[y * front_pitch + x] = fg_pixel;
+        }
+    }
+
+    // Drain the write-combining buffers so the text shows up now
+    __asm__ volatile("sfence" ::: "memory");
+}
+
+static void scroll() {
+    stats_inc(stat_scrolls);
+    top = (top + 1) % rows;
+    clear_row(rows - 1);
+
+    // Every row moved on screen
+    mark_dirty(0, 0, cols);
+    mark_dirty(rows - 1, 0, cols);
+}
+
+// Write one character, with the same control characters as the VGA console
+static void fbcon_putchar(char c) {
+    if (c == '\r') {
+        cursor_col = 0;
+        return;
+    } else if (c == '\b') {
+        if (cursor_col > 0) {
+            cursor_col--;
+            draw_cell(cursor_row, cursor_col, ' ');
+        }
+        return;
+    }
+
+    if (c == '\n') {
+        cursor_col = 0;
+        cursor_row++;
+    }
+
+    // Wrap if needed
+    if (cursor_col == cols) {
+        cursor_col = 0;
+        cursor_row++;
+    }
+
+    if (cursor_row == rows) {
+        scroll();
+        cursor_row--;
+    }
+
+    if (c != '\n') {
+        draw_cell(cursor_row, cursor_col, c);
+        cursor_col++;
+    }
+}
+
+bool fbcon_init(struct stivale2_struct_tag_framebuffer *fb) {
+    stat_bytes_written = stats_register("fbcon.bytes_written");
+    stat_flushes = stats_register("fbcon.flushes");
+    stat_scrolls = stats_register("fbcon.scrolls");
+
+    if (fb == NULL || fb->framebuffer_bpp != 32 || fb->memory_model != STIVALE2_FBUF_MMODEL_RGB) {
+        return false;
+    }
+    cols = fb->framebuffer_width / CELL_WIDTH;
+    rows = fb->framebuffer_height / CELL_HEIGHT;
+    if (cols == 0 || rows == 0) {
+        return false;
+    }
+
+    // The bootloader hands over the framebuffer's address in the higher-half
+    // direct map, which caches it write-back. Make that mapping
+    // write-combining in place, since a second mapping with another memory
+    // type would alias it.
+    uintptr_t root = read_cr3() & 0xFFFFFFFFFFFFF000;
+    size_t front_size = (size_t)fb->framebuffer_pitch * fb->framebuffer_height;
+    if (!vm_set_cache(root, fb->framebuffer_addr, front_size, VM_CACHE_WRITE_COMBINING)) {
+        return false;
+    }
+    front = (uint32_t *)fb->framebuffer_addr;
+    front_pitch = fb->framebuffer_pitch / sizeof(uint32_t);
+
+    // The back buffer is in ordinary memory
+    back_pitch = cols * CELL_WIDTH;
+    size_t back_size = back_pitch * rows * CELL_HEIGHT * sizeof(uint32_t);
+    for (size_t offset = 0; offset < back_size; offset += PAGE_SIZE) {
+        if (!vm_map(root, FBCON_REGION + offset, false, true, false)) {
+            return false;
+        }
+    }
+    back = (uint32_t *)FBCON_REGION;
+
+    // White on black, like the VGA console
+    fg_pixel = make_pixel(fb, 0xFF, 0xFF, 0xFF);
+    uint32_t bg_pixel = make_pixel(fb, 0, 0, 0);
+    for (size_t glyph = 0; glyph < FONT_GLYPHS; glyph++) {
+        for (size_t y = 0; y < CELL_HEIGHT; y++) {
+            uint8_t bits = font8x8[glyph][y / 2];
+            for (size_t x = 0; x < CELL_WIDTH; x++) {
+                glyphs[glyph][y][x] = (bits >> x) & 1 ? fg_pixel : bg_pixel;
+            }
+        }
+    }
+
+    // Clear the screen
+    for (size_t row = 0; row < rows; row++) {
+        clear_row(row);
+    }
+    flush();
+
+    ready = true;
+    return true;
+}
+
+void fbcon_write(const char *s, size_t size) {
+    if (!ready) {
+        return;
+    }
+    stats_add(stat_bytes_written, size);
+    uint64_t flags = spin_lock_irqsave(&lock);
+
+    // Erase the cursor wherever the text leaves it
+    mark_dirty(cursor_row, cursor_col < cols ? cursor_col : cols - 1,
+               cursor_col < cols ? cursor_col + 1 : cols);
+
+    for (size_t i = 0; i < size; i++) {
+        fbcon_putchar(s[i]);
+    }
+    flush();
+    spin_unlock_irqrestore(&lock, flags);
+}
@@ -0,0 +1,259 @@
+#include "futex.h"
+
+#include "mmap.h"
+#include "page.h"
+#include "percpu.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "timer.h"
+
+// A task sleeping in FUTEX_WAIT. It lives on the sleeper's kernel stack.
+typedef struct futex_waiter {
+    struct futex_waiter *next;
+    task_t *task;
+    uintptr_t key;                // physical address of the word waited on
+    struct futex_bucket *bucket;  // the bucket the waiter is queued on, NULL once woken
+} futex_waiter_t;
+
+// Waiters whose keys hash alike. The lock protects the list and the keys and
+// buckets of the waiters on it.
+typedef struct futex_bucket {
+    spinlock_t lock;
+    futex_waiter_t *head;
+} __cacheline_aligned futex_bucket_t;
+
+static futex_bucket_t buckets[FUTEX_HASH_SIZE];
+
+static stat_id_t stat_waits;
+static stat_id_t stat_wakes;
+static stat_id_t stat_requeues;
+static stat_id_t stat_timeouts;
+
+void futex_init() {
+    stat_waits = stats_register("futex.waits");
+    stat_wakes = stats_register("futex.wakes");
+    stat_requeues = stats_register("futex.requeues");
+    stat_timeouts = stats_register("futex.timeouts");
+}
+
+// The physical address of an aligned word in the current process's user
+// memory, or 0 if it isn't mapped there
+static uintptr_t futex_key(uint32_t *addr) {
+    uintptr_t address = (uintptr_t)addr;
+    if (address % sizeof(uint32_t) != 0 || !user_range_ok(addr, sizeof(uint32_t))) {
+        return 0;
+    }
+
+    // File pages are mapped on first touch, so fault the word in as a read
+    // from user mode would
+    uintptr_t root = sched_current()->root;
+    if (!vm_is_mapped(root, address, true) && !vm_fault(address, PF_USER)) {
+        return 0;
+    }
+    uintptr_t frame = vm_frame(root, address / PAGE_SIZE * PAGE_SIZE);
+    return frame != 0 ? frame + address % PAGE_SIZE : 0;
+}
+
+// Fibonacci hashing of the key, whose low two bits are always clear
+static futex_bucket_t *futex_bucket(uintptr_t key) {
+    return &buckets[((key >> 2) * 0x9E3779B97F4A7C15ULL) >> (64 - FUTEX_HASH_BITS)];
+}
+
+// Unlink a waiter from its bucket. Called with the bucket's lock held.
+static void bucket_remove(futex_bucket_t *bucket, futex_waiter_t *waiter) {
+    futex_waiter_t **link = &bucket->head;
+    while (*link != waiter) {
+        link = &(*link)->next;
+    }
+    *link = waiter->next;
+    waiter->next = NULL;
+}
+
+// Wake up to count waiters on key. Called with the bucket's lock held. A
+// woken waiter can't return until it sees its bucket cleared, so its task is
+// still alive when it is woken.
+static long wake_locked(futex_bucket_t *bucket, uintptr_t key, uint32_t count) {
+    long woken = 0;
+    futex_waiter_t **link = &bucket->head;
+    while (*link != NULL && woken < count) {
+        futex_waiter_t *waiter = *link;
+        if (waiter->key != key) {
+            link = &waiter->next;
+            continue;
+        }
+
+        *link = waiter->next;
+        waiter->next = NULL;
+        sched_wake(waiter->task);
+        __atomic_store_n(&waiter->bucket, NULL, __ATOMIC_RELEASE);
+        woken++;
+    }
+    return woken;
+}
+
+// Timer callback that ends a FUTEX_WAIT with a timeout
+static void futex_timeout(void *arg) { sched_wake((task_t *)arg); }
+
+// Lock the bucket a waiter is on, which FUTEX_REQUEUE may change under us.
+// Returns NULL with nothing locked if the waiter has been woken.
+static futex_bucket_t *lock_waiter_bucket(futex_waiter_t *waiter) {
+    while (true) {
+        futex_bucket_t *bucket = __atomic_load_n(&waiter->bucket, __ATOMIC_ACQUIRE);
+        if (bucket == NULL) {
+            return NULL;
+        }
+        spin_lock(&bucket->lock);
+        if (waiter->bucket == bucket) {
+            return bucket;
+        }
+        spin_unlock(&bucket->lock);
+    }
+}
+
+static long futex_wait(uint32_t *addr, uint32_t val, const timespec_t *timeout) {
+    uint64_t ticks = 0;
+    if (timeout != NULL) {
+        timespec_t ts;
+        if (!copy_from_user(&ts, timeout, sizeof(ts))) {
+            return -1;
+        }
+        if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= NS_PER_SEC) {
+            return -1;
+        }
+        // Round up, plus a tick for the part of the current one already gone
+        uint64_t ns = clock_timespec_ns(&ts);
+        ticks = (ns + NS_PER_TICK - 1) / NS_PER_TICK + 1;
+    }
+
+    uintptr_t key = futex_key(addr);
+    if (key == 0) {
+        return -1;
+    }
+
+    futex_waiter_t waiter = {.task = sched_current(), .key = key};
+    futex_bucket_t *bucket = futex_bucket(key);
+    uint64_t flags = spin_lock_irqsave(&bucket->lock);
+
+    // Wakers change the word before they take the bucket lock, so reading it
+    // under the lock means a wake can't slip in between the check and the sleep.
+    // Read through the kernel's mapping of the frame so nothing can fault.
+    if (*(volatile uint32_t *)add_virtual_offset(key) != val) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return -1;
+    }
+
+    waiter.bucket = bucket;
+    waiter.next = bucket->head;
+    bucket->head = &waiter;
+    stats_inc(stat_waits);
+
+    // Block before arming the timer and dropping the lock, so neither wakeup
+    // is lost. A process that is exiting interrupts the sleep.
+    ktimer_t timer;
+    sched_set_blocked_interruptible();
+    if (timeout != NULL) {
+        timer_add(&timer, ticks, futex_timeout, waiter.task);
+    }
+    spin_unlock(&bucket->lock);
+    sched_yield();
+
+    if (timeout != NULL) {
+        timer_cancel(&timer);
+    }
+
+    // Still queued means the timer or an interruption woke us rather than FUTEX_WAKE
+    bucket = lock_waiter_bucket(&waiter);
+    if (bucket != NULL) {
+        bucket_remove(bucket, &waiter);
+        spin_unlock(&bucket->lock);
+        irq_restore(flags);
+        if (!waiter.task->interrupted) {
+            stats_inc(stat_timeouts);
+        }
+        return -1;
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+static long futex_wake(uint32_t *addr, uint32_t count) {
+    uintptr_t key = futex_key(addr);
+    if (key == 0) {
+        return -1;
+    }
+
+    futex_bucket_t *bucket = futex_bucket(key);
+    uint64_t flags = spin_lock_irqsave(&bucket->lock);
+    long woken = wake_locked(bucket, key, count);
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    stats_add(stat_wakes, woken);
+    return woken;
+}
+
+static long futex_requeue(uint32_t *addr, uint32_t count, uint32_t *addr2, uint32_t limit) {
+    uintptr_t key = futex_key(addr);
+    uintptr_t key2 = futex_key(addr2);
+    if (key == 0 || key2 == 0) {
+        return -1;
+    }
+
+    // Take both bucket locks in address order so two requeues can't deadlock
+    futex_bucket_t *from = futex_bucket(key);
+    futex_bucket_t *to = futex_bucket(key2);
+    futex_bucket_t *first = from < to ? from : to;
+    futex_bucket_t *second = from < to ? to : from;
+    uint64_t flags = spin_lock_irqsave(&first->lock);
+    if (second != first) {
+        spin_lock(&second->lock);
+    }
+
+    long woken = wake_locked(from, key, count);
+
+    // Move the rest to addr2 without waking them, so a broadcast wakes one
+    // task onto the mutex instead of all of them into a stampede
+    long moved = 0;
+    futex_waiter_t **link = &from->head;
+    while (*link != NULL && moved < limit) {
+        futex_waiter_t *waiter = *link;
+        if (waiter->key != key) {
+            link = &waiter->next;
+            continue;
+        }
+
+        waiter->key = key2;
+        moved++;
+        if (to == from) {
+            link = &waiter->next;
+            continue;
+        }
+        *link = waiter->next;
+        waiter->next = to->head;
+        to->head = waiter;
+        __atomic_store_n(&waiter->bucket, to, __ATOMIC_RELEASE);
+    }
+
+    if (second != first) {
+        spin_unlock(&second->lock);
+    }
+    spin_unlock_irqrestore(&first->lock, flags);
+
+    stats_add(stat_wakes, woken);
+    stats_add(stat_requeues, moved);
+    return woken + moved;
+}
+
+long futex(uint32_t *addr, int op, uint32_t val, const timespec_t *timeout, uint32_t *addr2,
+           uint32_t val2) {
+    switch (op) {
+        case FUTEX_WAIT:
+            return futex_wait(addr, val, timeout);
+        case FUTEX_WAKE:
+            return futex_wake(addr, val);
+        case FUTEX_REQUEUE:
+            return futex_requeue(addr, val, addr2, val2);
+        default:
+            return -1;
+    }
+}
@@ -5,15 +5,15 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "msr.h"
+#include "percpu.h"
+
 #define MAX_GDT_SIZE 256
 
-// Reserve space for a GDT that we'll fill in below
-uint8_t gdt[MAX_GDT_SIZE];
+// Reserve space for a GDT per CPU, since each CPU needs its own TSS descriptor
+uint8_t gdt[MAX_CPUS][MAX_GDT_SIZE];
 size_t gdt_size = 0;
 
-// Reserve space for interrupt handlers to use as a stack
-uint8_t interrupt_stack[0x8000];
-
 // Struct definition for a segment descriptor
 typedef struct seg_descriptor {
     uint16_t limit_0;
@@ -25,7 +25,7 @@ typedef struct seg_descriptor {
 } __attribute__((packed)) seg_descriptor_t;
 
 // Create a code descriptor at the specified offset
-void gdt_code_descriptor(uint16_t offset, bool user) {
+void gdt_code_descriptor(uint8_t* gdt, uint16_t offset, bool user) {
     // Get a pointer to the new descriptor
     seg_descriptor_t* d = (seg_descriptor_t*)&gdt[offset];
     if (gdt_size < offset + sizeof(seg_descriptor_t)) {
@@ -41,7 +41,7 @@ void gdt_code_descriptor(uint16_t offset, bool user) {
 }
 
 // Create a data descriptor at the specified offset
-void gdt_data_descriptor(uint16_t offset, bool user) {
+void gdt_data_descriptor(uint8_t* gdt, uint16_t offset, bool user) {
     // Get a pointer to the new descriptor
     seg_descriptor_t* d = (seg_descriptor_t*)&gdt[offset];
     if (gdt_size < offset + sizeof(seg_descriptor_t)) {
@@ -73,8 +73,8 @@ typedef struct tss {
     uint16_t iomap;
 } __attribute__((packed)) tss_t;
 
-// Declare a task state segment
-tss_t tss;
+// Declare a task state segment per CPU
+tss_t tss[MAX_CPUS];
 
 // Struct definition for a system descriptor
 typedef struct sys_descriptor {
@@ -88,7 +88,7 @@ typedef struct sys_descriptor {
 } __attribute__((packed)) sys_descriptor_t;
 
 // Create a TSS descriptor at the specified offset
-void gdt_tss_descriptor(uint16_t offset, tss_t* tss) {
+void gdt_tss_descriptor(uint8_t* gdt, uint16_t offset, tss_t* tss) {
     // Get a pointer to the descriptor
     sys_descriptor_t* d = (sys_descriptor_t*)&gdt[offset];
     if (gdt_size < offset + sizeof(sys_descriptor_t)) {
@@ -115,31 +115,60 @@ typedef struct gdt_record {
     void* base;
 } __attribute__((packed)) gdt_record_t;
 
-void gdt_setup() {
+void gdt_setup(size_t cpu) {
+    uint8_t* table = gdt[cpu];
+    tss_t* cpu_tss = &tss[cpu];
+
     // Zero out the gdt
-    memset(gdt, 0, sizeof(gdt));
+    memset(table, 0, MAX_GDT_SIZE);
 
     // Create the kernel code and data descriptors
-    gdt_code_descriptor(KERNEL_CODE_SELECTOR, false);
-    gdt_data_descriptor(KERNEL_DATA_SELECTOR, false);
+    gdt_code_descriptor(table, KERNEL_CODE_SELECTOR, false);
+    gdt_data_descriptor(table, KERNEL_DATA_SELECTOR, false);
 
     // Create the user code and data descriptors
-    gdt_code_descriptor(USER_CODE_SELECTOR, true);
-    gdt_data_descriptor(USER_DATA_SELECTOR, true);
+    gdt_code_descriptor(table, USER_CODE_SELECTOR, true);
+    gdt_data_descriptor(table, USER_DATA_SELECTOR, true);
+
+    // Nothing loads it, so only the limit matters
+    gdt_data_descriptor(table, CPU_NUMBER_SELECTOR, true);
+    seg_descriptor_t* cpu_number = (seg_descriptor_t*)&table[CPU_NUMBER_SELECTOR];
+    cpu_number->limit_0 = cpu;
+    cpu_number->limit_1 = cpu >> 16;
+
+    // Zero out the TSS. The scheduler points rsp0 at each task's kernel stack.
+    memset(cpu_tss, 0, sizeof(tss_t));
 
     // Create a TSS descriptor
-    gdt_tss_descriptor(TSS_SELECTOR, &tss);
+    gdt_tss_descriptor(table, TSS_SELECTOR, cpu_tss);
 
     // Load the GDT
-    gdt_record_t record = {.sz = gdt_size - 1, .base = gdt};
+    gdt_record_t record = {.sz = gdt_size - 1, .base = table};
     __asm__("lgdt %0" ::"m"(record));
 
-    // Zero out the TSS
-    memset(&tss, 0, sizeof(tss));
-
-    // Interrupts delivered while in user mode should use this stack pointer
-    tss.rsp0 = (uintptr_t)interrupt_stack + sizeof(interrupt_stack) - 8;
+    // Reload the segment registers from the new table
+    __asm__ volatile(
+        "pushq %0\n"
+        "leaq 1f(%%rip), %%rax\n"
+        "pushq %%rax\n"
+        "lretq\n"
+        "1:\n"
+        "mov %1, %%ds\n"
+        "mov %1, %%es\n"
+        "mov %1, %%ss\n" ::"i"(KERNEL_CODE_SELECTOR),
+        "r"((uint16_t)KERNEL_DATA_SELECTOR)
+        : "rax", "memory");
+
+    // %gs holds the user data selector, whose DPL of 3 keeps iretq from
+    // clearing it on the way to user mode. Loading it resets the base, so
+    // put back the pointer to this CPU's data afterwards. Entries from user
+    // mode swapgs it in from the kernel GS base, see src/interrupt_entry.s.
+    uint64_t gs_base = rdmsr(MSR_GS_BASE);
+    __asm__ volatile("mov %0, %%gs" ::"r"((uint16_t)(USER_DATA_SELECTOR | 0x3)));
+    wrmsr(MSR_GS_BASE, gs_base);
 
     // Load the TSS
     __asm__("ltr %%ax" ::"a"(TSS_SELECTOR));
 }
+
+void gdt_set_kernel_stack(uintptr_t rsp0) { tss[cpu_id()].rsp0 = rsp0; }
@@ -4,120 +4,196 @@
 
 #include "gdt.h"
 #include "keyboard.h"
-#include "kstdio.h"
+#include "klog.h"
+#include "mmap.h"
+#include "page.h"
 #include "pic.h"
 #include "port.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "syscall.h"
+#include "trace.h"
 #include "util.h"
 
 idt_entry_t idt[256];
 
-__attribute__((interrupt)) void divide_error_handler(interrupt_context_t *ctx) {
-    kprintf("divide error handler\n");
+// The entry stubs in src/interrupt_entry.s, 16 bytes apart, and the handler
+// each one calls
+#define INTERRUPT_STUB_SIZE 16
+extern const uint8_t interrupt_stubs[];
+extern void *idt_handlers[256];
+
+// The copy in src/user_copy.s that may fault on user memory, and where it
+// gives up
+extern const uint8_t user_copy_insn[];
+extern const uint8_t user_copy_fixup[];
+
+static stat_id_t stat_page_faults;
+
+// A fault in user mode ends the process that caused it, not the machine. On
+// the task's own kernel stack it may sleep, once interrupts are back on.
+static void user_fault(interrupt_context_t *ctx, const char *what, int signal) {
+    if (!(ctx->cs & 3)) {
+        return;
+    }
+    klog(KLOG_WARN, "%s in pid %d at %p, killed\n", what, sched_current()->pid, ctx->ip);
+    irq_restore(ctx->flags);
+    sys_exit(PROC_STATUS_SIGNALED(signal));
+}
+
+void divide_error_handler(interrupt_context_t *ctx) {
+    user_fault(ctx, "divide error", PROC_SIGFPE);
+    klog(KLOG_ERR, "divide error handler\n");
     halt();
 };
 
-__attribute__((interrupt)) void debug_exception_handler(interrupt_context_t *ctx) {
-    kprintf("debug exception handler\n");
+void debug_exception_handler(interrupt_context_t *ctx) {
+    user_fault(ctx, "debug exception", PROC_SIGTRAP);
+    klog(KLOG_ERR, "debug exception handler\n");
     halt();
 }
 
-__attribute__((interrupt)) void nonmaskable_interrupt_handler(interrupt_context_t *ctx) {
-    kprintf("nonmaskable interrupt handler\n");
+void nonmaskable_interrupt_handler(interrupt_context_t *ctx) {
+    klog(KLOG_ERR, "nonmaskable interrupt handler\n");
     halt();
 }
 
-__attribute__((interrupt)) void breakpoint_handler(interrupt_context_t *ctx) {
-    kprintf("breakpoint handler\n");
+void breakpoint_handler(interrupt_context_t *ctx) {
+    user_fault(ctx, "breakpoint", PROC_SIGTRAP);
+    klog(KLOG_ERR, "breakpoint handler\n");
     halt();
 };
 
-__attribute__((interrupt)) void overflow_handler(interrupt_context_t *ctx) {
-    kprintf("overflow handler\n");
+void overflow_handler(interrupt_context_t *ctx) {
+    user_fault(ctx, "overflow", PROC_SIGSEGV);
+    klog(KLOG_ERR, "overflow handler\n");
     halt();
 };
 
-__attribute__((interrupt)) void bound_range_exceeded_handler(interrupt_context_t *ctx) {
-    kprintf("BOUND range exceeded handler\n");
+void bound_range_exceeded_handler(interrupt_context_t *ctx) {
+    user_fault(ctx, "BOUND range exceeded", PROC_SIGSEGV);
+    klog(KLOG_ERR, "BOUND range exceeded handler\n");
     halt();
 };
 
-__attribute__((interrupt)) void invalid_opcode_handler(interrupt_context_t *ctx) {
-    kprintf("invalid opcode handler\n");
+void invalid_opcode_handler(interrupt_context_t *ctx) {
+    user_fault(ctx, "invalid opcode", PROC_SIGILL);
+    klog(KLOG_ERR, "invalid opcode handler\n");
     halt();
 }
 
-__attribute__((interrupt)) void device_not_available_handler(interrupt_context_t *ctx) {
-    kprintf("device not available handler\n");
+void device_not_available_handler(interrupt_context_t *ctx) {
+    user_fault(ctx, "device not available", PROC_SIGFPE);
+    klog(KLOG_ERR, "device not available handler\n");
     halt();
 }
 
-__attribute__((interrupt)) void double_fault_handler(interrupt_context_t *ctx, uint64_t ec) {
-    kprintf("double fault handler (ec=%d)\n", ec);
+void double_fault_handler(interrupt_context_t *ctx, uint64_t ec) {
+    klog(KLOG_ERR, "double fault handler (ec=%lu)\n", ec);
     halt();
 }
 
-__attribute__((interrupt)) void coprocessor_segment_overrun_handler(interrupt_context_t *ctx) {
-    kprintf("coprocessor segment overrun fault handler\n");
+void coprocessor_segment_overrun_handler(interrupt_context_t *ctx) {
+    klog(KLOG_ERR, "coprocessor segment overrun fault handler\n");
     halt();
 }
 
-__attribute__((interrupt)) void invalid_tss_handler(interrupt_context_t *ctx, uint64_t ec) {
-    kprintf("invalid TSS handler (ec=%d)\n", ec);
+void invalid_tss_handler(interrupt_context_t *ctx, uint64_t ec) {
+    klog(KLOG_ERR, "invalid TSS handler (ec=%lu)\n", ec);
     halt();
 }
 
-__attribute__((interrupt)) void segment_not_present_handler(interrupt_context_t *ctx, uint64_t ec) {
-    kprintf("segment not present handler (ec=%d)\n", ec);
+void segment_not_present_handler(interrupt_context_t *ctx, uint64_t ec) {
+    user_fault(ctx, "segment not present", PROC_SIGBUS);
+    klog(KLOG_ERR, "segment not present handler (ec=%lu)\n", ec);
     halt();
 }
 
-__attribute__((interrupt)) void stack_segment_fault_handler(interrupt_context_t *ctx, uint64_t ec) {
-    kprintf("stack segment fault handler (ec=%d)\n", ec);
+void stack_segment_fault_handler(interrupt_context_t *ctx, uint64_t ec) {
+    user_fault(ctx, "stack segment fault", PROC_SIGBUS);
+    klog(KLOG_ERR, "stack segment fault handler (ec=%lu)\n", ec);
     halt();
 }
 
-__attribute__((interrupt)) void general_protection_handler(interrupt_context_t *ctx, uint64_t ec) {
-    kprintf("general protection handler (ec=%d)\n", ec);
+void general_protection_handler(interrupt_context_t *ctx, uint64_t ec) {
+    user_fault(ctx, "general protection fault", PROC_SIGSEGV);
+    klog(KLOG_ERR, "general protection handler (ec=%lu)\n", ec);
     halt();
 }
 
-__attribute__((interrupt)) void page_fault_handler(interrupt_context_t *ctx, uint64_t ec) {
-    kprintf("page fault handler (ec=%d)\n", ec);
+void page_fault_handler(interrupt_context_t *ctx, uint64_t ec) {
+    stats_inc(stat_page_faults);
+    uintptr_t address = read_cr2();
+    TRACE(TRACE_PAGE_FAULT, address, ctx->ip);
+
+    // Lazily mapped file pages are the only faults that can be resolved
+    if (vm_fault(address, ec)) {
+        return;
+    }
+
+    // A copy to or from user memory fails instead
+    if (ctx->ip == (uintptr_t)user_copy_insn) {
+        ctx->ip = (uintptr_t)user_copy_fixup;
+        return;
+    }
+    user_fault(ctx, "page fault", PROC_SIGSEGV);
+
+    // Any other kernel access to user memory ends the process that made the
+    // syscall, unless interrupts were off, as then it may hold a lock
+    task_t *task = sched_current();
+    if (address < USER_HALF_END && (ctx->flags & 0x200) && task != NULL && task->pid != 0) {
+        klog(KLOG_WARN, "kernel page fault at %p in pid %d at %p, killed\n", address, task->pid,
+             ctx->ip);
+        irq_restore(ctx->flags);
+        sys_exit(PROC_STATUS_SIGNALED(PROC_SIGSEGV));
+    }
+
+    klog(KLOG_ERR, "page fault handler (ec=%lu, address=%p)\n", ec, address);
     halt();
 }
 
-__attribute__((interrupt)) void x87_fpu_floating_point_handler(interrupt_context_t *ctx) {
-    kprintf("x87 FPU floating point handler\n");
+void x87_fpu_floating_point_handler(interrupt_context_t *ctx) {
+    user_fault(ctx, "x87 FPU error", PROC_SIGFPE);
+    klog(KLOG_ERR, "x87 FPU floating point handler\n");
     halt();
 }
 
-__attribute__((interrupt)) void alignment_check_handler(interrupt_context_t *ctx, uint64_t ec) {
-    kprintf("alignment check handler (ec=%d)\n", ec);
+void alignment_check_handler(interrupt_context_t *ctx, uint64_t ec) {
+    user_fault(ctx, "alignment check", PROC_SIGBUS);
+    klog(KLOG_ERR, "alignment check handler (ec=%lu)\n", ec);
     halt();
 }
 
-__attribute__((interrupt)) void machine_check_handler(interrupt_context_t *ctx) {
-    kprintf("machine check handler\n");
+void machine_check_handler(interrupt_context_t *ctx) {
+    klog(KLOG_ERR, "machine check handler\n");
     halt();
 }
 
-__attribute__((interrupt)) void simd_floating_point_exception_handler(interrupt_context_t *ctx) {
-    kprintf("SIMD floating-point exception handler\n");
+void simd_floating_point_exception_handler(interrupt_context_t *ctx) {
+    user_fault(ctx, "SIMD floating-point exception", PROC_SIGFPE);
+    klog(KLOG_ERR, "SIMD floating-point exception handler\n");
     halt();
 }
 
-__attribute__((interrupt)) void virtualization_exception_handler(interrupt_context_t *ctx) {
-    kprintf("virtualization exception handler\n");
+void virtualization_exception_handler(interrupt_context_t *ctx) {
+    klog(KLOG_ERR, "virtualization exception handler\n");
     halt();
 }
 
-__attribute__((interrupt)) void control_protection_exception_handler_ec(interrupt_context_t *ctx,
-                                                                        uint64_t ec) {
-    kprintf("control protection exception handler (ec=%d)\n", ec);
+void control_protection_exception_handler_ec(interrupt_context_t *ctx, uint64_t ec) {
+    user_fault(ctx, "control protection exception", PROC_SIGSEGV);
+    klog(KLOG_ERR, "control protection exception handler (ec=%lu)\n", ec);
     halt();
 }
 
 void idt_set_handler(uint8_t index, void *fn, uint8_t type) {
+    idt_handlers[index] = fn;
+    idt_set_gate(index, (void *)(interrupt_stubs + index * INTERRUPT_STUB_SIZE), type,
+                 IDT_DPL_KERNEL);
+}
+
+void idt_set_gate(uint8_t index, void *fn, uint8_t type, uint8_t dpl) {
     // set offset for handler
     idt[index].offset_0 = (uint16_t)fn;
     uint64_t offset_1_mask = ((1 << 16) - 1) << 16;
@@ -126,7 +202,7 @@ void idt_set_handler(uint8_t index, void *fn, uint8_t type) {
 
     idt[index].type = type;
     idt[index].present = 1;  // the entry is present
-    idt[index].dpl = 3;      // run the handler in kernel mode
+    idt[index].dpl = dpl;    // an int instruction from a less privileged ring faults
     idt[index].ist = 0;      // not using an interrupt stack table
     idt[index].selector = KERNEL_CODE_SELECTOR;
 }
@@ -136,6 +212,8 @@ void idt_set_handler(uint8_t index, void *fn, uint8_t type) {
  * exceptions, and install the IDT.
  */
 void idt_setup() {
+    stat_page_faults = stats_register("vm.page_faults");
+
     // zero out the IDT
     memset(&idt, 0, sizeof(idt_entry_t) * 256);
 
@@ -143,8 +221,8 @@ void idt_setup() {
     idt_set_handler(0, divide_error_handler, IDT_TYPE_INTERRUPT);
     idt_set_handler(1, debug_exception_handler, IDT_TYPE_INTERRUPT);
     idt_set_handler(2, nonmaskable_interrupt_handler, IDT_TYPE_INTERRUPT);
-    idt_set_handler(3, breakpoint_handler, IDT_TYPE_TRAP);
-    idt_set_handler(4, overflow_handler, IDT_TYPE_TRAP);
+    idt_set_handler(3, breakpoint_handler, IDT_TYPE_INTERRUPT);
+    idt_set_handler(4, overflow_handler, IDT_TYPE_INTERRUPT);
     idt_set_handler(5, bound_range_exceeded_handler, IDT_TYPE_INTERRUPT);
     idt_set_handler(6, invalid_opcode_handler, IDT_TYPE_INTERRUPT);
     idt_set_handler(7, device_not_available_handler, IDT_TYPE_INTERRUPT);
@@ -162,11 +240,14 @@ void idt_setup() {
     idt_set_handler(20, virtualization_exception_handler, IDT_TYPE_INTERRUPT);
     idt_set_handler(21, control_protection_exception_handler_ec, IDT_TYPE_INTERRUPT);
 
-    // set up the handler for pic
+    // set up the handler for the keyboard IRQ, routed by keyboard_init
     idt_set_handler(IRQ1_INTERRUPT, &keyboard_handler, IDT_TYPE_INTERRUPT);
-    pic_unmask_irq(1);
 
     // Step 3: Install the IDT
+    idt_load();
+}
+
+void idt_load() {
     idt_record_t record = {.size = sizeof(idt), .base = idt};
     __asm__("lidt %0" ::"m"(record));
 }
\ No newline at end of file
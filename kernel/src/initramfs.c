@@ -0,0 +1,163 @@
+#include "initramfs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "debug.h"
+#include "klog.h"
+#include "vfs.h"
+
+#define TAR_BLOCK_SIZE 512
+
+// Entry types that matter here, others are skipped
+#define TAR_TYPE_FILE '0'
+#define TAR_TYPE_FILE_OLD '\0'
+#define TAR_TYPE_DIR '5'
+
+// A POSIX ustar header
+typedef struct tar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char linkname[100];
+    char magic[6];  // "ustar\0"
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char _unused[12];
+} __attribute__((packed)) tar_header_t;
+
+// Parse a NUL- or space-terminated octal field
+static uint64_t parse_octal(const char *field, size_t len) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+// Length of a string field that may fill its whole width without a terminator
+static size_t field_len(const char *field, size_t width) {
+    size_t len = 0;
+    while (len < width && field[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+// Create every directory along path and the entry at its end
+static bool add_entry(const char *path, uint32_t mode, const uint8_t *data, size_t size) {
+    dentry_t *dir = vfs_root();
+    char name[VFS_NAME_MAX];
+
+    while (*path != '\0') {
+        while (*path == '/') {
+            path++;
+        }
+        const char *start = path;
+        while (*path != '\0' && *path != '/') {
+            path++;
+        }
+        size_t len = path - start;
+        while (*path == '/') {
+            path++;
+        }
+        if (len == 0 || (len == 1 && start[0] == '.')) {
+            continue;
+        }
+
+        len = len < VFS_NAME_MAX - 1 ? len : VFS_NAME_MAX - 1;
+        memcpy(name, start, len);
+        name[len] = '\0';
+
+        // Intermediate components are directories, even if the archive
+        // doesn't list them before their contents
+        bool last = *path == '\0';
+        dir = last ? vfs_create(dir, name, mode, data, size)
+                   : vfs_create(dir, name, VFS_S_IFDIR | 0755, NULL, 0);
+        if (dir == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool initramfs_init(struct stivale2_struct_tag_modules *modules) {
+    const uint8_t *archive = NULL;
+    size_t size = 0;
+    for (uint64_t i = 0; i < modules->module_count; i++) {
+        struct stivale2_module module = modules->modules[i];
+        if (strcmp(module.string, "initramfs") == 0) {
+            archive = (const uint8_t *)module.begin;
+            size = module.end - module.begin;
+            break;
+        }
+    }
+    if (archive == NULL) {
+        klog(KLOG_WARN, "initramfs: no initramfs module\n");
+        return false;
+    }
+
+    size_t offset = 0;
+    size_t files = 0;
+    while (offset + TAR_BLOCK_SIZE <= size) {
+        const tar_header_t *header = (const tar_header_t *)(archive + offset);
+
+        // The archive ends with zero blocks
+        if (header->name[0] == '\0') {
+            break;
+        }
+        if (memcmp(header->magic, "ustar", 5) != 0) {
+            klog(KLOG_WARN, "initramfs: bad header at offset %lu\n", offset);
+            return false;
+        }
+
+        uint64_t file_size = parse_octal(header->size, sizeof(header->size));
+        uint32_t perms = parse_octal(header->mode, sizeof(header->mode)) & 07777;
+        const uint8_t *data = archive + offset + TAR_BLOCK_SIZE;
+        if (data + file_size > archive + size) {
+            klog(KLOG_WARN, "initramfs: %s runs past the end of the archive\n", header->name);
+            return false;
+        }
+
+        // Long names are split between prefix and name
+        char path[sizeof(header->prefix) + sizeof(header->name) + 2];
+        size_t len = field_len(header->prefix, sizeof(header->prefix));
+        memcpy(path, header->prefix, len);
+        if (len > 0) {
+            path[len++] = '/';
+        }
+        size_t name_len = field_len(header->name, sizeof(header->name));
+        memcpy(path + len, header->name, name_len);
+        path[len + name_len] = '\0';
+
+        bool ok = true;
+        if (header->type == TAR_TYPE_FILE || header->type == TAR_TYPE_FILE_OLD) {
+            ok = add_entry(path, VFS_S_IFREG | perms, data, file_size);
+            files++;
+        } else if (header->type == TAR_TYPE_DIR) {
+            ok = add_entry(path, VFS_S_IFDIR | perms, NULL, 0);
+        }
+        if (!ok) {
+            klog(KLOG_WARN, "initramfs: can't add %s\n", path);
+        }
+
+        debugf("initramfs: %s (%lu bytes)\n", path, file_size);
+
+        // File data is padded to whole blocks
+        size_t blocks = (file_size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE;
+        offset += (1 + blocks) * TAR_BLOCK_SIZE;
+    }
+
+    klog(KLOG_INFO, "initramfs: %lu files\n", files);
+    return true;
+}
@@ -0,0 +1,77 @@
+# Entry code for every vector installed with idt_set_handler. The stub for
+# vector N is at interrupt_stubs + N * 16. It pushes an error code (a zero
+# where the CPU doesn't push one) and its vector, and the common path calls
+# idt_handlers[vector] as handler(interrupt_context_t *ctx, uint64_t ec).
+#
+# The GS base holds this CPU's cpu_t only while in the kernel. Coming from
+# user mode, swapgs trades the user's GS base for it before any C code runs,
+# and trades it back on the way out.
+
+.global interrupt_stubs
+.global idt_handlers
+
+.section .text
+
+.balign 16
+interrupt_stubs:
+.set vector, 0
+.rept 256
+  .balign 16
+  # Vectors the CPU pushes an error code for
+  .if !(vector == 8 || (vector >= 10 && vector <= 14) || vector == 17 || vector == 21 || vector == 29 || vector == 30)
+  pushq $0
+  .endif
+  pushq $vector
+  jmp interrupt_common
+  .set vector, vector + 1
+.endr
+
+# The stack holds the vector, the error code and then the CPU's frame
+interrupt_common:
+  testb $3, 24(%rsp)
+  jz 1f
+  swapgs
+1:
+  # Save the registers a C function may clobber. The CPU's frame is 16-byte
+  # aligned, so with the two words above this keeps the call aligned too.
+  push %rax
+  push %rcx
+  push %rdx
+  push %rsi
+  push %rdi
+  push %r8
+  push %r9
+  push %r10
+  push %r11
+  cld
+
+  # Leave %rbp alone, so handlers find the interrupted frame pointer through
+  # their own frame
+  mov 72(%rsp), %rax
+  mov 80(%rsp), %rsi
+  lea 88(%rsp), %rdi
+  call *idt_handlers(, %rax, 8)
+
+  pop %r11
+  pop %r10
+  pop %r9
+  pop %r8
+  pop %rdi
+  pop %rsi
+  pop %rdx
+  pop %rcx
+  pop %rax
+  add $16, %rsp
+
+  # An interrupt between swapgs and iretq would run with the user's GS base
+  testb $3, 8(%rsp)
+  jz 2f
+  cli
+  swapgs
+2:
+  iretq
+
+.section .bss
+.balign 8
+idt_handlers:
+  .skip 256 * 8
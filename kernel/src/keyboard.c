@@ -1,8 +1,14 @@
+#include "apic.h"
 #include "idt.h"
 #include "kstdio.h"
+#include "percpu.h"
 #include "pic.h"
 #include "port.h"
+#include "sched.h"
+#include "stats.h"
 #include "stdbool.h"
+#include "trace.h"
+#include "workqueue.h"
 
 #define BUFFER_SIZE 32
 
@@ -38,9 +44,45 @@ volatile bool lshift_pressed = false;
 volatile bool rshift_pressed = false;
 volatile bool capslock_pressed = false;
 
-__attribute__((interrupt)) void keyboard_handler(interrupt_context_t *ctx) {
-    uint8_t scancode = inb(0x60);  // read a keyboard scan code
+// tasks waiting for input, also guards the buffer
+static wait_queue_t input_wait = WAIT_QUEUE_INIT;
+
+// Scan codes the interrupt handler has read but not yet translated
+static uint8_t scancodes[BUFFER_SIZE];
+static size_t scancodes_start = 0;
+static size_t scancodes_count = 0;
+static spinlock_t scancodes_lock = SPINLOCK_INIT;
+
+static void translate_scancodes(void *arg);
+static work_t translate_work = WORK_INIT(translate_scancodes, NULL);
 
+static stat_id_t stat_scancodes;
+static stat_id_t stat_drops;
+
+void keyboard_init() {
+    stat_scancodes = stats_register("keyboard.scancodes");
+    stat_drops = stats_register("keyboard.drops");
+
+    // Deliver key presses to the CPU running this
+    ioapic_route_irq(1, IRQ1_INTERRUPT, this_cpu()->lapic_id);
+}
+
+void keyboard_inject(char c) {
+    // add to buffer when it is not full
+    uint64_t flags = spin_lock_irqsave(&input_wait.lock);
+    if (buffer_count < BUFFER_SIZE) {
+        buffer[buffer_end] = c;
+        buffer_end = (buffer_end + 1) % BUFFER_SIZE;
+        buffer_count += 1;
+    } else {
+        stats_inc(stat_drops);
+    }
+    spin_unlock_irqrestore(&input_wait.lock, flags);
+    wake_up(&input_wait);
+}
+
+// Track the modifiers and turn a scan code into input
+static void translate_scancode(uint8_t scancode) {
     switch (scancode) {
         case 0x2A:  // left shift pressed
             lshift_pressed = true;
@@ -62,22 +104,58 @@ __attribute__((interrupt)) void keyboard_handler(interrupt_context_t *ctx) {
             if (scancode > 0x58) {
                 break;
             }
-            // add to buffer when it is not full
-            if (buffer_count < BUFFER_SIZE) {
-                buffer[buffer_end] = (lshift_pressed || rshift_pressed || capslock_pressed)
-                                         ? upper_scancode_table[scancode]
-                                         : scancode_table[scancode];
-                buffer_end = (buffer_end + 1) % BUFFER_SIZE;
-                buffer_count += 1;
-            }
+            keyboard_inject((lshift_pressed || rshift_pressed || capslock_pressed)
+                                ? upper_scancode_table[scancode]
+                                : scancode_table[scancode]);
     }
+}
+
+// Bottom half of the interrupt handler, run by this CPU's worker
+static void translate_scancodes(void *arg) {
+    while (true) {
+        uint64_t flags = spin_lock_irqsave(&scancodes_lock);
+        if (scancodes_count == 0) {
+            spin_unlock_irqrestore(&scancodes_lock, flags);
+            return;
+        }
+        uint8_t scancode = scancodes[scancodes_start];
+        scancodes_start = (scancodes_start + 1) % BUFFER_SIZE;
+        scancodes_count--;
+        spin_unlock_irqrestore(&scancodes_lock, flags);
+
+        translate_scancode(scancode);
+    }
+}
 
-    outb(PIC1_COMMAND, PIC_EOI);  // end of interrupt message
+void keyboard_handler(interrupt_context_t *ctx) {
+    uint8_t scancode = inb(0x60);  // read a keyboard scan code
+    stats_inc(stat_scancodes);
+    TRACE(TRACE_IRQ, IRQ1_INTERRUPT, scancode);
+
+    // Only stash the scan code here and translate it in task context
+    spin_lock(&scancodes_lock);
+    if (scancodes_count < BUFFER_SIZE) {
+        scancodes[(scancodes_start + scancodes_count) % BUFFER_SIZE] = scancode;
+        scancodes_count++;
+    } else {
+        stats_inc(stat_drops);
+    }
+    spin_unlock(&scancodes_lock);
+    queue_work(&translate_work);
+
+    lapic_eoi();  // end of interrupt message
 }
 
-char kgetc() {
-    // wait for new input in the buffer
+int kgetc() {
+    uint64_t flags = spin_lock_irqsave(&input_wait.lock);
+
+    // sleep until there is new input in the buffer
     while (buffer_count == 0) {
+        if (sched_current()->interrupted) {
+            spin_unlock_irqrestore(&input_wait.lock, flags);
+            return -1;
+        }
+        wait_queue_sleep(&input_wait);
     }
 
     // move buffer start to next pos
@@ -85,5 +163,6 @@ char kgetc() {
     buffer_start = (buffer_start + 1) % BUFFER_SIZE;
     buffer_count -= 1;
 
+    spin_unlock_irqrestore(&input_wait.lock, flags);
     return rtr;
 }
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include "klog.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "clock.h"
+#include "kstdio.h"
+#include "page.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "workqueue.h"
+
+// One slot of the ring. seq is 0 while a writer owns the slot, and the
+// record's position + 1 once it is complete.
+typedef struct klog_record {
+    volatile uint64_t seq;
+    uint64_t ns;
+    uint16_t cpu;
+    uint8_t level;
+    uint8_t len;
+    char text[KLOG_TEXT_MAX];
+} klog_record_t;
+
+static klog_record_t ring[KLOG_RECORDS];
+
+// Position of the next record to be claimed. Writers claim a slot with one
+// atomic add and never wait for each other.
+static volatile uint64_t head = 0;
+
+// Position of the next record for the console. Only the drainer moves it.
+static uint64_t console_tail = 0;
+static spinlock_t drain_lock = SPINLOCK_INIT;
+
+// The CPU holding drain_lock, so klog_flush never waits on itself from an
+// interrupt that landed mid-drain. -1 when nobody holds it.
+static volatile int drain_owner = -1;
+
+// How long klog_flush waits for another CPU to finish writing a record, in
+// pause iterations, in case that CPU has stopped for good
+#define FLUSH_WAIT_SPINS 1000000
+
+volatile int klog_level = KLOG_DEFAULT_LEVEL;
+
+static const char level_tags[] = {'E', 'W', 'I', 'D'};
+
+static stat_id_t stat_records;
+static stat_id_t stat_dropped;
+
+void klog_init() {
+    stat_records = stats_register("klog.records");
+    stat_dropped = stats_register("klog.dropped");
+}
+
+int vklog(int level, const char *format, va_list args) {
+    if (level > klog_level) {
+        return 0;
+    }
+
+    uint64_t pos = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    klog_record_t *record = &ring[pos % KLOG_RECORDS];
+
+    // Claim the slot so readers skip it until it is complete
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->ns = clock_monotonic_ns();
+    record->cpu = cpu_id();
+    record->level = level;
+    int len = kvsnprintf(record->text, KLOG_TEXT_MAX, format, args);
+    record->len = len < KLOG_TEXT_MAX ? len : KLOG_TEXT_MAX - 1;
+
+    // Publish
+    __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+    stats_inc(stat_records);
+
+    // The caller may be about to halt, so errors can't wait for a drain
+    if (level == KLOG_ERR) {
+        klog_flush();
+    }
+    return len;
+}
+
+void klog(int level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vklog(level, format, args);
+    va_end(args);
+}
+
+// Copy out the record at pos. Returns false if it isn't there: either still
+// being written, or already overwritten by a later record.
+static bool read_record(uint64_t pos, klog_record_t *out) {
+    klog_record_t *record = &ring[pos % KLOG_RECORDS];
+    if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+        return false;
+    }
+
+    memcpy(out, record, sizeof(klog_record_t));
+
+    // A writer may have reclaimed the slot while we copied
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&record->seq, __ATOMIC_RELAXED) == pos + 1;
+}
+
+// The oldest position still in the ring
+static uint64_t oldest(uint64_t end) { return end > KLOG_RECORDS ? end - KLOG_RECORDS : 0; }
+
+bool klog_pending() { return console_tail != __atomic_load_n(&head, __ATOMIC_ACQUIRE); }
+
+// Write records up to head to the console, with drain_lock held. If wait is
+// set, records still being written are waited for rather than left for later.
+static void drain_locked(bool wait) {
+    drain_owner = cpu_id();
+    uint64_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (console_tail < oldest(end)) {
+        stats_add(stat_dropped, oldest(end) - console_tail);
+        console_tail = oldest(end);
+    }
+
+    klog_record_t record;
+    size_t spins = 0;
+    while (console_tail < end) {
+        if (!read_record(console_tail, &record)) {
+            // Stop at a record still being written, it goes out next time.
+            // Anything newer in the slot means ours was overwritten.
+            klog_record_t *slot = &ring[console_tail % KLOG_RECORDS];
+            uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            if (seq < console_tail + 1) {
+                if (wait && spins++ < FLUSH_WAIT_SPINS) {
+                    __asm__ volatile("pause");
+                    continue;
+                }
+                break;
+            }
+            stats_inc(stat_dropped);
+        } else {
+            kwrite(record.text, record.len);
+        }
+        console_tail++;
+    }
+
+    drain_owner = -1;
+}
+
+void klog_drain() {
+    if (!spin_trylock(&drain_lock)) {
+        return;
+    }
+    drain_locked(false);
+    spin_unlock(&drain_lock);
+}
+
+void klog_flush() {
+    // Interrupted in the middle of our own drain, which can't be waited for.
+    // It picks up the new records once the interrupt returns.
+    if (drain_owner == (int)cpu_id()) {
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&drain_lock);
+    drain_locked(true);
+    spin_unlock_irqrestore(&drain_lock, flags);
+}
+
+static void drain_work_fn(void *arg) { klog_drain(); }
+
+static work_t drain_work = WORK_INIT(drain_work_fn, NULL);
+
+void klog_drain_later() {
+    if (klog_pending()) {
+        queue_work(&drain_work);
+    }
+}
+
+int64_t klog_read(char *buf, size_t size) {
+    uint64_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    size_t used = 0;
+    bool line_start = true;
+
+    klog_record_t record;
+    for (uint64_t pos = oldest(end); pos < end; pos++) {
+        if (!read_record(pos, &record)) {
+            continue;
+        }
+
+        // Records that continue a line don't get their own prefix
+        char prefix[32];
+        size_t prefix_len = 0;
+        if (line_start) {
+            prefix_len = ksnprintf(prefix, sizeof(prefix), "[%5lu.%06lu] %c ",
+                                   record.ns / NS_PER_SEC, record.ns % NS_PER_SEC / 1000,
+                                   level_tags[record.level]);
+        }
+        if (used + prefix_len + record.len > size) {
+            break;
+        }
+
+        if (!copy_to_user(buf + used, prefix, prefix_len) ||
+            !copy_to_user(buf + used + prefix_len, record.text, record.len)) {
+            return -1;
+        }
+        used += prefix_len + record.len;
+        line_start = record.len > 0 && record.text[record.len - 1] == '\n';
+    }
+
+    return used;
+}
@@ -0,0 +1,445 @@
+#include "kmalloc.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "klog.h"
+#include "page.h"
+#include "percpu.h"
+#include "spinlock.h"
+
+#define KMEM_MAX_CACHES 32
+#define KMEM_DEFAULT_ALIGN 8
+
+// Objects each CPU keeps on hand, sized so a per-CPU cache fills two cache lines
+#define KMEM_CPU_CACHE_SIZE 13
+// Objects moved between a CPU cache and the slabs at a time
+#define KMEM_CPU_BATCH 6
+
+// Debug mode guards each object with red zones and poisons it while free
+#define KMEM_REDZONE_SIZE 8
+#define KMEM_REDZONE_PATTERN 0xBBBBBBBBBBBBBBBBULL
+#define KMEM_POISON 0x6B
+
+#define SLAB_MAGIC 0x51AB51AB
+
+#define ALIGN_UP(x, y) (((x) + (y)-1) & ~((y)-1))
+
+// Header at the start of every slab page, followed by the object slots
+typedef struct slab {
+    kmem_cache_t *cache;
+    struct slab *next;
+    struct slab *prev;
+    void *free;       // first free slot
+    uint32_t in_use;  // slots handed out of this slab
+    uint32_t magic;
+} slab_t;
+
+// Objects cached by one CPU, so most allocations take no lock
+typedef struct kmem_cpu_cache {
+    uint32_t avail;
+    uint32_t _unused;
+    uint64_t allocs;
+    uint64_t frees;
+    void *objects[KMEM_CPU_CACHE_SIZE];
+} __cacheline_aligned kmem_cpu_cache_t;
+
+struct kmem_cache {
+    kmem_cpu_cache_t cpu[MAX_CPUS];
+
+    spinlock_t lock;  // protects the slab lists and counts below
+    const char *name;
+    kmem_ctor_t ctor;
+    size_t size;          // object size requested by the creator
+    size_t stride;        // distance between slots
+    size_t first_offset;  // offset of the first slot from the slab header
+    size_t obj_offset;    // offset of the object within its slot
+    size_t link_offset;   // offset of the free-list link within its slot
+    size_t per_slab;      // slots per slab
+
+    // Slabs with some, no, and all slots free
+    slab_t *partial;
+    slab_t *full;
+    slab_t *empty;
+    size_t slabs;
+};
+
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+static size_t cache_count = 0;
+static spinlock_t caches_lock = SPINLOCK_INIT;
+
+// Size classes served by kmalloc
+static const size_t kmalloc_sizes[] = {8, 16, 32, 64, 96, 128, 192, 256, 512, 1024, 2048};
+static const char *kmalloc_names[] = {"kmalloc-8",   "kmalloc-16",  "kmalloc-32",   "kmalloc-64",
+                                      "kmalloc-96",  "kmalloc-128", "kmalloc-192",  "kmalloc-256",
+                                      "kmalloc-512", "kmalloc-1024", "kmalloc-2048"};
+#define KMALLOC_CLASSES (sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+static kmem_cache_t *kmalloc_caches[KMALLOC_CLASSES];
+
+// Find the slab holding an object. Slabs are single pages, so this is a mask.
+static inline slab_t *slab_of(void *obj) { return (slab_t *)((uintptr_t)obj & ~(PAGE_SIZE - 1)); }
+
+static inline void *slot_link(kmem_cache_t *cache, void *slot) {
+    return *(void **)((uintptr_t)slot + cache->link_offset);
+}
+
+static inline void set_slot_link(kmem_cache_t *cache, void *slot, void *next) {
+    *(void **)((uintptr_t)slot + cache->link_offset) = next;
+}
+
+static inline void *slot_to_obj(kmem_cache_t *cache, void *slot) {
+    return (void *)((uintptr_t)slot + cache->obj_offset);
+}
+
+static inline void *obj_to_slot(kmem_cache_t *cache, void *obj) {
+    return (void *)((uintptr_t)obj - cache->obj_offset);
+}
+
+// Unlink a slab from one of the cache's lists
+static void list_remove(slab_t **list, slab_t *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = slab->prev = NULL;
+}
+
+// Push a slab onto the front of one of the cache's lists
+static void list_push(slab_t **list, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+#if KMEM_DEBUG
+// Write the red zones on either side of an object
+static void redzone_set(kmem_cache_t *cache, void *obj) {
+    *(uint64_t *)((uintptr_t)obj - KMEM_REDZONE_SIZE) = KMEM_REDZONE_PATTERN;
+    *(uint64_t *)((uintptr_t)obj + cache->size) = KMEM_REDZONE_PATTERN;
+}
+
+// Report any write that strayed past either end of an object
+static void redzone_check(kmem_cache_t *cache, void *obj) {
+    if (*(uint64_t *)((uintptr_t)obj - KMEM_REDZONE_SIZE) != KMEM_REDZONE_PATTERN) {
+        klog(KLOG_ERR, "kmem: %s: red zone before %p overwritten\n", cache->name, obj);
+    }
+    if (*(uint64_t *)((uintptr_t)obj + cache->size) != KMEM_REDZONE_PATTERN) {
+        klog(KLOG_ERR, "kmem: %s: red zone after %p overwritten\n", cache->name, obj);
+    }
+}
+
+// Report any write to an object while it sat free
+static void poison_check(kmem_cache_t *cache, void *obj) {
+    uint8_t *bytes = obj;
+    for (size_t i = 0; i < cache->size; i++) {
+        if (bytes[i] != KMEM_POISON) {
+            klog(KLOG_ERR, "kmem: %s: %p modified after free (offset %zu)\n", cache->name, obj, i);
+            return;
+        }
+    }
+}
+#endif
+
+// Carve a new page into a slab of free slots. Called with the cache lock held.
+static slab_t *slab_create(kmem_cache_t *cache) {
+    uintptr_t page = pmem_alloc();
+    if (page == 0) {
+        return NULL;
+    }
+
+    slab_t *slab = (slab_t *)add_virtual_offset(page);
+    slab->cache = cache;
+    slab->next = slab->prev = NULL;
+    slab->in_use = 0;
+    slab->magic = SLAB_MAGIC;
+
+    // Thread every slot onto the free list, lowest address first
+    slab->free = NULL;
+    for (size_t i = cache->per_slab; i > 0; i--) {
+        void *slot = (void *)((uintptr_t)slab + cache->first_offset + (i - 1) * cache->stride);
+        void *obj = slot_to_obj(cache, slot);
+
+#if KMEM_DEBUG
+        redzone_set(cache, obj);
+        if (cache->ctor == NULL) {
+            memset(obj, KMEM_POISON, cache->size);
+        }
+#endif
+        if (cache->ctor != NULL) {
+            cache->ctor(obj);
+        }
+
+        set_slot_link(cache, slot, slab->free);
+        slab->free = slot;
+    }
+
+    cache->slabs++;
+    return slab;
+}
+
+// Return an empty slab's page to the frame allocator. Called with the cache lock held.
+static void slab_destroy(kmem_cache_t *cache, slab_t *slab) {
+    slab->magic = 0;
+    cache->slabs--;
+    pmem_free(sub_virtual_offset((uintptr_t)slab));
+}
+
+// Move up to count objects from the slabs into a CPU cache
+static void cache_refill(kmem_cache_t *cache, kmem_cpu_cache_t *cpu, size_t count) {
+    spin_lock(&cache->lock);
+
+    while (count > 0) {
+        // Prefer partially used slabs to keep the working set dense
+        slab_t *slab = cache->partial;
+        if (slab == NULL) {
+            slab = cache->empty;
+            if (slab != NULL) {
+                list_remove(&cache->empty, slab);
+            } else {
+                slab = slab_create(cache);
+                if (slab == NULL) {
+                    break;
+                }
+            }
+            list_push(&cache->partial, slab);
+        }
+
+        // Take as many objects from this slab as we need
+        while (count > 0 && slab->free != NULL) {
+            void *slot = slab->free;
+            slab->free = slot_link(cache, slot);
+            slab->in_use++;
+            cpu->objects[cpu->avail++] = slot_to_obj(cache, slot);
+            count--;
+        }
+
+        if (slab->free == NULL) {
+            list_remove(&cache->partial, slab);
+            list_push(&cache->full, slab);
+        }
+    }
+
+    spin_unlock(&cache->lock);
+}
+
+// Return the count oldest objects in a CPU cache to their slabs
+static void cache_flush(kmem_cache_t *cache, kmem_cpu_cache_t *cpu, size_t count) {
+    spin_lock(&cache->lock);
+
+    for (size_t i = 0; i < count; i++) {
+        void *obj = cpu->objects[i];
+        void *slot = obj_to_slot(cache, obj);
+        slab_t *slab = slab_of(obj);
+
+        if (slab->free == NULL) {
+            list_remove(&cache->full, slab);
+            list_push(&cache->partial, slab);
+        }
+
+        set_slot_link(cache, slot, slab->free);
+        slab->free = slot;
+        slab->in_use--;
+
+        // Keep a single empty slab around and give the rest back
+        if (slab->in_use == 0) {
+            list_remove(&cache->partial, slab);
+            if (cache->empty == NULL) {
+                list_push(&cache->empty, slab);
+            } else {
+                slab_destroy(cache, slab);
+            }
+        }
+    }
+
+    spin_unlock(&cache->lock);
+
+    // Slide the remaining (most recently freed, so cache-hot) objects down
+    cpu->avail -= count;
+    for (size_t i = 0; i < cpu->avail; i++) {
+        cpu->objects[i] = cpu->objects[i + count];
+    }
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor) {
+    if (align == 0) {
+        align = KMEM_DEFAULT_ALIGN;
+    }
+    if (size == 0 || size > KMALLOC_MAX_SLAB_SIZE || (align & (align - 1)) != 0 ||
+        align > PAGE_SIZE / 8) {
+        return NULL;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&caches_lock);
+    if (cache_count == KMEM_MAX_CACHES) {
+        spin_unlock_irqrestore(&caches_lock, flags);
+        klog(KLOG_ERR, "kmem: too many caches, cannot create %s\n", name);
+        return NULL;
+    }
+    kmem_cache_t *cache = &caches[cache_count++];
+    spin_unlock_irqrestore(&caches_lock, flags);
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    cache->name = name;
+    cache->ctor = ctor;
+    cache->size = size;
+
+    // Lay out a slot: [red zone] object [red zone] [free-list link]
+    size_t slot_end;
+#if KMEM_DEBUG
+    cache->obj_offset = align > KMEM_REDZONE_SIZE ? align : KMEM_REDZONE_SIZE;
+    slot_end = cache->obj_offset + size + KMEM_REDZONE_SIZE;
+#else
+    cache->obj_offset = 0;
+    slot_end = size;
+#endif
+
+    // The link can share space with a free object, unless a constructor has
+    // initialized it or debug mode is watching its contents
+    if (ctor != NULL || KMEM_DEBUG) {
+        cache->link_offset = ALIGN_UP(slot_end, sizeof(void *));
+        slot_end = cache->link_offset + sizeof(void *);
+    } else {
+        cache->link_offset = cache->obj_offset;
+        slot_end = slot_end > sizeof(void *) ? slot_end : sizeof(void *);
+    }
+
+    cache->stride = ALIGN_UP(slot_end, align);
+    cache->first_offset = ALIGN_UP(sizeof(slab_t), align);
+    cache->per_slab = (PAGE_SIZE - cache->first_offset) / cache->stride;
+
+    return cache;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    uint64_t flags = irq_save();
+    kmem_cpu_cache_t *cpu = &cache->cpu[cpu_id()];
+
+    if (cpu->avail == 0) {
+        cache_refill(cache, cpu, KMEM_CPU_BATCH);
+        if (cpu->avail == 0) {
+            irq_restore(flags);
+            return NULL;
+        }
+    }
+
+    void *obj = cpu->objects[--cpu->avail];
+    cpu->allocs++;
+    irq_restore(flags);
+
+#if KMEM_DEBUG
+    redzone_check(cache, obj);
+    if (cache->ctor == NULL) {
+        poison_check(cache, obj);
+    }
+#endif
+
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+#if KMEM_DEBUG
+    slab_t *slab = slab_of(obj);
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache) {
+        klog(KLOG_ERR, "kmem: %s: freeing %p, which is not from this cache\n", cache->name, obj);
+        return;
+    }
+    redzone_check(cache, obj);
+    if (cache->ctor == NULL) {
+        memset(obj, KMEM_POISON, cache->size);
+    }
+#endif
+
+    uint64_t flags = irq_save();
+    kmem_cpu_cache_t *cpu = &cache->cpu[cpu_id()];
+
+    if (cpu->avail == KMEM_CPU_CACHE_SIZE) {
+        cache_flush(cache, cpu, KMEM_CPU_BATCH);
+    }
+
+    cpu->objects[cpu->avail++] = obj;
+    cpu->frees++;
+    irq_restore(flags);
+}
+
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats) {
+    stats->name = cache->name;
+    stats->object_size = cache->size;
+    stats->stride = cache->stride;
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    stats->slabs = cache->slabs;
+    spin_unlock_irqrestore(&cache->lock, flags);
+    stats->objects = stats->slabs * cache->per_slab;
+
+    stats->allocs = 0;
+    stats->frees = 0;
+    for (size_t i = 0; i < MAX_CPUS; i++) {
+        stats->allocs += cache->cpu[i].allocs;
+        stats->frees += cache->cpu[i].frees;
+    }
+    stats->in_use = stats->allocs - stats->frees;
+}
+
+void kmem_cache_foreach(void (*fn)(const kmem_cache_stats_t *stats)) {
+    for (size_t i = 0; i < cache_count; i++) {
+        kmem_cache_stats_t stats;
+        kmem_cache_get_stats(&caches[i], &stats);
+        fn(&stats);
+    }
+}
+
+void kmalloc_init() {
+    for (size_t i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], kmalloc_sizes[i], 0, NULL);
+    }
+}
+
+void *kmalloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < KMALLOC_CLASSES; i++) {
+        if (size <= kmalloc_sizes[i]) {
+            return kmem_cache_alloc(kmalloc_caches[i]);
+        }
+    }
+
+    // Too big for a slab, so hand out a whole frame. Slab objects never start
+    // on a page boundary, which is how kfree tells the two apart.
+    if (size <= PAGE_SIZE) {
+        uintptr_t page = pmem_alloc();
+        return page == 0 ? NULL : (void *)add_virtual_offset(page);
+    }
+
+    return NULL;
+}
+
+void *kzalloc(size_t size) {
+    void *ptr = kmalloc(size);
+    if (ptr != NULL) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void kfree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    if (((uintptr_t)ptr & (PAGE_SIZE - 1)) == 0) {
+        pmem_free(sub_virtual_offset((uintptr_t)ptr));
+        return;
+    }
+
+    slab_t *slab = slab_of(ptr);
+    kmem_cache_free(slab->cache, ptr);
+}
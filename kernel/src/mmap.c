@@ -0,0 +1,262 @@
+#include "mmap.h"
+
+#include <string.h>
+
+#include "kmalloc.h"
+#include "page.h"
+#include "pagecache.h"
+#include "sched.h"
+#include "stats.h"
+#include "tlb.h"
+
+static stat_id_t stat_file_faults;
+static stat_id_t stat_cow_faults;
+
+static vma_t *vma_find(task_t *task, uintptr_t address) {
+    for (vma_t *vma = task->vmas; vma != NULL; vma = vma->next) {
+        if (address >= vma->start && address < vma->end) {
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+// true if a vma with all of flags set overlaps [start, end)
+static bool vma_overlaps(task_t *task, uintptr_t start, uintptr_t end, int flags) {
+    for (vma_t *vma = task->vmas; vma != NULL; vma = vma->next) {
+        if (start < vma->end && vma->start < end && (vma->flags & flags) == flags) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Take [start, end) out of the process's mappings and unmap its pages, for a
+// fixed mapping that replaces them. A mapping that straddles the whole range
+// is split in two, using spare for the upper half. Called with vm_lock held.
+static void vma_remove_range(task_t *task, uintptr_t start, uintptr_t end, vma_t **spare) {
+    vma_t **link = &task->vmas;
+    while (*link != NULL) {
+        vma_t *vma = *link;
+        if (end <= vma->start || vma->end <= start) {
+            link = &vma->next;
+            continue;
+        }
+
+        if (vma->start < start && end < vma->end) {
+            vma_t *upper = *spare;
+            *spare = NULL;
+            *upper = *vma;
+            upper->offset += end - vma->start;
+            upper->start = end;
+            vma->end = start;
+            vma->next = upper;
+            break;
+        } else if (vma->start < start) {
+            vma->end = start;
+        } else if (end < vma->end) {
+            vma->offset += end - vma->start;
+            vma->start = end;
+        } else {
+            *link = vma->next;
+            kfree(vma);
+            continue;
+        }
+        link = &vma->next;
+    }
+
+    for (uintptr_t p = vm_next_mapped(task->root, start, end); p < end;
+         p = vm_next_mapped(task->root, p + PAGE_SIZE, end)) {
+        vm_unmap(task->root, p);
+    }
+}
+
+void mmap_init() {
+    stat_file_faults = stats_register("mmap.file_faults");
+    stat_cow_faults = stats_register("mmap.cow_faults");
+}
+
+intptr_t vm_mmap(uintptr_t addr, size_t length, int prot, int flags, file_t *file, off_t offset) {
+    bool anonymous = flags & MMAP_ANONYMOUS;
+    bool shared = flags & MMAP_SHARED;
+    bool fixed = flags & MMAP_FIXED;
+    if (length == 0 || shared == ((flags & MMAP_PRIVATE) != 0)) {
+        return -1;
+    }
+
+    // A fixed mapping replaces what is there, so it must say exactly where
+    if (fixed && (addr == 0 || addr % PAGE_SIZE != 0)) {
+        return -1;
+    }
+
+    inode_t *inode = NULL;
+    if (!anonymous) {
+        if (file == NULL || file->dentry == NULL || offset < 0 || offset % PAGE_SIZE != 0) {
+            return -1;
+        }
+        inode = file->dentry->inode;
+        if ((inode->mode & VFS_S_IFMT) != VFS_S_IFREG) {
+            return -1;
+        }
+        // Files are read-only, so a shared mapping can't be writable
+        if (shared && (prot & MMAP_PROT_WRITE)) {
+            return -1;
+        }
+    }
+
+    // Keep the whole range in the lower half, without wrapping
+    uintptr_t start = addr / PAGE_SIZE * PAGE_SIZE;
+    if (start > USER_HALF_END || length > USER_HALF_END) {
+        return -1;
+    }
+    size_t pages = (addr - start + length + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages > (USER_HALF_END - start) / PAGE_SIZE) {
+        return -1;
+    }
+    uintptr_t end = start + pages * PAGE_SIZE;
+
+    // A fixed mapping may split one it replaces, which takes a second vma
+    vma_t *vma = kmalloc(sizeof(vma_t));
+    vma_t *spare = fixed ? kmalloc(sizeof(vma_t)) : NULL;
+    if (vma == NULL || (fixed && spare == NULL)) {
+        kfree(vma);
+        kfree(spare);
+        return -1;
+    }
+
+    // Use the address asked for, or hand out the next range above MMAP_BASE.
+    // The process's threads share its mappings.
+    task_t *task = sched_current()->group;
+    uint64_t flags_irq = tlb_lock(&task->vm_lock);
+    bool ok = true;
+    if (addr == 0) {
+        if (task->mmap_next == 0) {
+            task->mmap_next = MMAP_BASE;
+        }
+        start = task->mmap_next;
+        ok = pages <= (USER_HALF_END - start) / PAGE_SIZE;
+        end = ok ? start + pages * PAGE_SIZE : start;
+    }
+    if (fixed) {
+        ok = !vma_overlaps(task, start, end, MMAP_PINNED);
+        if (ok) {
+            vma_remove_range(task, start, end, &spare);
+        }
+    } else if (ok) {
+        // Pages outside any vma, such as the image, its stack and the vDSO,
+        // are taken too
+        ok = !vma_overlaps(task, start, end, 0) && vm_next_mapped(task->root, start, end) == end;
+    }
+    if (!ok) {
+        spin_unlock_irqrestore(&task->vm_lock, flags_irq);
+        kfree(vma);
+        kfree(spare);
+        return -1;
+    }
+    if (addr == 0) {
+        task->mmap_next = end;
+    }
+
+    vma->start = start;
+    vma->end = end;
+    vma->prot = prot;
+    vma->flags = flags;
+    vma->inode = inode;
+    vma->offset = offset;
+    vma->next = task->vmas;
+    task->vmas = vma;
+
+    // Anonymous memory is cheap to hand out up front
+    uintptr_t p = start;
+    for (; anonymous && p < end; p += PAGE_SIZE) {
+        if (!vm_map(task->root, p, true, prot & MMAP_PROT_WRITE, prot & MMAP_PROT_EXEC)) {
+            break;
+        }
+    }
+
+    // Out of memory, so take back the vma and the pages mapped so far
+    bool mapped = !anonymous || p == end;
+    if (!mapped) {
+        task->vmas = vma->next;
+        kfree(vma);
+        for (uintptr_t q = start; q < p; q += PAGE_SIZE) {
+            vm_unmap(task->root, q);
+        }
+        if (task->mmap_next == end) {
+            task->mmap_next = start;
+        }
+    }
+    spin_unlock_irqrestore(&task->vm_lock, flags_irq);
+    kfree(spare);
+
+    return mapped ? (intptr_t)start : -1;
+}
+
+// Resolve a fault in a process's address space. Called with its vm_lock held.
+static bool fault_locked(task_t *task, uintptr_t address, uint64_t error_code) {
+    vma_t *vma = vma_find(task, address);
+    if (vma == NULL || vma->inode == NULL) {
+        return false;
+    }
+
+    bool write = error_code & PF_WRITE;
+    bool writable = vma->prot & MMAP_PROT_WRITE;
+    bool executable = vma->prot & MMAP_PROT_EXEC;
+    if ((write && !writable) || ((error_code & PF_FETCH) && !executable)) {
+        return false;
+    }
+
+    uintptr_t page = address / PAGE_SIZE * PAGE_SIZE;
+    size_t index = (vma->offset + (page - vma->start)) / PAGE_SIZE;
+    uintptr_t frame = pagecache_get(vma->inode, index);
+    if (frame == 0) {
+        return false;  // past the end of the file, or out of memory
+    }
+
+    // Another thread may have faulted the page in while we waited for the
+    // lock. Anything but the cached frame is already a private copy.
+    uintptr_t mapped = vm_frame(task->root, page);
+    if (mapped != 0 && (!write || mapped != frame)) {
+        return true;
+    }
+
+    // Reads of a private mapping share the cached frame until the first
+    // write, which gets a copy of its own
+    if (!write) {
+        stats_inc(stat_file_faults);
+        return vm_map_page(task->root, page, frame, true, false, executable);
+    }
+
+    stats_inc(stat_cow_faults);
+    uintptr_t copy = pmem_alloc();
+    if (copy == 0) {
+        return false;
+    }
+    memcpy((void *)add_virtual_offset(copy), (void *)add_virtual_offset(frame), PAGE_SIZE);
+    return vm_map_owned(task->root, page, copy, true, true, executable);
+}
+
+bool vm_fault(uintptr_t address, uint64_t error_code) {
+    // Faults before the scheduler is up have no task to resolve them for
+    task_t *task = sched_current();
+    if (task == NULL) {
+        return false;
+    }
+    task = task->group;
+    uint64_t flags = tlb_lock(&task->vm_lock);
+    bool resolved = fault_locked(task, address, error_code);
+    spin_unlock_irqrestore(&task->vm_lock, flags);
+    return resolved;
+}
+
+void vm_release_all() {
+    task_t *task = sched_current()->group;
+    vma_t *vma = task->vmas;
+    while (vma != NULL) {
+        vma_t *next = vma->next;
+        kfree(vma);
+        vma = next;
+    }
+    task->vmas = NULL;
+    task->mmap_next = MMAP_BASE;
+}
@@ -7,9 +7,18 @@
 
 #include "debug.h"
 #include "kstdio.h"
+#include "msr.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "tlb.h"
+#include "trace.h"
+#include "workqueue.h"
 
 #define PAGE_SIZE 0x1000
 
+// Frames kept zeroed ahead of time, refilled once half are gone
+#define ZERO_POOL_TARGET 64
+
 typedef struct page_table_entry {
     bool present : 1;
     bool writable : 1;
@@ -19,7 +28,9 @@ typedef struct page_table_entry {
     bool accessed : 1;
     bool dirty : 1;
     bool page_size : 1;
-    uint8_t _unused0 : 4;
+    bool global : 1;
+    bool owned : 1;  // available to software: the leaf's frame is freed with the address space
+    uint8_t _unused0 : 2;
     uintptr_t address : 40;
     uint16_t _unused1 : 11;
     bool no_execute : 1;
@@ -43,16 +54,39 @@ typedef struct free_list {
 } free_list_t;
 
 free_list_t free_list;    // lsit of free pages
+spinlock_t free_list_lock = SPINLOCK_INIT;
 uint64_t virtual_offset;  // hhdm virtual address offset
 
+// Free frames a worker has already zeroed, so page faults and exec don't wait
+// on memset. Protected by free_list_lock; they still count as free.
+static free_list_t zero_pool;
+static size_t zero_pool_count;
+
+static void zero_pool_refill(void* arg);
+static work_t zero_pool_work = WORK_INIT(zero_pool_refill, NULL);
+
+static stat_id_t stat_frames_free;
+static stat_id_t stat_frame_allocs;
+static stat_id_t stat_frame_frees;
+static stat_id_t stat_zero_hits;
+static stat_id_t stat_zero_misses;
+
 uintptr_t add_virtual_offset(uintptr_t ptr) { return ptr + virtual_offset; }
 
+uintptr_t sub_virtual_offset(uintptr_t ptr) { return ptr - virtual_offset; }
+
 uintptr_t read_cr3() {
     uintptr_t value;
     __asm__("mov %%cr3, %0" : "=r"(value));
     return value;
 }
 
+uintptr_t read_cr2() {
+    uintptr_t value;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
 uint64_t read_cr0() {
     uintptr_t value;
     __asm__("mov %%cr0, %0" : "=r"(value));
@@ -88,14 +122,14 @@ void print_table_entry(pt_entry_t* page_entry) {
     }
 
     // next-level's kernel table
-    kprintf("-> 0x%x\n", page_entry->address << 12);
+    kprintf("-> 0x%lx\n", (uint64_t)page_entry->address << 12);
 }
 
 pt_entry_t* translate_entry(pt_entry_t* page_start, int level, uint16_t index) {
     pt_entry_t* page_entry = page_start + index;
     page_entry = add_virtual_offset(page_entry);
 
-    kprintf("  Level %d (index %d of 0x%x)\n", level, index, page_start);
+    kprintf("  Level %d (index %d of %p)\n", level, index, page_start);
     kprintf("    ");
     print_table_entry(page_entry);
 
@@ -104,7 +138,7 @@ pt_entry_t* translate_entry(pt_entry_t* page_start, int level, uint16_t index) {
 }
 
 void translate(void* address) {
-    kprintf("Translating 0x%x\n", address);
+    kprintf("Translating %p\n", address);
 
     pt_entry_t* page_start = (pt_entry_t*)read_cr3();
     linear_address_t* laddress = &address;
@@ -114,37 +148,121 @@ void translate(void* address) {
     page_start = translate_entry(page_start, 2, laddress->directory);
     page_start = translate_entry(page_start, 1, laddress->table);
 
-    kprintf("0x%x maps to 0x%x\n\n", address, page_start + laddress->offset);
+    kprintf("%p maps to %p\n\n", address, page_start + laddress->offset);
+}
+
+// Pop a frame off a list, or return 0 if it is empty. Called with free_list_lock held.
+static uintptr_t list_pop(free_list_t* list) {
+    uintptr_t frame = (uintptr_t)list->head;
+    if (frame != 0) {
+        list->head = ((list_node_t*)add_virtual_offset(frame))->next;
+    }
+    return frame;
 }
 
 uintptr_t pmem_alloc() {
-    if (free_list.head == NULL) {
+    uint64_t flags = spin_lock_irqsave(&free_list_lock);
+    uintptr_t rtr = list_pop(&free_list);
+
+    // Zeroed frames are free frames too, so use them before running out
+    if (rtr == 0) {
+        rtr = list_pop(&zero_pool);
+        zero_pool_count -= rtr != 0;
+    }
+    spin_unlock_irqrestore(&free_list_lock, flags);
+    if (rtr == 0) {
         return NULL;
     }
 
-    uintptr_t rtr = free_list.head;
-    list_node_t* nxt = ((list_node_t*)add_virtual_offset(free_list.head))->next;
-    free_list.head = nxt;
+    stats_dec(stat_frames_free);
+    stats_inc(stat_frame_allocs);
+    TRACE(TRACE_PMEM_ALLOC, rtr, 0);
 
     return rtr;
 }
 
+uintptr_t pmem_alloc_zeroed() {
+    uint64_t flags = spin_lock_irqsave(&free_list_lock);
+    uintptr_t frame = list_pop(&zero_pool);
+    zero_pool_count -= frame != 0;
+    bool low = zero_pool_count < ZERO_POOL_TARGET / 2;
+    spin_unlock_irqrestore(&free_list_lock, flags);
+
+    if (low) {
+        queue_work(&zero_pool_work);
+    }
+
+    if (frame == 0) {
+        stats_inc(stat_zero_misses);
+        frame = pmem_alloc();
+        if (frame != 0) {
+            memset((void*)add_virtual_offset(frame), 0, PAGE_SIZE);
+        }
+        return frame;
+    }
+
+    // Only the list link needs clearing
+    ((list_node_t*)add_virtual_offset(frame))->next = NULL;
+    stats_inc(stat_zero_hits);
+    stats_dec(stat_frames_free);
+    stats_inc(stat_frame_allocs);
+    TRACE(TRACE_PMEM_ALLOC, frame, 0);
+    return frame;
+}
+
+// Move free frames to the zero pool, zeroing them outside the lock
+static void zero_pool_refill(void* arg) {
+    while (true) {
+        uint64_t flags = spin_lock_irqsave(&free_list_lock);
+        uintptr_t frame = zero_pool_count < ZERO_POOL_TARGET ? list_pop(&free_list) : 0;
+        spin_unlock_irqrestore(&free_list_lock, flags);
+        if (frame == 0) {
+            return;
+        }
+
+        list_node_t* node = (list_node_t*)add_virtual_offset(frame);
+        memset(node, 0, PAGE_SIZE);
+
+        flags = spin_lock_irqsave(&free_list_lock);
+        node->next = zero_pool.head;
+        zero_pool.head = (list_node_t*)frame;
+        zero_pool_count++;
+        spin_unlock_irqrestore(&free_list_lock, flags);
+    }
+}
+
 void pmem_free(uintptr_t p) {
     list_node_t* new_head = add_virtual_offset(p);
+    uint64_t flags = spin_lock_irqsave(&free_list_lock);
     new_head->next = free_list.head;
     free_list.head = p;
+    spin_unlock_irqrestore(&free_list_lock, flags);
+
+    stats_inc(stat_frames_free);
+    stats_inc(stat_frame_frees);
 }
 
 void unmap_lower_half(uintptr_t root) {
-    // We can reclaim memory used to hold page tables, but NOT the mapped pages
+    // Reclaim the page tables and the frames the address space owns, but not
+    // frames shared with the page cache or the kernel
     pt_entry_t* l4_table = add_virtual_offset(root);
+
+    // Mark the level 4 entries not present, and remember which ones were
+    uint64_t unmapped[256 / 64] = {0};
     for (size_t l4_index = 0; l4_index < 256; l4_index++) {
-        // Does this entry point to a level 3 table?
         if (l4_table[l4_index].present) {
-            // Yes. Mark the entry as not present in the level 4 table
             l4_table[l4_index].present = false;
+            unmapped[l4_index / 64] |= 1ULL << (l4_index % 64);
+        }
+    }
+
+    // No CPU may still walk the old tables once they go back on the free list
+    tlb_flush_all(root);
 
-            // Now loop over the level 3 table
+    for (size_t l4_index = 0; l4_index < 256; l4_index++) {
+        // Did this entry point to a level 3 table?
+        if (unmapped[l4_index / 64] & (1ULL << (l4_index % 64))) {
+            // Yes. Loop over the level 3 table
             pt_entry_t* l3_table = add_virtual_offset(l4_table[l4_index].address << 12);
             for (size_t l3_index = 0; l3_index < 512; l3_index++) {
                 // Does this entry point to a level 2 table?
@@ -154,7 +272,14 @@ void unmap_lower_half(uintptr_t root) {
                     for (size_t l2_index = 0; l2_index < 512; l2_index++) {
                         // Does this entry point to a level 1 table?
                         if (l2_table[l2_index].present && !l2_table[l2_index].page_size) {
-                            // Yes. Free the physical page the holds the level 1 table
+                            // Yes. Free the frames it owns, then the level 1 table itself
+                            pt_entry_t* l1_table =
+                                (pt_entry_t*)add_virtual_offset(l2_table[l2_index].address << 12);
+                            for (size_t l1_index = 0; l1_index < 512; l1_index++) {
+                                if (l1_table[l1_index].present && l1_table[l1_index].owned) {
+                                    pmem_free(l1_table[l1_index].address << 12);
+                                }
+                            }
                             pmem_free(l2_table[l2_index].address << 12);
                         }
                     }
@@ -166,38 +291,62 @@ void unmap_lower_half(uintptr_t root) {
             pmem_free(l4_table[l4_index].address << 12);
         }
     }
+}
+
+uintptr_t vm_create_root(uintptr_t kernel_root) {
+    uintptr_t root = pmem_alloc();
+    if (root == 0) {
+        return 0;
+    }
 
-    // Reload CR3 to flush any cached address translations
-    write_cr3(read_cr3());
+    pt_entry_t* l4_table = (pt_entry_t*)add_virtual_offset(root);
+    pt_entry_t* kernel_l4_table = (pt_entry_t*)add_virtual_offset(kernel_root);
+    memset(l4_table, 0, 256 * sizeof(pt_entry_t));
+    memcpy(l4_table + 256, kernel_l4_table + 256, 256 * sizeof(pt_entry_t));
+    return root;
 }
 
-// reload Translation Lookaside Buffer
-void invalidate_tlb(uintptr_t virtual_address) {
-    __asm__("invlpg (%0)" ::"r"(virtual_address) : "memory");
+void vm_destroy_root(uintptr_t root) {
+    unmap_lower_half(root);
+    pmem_free(root);
 }
 
 void init_alloc(struct stivale2_struct_tag_memmap* memmap, struct stivale2_struct_tag_hhdm* hhdm) {
     free_list.head = NULL;  // init free list
     virtual_offset = hhdm->addr;
 
+    stat_frames_free = stats_register("pmem.frames_free");
+    stat_frame_allocs = stats_register("pmem.allocs");
+    stat_frame_frees = stats_register("pmem.frees");
+    stat_zero_hits = stats_register("pmem.zero_pool_hits");
+    stat_zero_misses = stats_register("pmem.zero_pool_misses");
+
     // Enable write protection
     uint64_t cr0 = read_cr0();
     cr0 |= 0x10000;
     write_cr0(cr0);
 
+    uint64_t frames = 0;
     for (uint64_t i = 0; i < memmap->entries; i++) {
         struct stivale2_mmap_entry entry = memmap->memmap[i];
         if (entry.type == 1) {  // entry is an usable memory
             for (uint64_t curr = entry.base; curr < entry.base + entry.length; curr += PAGE_SIZE) {
                 pmem_free(curr);
+                frames++;
             }
         }
     }
 
+    // Seeding the free list doesn't count as freeing frames
+    stats_add(stat_frame_frees, -(int64_t)frames);
+
     unmap_lower_half(read_cr3());
 }
 
-bool vm_map(uintptr_t root, uintptr_t address, bool user, bool writable, bool executable) {
+// Map address to the frame at phys, or to a new zeroed frame if allocate is
+// set. owned marks phys as belonging to the address space; allocated frames always do.
+static bool vm_map_internal(uintptr_t root, uintptr_t address, uintptr_t phys, bool allocate,
+                            bool owned, bool user, bool writable, bool executable) {
     // init linear address
     linear_address_t* laddress = &address;
     uint16_t addresses[] = {
@@ -208,26 +357,44 @@ bool vm_map(uintptr_t root, uintptr_t address, bool user, bool writable, bool ex
         laddress->pml4,           // level 4
     };
 
+    TRACE(TRACE_VM_MAP, root, address);
+
     pt_entry_t* table_entry = root;
+    bool replaced = false;
+    uintptr_t old_frame = 0;
 
     for (int level = 4; level >= 1; level--) {
         pt_entry_t* page_entry = table_entry + addresses[level];
         page_entry = add_virtual_offset(page_entry);
 
-        debugf("level %d table: 0x%x entry: 0x%x\n", level, table_entry, page_entry);
+        debugf("level %d table: %p entry: %p\n", level, table_entry, page_entry);
+
+        // point the leaf at the requested frame, replacing any old mapping
+        if (level == 1 && !allocate) {
+            replaced = page_entry->present;
+            if (replaced && page_entry->owned) {
+                old_frame = page_entry->address << 12;
+            }
+            page_entry->present = true;
+            page_entry->owned = owned;
+            page_entry->no_execute = !executable;
+            page_entry->user = user;
+            page_entry->writable = writable;
+            page_entry->address = phys >> 12;
+            break;
+        }
 
         // create new page if not present
         if (!page_entry->present) {
             debug(" not present, make new page\n");
 
             // allocate new page
-            uintptr_t new_page = pmem_alloc();
+            uintptr_t new_page = pmem_alloc_zeroed();
             if (new_page == NULL) {  // run out of page
                 return false;
             }
-            memset(add_virtual_offset(new_page), 0, PAGE_SIZE);
 
-            debugf(" new page %p shift %p\n", new_page, new_page >> 12);
+            debugf(" new page %p shift 0x%lx\n", new_page, new_page >> 12);
 
             // link new page to current table and set permission
             page_entry->present = true;
@@ -235,13 +402,118 @@ bool vm_map(uintptr_t root, uintptr_t address, bool user, bool writable, bool ex
             page_entry->user = level == 1 ? user : true;
             page_entry->writable = level == 1 ? writable : true;
             page_entry->address = new_page >> 12;
+            page_entry->owned = level == 1;
         }
 
         table_entry = page_entry->address << 12;
     }
 
-    invalidate_tlb(address);
+    // The CPU never caches a missing translation, so only a replaced one needs flushing
+    if (replaced) {
+        tlb_invalidate(root, address);
+    }
+
+    // Only once no CPU can reach it through the old translation
+    if (old_frame != 0) {
+        pmem_free(old_frame);
+    }
+
+    return true;
+}
+
+// Memory types in the page attribute table
+#define PAT_WRITE_COMBINING 0x01
+
+void pat_init() {
+    // Entry 1 is write-through at reset, and nothing maps with it before this
+    uint64_t pat = rdmsr(MSR_PAT);
+    pat = (pat & ~0xFF00ULL) | ((uint64_t)PAT_WRITE_COMBINING << 8);
+    wrmsr(MSR_PAT, pat);
+}
+
+bool vm_map(uintptr_t root, uintptr_t address, bool user, bool writable, bool executable) {
+    return vm_map_internal(root, address, 0, true, true, user, writable, executable);
+}
+
+bool vm_map_page(uintptr_t root, uintptr_t address, uintptr_t phys, bool user, bool writable,
+                 bool executable) {
+    return vm_map_internal(root, address, phys, false, false, user, writable, executable);
+}
+
+bool vm_map_owned(uintptr_t root, uintptr_t address, uintptr_t phys, bool user, bool writable,
+                  bool executable) {
+    return vm_map_internal(root, address, phys, false, true, user, writable, executable);
+}
+
+// Replace the large page behind entry, at level 3 or 2, with a table one
+// level down mapping the same frames with the same attributes
+static bool split_large_page(pt_entry_t* entry, int level) {
+    uintptr_t table = pmem_alloc_zeroed();
+    if (table == 0) {
+        return false;
+    }
+
+    // Bit 12 of a large page is its PAT bit, not part of the address. A 4 KiB
+    // page keeps it in bit 7 instead.
+    bool pat = entry->address & 1;
+    size_t child_size = level == 3 ? 0x200000 : PAGE_SIZE;
+    uintptr_t base = ((uintptr_t)entry->address << 12) & ~(child_size * 512 - 1);
+
+    pt_entry_t* children = (pt_entry_t*)add_virtual_offset(table);
+    for (size_t i = 0; i < 512; i++) {
+        children[i] = *entry;
+        children[i].address = (base + i * child_size) >> 12;
+        if (level == 3) {
+            children[i].address |= pat;
+        } else {
+            children[i].page_size = pat;
+        }
+    }
 
+    pt_entry_t parent = *entry;
+    parent.page_size = false;
+    parent.write_through = false;
+    parent.cache_disable = false;
+    parent.address = table >> 12;
+    *entry = parent;
+    return true;
+}
+
+bool vm_set_cache(uintptr_t root, uintptr_t address, size_t size, uint8_t cache) {
+    uintptr_t end = address + size;
+    for (uintptr_t page = address & ~(uintptr_t)(PAGE_SIZE - 1); page < end; page += PAGE_SIZE) {
+        // init linear address
+        linear_address_t* laddress = (linear_address_t*)&page;
+        uint16_t addresses[] = {
+            0,
+            laddress->table,          // level 1
+            laddress->directory,      // level 2
+            laddress->directory_ptr,  // level 3
+            laddress->pml4,           // level 4
+        };
+
+        uintptr_t table = root;
+        for (int level = 4; level >= 1; level--) {
+            pt_entry_t* page_entry = (pt_entry_t*)add_virtual_offset(table) + addresses[level];
+            if (!page_entry->present) {
+                return false;
+            }
+
+            // Only part of a large page may change type, so break it up
+            if (level > 1 && page_entry->page_size && !split_large_page(page_entry, level)) {
+                return false;
+            }
+
+            if (level == 1) {
+                page_entry->write_through = cache & 1;
+                page_entry->cache_disable = (cache >> 1) & 1;
+            }
+            table = (uintptr_t)page_entry->address << 12;
+        }
+
+        // Also drops the large page's translation if it was just split
+        tlb_invalidate(root, page);
+    }
     return true;
 }
 
@@ -262,7 +534,7 @@ bool vm_protect(uintptr_t root, uintptr_t address, bool user, bool writable, boo
         pt_entry_t* page_entry = table_entry + addresses[level];
         page_entry = add_virtual_offset(page_entry);
 
-        debugf("level %d table: 0x%x entry: 0x%x\n", level, table_entry, page_entry);
+        debugf("level %d table: %p entry: %p\n", level, table_entry, page_entry);
 
         // page is not mapped
         if (!page_entry->present) {
@@ -276,7 +548,122 @@ bool vm_protect(uintptr_t root, uintptr_t address, bool user, bool writable, boo
         table_entry = page_entry->address << 12;
     }
 
-    invalidate_tlb(address);
+    tlb_invalidate(root, address);
+
+    return true;
+}
+
+bool vm_is_mapped(uintptr_t root, uintptr_t address, bool user) {
+    // init linear address
+    linear_address_t* laddress = (linear_address_t*)&address;
+    uint16_t addresses[] = {
+        0,
+        laddress->table,          // level 1
+        laddress->directory,      // level 2
+        laddress->directory_ptr,  // level 3
+        laddress->pml4,           // level 4
+    };
+
+    uintptr_t table = root;
+
+    for (int level = 4; level >= 1; level--) {
+        pt_entry_t* page_entry = (pt_entry_t*)add_virtual_offset(table) + addresses[level];
+
+        if (!page_entry->present || (user && !page_entry->user)) {
+            return false;
+        }
+
+        // a large page ends the walk early
+        if (level > 1 && page_entry->page_size) {
+            return true;
+        }
+
+        table = (uintptr_t)page_entry->address << 12;
+    }
 
     return true;
-}
\ No newline at end of file
+}
+
+uintptr_t vm_next_mapped(uintptr_t root, uintptr_t address, uintptr_t end) {
+    while (address < end) {
+        uintptr_t table = root;
+        int level = 4;
+        for (; level >= 1; level--) {
+            size_t index = (address >> (12 + 9 * (level - 1))) & 0x1FF;
+            pt_entry_t* page_entry = (pt_entry_t*)add_virtual_offset(table) + index;
+            if (!page_entry->present) {
+                break;
+            }
+            if (level == 1 || page_entry->page_size) {
+                return address;
+            }
+            table = (uintptr_t)page_entry->address << 12;
+        }
+
+        // Nothing is mapped in the rest of the range the missing entry covers
+        uintptr_t span = 1ULL << (12 + 9 * (level - 1));
+        uintptr_t next = (address & ~(span - 1)) + span;
+        if (next <= address) {
+            break;
+        }
+        address = next;
+    }
+    return end;
+}
+
+void vm_unmap(uintptr_t root, uintptr_t address) {
+    // init linear address
+    linear_address_t* laddress = (linear_address_t*)&address;
+    uint16_t addresses[] = {
+        0,
+        laddress->table,          // level 1
+        laddress->directory,      // level 2
+        laddress->directory_ptr,  // level 3
+        laddress->pml4,           // level 4
+    };
+
+    uintptr_t table = root;
+    pt_entry_t* page_entry = NULL;
+    for (int level = 4; level >= 1; level--) {
+        page_entry = (pt_entry_t*)add_virtual_offset(table) + addresses[level];
+        if (!page_entry->present || (level > 1 && page_entry->page_size)) {
+            return;
+        }
+        table = (uintptr_t)page_entry->address << 12;
+    }
+
+    bool owned = page_entry->owned;
+    memset(page_entry, 0, sizeof(pt_entry_t));
+    tlb_invalidate(root, address);
+
+    // Only once no CPU can reach it through the old translation
+    if (owned) {
+        pmem_free(table);
+    }
+}
+
+uintptr_t vm_frame(uintptr_t root, uintptr_t address) {
+    // init linear address
+    linear_address_t* laddress = (linear_address_t*)&address;
+    uint16_t addresses[] = {
+        0,
+        laddress->table,          // level 1
+        laddress->directory,      // level 2
+        laddress->directory_ptr,  // level 3
+        laddress->pml4,           // level 4
+    };
+
+    uintptr_t table = root;
+
+    for (int level = 4; level >= 1; level--) {
+        pt_entry_t* page_entry = (pt_entry_t*)add_virtual_offset(table) + addresses[level];
+
+        if (!page_entry->present || (level > 1 && page_entry->page_size)) {
+            return 0;
+        }
+
+        table = (uintptr_t)page_entry->address << 12;
+    }
+
+    return table;
+}
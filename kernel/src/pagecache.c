@@ -0,0 +1,100 @@
+#include "pagecache.h"
+
+#include <string.h>
+
+#include "kmalloc.h"
+#include "page.h"
+#include "spinlock.h"
+#include "stats.h"
+
+// Buckets in the page hash, a power of two
+#define PAGECACHE_HASH_SIZE 512
+
+// One cached page of a file
+typedef struct cached_page {
+    inode_t *inode;
+    size_t index;
+    uintptr_t frame;
+    struct cached_page *next;  // next page on the same hash chain
+} cached_page_t;
+
+static spinlock_t pagecache_lock = SPINLOCK_INIT;
+static cached_page_t *pagecache_hash[PAGECACHE_HASH_SIZE];
+
+static stat_id_t stat_hits;
+static stat_id_t stat_misses;
+static stat_id_t stat_pages;
+
+static size_t pagecache_hash_index(const inode_t *inode, size_t index) {
+    uint64_t key = inode->ino * 0x9E3779B97F4A7C15ULL + index;
+    return (key ^ (key >> 29)) & (PAGECACHE_HASH_SIZE - 1);
+}
+
+// Find a cached page. Called with pagecache_lock held.
+static cached_page_t *find_locked(const inode_t *inode, size_t index) {
+    cached_page_t *page = pagecache_hash[pagecache_hash_index(inode, index)];
+    while (page != NULL && (page->inode != inode || page->index != index)) {
+        page = page->next;
+    }
+    return page;
+}
+
+void pagecache_init() {
+    stat_hits = stats_register("pagecache.hits");
+    stat_misses = stats_register("pagecache.misses");
+    stat_pages = stats_register("pagecache.pages");
+}
+
+uintptr_t pagecache_get(inode_t *inode, size_t index) {
+    if (index * PAGE_SIZE >= inode->size) {
+        return 0;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&pagecache_lock);
+    cached_page_t *page = find_locked(inode, index);
+    if (page != NULL) {
+        spin_unlock_irqrestore(&pagecache_lock, flags);
+        stats_inc(stat_hits);
+        return page->frame;
+    }
+    spin_unlock_irqrestore(&pagecache_lock, flags);
+
+    // Fill a frame outside the lock, the tail of the last page reads as zeroes
+    stats_inc(stat_misses);
+    uintptr_t frame = pmem_alloc();
+    cached_page_t *entry = kmalloc(sizeof(cached_page_t));
+    if (frame == 0 || entry == NULL) {
+        if (frame != 0) {
+            pmem_free(frame);
+        }
+        kfree(entry);
+        return 0;
+    }
+
+    size_t offset = index * PAGE_SIZE;
+    size_t len = inode->size - offset < PAGE_SIZE ? inode->size - offset : PAGE_SIZE;
+    uint8_t *dst = (uint8_t *)add_virtual_offset(frame);
+    memcpy(dst, inode->data + offset, len);
+    memset(dst + len, 0, PAGE_SIZE - len);
+
+    // Another CPU may have cached the page meanwhile; keep whichever came first
+    flags = spin_lock_irqsave(&pagecache_lock);
+    page = find_locked(inode, index);
+    if (page == NULL) {
+        entry->inode = inode;
+        entry->index = index;
+        entry->frame = frame;
+        size_t bucket = pagecache_hash_index(inode, index);
+        entry->next = pagecache_hash[bucket];
+        pagecache_hash[bucket] = entry;
+        page = entry;
+        stats_inc(stat_pages);
+    }
+    spin_unlock_irqrestore(&pagecache_lock, flags);
+
+    if (page != entry) {
+        pmem_free(frame);
+        kfree(entry);
+    }
+    return page->frame;
+}
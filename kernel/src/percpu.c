@@ -0,0 +1,18 @@
+#include "percpu.h"
+
+#include "msr.h"
+
+cpu_t cpus[MAX_CPUS];
+size_t cpu_count = 1;
+
+void percpu_init(size_t id, uint32_t lapic_id) {
+    cpu_t *cpu = &cpus[id];
+    cpu->self = cpu;
+    cpu->id = id;
+    cpu->lapic_id = lapic_id;
+    wrmsr(MSR_GS_BASE, (uintptr_t)cpu);
+
+    // User mode gets its own GS base, swapped in on the way out of the
+    // kernel, so it can't reach this CPU's data through %gs
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
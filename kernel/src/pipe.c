@@ -0,0 +1,212 @@
+#include "pipe.h"
+
+#include "kmalloc.h"
+#include "page.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "stats.h"
+
+// The ring buffer is bigger than kmalloc hands out, so it is made of frames
+// the pipe owns
+#define PIPE_PAGES (PIPE_SIZE / PAGE_SIZE)
+
+// A pipe's ring buffer. The wait queue's lock protects everything here, and
+// readers and writers sleep on the same queue since only one side ever waits.
+typedef struct pipe {
+    wait_queue_t wait;
+    size_t head;  // next byte to read
+    size_t used;  // bytes buffered
+    uint32_t readers;
+    uint32_t writers;
+    uint8_t *pages[PIPE_PAGES];  // the ring, in the direct map
+} pipe_t;
+
+static stat_id_t stat_bytes;
+static stat_id_t stat_reader_waits;
+static stat_id_t stat_writer_waits;
+
+static void pipe_free(pipe_t *pipe) {
+    for (size_t i = 0; i < PIPE_PAGES; i++) {
+        if (pipe->pages[i] != NULL) {
+            pmem_free(sub_virtual_offset((uintptr_t)pipe->pages[i]));
+        }
+    }
+    kfree(pipe);
+}
+
+// Copy n bytes out of the ring from offset on to user memory, wrapping at its end.
+// Returns false if dst can't be written.
+static bool ring_copy_out(pipe_t *pipe, size_t offset, uint8_t *dst, size_t n) {
+    while (n > 0) {
+        size_t in_page = offset % PAGE_SIZE;
+        size_t chunk = PAGE_SIZE - in_page < n ? PAGE_SIZE - in_page : n;
+        if (!copy_to_user(dst, pipe->pages[offset / PAGE_SIZE] + in_page, chunk)) {
+            return false;
+        }
+        dst += chunk;
+        n -= chunk;
+        offset = (offset + chunk) % PIPE_SIZE;
+    }
+    return true;
+}
+
+// Copy n bytes from user memory into the ring from offset on, wrapping at its end.
+// Returns false if src can't be read.
+static bool ring_copy_in(pipe_t *pipe, size_t offset, const uint8_t *src, size_t n) {
+    while (n > 0) {
+        size_t in_page = offset % PAGE_SIZE;
+        size_t chunk = PAGE_SIZE - in_page < n ? PAGE_SIZE - in_page : n;
+        if (!copy_from_user(pipe->pages[offset / PAGE_SIZE] + in_page, src, chunk)) {
+            return false;
+        }
+        src += chunk;
+        n -= chunk;
+        offset = (offset + chunk) % PIPE_SIZE;
+    }
+    return true;
+}
+
+// Free the pipe once both ends are gone. Called with the lock held; releases it.
+static void pipe_unlock_and_maybe_free(pipe_t *pipe, uint64_t flags) {
+    bool unused = pipe->readers == 0 && pipe->writers == 0;
+    spin_unlock_irqrestore(&pipe->wait.lock, flags);
+    if (unused) {
+        pipe_free(pipe);
+    } else {
+        wake_up(&pipe->wait);
+    }
+}
+
+static ssize_t pipe_read(file_t *file, void *buf, size_t count) {
+    pipe_t *pipe = file->private;
+    uint64_t flags = spin_lock_irqsave(&pipe->wait.lock);
+
+    while (pipe->used == 0 && pipe->writers > 0) {
+        if (sched_current()->interrupted) {
+            spin_unlock_irqrestore(&pipe->wait.lock, flags);
+            return -1;
+        }
+        stats_inc(stat_reader_waits);
+        wait_queue_sleep(&pipe->wait);
+    }
+
+    // Nothing is consumed if buf can't take it
+    size_t n = count < pipe->used ? count : pipe->used;
+    if (!ring_copy_out(pipe, pipe->head, buf, n)) {
+        spin_unlock_irqrestore(&pipe->wait.lock, flags);
+        return -1;
+    }
+    pipe->head = (pipe->head + n) % PIPE_SIZE;
+    pipe->used -= n;
+
+    spin_unlock_irqrestore(&pipe->wait.lock, flags);
+    if (n > 0) {
+        wake_up(&pipe->wait);
+    }
+    return n;
+}
+
+static ssize_t pipe_write(file_t *file, const void *buf, size_t count) {
+    pipe_t *pipe = file->private;
+    const uint8_t *src = buf;
+    size_t written = 0;
+
+    while (written < count) {
+        uint64_t flags = spin_lock_irqsave(&pipe->wait.lock);
+        while (pipe->used == PIPE_SIZE && pipe->readers > 0) {
+            if (sched_current()->interrupted) {
+                spin_unlock_irqrestore(&pipe->wait.lock, flags);
+                return written > 0 ? (ssize_t)written : -1;
+            }
+            stats_inc(stat_writer_waits);
+            wait_queue_sleep(&pipe->wait);
+        }
+        if (pipe->readers == 0) {
+            spin_unlock_irqrestore(&pipe->wait.lock, flags);
+            return written > 0 ? (ssize_t)written : -1;
+        }
+
+        // Fill all the free space at once
+        size_t space = PIPE_SIZE - pipe->used;
+        size_t n = count - written < space ? count - written : space;
+        if (!ring_copy_in(pipe, (pipe->head + pipe->used) % PIPE_SIZE, src + written, n)) {
+            spin_unlock_irqrestore(&pipe->wait.lock, flags);
+            return written > 0 ? (ssize_t)written : -1;
+        }
+        pipe->used += n;
+        written += n;
+
+        spin_unlock_irqrestore(&pipe->wait.lock, flags);
+        stats_add(stat_bytes, n);
+        wake_up(&pipe->wait);
+    }
+
+    return written;
+}
+
+static void pipe_release_read(file_t *file) {
+    pipe_t *pipe = file->private;
+    uint64_t flags = spin_lock_irqsave(&pipe->wait.lock);
+    pipe->readers--;
+    pipe_unlock_and_maybe_free(pipe, flags);
+}
+
+static void pipe_release_write(file_t *file) {
+    pipe_t *pipe = file->private;
+    uint64_t flags = spin_lock_irqsave(&pipe->wait.lock);
+    pipe->writers--;
+    pipe_unlock_and_maybe_free(pipe, flags);
+}
+
+static ssize_t pipe_wrong_end(file_t *file, const void *buf, size_t count) { return -1; }
+
+static ssize_t pipe_wrong_end_read(file_t *file, void *buf, size_t count) { return -1; }
+
+static const file_ops_t pipe_read_ops = {
+    .read = pipe_read, .write = pipe_wrong_end, .release = pipe_release_read};
+static const file_ops_t pipe_write_ops = {
+    .read = pipe_wrong_end_read, .write = pipe_write, .release = pipe_release_write};
+
+void pipe_init() {
+    stat_bytes = stats_register("pipe.bytes");
+    stat_reader_waits = stats_register("pipe.reader_waits");
+    stat_writer_waits = stats_register("pipe.writer_waits");
+}
+
+bool pipe_create(file_t **read_end, file_t **write_end) {
+    pipe_t *pipe = kzalloc(sizeof(pipe_t));
+    if (pipe == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < PIPE_PAGES; i++) {
+        uintptr_t frame = pmem_alloc();
+        if (frame == 0) {
+            pipe_free(pipe);
+            return false;
+        }
+        pipe->pages[i] = (uint8_t *)add_virtual_offset(frame);
+    }
+    pipe->wait = (wait_queue_t)WAIT_QUEUE_INIT;
+
+    // An end that couldn't be made counts as closed, so releasing the other
+    // one frees the pipe
+    *read_end = file_alloc(&pipe_read_ops, NULL);
+    *write_end = file_alloc(&pipe_write_ops, NULL);
+    if (*read_end != NULL) {
+        (*read_end)->private = pipe;
+        pipe->readers = 1;
+    }
+    if (*write_end != NULL) {
+        (*write_end)->private = pipe;
+        pipe->writers = 1;
+    }
+
+    if (*read_end == NULL && *write_end == NULL) {
+        pipe_free(pipe);
+        return false;
+    } else if (*read_end == NULL || *write_end == NULL) {
+        file_put(*read_end != NULL ? *read_end : *write_end);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,221 @@
+#include "proc.h"
+
+#include "elf.h"
+#include "klog.h"
+#include "kmalloc.h"
+#include "mmap.h"
+#include "page.h"
+#include "ring.h"
+#include "stats.h"
+#include "thread.h"
+
+typedef enum proc_state {
+    PROC_FREE,
+    PROC_RUNNING,
+    PROC_ZOMBIE,  // exited, holding its status until the parent reaps it
+} proc_state_t;
+
+// A slot in the process table. The task itself is freed by the scheduler
+// once it exits; the slot outlives it until the parent has the status.
+typedef struct proc {
+    int pid;
+    proc_state_t state;
+    int parent;  // PID of the waiting parent, 0 once orphaned
+    int status;  // exit status of a zombie
+} proc_t;
+
+static proc_t procs[PROC_MAX];
+static int next_pid = PROC_INIT_PID;
+
+// Parents waiting for a child sleep here. Its lock protects the table.
+static wait_queue_t child_exited = WAIT_QUEUE_INIT;
+
+// What a spawned task needs to exec its program, handed over by the parent
+typedef struct spawn_request {
+    dentry_t *program;
+    exec_args_t args;
+} spawn_request_t;
+
+static stat_id_t stat_spawns;
+static stat_id_t stat_reaped;
+static stat_id_t stat_wait_sleeps;
+
+// The slot of a live or zombie process. Called with the table lock held.
+static proc_t *proc_find(int pid) {
+    for (size_t i = 0; i < PROC_MAX; i++) {
+        if (procs[i].state != PROC_FREE && procs[i].pid == pid) {
+            return &procs[i];
+        }
+    }
+    return NULL;
+}
+
+void proc_init() {
+    stat_spawns = stats_register("proc.spawns");
+    stat_reaped = stats_register("proc.reaped");
+    stat_wait_sleeps = stats_register("proc.wait_sleeps");
+}
+
+int proc_attach(task_t *task, int parent) {
+    uint64_t flags = spin_lock_irqsave(&child_exited.lock);
+    proc_t *proc = NULL;
+    for (size_t i = 0; i < PROC_MAX && proc == NULL; i++) {
+        if (procs[i].state == PROC_FREE) {
+            proc = &procs[i];
+        }
+    }
+    if (proc == NULL) {
+        spin_unlock_irqrestore(&child_exited.lock, flags);
+        return -1;
+    }
+
+    proc->pid = next_pid++;
+    proc->state = PROC_RUNNING;
+    proc->parent = parent;
+    proc->status = 0;
+    task->pid = proc->pid;
+
+    spin_unlock_irqrestore(&child_exited.lock, flags);
+    return task->pid;
+}
+
+// Body of a spawned task, which runs in its new address space. exec_image
+// never returns, so the arguments move to the kernel stack, which is reset on
+// the way to user mode, and the request is freed first.
+static void spawn_entry(void *arg) {
+    spawn_request_t *request = arg;
+    dentry_t *d = request->program;
+    exec_args_t args = request->args;
+    kfree(request);
+    exec_image(d->name, (uintptr_t)d->inode->data, d->inode->size, d->inode, &args);
+}
+
+int proc_spawn(dentry_t *program, char *const argv[], char *const envp[]) {
+    spawn_request_t *request = kmalloc(sizeof(spawn_request_t));
+    if (request == NULL) {
+        return -1;
+    }
+    request->program = program;
+    if (!exec_args_copy(&request->args, argv, envp)) {
+        kfree(request);
+        return -1;
+    }
+
+    uintptr_t root = vm_create_root(sched_kernel_root());
+    task_t *task = root != 0 ? sched_create(program->name, spawn_entry, request) : NULL;
+    if (task == NULL) {
+        klog(KLOG_WARN, "spawn: out of memory for %s\n", program->name);
+        if (root != 0) {
+            vm_destroy_root(root);
+        }
+        kfree(request);
+        return -1;
+    }
+    task->root = root;
+
+    task_t *parent = sched_current();
+    if (proc_attach(task, parent->pid) < 0) {
+        klog(KLOG_WARN, "spawn: process table full\n");
+        sched_destroy(task);
+        vm_destroy_root(root);
+        kfree(request);
+        return -1;
+    }
+
+    for (int fd = 0; fd < 3; fd++) {
+        task->files[fd] = fd_get(fd);
+    }
+
+    stats_inc(stat_spawns);
+    int pid = task->pid;
+    sched_start(task);
+    return pid;
+}
+
+void proc_exit(int status) {
+    task_t *task = sched_current();
+
+    // The other threads go first, since they share everything freed below
+    thread_stop_others();
+    ring_release();
+
+    // Closing files lets the other end of any pipe see end of file
+    for (int fd = 0; fd < TASK_MAX_FILES; fd++) {
+        fd_close(fd);
+    }
+
+    // Leave the address space before freeing it
+    vm_release_all();
+    uintptr_t root = task->root;
+    sched_switch_root(sched_kernel_root());
+    vm_destroy_root(root);
+
+    uint64_t flags = spin_lock_irqsave(&child_exited.lock);
+
+    // Nobody will wait for our children any more
+    for (size_t i = 0; i < PROC_MAX; i++) {
+        if (procs[i].state != PROC_FREE && procs[i].parent == task->pid) {
+            procs[i].parent = 0;
+            if (procs[i].state == PROC_ZOMBIE) {
+                procs[i].state = PROC_FREE;
+            }
+        }
+    }
+
+    // An orphan has nobody to report to
+    proc_t *proc = proc_find(task->pid);
+    if (proc->parent == 0) {
+        proc->state = PROC_FREE;
+    } else {
+        proc->state = PROC_ZOMBIE;
+        proc->status = status;
+    }
+
+    spin_unlock_irqrestore(&child_exited.lock, flags);
+    wake_up(&child_exited);
+    sched_exit();
+}
+
+int proc_wait(int pid, int *status) {
+    // Kernel tasks have no children, and orphans point at PID 0
+    int self = sched_current()->pid;
+    if (self == 0) {
+        return -1;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&child_exited.lock);
+
+    while (true) {
+        bool have_child = false;
+        for (size_t i = 0; i < PROC_MAX; i++) {
+            proc_t *proc = &procs[i];
+            if (proc->state == PROC_FREE || proc->parent != self ||
+                (pid != -1 && proc->pid != pid)) {
+                continue;
+            }
+            have_child = true;
+            if (proc->state != PROC_ZOMBIE) {
+                continue;
+            }
+
+            // Reap it
+            int reaped = proc->pid;
+            int exit_status = proc->status;
+            proc->state = PROC_FREE;
+            spin_unlock_irqrestore(&child_exited.lock, flags);
+
+            stats_inc(stat_reaped);
+            if (status != NULL) {
+                *status = exit_status;
+            }
+            return reaped;
+        }
+
+        if (!have_child || sched_current()->interrupted) {
+            spin_unlock_irqrestore(&child_exited.lock, flags);
+            return -1;
+        }
+        stats_inc(stat_wait_sleeps);
+        wait_queue_sleep(&child_exited);
+    }
+}
@@ -0,0 +1,131 @@
+#include "profile.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "elf.h"
+#include "page.h"
+#include "percpu.h"
+#include "util.h"
+
+// Lowest higher-half address, where kernel frames live
+#define KERNEL_HALF_START 0xFFFF800000000000
+
+// A CPU's sample ring. Only its own tick interrupt writes it, and readers
+// only consume up to the published head.
+typedef struct profile_ring {
+    volatile uint64_t head;  // samples written
+    volatile uint64_t tail;  // samples consumed
+    uint64_t countdown;      // ticks until the next sample
+    profile_sample_t samples[PROFILE_RING_SIZE];
+} __cacheline_aligned profile_ring_t;
+
+static profile_ring_t rings[MAX_CPUS];
+static volatile bool running = false;
+static volatile uint64_t interval = 1;
+
+// Is fp a plausible frame pointer on the sampled stack?
+static bool frame_ok(uintptr_t root, uintptr_t fp, bool user) {
+    if (fp == 0 || (fp & 0x7) != 0) {
+        return false;
+    }
+    if (user != (fp < KERNEL_HALF_START)) {
+        return false;
+    }
+    // Both words of the frame must be readable without faulting
+    return vm_is_mapped(root, fp, user) && vm_is_mapped(root, fp + 8, user);
+}
+
+void profile_tick(interrupt_context_t *ctx, uintptr_t fp) {
+    if (!running) {
+        return;
+    }
+
+    profile_ring_t *ring = &rings[cpu_id()];
+    if (ring->countdown > 1) {
+        ring->countdown--;
+        return;
+    }
+    ring->countdown = interval;
+
+    // Overwrite the oldest sample when the reader has fallen behind
+    if (ring->head - ring->tail == PROFILE_RING_SIZE) {
+        ring->tail++;
+    }
+
+    profile_sample_t *sample = &ring->samples[ring->head % PROFILE_RING_SIZE];
+    bool user = (ctx->cs & 0x3) != 0;
+    uintptr_t root = read_cr3() & ~0xFFFULL;
+
+    sample->tsc = rdtsc();
+    sample->cr3 = root;
+    sample->cpu = cpu_id();
+    sample->user = user;
+
+    // Tag the sample with the running program so the host knows which ELF to use
+    const char *image = user ? exec_current_image() : "kernel";
+    size_t len = strlen(image);
+    len = len < PROFILE_IMAGE_MAX - 1 ? len : PROFILE_IMAGE_MAX - 1;
+    memcpy(sample->image, image, len);
+    sample->image[len] = '\0';
+
+    // Follow the saved frame pointers up the interrupted stack
+    size_t depth = 0;
+    sample->pcs[depth++] = ctx->ip;
+    while (depth < PROFILE_MAX_DEPTH && frame_ok(root, fp, user)) {
+        uintptr_t *frame = (uintptr_t *)fp;
+        uintptr_t ret = frame[1];
+        if (ret == 0) {
+            break;
+        }
+        sample->pcs[depth++] = ret;
+
+        // Frames must move toward the base of the stack
+        if (frame[0] <= fp) {
+            break;
+        }
+        fp = frame[0];
+    }
+    sample->depth = depth;
+
+    // Publish the sample
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void profile_start(uint64_t every) {
+    running = false;
+
+    interval = every == 0 ? 1 : every;
+    for (size_t i = 0; i < MAX_CPUS; i++) {
+        rings[i].tail = rings[i].head;
+        rings[i].countdown = interval;
+    }
+
+    running = true;
+}
+
+int profile_stop() {
+    bool was_running = running;
+    running = false;
+    return was_running;
+}
+
+int64_t profile_read(profile_sample_t *samples, size_t count) {
+    size_t copied = 0;
+
+    for (size_t i = 0; i < MAX_CPUS && copied < count; i++) {
+        profile_ring_t *ring = &rings[i];
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        while (ring->tail < head && copied < count) {
+            profile_sample_t *sample = &ring->samples[ring->tail % PROFILE_RING_SIZE];
+            if (!copy_to_user(&samples[copied], sample, sizeof(*sample))) {
+                return copied > 0 ? (int64_t)copied : -1;
+            }
+            copied++;
+            ring->tail++;
+        }
+    }
+
+    return copied;
+}
@@ -0,0 +1,230 @@
+#include "ring.h"
+
+#include "clock.h"
+#include "futex.h"
+#include "kmalloc.h"
+#include "mmap.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "syscall.h"
+#include "thread.h"
+
+// System calls a ring may make. Ones that replace or end the caller, or start
+// threads and rings, only make sense as traps.
+#define RING_ALLOWED                                                                            \
+    ((1ULL << SYS_read) | (1ULL << SYS_write) | (1ULL << SYS_mmap) | (1ULL << SYS_open) |      \
+     (1ULL << SYS_close) | (1ULL << SYS_lseek) | (1ULL << SYS_stat) | (1ULL << SYS_getdents) | \
+     (1ULL << SYS_pipe) | (1ULL << SYS_dup2) | (1ULL << SYS_futex) |                          \
+     (1ULL << SYS_clock_gettime) | (1ULL << SYS_nanosleep))
+
+// A process's ring. The shared memory is only trusted for the program's own
+// indices; the kernel keeps its side here. The lock protects the indices and
+// the poller's sleep.
+typedef struct ring {
+    spinlock_t lock;
+    ring_header_t *header;  // in user memory, like the queues
+    ring_sqe_t *sqes;
+    ring_cqe_t *cqes;
+    uint32_t mask;                 // entries - 1
+    uint32_t sq_head;              // next submission to take
+    uint32_t cq_tail;              // next completion to post
+    uint32_t inflight;             // requests taken whose completions aren't posted yet
+    volatile uint32_t cq_waiters;  // tasks in ring_enter waiting for completions
+    task_t *poller;                // the polling thread with RING_SETUP_SQPOLL, or NULL
+    bool poller_sleeping;
+} ring_t;
+
+static stat_id_t stat_enters;
+static stat_id_t stat_requests;
+static stat_id_t stat_polled;
+static stat_id_t stat_poller_wakeups;
+
+void ring_init() {
+    stat_enters = stats_register("ring.enters");
+    stat_requests = stats_register("ring.requests");
+    stat_polled = stats_register("ring.polled");
+    stat_poller_wakeups = stats_register("ring.poller_wakeups");
+}
+
+// Take the next submission and reserve room for its completion. Returns
+// false if the queue is empty or the completion queue has no room.
+static bool take_sqe(ring_t *ring, ring_sqe_t *sqe) {
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    uint32_t sq_tail = __atomic_load_n(&ring->header->sq_tail, __ATOMIC_ACQUIRE);
+    uint32_t cq_head = __atomic_load_n(&ring->header->cq_head, __ATOMIC_ACQUIRE);
+    if (sq_tail == ring->sq_head || ring->cq_tail + ring->inflight - cq_head > ring->mask) {
+        spin_unlock_irqrestore(&ring->lock, flags);
+        return false;
+    }
+
+    // Copy it out before publishing the head, which hands the slot back
+    *sqe = ring->sqes[ring->sq_head & ring->mask];
+    ring->sq_head++;
+    ring->inflight++;
+    __atomic_store_n(&ring->header->sq_head, ring->sq_head, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&ring->lock, flags);
+    return true;
+}
+
+static void post_cqe(ring_t *ring, uint64_t user_data, int64_t res) {
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    ring_cqe_t *cqe = &ring->cqes[ring->cq_tail & ring->mask];
+    cqe->user_data = user_data;
+    cqe->res = res;
+    ring->cq_tail++;
+    ring->inflight--;
+    __atomic_store_n(&ring->header->cq_tail, ring->cq_tail, __ATOMIC_SEQ_CST);
+    spin_unlock_irqrestore(&ring->lock, flags);
+
+    // Waiters count themselves before reading the tail, so one of us sees the other
+    if (__atomic_load_n(&ring->cq_waiters, __ATOMIC_SEQ_CST) > 0) {
+        futex(&ring->header->cq_tail, FUTEX_WAKE, UINT32_MAX, NULL, NULL, 0);
+    }
+}
+
+// Run up to max submitted requests in the current task, returning how many ran
+static uint32_t run_requests(ring_t *ring, uint32_t max) {
+    uint32_t done = 0;
+    ring_sqe_t sqe;
+    // A batch ends early when the process stops its threads
+    while (done < max && !sched_current()->interrupted && take_sqe(ring, &sqe)) {
+        int64_t res = -1;
+        if (sqe.nr < SYS_COUNT && (RING_ALLOWED & (1ULL << sqe.nr))) {
+            res = syscall_dispatch(sqe.nr, sqe.args[0], sqe.args[1], sqe.args[2], sqe.args[3],
+                                   sqe.args[4], sqe.args[5]);
+        }
+        post_cqe(ring, sqe.user_data, res);
+        done++;
+    }
+    stats_add(stat_requests, done);
+    return done;
+}
+
+// Sleep until ring_enter wakes the poller or the process stops its threads.
+// The flag is set before the queue is checked again, and programs check it
+// after publishing their tail, so a submission can't slip between the two.
+static void poller_sleep(ring_t *ring) {
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+    __atomic_or_fetch(&ring->header->flags, RING_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->header->sq_tail, __ATOMIC_SEQ_CST) == ring->sq_head) {
+        ring->poller_sleeping = true;
+        sched_set_blocked_interruptible();
+        spin_unlock(&ring->lock);
+        sched_yield();
+        spin_lock(&ring->lock);
+        ring->poller_sleeping = false;
+    }
+    __atomic_and_fetch(&ring->header->flags, ~RING_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+    spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+// Body of the polling thread. Kernel code isn't preempted, so it yields
+// between looks at an empty queue.
+static void poller_main(void *arg) {
+    ring_t *ring = arg;
+    task_t *self = sched_current();
+    uint64_t idle_since = clock_monotonic_ns();
+
+    while (!self->interrupted) {
+        uint32_t done = run_requests(ring, UINT32_MAX);
+        if (done > 0) {
+            stats_add(stat_polled, done);
+            idle_since = clock_monotonic_ns();
+        } else if (clock_monotonic_ns() - idle_since < RING_POLL_IDLE_NS) {
+            sched_yield();
+        } else {
+            poller_sleep(ring);
+            idle_since = clock_monotonic_ns();
+        }
+    }
+    thread_exit();
+}
+
+intptr_t ring_setup(uint32_t entries, uint32_t flags) {
+    task_t *main = sched_current()->group;
+    if (entries == 0 || entries > RING_MAX_ENTRIES || (entries & (entries - 1)) != 0 ||
+        (flags & ~RING_SETUP_SQPOLL) != 0 || main->ring != NULL) {
+        return -1;
+    }
+
+    ring_t *ring = kzalloc(sizeof(ring_t));
+    if (ring == NULL) {
+        return -1;
+    }
+
+    // Anonymous memory is mapped up front, and pinned so MMAP_FIXED can't
+    // unmap it, so the kernel never faults on it
+    size_t size = sizeof(ring_header_t) + entries * (sizeof(ring_sqe_t) + sizeof(ring_cqe_t));
+    intptr_t addr = vm_mmap(0, size, MMAP_PROT_READ | MMAP_PROT_WRITE,
+                            MMAP_PRIVATE | MMAP_ANONYMOUS | MMAP_PINNED, NULL, 0);
+    if (addr == -1) {
+        kfree(ring);
+        return -1;
+    }
+    ring->header = (ring_header_t *)addr;
+    ring->sqes = (ring_sqe_t *)(ring->header + 1);
+    ring->cqes = (ring_cqe_t *)(ring->sqes + entries);
+    ring->mask = entries - 1;
+    ring->header->entries = entries;
+
+    // Another thread may have won the race; its ring stands and our memory
+    // stays behind as ordinary pages
+    ring_t *expected = NULL;
+    if (!__atomic_compare_exchange_n(&main->ring, &expected, ring, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+        kfree(ring);
+        return -1;
+    }
+
+    // Published first, so ring_release frees it even if the poller doesn't
+    // start. The process is then left with a ring it can't use.
+    if (flags & RING_SETUP_SQPOLL) {
+        ring->poller = thread_create_kernel("ring-poll", poller_main, ring);
+        if (ring->poller == NULL) {
+            return -1;
+        }
+    }
+    return addr;
+}
+
+long ring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    ring_t *ring = __atomic_load_n(&sched_current()->group->ring, __ATOMIC_ACQUIRE);
+    if (ring == NULL) {
+        return -1;
+    }
+    stats_inc(stat_enters);
+
+    long submitted = 0;
+    if (ring->poller == NULL) {
+        submitted = run_requests(ring, to_submit);
+    } else if (flags & RING_ENTER_WAKEUP) {
+        uint64_t irq = spin_lock_irqsave(&ring->lock);
+        if (ring->poller_sleeping) {
+            ring->poller_sleeping = false;
+            sched_wake(ring->poller);
+            stats_inc(stat_poller_wakeups);
+        }
+        spin_unlock_irqrestore(&ring->lock, irq);
+    }
+
+    if (min_complete > 0) {
+        __atomic_add_fetch(&ring->cq_waiters, 1, __ATOMIC_SEQ_CST);
+        while (!sched_current()->interrupted) {
+            uint32_t tail = __atomic_load_n(&ring->header->cq_tail, __ATOMIC_SEQ_CST);
+            uint32_t head = __atomic_load_n(&ring->header->cq_head, __ATOMIC_ACQUIRE);
+            if (tail - head >= min_complete) {
+                break;
+            }
+            futex(&ring->header->cq_tail, FUTEX_WAIT, tail, NULL, NULL, 0);
+        }
+        __atomic_sub_fetch(&ring->cq_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    return submitted;
+}
+
+void ring_release() {
+    task_t *main = sched_current()->group;
+    kfree(main->ring);
+    main->ring = NULL;
+}
@@ -0,0 +1,484 @@
+#include "sched.h"
+
+#include <string.h>
+
+#include "apic.h"
+#include "gdt.h"
+#include "kmalloc.h"
+#include "klog.h"
+#include "msr.h"
+#include "page.h"
+#include "percpu.h"
+#include "stats.h"
+#include "util.h"
+
+// Kernel stacks live in their own slice of the higher half, each below an
+// unmapped guard page so an overflow faults instead of corrupting memory
+#define KSTACK_REGION 0xFFFFFE0000000000
+#define KSTACK_SLOT_SIZE (KSTACK_SIZE + PAGE_SIZE)
+
+// A CPU's queue of runnable tasks
+typedef struct run_queue {
+    spinlock_t lock;
+    task_t *head;
+    task_t *tail;
+    volatile size_t length;
+} __cacheline_aligned run_queue_t;
+
+static run_queue_t run_queues[MAX_CPUS];
+
+// Each CPU's scheduler loop runs as a task on the stack the CPU booted on
+static task_t idle_tasks[MAX_CPUS];
+
+// Stacks of exited tasks. They stay mapped, so reusing one needs no TLB flush.
+typedef struct free_kstack {
+    struct free_kstack *next;
+} free_kstack_t;
+
+static spinlock_t kstack_lock = SPINLOCK_INIT;
+static free_kstack_t *free_kstacks = NULL;
+static uintptr_t kstack_next = KSTACK_REGION;
+
+static uintptr_t kernel_root;
+
+static stat_id_t stat_context_switches;
+static stat_id_t stat_steals;
+
+// Defined in context_switch.s
+void context_switch(uintptr_t *save_rsp, uintptr_t next_rsp);
+void task_trampoline();
+
+// Map a fresh kernel stack, or reuse one left behind by an exited task
+static uintptr_t kstack_alloc() {
+    uint64_t flags = spin_lock_irqsave(&kstack_lock);
+
+    if (free_kstacks != NULL) {
+        uintptr_t stack = (uintptr_t)free_kstacks;
+        free_kstacks = free_kstacks->next;
+        spin_unlock_irqrestore(&kstack_lock, flags);
+        return stack;
+    }
+
+    // Leave the first page of the slot unmapped as the guard
+    uintptr_t stack = kstack_next + PAGE_SIZE;
+    kstack_next += KSTACK_SLOT_SIZE;
+    for (uintptr_t p = stack; p < stack + KSTACK_SIZE; p += PAGE_SIZE) {
+        if (!vm_map(kernel_root, p, false, true, false)) {
+            spin_unlock_irqrestore(&kstack_lock, flags);
+            return 0;
+        }
+    }
+
+    spin_unlock_irqrestore(&kstack_lock, flags);
+    return stack;
+}
+
+static void kstack_free(uintptr_t stack) {
+    uint64_t flags = spin_lock_irqsave(&kstack_lock);
+    free_kstack_t *entry = (free_kstack_t *)stack;
+    entry->next = free_kstacks;
+    free_kstacks = entry;
+    spin_unlock_irqrestore(&kstack_lock, flags);
+}
+
+// Append a task to a CPU's run queue
+static void enqueue(size_t cpu, task_t *task) {
+    run_queue_t *rq = &run_queues[cpu];
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+
+    task->cpu = cpu;
+    task->next = NULL;
+    if (rq->tail != NULL) {
+        rq->tail->next = task;
+    } else {
+        rq->head = task;
+    }
+    rq->tail = task;
+    rq->length++;
+
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    // Wake the CPU in case it is halted in its scheduler loop
+    if (cpu != cpu_id()) {
+        lapic_send_ipi(cpus[cpu].lapic_id, APIC_RESCHEDULE_VECTOR);
+    }
+}
+
+// Pop the first task off a run queue, or the first unpinned one for a CPU
+// stealing from it. Called with the queue's lock held.
+static task_t *dequeue_locked(run_queue_t *rq, bool steal) {
+    task_t *prev = NULL;
+    task_t *task = rq->head;
+    while (steal && task != NULL && task->pinned) {
+        prev = task;
+        task = task->next;
+    }
+    if (task == NULL) {
+        return NULL;
+    }
+
+    if (prev != NULL) {
+        prev->next = task->next;
+    } else {
+        rq->head = task->next;
+    }
+    if (rq->tail == task) {
+        rq->tail = prev;
+    }
+    rq->length--;
+    task->next = NULL;
+    return task;
+}
+
+// Pick the next task for this CPU, taking one from a busier CPU if ours is empty
+static task_t *pick_next(size_t cpu) {
+    run_queue_t *rq = &run_queues[cpu];
+    spin_lock(&rq->lock);
+    task_t *task = dequeue_locked(rq, false);
+    spin_unlock(&rq->lock);
+    if (task != NULL) {
+        return task;
+    }
+
+    for (size_t i = 1; i < cpu_count; i++) {
+        run_queue_t *victim = &run_queues[(cpu + i) % cpu_count];
+        // Peek first so idle CPUs don't hammer the lock of an empty queue
+        if (victim->length == 0 || !spin_trylock(&victim->lock)) {
+            continue;
+        }
+        task = dequeue_locked(victim, true);
+        spin_unlock(&victim->lock);
+        if (task != NULL) {
+            stats_inc(stat_steals);
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+// The online CPU with the shortest run queue
+static size_t least_loaded_cpu() {
+    size_t best = cpu_id();
+    for (size_t i = 0; i < cpu_count; i++) {
+        if (cpus[i].online && run_queues[i].length < run_queues[best].length) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Make a task runnable again after it has been switched out. Called with the task's lock held.
+static void requeue_locked(task_t *task) {
+    task->state = TASK_RUNNABLE;
+    task->slice = SCHED_SLICE_TICKS;
+    if (task->pinned) {
+        enqueue(task->cpu, task);
+    } else {
+        enqueue(task->on_cpu ? cpu_id() : least_loaded_cpu(), task);
+    }
+}
+
+void sched_init_cpu() {
+    cpu_t *cpu = this_cpu();
+    task_t *idle = &idle_tasks[cpu->id];
+
+    memset(idle, 0, sizeof(task_t));
+    idle->root = kernel_root;
+    idle->state = TASK_RUNNING;
+    idle->on_cpu = true;
+    idle->image = "idle";
+    idle->group = idle;
+    memcpy(idle->name, "idle", sizeof("idle"));
+
+    cpu->idle = idle;
+    cpu->current = idle;
+
+    // Start taking TLB shootdowns, and drop anything cached from before
+    // another CPU changed the page tables we were parked on
+    __atomic_store_n(&cpu->active_root, read_cr3(), __ATOMIC_SEQ_CST);
+    write_cr3(read_cr3());
+}
+
+void sched_init() {
+    kernel_root = read_cr3();
+    stat_context_switches = stats_register("sched.context_switches");
+    stat_steals = stats_register("sched.steals");
+    sched_init_cpu();
+}
+
+task_t *sched_create(const char *name, task_entry_t entry, void *arg) {
+    task_t *task = kzalloc(sizeof(task_t));
+    if (task == NULL) {
+        return NULL;
+    }
+
+    task->kstack = kstack_alloc();
+    if (task->kstack == 0) {
+        kfree(task);
+        return NULL;
+    }
+
+    task->root = kernel_root;
+    task->image = "none";
+    task->group = task;
+    size_t len = strlen(name);
+    memcpy(task->name, name, len < sizeof(task->name) ? len : sizeof(task->name) - 1);
+
+    // Build the frame context_switch pops: callee-saved registers, then the
+    // return address. The trampoline finds the entry point in r12 and its
+    // argument in r13, and a zero rbp ends frame-pointer walks.
+    uintptr_t *sp = (uintptr_t *)(task->kstack + KSTACK_SIZE);
+    *--sp = (uintptr_t)task_trampoline;
+    *--sp = 0;                  // rbp
+    *--sp = 0;                  // rbx
+    *--sp = (uintptr_t)entry;   // r12
+    *--sp = (uintptr_t)arg;     // r13
+    *--sp = 0;                  // r14
+    *--sp = 0;                  // r15
+    task->rsp = (uintptr_t)sp;
+    return task;
+}
+
+void sched_start(task_t *task) {
+    uint64_t flags = spin_lock_irqsave(&task->lock);
+    requeue_locked(task);
+    spin_unlock_irqrestore(&task->lock, flags);
+}
+
+void sched_start_on(task_t *task, size_t cpu) {
+    uint64_t flags = spin_lock_irqsave(&task->lock);
+    task->pinned = true;
+    task->cpu = cpu;
+    requeue_locked(task);
+    spin_unlock_irqrestore(&task->lock, flags);
+}
+
+void sched_destroy(task_t *task) {
+    kstack_free(task->kstack);
+    kfree(task);
+}
+
+task_t *sched_spawn(const char *name, task_entry_t entry, void *arg) {
+    task_t *task = sched_create(name, entry, arg);
+    if (task != NULL) {
+        sched_start(task);
+    }
+    return task;
+}
+
+uintptr_t sched_kernel_root() { return kernel_root; }
+
+void sched_switch_root(uintptr_t root) {
+    uint64_t flags = irq_save();
+    sched_current()->root = root;
+    // Publish before loading, as in sched_run
+    __atomic_store_n(&this_cpu()->active_root, root, __ATOMIC_SEQ_CST);
+    write_cr3(root);
+    irq_restore(flags);
+}
+
+task_t *sched_current() { return this_cpu()->current; }
+
+// Switch from the current task back to this CPU's scheduler loop
+static void schedule() {
+    uint64_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    task_t *task = cpu->current;
+    context_switch(&task->rsp, cpu->idle->rsp);
+
+    // The task may resume on a different CPU
+    irq_restore(flags);
+}
+
+void sched_run() {
+    cpu_t *cpu = this_cpu();
+    task_t *idle = cpu->idle;
+
+    while (true) {
+        irq_save();
+        task_t *next = pick_next(cpu->id);
+        if (next == NULL) {
+            // Nothing to run, so catch the console up with the log first
+            if (klog_pending()) {
+                __asm__ volatile("sti" : : : "memory");
+                klog_drain();
+                continue;
+            }
+
+            // Sleep until the next tick, or until another CPU queues work
+            // here and sends a reschedule IPI
+            __asm__ volatile("sti; hlt" : : : "memory");
+            continue;
+        }
+
+        spin_lock(&next->lock);
+        next->state = TASK_RUNNING;
+        next->on_cpu = true;
+        spin_unlock(&next->lock);
+
+        cpu->current = next;
+        gdt_set_kernel_stack(next->kstack + KSTACK_SIZE);
+        if (next->root != read_cr3()) {
+            // Publish the switch before loading the tables, so a shootdown
+            // of next's address space either sees us or finishes first
+            __atomic_store_n(&cpu->active_root, next->root, __ATOMIC_SEQ_CST);
+            write_cr3(next->root);
+        }
+        // Kernel code never touches FS, so only user tasks need their own base
+        if (next->pid != 0 && next->fs_base != cpu->fs_base) {
+            wrmsr(MSR_FS_BASE, next->fs_base);
+            cpu->fs_base = next->fs_base;
+        }
+
+        stats_inc(stat_context_switches);
+        context_switch(&idle->rsp, next->rsp);
+
+        // Back from the task. Now that its stack is no longer in use, either
+        // requeue it or finish it off.
+        cpu->current = idle;
+        spin_lock(&next->lock);
+        if (next->state == TASK_DEAD) {
+            spin_unlock(&next->lock);
+            kstack_free(next->kstack);
+            kfree(next);
+            continue;
+        }
+        if (next->state != TASK_BLOCKED) {
+            requeue_locked(next);
+        }
+        next->on_cpu = false;
+        spin_unlock(&next->lock);
+    }
+}
+
+void sched_yield() { schedule(); }
+
+void sched_exit() {
+    irq_save();
+    task_t *task = sched_current();
+    spin_lock(&task->lock);
+    task->state = TASK_DEAD;
+    spin_unlock(&task->lock);
+    schedule();
+
+    klog(KLOG_ERR, "sched_exit: dead task resumed\n");
+    halt();
+}
+
+void sched_set_blocked() {
+    task_t *task = sched_current();
+    spin_lock(&task->lock);
+    task->state = TASK_BLOCKED;
+    spin_unlock(&task->lock);
+}
+
+void sched_set_blocked_interruptible() {
+    task_t *task = sched_current();
+    spin_lock(&task->lock);
+    if (!task->interrupted) {
+        task->state = TASK_BLOCKED;
+        task->interruptible = true;
+    }
+    spin_unlock(&task->lock);
+}
+
+// Make a blocked task runnable. Called with the task's lock held.
+static void wake_locked(task_t *task) {
+    task->interruptible = false;
+    // A task still on its CPU is requeued by that CPU's scheduler loop once
+    // it has switched away
+    if (task->on_cpu) {
+        task->state = TASK_RUNNABLE;
+    } else {
+        requeue_locked(task);
+    }
+}
+
+void sched_wake(task_t *task) {
+    uint64_t flags = spin_lock_irqsave(&task->lock);
+    if (task->state == TASK_BLOCKED) {
+        wake_locked(task);
+    }
+    spin_unlock_irqrestore(&task->lock, flags);
+}
+
+void sched_interrupt(task_t *task) {
+    uint64_t flags = spin_lock_irqsave(&task->lock);
+    task->interrupted = true;
+    if (task->state == TASK_BLOCKED && task->interruptible) {
+        wake_locked(task);
+    }
+    spin_unlock_irqrestore(&task->lock, flags);
+}
+
+void sched_set_fs_base(uintptr_t base) {
+    uint64_t flags = irq_save();
+    sched_current()->fs_base = base;
+    this_cpu()->fs_base = base;
+    wrmsr(MSR_FS_BASE, base);
+    irq_restore(flags);
+}
+
+void sched_tick(bool user) {
+    task_t *task = sched_current();
+    if (task == this_cpu()->idle) {
+        return;
+    }
+
+    if (task->slice > 0) {
+        task->slice--;
+    }
+
+    // Kernel code is never preempted, it blocks or returns to user space soon enough
+    if (user && task->slice == 0 && run_queues[cpu_id()].length > 0) {
+        schedule();
+    }
+}
+
+void wait_queue_sleep(wait_queue_t *wq) {
+    // task->next belongs to the run queues, which a wakeup may put the task
+    // on while it is still queued here
+    wait_entry_t entry = {.next = NULL, .task = sched_current()};
+    if (wq->tail != NULL) {
+        wq->tail->next = &entry;
+    } else {
+        wq->head = &entry;
+    }
+    wq->tail = &entry;
+
+    // Block before dropping the queue lock so a wake_up in between isn't lost.
+    // A process that is exiting interrupts the sleep.
+    sched_set_blocked_interruptible();
+    spin_unlock(&wq->lock);
+
+    schedule();
+
+    spin_lock(&wq->lock);
+
+    // An interrupted task is still queued, so take it off
+    wait_entry_t *prev = NULL;
+    for (wait_entry_t **link = &wq->head; *link != NULL; prev = *link, link = &(*link)->next) {
+        if (*link == &entry) {
+            *link = entry.next;
+            if (wq->tail == &entry) {
+                wq->tail = prev;
+            }
+            break;
+        }
+    }
+}
+
+void wake_up(wait_queue_t *wq) {
+    // Wake them under the lock, which a sleeper takes again before its entry
+    // goes away
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    wait_entry_t *entry = wq->head;
+    wq->head = wq->tail = NULL;
+    while (entry != NULL) {
+        wait_entry_t *next = entry->next;
+        sched_wake(entry->task);
+        entry = next;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
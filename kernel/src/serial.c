@@ -0,0 +1,190 @@
+#include "serial.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "apic.h"
+#include "keyboard.h"
+#include "percpu.h"
+#include "pic.h"
+#include "port.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "trace.h"
+
+#define COM1 0x3F8
+
+// UART registers, as offsets from the base port
+#define UART_DATA 0         // receive/transmit buffer, divisor low byte when DLAB is set
+#define UART_IER 1          // interrupt enable, divisor high byte when DLAB is set
+#define UART_IIR 2          // interrupt identification (read)
+#define UART_FCR 2          // FIFO control (write)
+#define UART_LCR 3          // line control
+#define UART_MCR 4          // modem control
+#define UART_LSR 5          // line status
+
+#define UART_IER_RX 0x01    // interrupt when data arrives
+#define UART_IER_TX 0x02    // interrupt when the transmit FIFO empties
+
+#define UART_IIR_NONE 0x01  // no interrupt is pending
+
+#define UART_FCR_ENABLE 0x07      // enable and clear both FIFOs
+#define UART_FCR_TRIGGER_14 0xC0  // receive interrupt at 14 bytes (or on timeout)
+
+#define UART_LCR_8N1 0x03
+#define UART_LCR_DLAB 0x80
+
+#define UART_MCR_DTR 0x01
+#define UART_MCR_RTS 0x02
+#define UART_MCR_OUT2 0x08  // gates the UART's interrupt line
+
+#define UART_LSR_DATA 0x01  // a received byte is waiting
+#define UART_LSR_THRE 0x20  // the transmit FIFO is empty
+#define UART_LSR_TEMT 0x40  // the transmit FIFO and shift register are empty
+
+#define UART_FIFO_SIZE 16
+#define UART_CLOCK 115200
+
+#define BAUD_RATE 115200
+
+// Bytes waiting to be sent. The interrupt handler refills the FIFO from
+// here, so writers never wait on the line unless the ring fills up.
+static char tx_ring[SERIAL_TX_RING_SIZE];
+static size_t tx_head = 0;  // bytes queued
+static size_t tx_tail = 0;  // bytes handed to the UART
+static bool tx_active = false;  // the transmit interrupt is armed
+static spinlock_t tx_lock = SPINLOCK_INIT;
+
+static bool ready = false;
+
+static stat_id_t stat_tx_bytes;
+static stat_id_t stat_rx_bytes;
+static stat_id_t stat_tx_stalls;
+
+// Move up to a FIFO's worth of bytes from the ring to the UART, whose
+// FIFO must be empty. Called with the ring locked.
+static void tx_fill_fifo() {
+    for (size_t i = 0; i < UART_FIFO_SIZE && tx_tail != tx_head; i++) {
+        outb(COM1 + UART_DATA, tx_ring[tx_tail % SERIAL_TX_RING_SIZE]);
+        tx_tail++;
+    }
+}
+
+// Queue one byte. Called with the ring locked.
+static void tx_push(char c) {
+    if (tx_head - tx_tail == SERIAL_TX_RING_SIZE) {
+        // The ring is full and the handler can't run while we hold the lock,
+        // so drain a FIFO's worth by hand
+        stats_inc(stat_tx_stalls);
+        while (!(inb(COM1 + UART_LSR) & UART_LSR_THRE)) {
+            __asm__ volatile("pause");
+        }
+        tx_fill_fifo();
+    }
+    tx_ring[tx_head % SERIAL_TX_RING_SIZE] = c;
+    tx_head++;
+}
+
+void serial_write(const char *s, size_t size) {
+    if (!ready) {
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    for (size_t i = 0; i < size; i++) {
+        if (s[i] == '\n') {
+            tx_push('\r');
+        }
+        tx_push(s[i]);
+    }
+    stats_add(stat_tx_bytes, size);
+
+    // An idle transmitter has an empty FIFO; prime it and let the
+    // interrupt take over from there
+    if (!tx_active) {
+        tx_fill_fifo();
+        tx_active = true;
+        outb(COM1 + UART_IER, UART_IER_RX | UART_IER_TX);
+    }
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+void serial_flush() {
+    if (!ready) {
+        return;
+    }
+
+    // Feed the UART by hand; the handler finds the ring empty afterwards
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    while (tx_tail != tx_head) {
+        while (!(inb(COM1 + UART_LSR) & UART_LSR_THRE)) {
+            __asm__ volatile("pause");
+        }
+        tx_fill_fifo();
+    }
+    while (!(inb(COM1 + UART_LSR) & UART_LSR_TEMT)) {
+        __asm__ volatile("pause");
+    }
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+void serial_handler(interrupt_context_t *ctx) {
+    TRACE(TRACE_IRQ, IRQ4_INTERRUPT, 0);
+
+    // The IRQ is edge triggered, so keep going until the UART has nothing
+    // pending or its line would stay raised and never interrupt again
+    while (!(inb(COM1 + UART_IIR) & UART_IIR_NONE)) {
+        // Pass received bytes to the console input, as terminals send them
+        while (inb(COM1 + UART_LSR) & UART_LSR_DATA) {
+            char c = inb(COM1 + UART_DATA);
+            stats_inc(stat_rx_bytes);
+            if (c == '\r') {
+                c = '\n';
+            } else if (c == 0x7F) {
+                c = '\b';
+            }
+            keyboard_inject(c);
+        }
+
+        spin_lock(&tx_lock);
+        if (tx_active && (inb(COM1 + UART_LSR) & UART_LSR_THRE)) {
+            if (tx_tail == tx_head) {
+                // Nothing left to send, so stop asking for transmit interrupts
+                tx_active = false;
+                outb(COM1 + UART_IER, UART_IER_RX);
+            } else {
+                tx_fill_fifo();
+            }
+        }
+        spin_unlock(&tx_lock);
+    }
+
+    lapic_eoi();  // end of interrupt message
+}
+
+void serial_init() {
+    stat_tx_bytes = stats_register("serial.tx_bytes");
+    stat_rx_bytes = stats_register("serial.rx_bytes");
+    stat_tx_stalls = stats_register("serial.tx_stalls");
+
+    uint16_t divisor = UART_CLOCK / BAUD_RATE;
+
+    outb(COM1 + UART_IER, 0);
+    outb(COM1 + UART_LCR, UART_LCR_DLAB);
+    outb(COM1 + UART_DATA, divisor & 0xFF);
+    outb(COM1 + UART_IER, divisor >> 8);
+    outb(COM1 + UART_LCR, UART_LCR_8N1);
+    outb(COM1 + UART_FCR, UART_FCR_ENABLE | UART_FCR_TRIGGER_14);
+    outb(COM1 + UART_MCR, UART_MCR_DTR | UART_MCR_RTS | UART_MCR_OUT2);
+
+    // A missing UART reads back as all ones
+    if (inb(COM1 + UART_LSR) == 0xFF) {
+        return;
+    }
+
+    idt_set_handler(IRQ4_INTERRUPT, serial_handler, IDT_TYPE_INTERRUPT);
+    ioapic_route_irq(4, IRQ4_INTERRUPT, this_cpu()->lapic_id);
+    outb(COM1 + UART_IER, UART_IER_RX);
+
+    ready = true;
+}
@@ -0,0 +1,71 @@
+#include "smp.h"
+
+#include <stdbool.h>
+
+#include "apic.h"
+#include "clock.h"
+#include "gdt.h"
+#include "idt.h"
+#include "page.h"
+#include "percpu.h"
+#include "sched.h"
+
+// Boot stacks for the application processors. They keep running their
+// scheduler loops on these.
+#define AP_STACK_SIZE 8192
+static uint8_t ap_stacks[MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(16)));
+
+static volatile bool released = false;
+
+// Entry point of the application processors, with our CPU index as argument
+static void ap_entry(struct stivale2_smp_info *info) {
+    size_t id = info->extra_argument;
+    percpu_init(id, info->lapic_id);
+    gdt_setup(id);
+    pat_init();
+    idt_load();
+
+    __atomic_store_n(&cpus[id].online, 1, __ATOMIC_RELEASE);
+
+    while (!__atomic_load_n(&released, __ATOMIC_ACQUIRE)) {
+        __asm__ volatile("pause");
+    }
+
+    lapic_init();
+    lapic_timer_start(HZ);
+    sched_init_cpu();
+    sched_run();
+}
+
+void smp_init(struct stivale2_struct_tag_smp *smp) {
+    cpus[0].online = 1;
+    if (smp == NULL) {
+        return;
+    }
+
+    size_t next = 1;
+    for (uint64_t i = 0; i < smp->cpu_count; i++) {
+        struct stivale2_smp_info *info = &smp->smp_info[i];
+        if (info->lapic_id == smp->bsp_lapic_id) {
+            cpus[0].lapic_id = info->lapic_id;
+            continue;
+        }
+        if (next == MAX_CPUS) {
+            break;  // the rest stay parked in the bootloader
+        }
+
+        size_t id = next++;
+        info->target_stack = (uintptr_t)ap_stacks[id] + AP_STACK_SIZE;
+        info->extra_argument = id;
+
+        // Writing the entry point is what sets the processor going
+        __atomic_store_n(&info->goto_address, (uintptr_t)ap_entry, __ATOMIC_RELEASE);
+        while (!__atomic_load_n(&cpus[id].online, __ATOMIC_ACQUIRE)) {
+            __asm__ volatile("pause");
+        }
+    }
+
+    cpu_count = next;
+}
+
+void smp_release() { __atomic_store_n(&released, true, __ATOMIC_RELEASE); }
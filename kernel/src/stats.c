@@ -0,0 +1,58 @@
+#include "stats.h"
+
+#include <string.h>
+
+#include "page.h"
+#include "spinlock.h"
+
+stats_cpu_t stats_percpu[MAX_CPUS];
+
+// Counter names, indexed by id. Slot 0 is reserved as the scratch counter.
+static const char *stat_names[STATS_MAX_COUNTERS];
+static size_t stat_count = 1;
+static spinlock_t stats_lock = SPINLOCK_INIT;
+
+stat_id_t stats_register(const char *name) {
+    uint64_t flags = spin_lock_irqsave(&stats_lock);
+    if (stat_count == STATS_MAX_COUNTERS) {
+        spin_unlock_irqrestore(&stats_lock, flags);
+        return 0;
+    }
+
+    stat_id_t id = stat_count++;
+    stat_names[id] = name;
+    spin_unlock_irqrestore(&stats_lock, flags);
+
+    return id;
+}
+
+int64_t stats_read(stat_id_t id) {
+    int64_t total = 0;
+    for (size_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        total += stats_percpu[cpu].values[id];
+    }
+    return total;
+}
+
+int64_t stats_snapshot(stat_entry_t *entries, size_t count) {
+    size_t registered = stat_count - 1;
+
+    for (size_t i = 0; i < registered && i < count; i++) {
+        stat_id_t id = i + 1;
+        const char *name = stat_names[id];
+
+        // Copy the name, truncating if needed
+        stat_entry_t entry = {0};
+        size_t len = strlen(name);
+        if (len >= STATS_NAME_MAX) {
+            len = STATS_NAME_MAX - 1;
+        }
+        memcpy(entry.name, name, len);
+        entry.value = stats_read(id);
+        if (!copy_to_user(&entries[i], &entry, sizeof(entry))) {
+            return -1;
+        }
+    }
+
+    return registered;
+}
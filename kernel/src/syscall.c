@@ -1,70 +1,169 @@
 #include "syscall.h"
 
+#include <string.h>
+
+#include "clock.h"
+#include "console.h"
 #include "elf.h"
+#include "futex.h"
 #include "gdt.h"
-#include "keyboard.h"
+#include "klog.h"
+#include "mmap.h"
 #include "kstdio.h"
 #include "page.h"
+#include "pipe.h"
+#include "port.h"
+#include "proc.h"
+#include "profile.h"
+#include "ring.h"
+#include "sched.h"
+#include "serial.h"
+#include "stats.h"
+#include "thread.h"
+#include "trace.h"
+#include "util.h"
+#include "vfs.h"
 
-typedef long ssize_t;  // signed size_t
-typedef long long off_t;
+// QEMU's isa-debug-exit device, as tools/bench.py configures it
+#define ISA_DEBUG_EXIT_PORT 0xF4
 
 static struct stivale2_struct_tag_modules *modules;
 
+// Per-syscall counters and the names they are registered under
+static stat_id_t stat_syscalls[SYS_COUNT];
+static const char *syscall_stat_names[SYS_COUNT] = {
+    [SYS_read] = "syscall.read",
+    [SYS_write] = "syscall.write",
+    [SYS_mmap] = "syscall.mmap",
+    [SYS_exec] = "syscall.exec",
+    [SYS_exit] = "syscall.exit",
+    [SYS_stats] = "syscall.stats",
+    [SYS_clock_gettime] = "syscall.clock_gettime",
+    [SYS_nanosleep] = "syscall.nanosleep",
+    [SYS_profile] = "syscall.profile",
+    [SYS_dmesg] = "syscall.dmesg",
+    [SYS_trace] = "syscall.trace",
+    [SYS_open] = "syscall.open",
+    [SYS_close] = "syscall.close",
+    [SYS_lseek] = "syscall.lseek",
+    [SYS_stat] = "syscall.stat",
+    [SYS_getdents] = "syscall.getdents",
+    [SYS_pipe] = "syscall.pipe",
+    [SYS_dup2] = "syscall.dup2",
+    [SYS_spawn] = "syscall.spawn",
+    [SYS_waitpid] = "syscall.waitpid",
+    [SYS_getpid] = "syscall.getpid",
+    [SYS_futex] = "syscall.futex",
+    [SYS_clone] = "syscall.clone",
+    [SYS_thread_exit] = "syscall.thread_exit",
+    [SYS_arch_prctl] = "syscall.arch_prctl",
+    [SYS_ring_setup] = "syscall.ring_setup",
+    [SYS_ring_enter] = "syscall.ring_enter",
+    [SYS_poweroff] = "syscall.poweroff",
+};
+
 void syscall_init(struct stivale2_struct_tag_modules *mod) {
     modules = mod;
-    idt_set_handler(0x80, syscall_entry, IDT_TYPE_TRAP);
+    for (size_t i = 0; i < SYS_COUNT; i++) {
+        stat_syscalls[i] = stats_register(syscall_stat_names[i]);
+    }
+    idt_set_gate(0x80, syscall_entry, IDT_TYPE_INTERRUPT, IDT_DPL_USER);
 }
 
 ssize_t sys_read(int fd, void *buf, size_t count) {
-    size_t index = 0;
-    char *buffer = (char *)buf;
-
-    while (index < count) {
-        char ch = kgetc();
-
-        if (ch == 8) {  // backspace
-            index = index == 0 ? 0 : index - 1;
-        } else {
-            buffer[index] = ch;
-            index += 1;
-        }
+    if (!user_range_ok(buf, count)) {
+        return -1;
     }
-
-    return index;
+    file_t *file = fd_get(fd);
+    if (file == NULL) {
+        return -1;
+    }
+    ssize_t ret = file->ops->read(file, buf, count);
+    file_put(file);
+    return ret;
 }
 
 ssize_t sys_write(int fd, const void *buf, size_t count) {
-    char *buffer = (char *)buf;
-    size_t write_count = 0;
-
-    for (size_t i = 0; i < count; i++) {
-        kprintf("%c", buffer[i]);
-        write_count += 1;
+    if (!user_range_ok(buf, count)) {
+        return -1;
     }
-
-    return write_count;
+    file_t *file = fd_get(fd);
+    if (file == NULL) {
+        return -1;
+    }
+    ssize_t ret = file->ops->write(file, buf, count);
+    file_put(file);
+    return ret;
 }
 
 intptr_t sys_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
-    uintptr_t root = read_cr3();
-    intptr_t start = ((intptr_t)addr / PAGE_SIZE) * PAGE_SIZE;  // left-align the address
-    length += ((intptr_t)addr - start);
+    if (flags & MMAP_PINNED) {
+        return -1;
+    }
+    file_t *file = flags & MMAP_ANONYMOUS ? NULL : fd_get(fd);
+    intptr_t start = vm_mmap((uintptr_t)addr, length, prot, flags, file, offset);
+    if (file != NULL) {
+        file_put(file);
+    }
+    if (start == -1) {
+        klog(KLOG_WARN, "mmap: can't map %lu bytes at %p\n", length, addr);
+    }
+    return start;
+}
 
-    for (size_t offset = 0; offset < length; offset += PAGE_SIZE) {
-        if (!vm_map(root, start + offset, true, true, true)) {
-            kprintf("mmap: vm_map failed!\n");
+// Copy a path from user space, failing if it doesn't fit
+static bool copy_path(char *dst, const char *src) {
+    for (size_t i = 0; i < VFS_PATH_MAX; i++) {
+        if (!copy_from_user(&dst[i], src + i, 1)) {
+            return false;
+        }
+        if (dst[i] == '\0') {
+            return true;
         }
     }
+    return false;
+}
 
-    return start;
+// Find the program a path names, with bare names taken as programs in /bin
+static dentry_t *find_program(const char *path) {
+    dentry_t *d = NULL;
+    if (strchr(path, '/') != NULL) {
+        d = vfs_lookup(path);
+    } else {
+        char bin_path[VFS_PATH_MAX + 5];
+        ksnprintf(bin_path, sizeof(bin_path), "/bin/%s", path);
+        d = vfs_lookup(bin_path);
+    }
+    if (d == NULL || (d->inode->mode & VFS_S_IFMT) != VFS_S_IFREG) {
+        return NULL;
+    }
+    return d;
 }
 
-int sys_exec(const char *file_name, char *const argv[]) {
+int sys_exec(const char *file_name, char *const argv[], char *const envp[]) {
+    // Only the main thread may replace the image, after stopping the others
+    if (sched_current()->group != sched_current()) {
+        return -1;
+    }
+
+    // Take the arguments out of user memory before exec tears it down
+    char path[VFS_PATH_MAX];
+    exec_args_t args;
+    if (!copy_path(path, file_name) || !exec_args_copy(&args, argv, envp)) {
+        return -1;
+    }
+
+    dentry_t *d = find_program(path);
+    if (d != NULL) {
+        exec_image(d->name, (uintptr_t)d->inode->data, d->inode->size, d->inode, &args);
+        return 0;
+    }
+
+    // Programs loaded as modules of their own
     for (uint64_t i = 0; i < modules->module_count; i++) {
         struct stivale2_module module = modules->modules[i];
-        if (strcmp(module.string, file_name) == 0) {
-            exec_module(module);
+        if (strcmp(module.string, path) == 0) {
+            exec_image(module.string, module.begin, module.end - module.begin, NULL, &args);
             return 0;
         }
     }
@@ -72,6 +171,29 @@ int sys_exec(const char *file_name, char *const argv[]) {
 }
 
 int sys_exit(int status) {
+    // Other threads leave tearing the process down to its main thread. Init's
+    // threads can't end it.
+    task_t *task = sched_current();
+    if (task->group != task) {
+        if (task->pid == PROC_INIT_PID) {
+            thread_exit();
+        }
+        thread_exit_group(status);
+    }
+
+    if (task->pid != PROC_INIT_PID) {
+        proc_exit(status);
+    }
+
+    // Init has nobody to report to, so it starts over on the console
+    thread_stop_others();
+    for (int fd = 0; fd < TASK_MAX_FILES; fd++) {
+        fd_close(fd);
+    }
+    for (int fd = 0; fd < 3; fd++) {
+        fd_install(console_open());
+    }
+
     for (uint64_t i = 0; i < modules->module_count; i++) {
         struct stivale2_module module = modules->modules[i];
         if (strcmp(module.string, "init") == 0) {
@@ -82,8 +204,256 @@ int sys_exit(int status) {
     return -1;
 }
 
-int syscall_handler(uint64_t nr, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3,
-                    uint64_t arg4, uint64_t arg5) {
+ssize_t sys_stats(stat_entry_t *entries, size_t count) {
+    if (!user_array_ok(entries, count, sizeof(stat_entry_t))) {
+        return -1;
+    }
+    return stats_snapshot(entries, count);
+}
+
+int sys_clock_gettime(int clock_id, timespec_t *tp) {
+    // There is no real-time clock source yet, only time since boot
+    uint64_t ns;
+    if (clock_id == CLOCK_MONOTONIC) {
+        ns = clock_monotonic_ns();
+    } else if (clock_id == CLOCK_MONOTONIC_COARSE) {
+        ns = clock_coarse_ns();
+    } else {
+        return -1;
+    }
+
+    timespec_t ts = {.tv_sec = ns / NS_PER_SEC, .tv_nsec = ns % NS_PER_SEC};
+    return copy_to_user(tp, &ts, sizeof(ts)) ? 0 : -1;
+}
+
+int sys_nanosleep(const timespec_t *req, timespec_t *rem) {
+    timespec_t ts;
+    if (!copy_from_user(&ts, req, sizeof(ts))) {
+        return -1;
+    }
+    if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= NS_PER_SEC) {
+        return -1;
+    }
+
+    clock_sleep_ns(clock_timespec_ns(&ts));
+
+    // Only a process that is exiting cuts a sleep short, and it never looks at
+    // the time remaining
+    timespec_t none = {0};
+    if (rem != NULL && !copy_to_user(rem, &none, sizeof(none))) {
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t sys_profile(int op, uint64_t arg, uint64_t arg2) {
+    switch (op) {
+        case PROFILE_START:
+            profile_start(arg);
+            return 0;
+        case PROFILE_STOP:
+            return profile_stop();
+        case PROFILE_READ:
+            if (!user_array_ok((void *)arg, arg2, sizeof(profile_sample_t))) {
+                return -1;
+            }
+            return profile_read((profile_sample_t *)arg, arg2);
+        default:
+            return -1;
+    }
+}
+
+ssize_t sys_dmesg(char *buf, size_t size) {
+    if (!user_range_ok(buf, size)) {
+        return -1;
+    }
+    return klog_read(buf, size);
+}
+
+int sys_open(const char *pathname, int flags) {
+    char path[VFS_PATH_MAX];
+    if (!copy_path(path, pathname)) {
+        return -1;
+    }
+
+    file_t *file = vfs_open(path, flags);
+    if (file == NULL) {
+        return -1;
+    }
+
+    int fd = fd_install(file);
+    if (fd < 0) {
+        file_put(file);
+    }
+    return fd;
+}
+
+int sys_close(int fd) { return fd_close(fd); }
+
+off_t sys_lseek(int fd, off_t offset, int whence) {
+    file_t *file = fd_get(fd);
+    if (file == NULL) {
+        return -1;
+    }
+    off_t ret = vfs_seek(file, offset, whence);
+    file_put(file);
+    return ret;
+}
+
+int sys_stat(const char *pathname, vfs_stat_t *st) {
+    char path[VFS_PATH_MAX];
+    if (!copy_path(path, pathname)) {
+        return -1;
+    }
+
+    dentry_t *d = vfs_lookup(path);
+    if (d == NULL) {
+        return -1;
+    }
+    vfs_stat_t result;
+    vfs_stat(d, &result);
+    return copy_to_user(st, &result, sizeof(result)) ? 0 : -1;
+}
+
+ssize_t sys_getdents(int fd, vfs_dirent_t *dirents, size_t count) {
+    if (!user_array_ok(dirents, count, sizeof(vfs_dirent_t))) {
+        return -1;
+    }
+    file_t *file = fd_get(fd);
+    if (file == NULL) {
+        return -1;
+    }
+    ssize_t ret = vfs_getdents(file, dirents, count);
+    file_put(file);
+    return ret;
+}
+
+int sys_pipe(int fds[2]) {
+    if (!user_range_ok(fds, 2 * sizeof(int))) {
+        return -1;
+    }
+    file_t *read_end;
+    file_t *write_end;
+    if (!pipe_create(&read_end, &write_end)) {
+        return -1;
+    }
+
+    int read_fd = fd_install(read_end);
+    if (read_fd < 0) {
+        file_put(read_end);
+        file_put(write_end);
+        return -1;
+    }
+    int write_fd = fd_install(write_end);
+    if (write_fd < 0) {
+        fd_close(read_fd);
+        file_put(write_end);
+        return -1;
+    }
+
+    int result[2] = {read_fd, write_fd};
+    if (!copy_to_user(fds, result, sizeof(result))) {
+        fd_close(read_fd);
+        fd_close(write_fd);
+        return -1;
+    }
+    return 0;
+}
+
+int sys_dup2(int old_fd, int new_fd) { return fd_dup2(old_fd, new_fd); }
+
+int sys_spawn(const char *file_name, char *const argv[], char *const envp[]) {
+    char path[VFS_PATH_MAX];
+    if (!copy_path(path, file_name)) {
+        return -1;
+    }
+
+    dentry_t *d = find_program(path);
+    if (d == NULL) {
+        return -1;
+    }
+    return proc_spawn(d, argv, envp);
+}
+
+int sys_waitpid(int pid, int *status, int options) {
+    // Waits always block, there are no options yet
+    if (options != 0 || !user_range_ok(status, sizeof(int))) {
+        return -1;
+    }
+    int exit_status;
+    int reaped = proc_wait(pid, &exit_status);
+    if (reaped >= 0 && status != NULL && !copy_to_user(status, &exit_status, sizeof(int))) {
+        return -1;
+    }
+    return reaped;
+}
+
+int sys_getpid() { return sched_current()->pid; }
+
+long sys_futex(uint32_t *addr, int op, uint32_t val, const timespec_t *timeout, uint32_t *addr2,
+               uint32_t val2) {
+    return futex(addr, op, val, timeout, addr2, val2);
+}
+
+long sys_clone(uintptr_t entry, uintptr_t arg, uintptr_t tls, uint32_t *tid_word) {
+    return thread_create(entry, arg, tls, tid_word);
+}
+
+int sys_thread_exit() {
+    // The main thread has nobody to hand the process to, so it ends it
+    if (sched_current()->group == sched_current()) {
+        return sys_exit(0);
+    }
+    thread_exit();
+    return 0;
+}
+
+long sys_arch_prctl(int code, uintptr_t addr) { return thread_arch_prctl(code, addr); }
+
+intptr_t sys_ring_setup(uint32_t entries, uint32_t flags) { return ring_setup(entries, flags); }
+
+long sys_ring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return ring_enter(to_submit, min_complete, flags);
+}
+
+int sys_poweroff(int status) {
+    if (sched_current()->pid != PROC_INIT_PID) {
+        return -1;
+    }
+
+    // Let the serial console finish, then leave QEMU through its
+    // isa-debug-exit device, whose exit status is (status << 1) | 1. On
+    // other machines the write goes nowhere and the CPU stops instead.
+    klog(KLOG_INFO, "poweroff: status %d\n", status);
+    klog_flush();
+    serial_flush();
+    outb(ISA_DEBUG_EXIT_PORT, status);
+    __asm__ volatile("cli");
+    halt();
+    return 0;
+}
+
+ssize_t sys_trace(int op, uint64_t arg, uint64_t arg2) {
+    switch (op) {
+        case TRACE_START:
+            trace_start(arg);
+            return 0;
+        case TRACE_STOP:
+            return trace_stop();
+        case TRACE_READ:
+            if (!user_array_ok((void *)arg, arg2, sizeof(trace_record_t))) {
+                return -1;
+            }
+            return trace_read((trace_record_t *)arg, arg2);
+        case TRACE_TSC_HZ:
+            return clock_tsc_hz();
+        default:
+            return -1;
+    }
+}
+
+int64_t syscall_dispatch(uint64_t nr, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                         uint64_t arg4, uint64_t arg5) {
     switch (nr) {
         case SYS_read:
             return sys_read(arg0, arg1, arg2);
@@ -92,10 +462,72 @@ int syscall_handler(uint64_t nr, uint64_t arg0, uint64_t arg1, uint64_t arg2, ui
         case SYS_mmap:
             return sys_mmap(arg0, arg1, arg2, arg3, arg4, arg5);
         case SYS_exec:
-            return sys_exec(arg0, arg1);
+            return sys_exec((const char *)arg0, (char *const *)arg1, (char *const *)arg2);
         case SYS_exit:
             return sys_exit(arg0);
+        case SYS_stats:
+            return sys_stats((stat_entry_t *)arg0, arg1);
+        case SYS_clock_gettime:
+            return sys_clock_gettime(arg0, (timespec_t *)arg1);
+        case SYS_nanosleep:
+            return sys_nanosleep((const timespec_t *)arg0, (timespec_t *)arg1);
+        case SYS_profile:
+            return sys_profile(arg0, arg1, arg2);
+        case SYS_dmesg:
+            return sys_dmesg((char *)arg0, arg1);
+        case SYS_trace:
+            return sys_trace(arg0, arg1, arg2);
+        case SYS_open:
+            return sys_open((const char *)arg0, arg1);
+        case SYS_close:
+            return sys_close(arg0);
+        case SYS_lseek:
+            return sys_lseek(arg0, arg1, arg2);
+        case SYS_stat:
+            return sys_stat((const char *)arg0, (vfs_stat_t *)arg1);
+        case SYS_getdents:
+            return sys_getdents(arg0, (vfs_dirent_t *)arg1, arg2);
+        case SYS_pipe:
+            return sys_pipe((int *)arg0);
+        case SYS_dup2:
+            return sys_dup2(arg0, arg1);
+        case SYS_spawn:
+            return sys_spawn((const char *)arg0, (char *const *)arg1, (char *const *)arg2);
+        case SYS_waitpid:
+            return sys_waitpid(arg0, (int *)arg1, arg2);
+        case SYS_getpid:
+            return sys_getpid();
+        case SYS_futex:
+            return sys_futex((uint32_t *)arg0, arg1, arg2, (const timespec_t *)arg3,
+                             (uint32_t *)arg4, arg5);
+        case SYS_clone:
+            return sys_clone(arg0, arg1, arg2, (uint32_t *)arg3);
+        case SYS_thread_exit:
+            return sys_thread_exit();
+        case SYS_arch_prctl:
+            return sys_arch_prctl(arg0, arg1);
+        case SYS_ring_setup:
+            return sys_ring_setup(arg0, arg1);
+        case SYS_ring_enter:
+            return sys_ring_enter(arg0, arg1, arg2);
+        case SYS_poweroff:
+            return sys_poweroff(arg0);
         default:
             return -1;
     }
+}
+
+int64_t syscall_handler(uint64_t nr, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                        uint64_t arg4, uint64_t arg5) {
+    if (nr < SYS_COUNT) {
+        stats_inc(stat_syscalls[nr]);
+    }
+
+    TRACE(TRACE_SYSCALL_ENTER, nr, arg0);
+    int64_t ret = syscall_dispatch(nr, arg0, arg1, arg2, arg3, arg4, arg5);
+    TRACE(TRACE_SYSCALL_EXIT, nr, ret);
+
+    // A thread of an exiting process leaves instead of returning
+    thread_check_exit();
+    return ret;
 }
\ No newline at end of file
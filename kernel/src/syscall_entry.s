@@ -3,6 +3,14 @@
 
 # This is the interrupt handler routine called when a system call is issued
 syscall_entry:
+  # Trade the user's GS base for this CPU's data. The gate keeps interrupts
+  # off until it's done.
+  testb $3, 8(%rsp)
+  jz 1f
+  swapgs
+1:
+  sti
+
   # The %rax register holds the sixth syscall argument. Put it on the stack.
   push %rax
 
@@ -12,5 +20,12 @@ syscall_entry:
   # The %rax register now holds the return value. Move the stack up without overwriting %rax.
   add $0x8, %rsp
 
+  # Give the user's GS base back, with interrupts off so none sees it
+  testb $3, 8(%rsp)
+  jz 2f
+  cli
+  swapgs
+2:
+
   # Return from the interrupt handler
   iretq
\ No newline at end of file
@@ -27,6 +27,7 @@
 #include "kstdio.h"
 #include "page.h"
 #include "port.h"
+#include "stats.h"
 
 // Struct representing a single character entry in the VGA buffer
 typedef struct vga_entry {
@@ -38,6 +39,8 @@ typedef struct vga_entry {
 // A pointer to the VGA buffer
 vga_entry_t* term;
 
+static stat_id_t stat_bytes_written;
+
 // The current cursor position in the terminal
 size_t term_col = 0;
 size_t term_row = 0;
@@ -138,12 +141,14 @@ void term_putchar(char c) {
 void term_init() {
     // Get a usable pointer to the VGA text mode buffer
     term = add_virtual_offset(VGA_BUFFER);
+    stat_bytes_written = stats_register("term.bytes_written");
 
     term_enable_cursor();
     term_clear();
 }
 
 void term_putstr(const char* s, size_t size) {
+    stats_add(stat_bytes_written, size);
     for (size_t i = 0; i < size; i++) {
         term_putchar(s[i]);
     }
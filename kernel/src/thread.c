@@ -0,0 +1,293 @@
+#include "thread.h"
+
+#include "futex.h"
+#include "gdt.h"
+#include "kmalloc.h"
+#include "page.h"
+#include "proc.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "tlb.h"
+#include "usermode_entry.h"
+
+#define THREAD_STACK_SLOT_SIZE (THREAD_STACK_SIZE + PAGE_SIZE)
+
+// The threads a process runs besides its main one, allocated when the first
+// one starts. The lock protects everything here.
+typedef struct thread_group {
+    spinlock_t lock;
+    task_t *tasks[THREAD_MAX];        // live threads by slot, whose thread ID is slot + 1
+    uint32_t *tid_words[THREAD_MAX];  // cleared and woken when the slot's thread exits
+    uint64_t stacks_mapped;           // slots whose user stacks are mapped, kept for reuse
+    size_t count;                     // live threads
+    bool exiting;                     // threads must leave, and no more may start
+    int status;                       // exit status a thread asked for
+    task_t *waiter;                   // main thread waiting for count to reach 0
+} thread_group_t;
+
+// Where a new thread enters user mode, handed over by its creator
+typedef struct thread_start {
+    uintptr_t entry;
+    uintptr_t arg;
+    uintptr_t sp;
+} thread_start_t;
+
+static stat_id_t stat_created;
+static stat_id_t stat_exited;
+
+void thread_init() {
+    stat_created = stats_register("thread.created");
+    stat_exited = stats_register("thread.exited");
+}
+
+// Body of a new thread's task. The request is freed before leaving for user
+// mode, which never comes back to this frame.
+static void thread_entry(void *arg) {
+    thread_start_t start = *(thread_start_t *)arg;
+    kfree(arg);
+    usermode_entry(USER_DATA_SELECTOR | 0x3, start.sp, USER_CODE_SELECTOR | 0x3, start.entry,
+                   start.arg, 0, 0);
+}
+
+// Give back a thread's slot. The main thread frees the group once the last
+// one is gone, so it is woken under the lock and nothing here is touched after.
+static void release_slot(thread_group_t *group, int slot) {
+    uint64_t flags = spin_lock_irqsave(&group->lock);
+    group->tasks[slot] = NULL;
+    group->tid_words[slot] = NULL;
+    group->count--;
+    if (group->count == 0 && group->waiter != NULL) {
+        sched_wake(group->waiter);
+    }
+    spin_unlock_irqrestore(&group->lock, flags);
+}
+
+// Map a slot's user stack, leaving its first page as the guard
+static bool map_stack(task_t *main, uintptr_t slot_base) {
+    uint64_t flags = tlb_lock(&main->vm_lock);
+    bool mapped = true;
+    for (uintptr_t p = slot_base + PAGE_SIZE; mapped && p < slot_base + THREAD_STACK_SLOT_SIZE;
+         p += PAGE_SIZE) {
+        mapped = vm_map(main->root, p, true, true, false);
+    }
+    spin_unlock_irqrestore(&main->vm_lock, flags);
+    return mapped;
+}
+
+// Create a task in the current process's thread group and claim it a slot.
+// Returns NULL with nothing claimed when out of memory or slots.
+static task_t *group_add(const char *name, task_entry_t entry, void *arg, uint32_t *tid_word) {
+    task_t *main = sched_current()->group;
+    if (main->pid == 0) {
+        return NULL;
+    }
+
+    // Until the first thread starts, the main thread is alone and can't race us here
+    if (main->threads == NULL) {
+        main->threads = kzalloc(sizeof(thread_group_t));
+        if (main->threads == NULL) {
+            return NULL;
+        }
+    }
+    thread_group_t *group = main->threads;
+
+    task_t *task = sched_create(name, entry, arg);
+    if (task == NULL) {
+        return NULL;
+    }
+    task->group = main;
+    task->root = main->root;
+    task->pid = main->pid;
+    task->image = main->image;
+
+    uint64_t flags = spin_lock_irqsave(&group->lock);
+    int slot = -1;
+    for (int i = 0; i < THREAD_MAX && slot < 0 && !group->exiting; i++) {
+        if (group->tasks[i] == NULL) {
+            slot = i;
+        }
+    }
+    if (slot >= 0) {
+        group->tasks[slot] = task;
+        group->tid_words[slot] = tid_word;
+        group->count++;
+    }
+    spin_unlock_irqrestore(&group->lock, flags);
+    if (slot < 0) {
+        sched_destroy(task);
+        return NULL;
+    }
+
+    task->tid = slot + 1;
+    return task;
+}
+
+long thread_create(uintptr_t entry, uintptr_t arg, uintptr_t tls, uint32_t *tid_word) {
+    if (tls >= USER_HALF_END || (tid_word != NULL && !user_range_ok(tid_word, sizeof(uint32_t)))) {
+        return -1;
+    }
+
+    thread_start_t *start = kmalloc(sizeof(thread_start_t));
+    task_t *main = sched_current()->group;
+    task_t *task = start != NULL ? group_add(main->name, thread_entry, start, tid_word) : NULL;
+    if (task == NULL) {
+        kfree(start);
+        return -1;
+    }
+    task->fs_base = tls;
+
+    thread_group_t *group = main->threads;
+    int slot = task->tid - 1;
+    uint64_t flags = spin_lock_irqsave(&group->lock);
+    bool mapped = group->stacks_mapped & (1ULL << slot);
+    spin_unlock_irqrestore(&group->lock, flags);
+
+    // The slot is ours, so nobody else maps its stack meanwhile
+    uintptr_t slot_base = THREAD_STACK_BASE + slot * THREAD_STACK_SLOT_SIZE;
+    if (!mapped) {
+        if (!map_stack(main, slot_base)) {
+            release_slot(group, slot);
+            sched_destroy(task);
+            kfree(start);
+            return -1;
+        }
+        flags = spin_lock_irqsave(&group->lock);
+        group->stacks_mapped |= 1ULL << slot;
+        spin_unlock_irqrestore(&group->lock, flags);
+    }
+
+    // Enter with a zero return address on the stack, aligned as after a call.
+    // Both it and tid_word are user memory, which the process may have unmapped.
+    start->entry = entry;
+    start->arg = arg;
+    start->sp = slot_base + THREAD_STACK_SLOT_SIZE - sizeof(uintptr_t);
+    uintptr_t ret = 0;
+    uint32_t tid_value = task->tid;
+    if (!copy_to_user((void *)start->sp, &ret, sizeof(ret)) ||
+        (tid_word != NULL && !copy_to_user(tid_word, &tid_value, sizeof(tid_value)))) {
+        release_slot(group, slot);
+        sched_destroy(task);
+        kfree(start);
+        return -1;
+    }
+
+    stats_inc(stat_created);
+    long tid = task->tid;
+    sched_start(task);
+    return tid;
+}
+
+task_t *thread_create_kernel(const char *name, task_entry_t entry, void *arg) {
+    task_t *task = group_add(name, entry, arg, NULL);
+    if (task != NULL) {
+        sched_start(task);
+    }
+    return task;
+}
+
+void thread_exit() {
+    task_t *task = sched_current();
+    thread_group_t *group = task->group->threads;
+    int slot = task->tid - 1;
+
+    // Tell a joiner the thread is gone, if the word is still mapped. Only its
+    // low byte can be nonzero, so the copy can't tear.
+    uint32_t *tid_word = group->tid_words[slot];
+    uint32_t zero = 0;
+    if (tid_word != NULL && copy_to_user(tid_word, &zero, sizeof(zero))) {
+        futex(tid_word, FUTEX_WAKE, UINT32_MAX, NULL, NULL, 0);
+    }
+
+    // Leave the address space before the main thread may free it
+    sched_switch_root(sched_kernel_root());
+    stats_inc(stat_exited);
+    release_slot(group, slot);
+    sched_exit();
+}
+
+// Tell every thread of a group to leave. Called with the group's lock held.
+static void interrupt_all(thread_group_t *group) {
+    group->exiting = true;
+    for (int i = 0; i < THREAD_MAX; i++) {
+        if (group->tasks[i] != NULL) {
+            sched_interrupt(group->tasks[i]);
+        }
+    }
+}
+
+void thread_exit_group(int status) {
+    task_t *main = sched_current()->group;
+    thread_group_t *group = main->threads;
+
+    // Only the first exit counts; the process may be going already
+    uint64_t flags = spin_lock_irqsave(&group->lock);
+    if (!group->exiting) {
+        group->status = status;
+        interrupt_all(group);
+        sched_interrupt(main);
+    }
+    spin_unlock_irqrestore(&group->lock, flags);
+
+    thread_exit();
+}
+
+void thread_stop_others() {
+    task_t *main = sched_current();
+    thread_group_t *group = main->threads;
+    if (group == NULL) {
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&group->lock);
+    interrupt_all(group);
+    while (group->count > 0) {
+        group->waiter = main;
+        sched_set_blocked();
+        spin_unlock(&group->lock);
+        sched_yield();
+        spin_lock(&group->lock);
+    }
+    int status = group->status;
+    spin_unlock_irqrestore(&group->lock, flags);
+
+    // Their stacks go with the address space, which is torn down next
+    main->threads = NULL;
+    kfree(group);
+
+    if (main->interrupted) {
+        proc_exit(status);
+    }
+}
+
+void thread_check_exit() {
+    task_t *task = sched_current();
+    if (!task->interrupted) {
+        return;
+    }
+    if (task->group != task) {
+        thread_exit();
+    }
+
+    // Only thread_exit_group interrupts a main thread, so this exits
+    thread_stop_others();
+}
+
+long thread_arch_prctl(int code, uintptr_t addr) {
+    switch (code) {
+        case ARCH_SET_FS:
+            // An FS base past the lower half would fault when loaded
+            if (addr >= USER_HALF_END) {
+                return -1;
+            }
+            sched_set_fs_base(addr);
+            return 0;
+        case ARCH_GET_FS:
+            if (!copy_to_user((void *)addr, &sched_current()->fs_base, sizeof(uintptr_t))) {
+                return -1;
+            }
+            return 0;
+        default:
+            return -1;
+    }
+}
@@ -0,0 +1,101 @@
+#include "timer.h"
+
+#include <stddef.h>
+
+#include "spinlock.h"
+
+static ktimer_t *wheel[TIMER_WHEEL_SLOTS];
+static volatile uint64_t ticks = 0;
+static spinlock_t wheel_lock = SPINLOCK_INIT;
+
+// The timer whose callback timer_tick is running, protected by the wheel lock
+static ktimer_t *running_timer = NULL;
+
+// Unlink a timer from its wheel slot. Called with the wheel lock held.
+static void wheel_remove(ktimer_t *timer) {
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel[timer->expires % TIMER_WHEEL_SLOTS] = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = timer->prev = NULL;
+    timer->pending = false;
+}
+
+void timer_add(ktimer_t *timer, uint64_t delay, timer_fn_t fn, void *arg) {
+    if (delay == 0) {
+        delay = 1;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&wheel_lock);
+
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->expires = ticks + delay;
+    timer->pending = true;
+
+    // Push onto the slot the timer expires in
+    ktimer_t **slot = &wheel[timer->expires % TIMER_WHEEL_SLOTS];
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+bool timer_cancel(ktimer_t *timer) {
+    uint64_t flags = spin_lock_irqsave(&wheel_lock);
+
+    // Let a callback that is already running finish, since the caller may
+    // free the timer and its argument as soon as this returns
+    while (running_timer == timer) {
+        spin_unlock(&wheel_lock);
+        __asm__ volatile("pause");
+        spin_lock(&wheel_lock);
+    }
+
+    bool pending = timer->pending;
+    if (pending) {
+        wheel_remove(timer);
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+    return pending;
+}
+
+void timer_tick() {
+    spin_lock(&wheel_lock);
+    uint64_t now = ++ticks;
+
+    // Only the current slot can hold expired timers
+    ktimer_t *timer = wheel[now % TIMER_WHEEL_SLOTS];
+    while (timer != NULL) {
+        ktimer_t *next = timer->next;
+
+        if (timer->expires <= now) {
+            wheel_remove(timer);
+
+            // Run the callback without the lock so it may re-arm the timer.
+            // The timer may be gone once fn returns, so only its address is kept.
+            running_timer = timer;
+            spin_unlock(&wheel_lock);
+            timer->fn(timer->arg);
+            spin_lock(&wheel_lock);
+            running_timer = NULL;
+
+            // The slot may have changed while unlocked, so start it over
+            next = wheel[now % TIMER_WHEEL_SLOTS];
+        }
+
+        timer = next;
+    }
+
+    spin_unlock(&wheel_lock);
+}
+
+uint64_t timer_ticks() { return ticks; }
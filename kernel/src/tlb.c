@@ -0,0 +1,208 @@
+#include "tlb.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "apic.h"
+#include "idt.h"
+#include "page.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "stats.h"
+
+// Lowest higher-half address. Kernel mappings are shared by every address space.
+#define KERNEL_HALF_START 0xFFFF800000000000
+
+#define CR4_PGE (1 << 7)
+
+#define ROOT_MASK (~0xFFFULL)
+
+// Pages waiting to be invalidated in one address space
+typedef struct tlb_range {
+    uintptr_t root;
+    uintptr_t start;  // lowest page recorded
+    uintptr_t end;    // end of the highest page recorded
+    bool kernel;      // covers kernel pages, which every CPU may cache
+    bool full;        // flush everything instead of the range
+} tlb_range_t;
+
+// A CPU's open batch
+typedef struct tlb_batch {
+    bool active;
+    bool empty;
+    tlb_range_t range;
+} __cacheline_aligned tlb_batch_t;
+
+static tlb_batch_t batches[MAX_CPUS];
+
+// One shootdown is in flight at a time. Its targets clear their bit in
+// pending once they have flushed.
+static spinlock_t shootdown_lock = SPINLOCK_INIT;
+static tlb_range_t shootdown_range;
+static volatile uint32_t shootdown_pending = 0;
+
+static stat_id_t stat_shootdowns;
+static stat_id_t stat_ipis;
+static stat_id_t stat_full_flushes;
+
+// Flush this CPU's entire TLB, including global kernel pages
+static void local_flush_all() {
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (cr4 & CR4_PGE) {
+        // Toggling PGE drops global entries along with everything else
+        __asm__ volatile("mov %0, %%cr4" : : "r"(cr4 & ~CR4_PGE) : "memory");
+        __asm__ volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+    } else {
+        write_cr3(read_cr3());
+    }
+}
+
+static void local_flush(const tlb_range_t *range) {
+    // Kernel pages are mapped the same everywhere; user pages only matter if
+    // their address space is the one loaded here
+    if (!range->kernel && (read_cr3() & ROOT_MASK) != range->root) {
+        return;
+    }
+
+    if (range->full) {
+        local_flush_all();
+        return;
+    }
+    for (uintptr_t p = range->start; p < range->end; p += PAGE_SIZE) {
+        __asm__ volatile("invlpg (%0)" : : "r"(p) : "memory");
+    }
+}
+
+// Handle the shootdown in flight if it is waiting on this CPU
+static void shootdown_service() {
+    uint32_t bit = 1U << cpu_id();
+    if (__atomic_load_n(&shootdown_pending, __ATOMIC_ACQUIRE) & bit) {
+        local_flush(&shootdown_range);
+        __atomic_and_fetch(&shootdown_pending, ~bit, __ATOMIC_RELEASE);
+    }
+}
+
+void tlb_shootdown_handler(interrupt_context_t *ctx) {
+    shootdown_service();
+    lapic_eoi();
+}
+
+// Flush a range here and on every other CPU that may cache it
+static void flush_range(tlb_range_t *range) {
+    range->root &= ROOT_MASK;
+    if (!range->full && (range->end - range->start) / PAGE_SIZE > TLB_FLUSH_ALL_PAGES) {
+        range->full = true;
+    }
+    if (range->full) {
+        stats_inc(stat_full_flushes);
+    }
+
+    local_flush(range);
+
+    // The page tables were changed before this point; make sure CPUs that
+    // load them from now on see the change before we look for targets
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    size_t self = cpu_id();
+    uint32_t targets = 0;
+    for (size_t i = 0; i < cpu_count; i++) {
+        if (i != self && cpus[i].active_root != 0 &&
+            (range->kernel || (cpus[i].active_root & ROOT_MASK) == range->root)) {
+            targets |= 1U << i;
+        }
+    }
+    if (targets == 0) {
+        return;
+    }
+
+    // Keep answering other CPUs' shootdowns while we wait our turn, in case
+    // they are waiting on us with interrupts disabled
+    uint64_t flags = irq_save();
+    while (!spin_trylock(&shootdown_lock)) {
+        shootdown_service();
+        __asm__ volatile("pause");
+    }
+
+    stats_inc(stat_shootdowns);
+    shootdown_range = *range;
+    __atomic_store_n(&shootdown_pending, targets, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < cpu_count; i++) {
+        if (targets & (1U << i)) {
+            stats_inc(stat_ipis);
+            lapic_send_ipi(cpus[i].lapic_id, APIC_TLB_VECTOR);
+        }
+    }
+
+    while (__atomic_load_n(&shootdown_pending, __ATOMIC_ACQUIRE) != 0) {
+        __asm__ volatile("pause");
+    }
+
+    spin_unlock(&shootdown_lock);
+    irq_restore(flags);
+}
+
+void tlb_init() {
+    stat_shootdowns = stats_register("tlb.shootdowns");
+    stat_ipis = stats_register("tlb.ipis");
+    stat_full_flushes = stats_register("tlb.full_flushes");
+    idt_set_handler(APIC_TLB_VECTOR, tlb_shootdown_handler, IDT_TYPE_INTERRUPT);
+}
+
+void tlb_invalidate(uintptr_t root, uintptr_t address) {
+    address &= ~(uintptr_t)(PAGE_SIZE - 1);
+    root &= ROOT_MASK;
+
+    bool kernel = address >= KERNEL_HALF_START;
+
+    tlb_batch_t *batch = &batches[cpu_id()];
+    if (batch->active && batch->range.root == root) {
+        batch->range.kernel |= kernel;
+        if (batch->empty || address < batch->range.start) {
+            batch->range.start = address;
+        }
+        if (batch->empty || address + PAGE_SIZE > batch->range.end) {
+            batch->range.end = address + PAGE_SIZE;
+        }
+        batch->empty = false;
+        return;
+    }
+
+    tlb_range_t range = {.root = root,
+                         .start = address,
+                         .end = address + PAGE_SIZE,
+                         .kernel = kernel,
+                         .full = false};
+    flush_range(&range);
+}
+
+void tlb_flush_all(uintptr_t root) {
+    tlb_range_t range = {.root = root, .start = 0, .end = 0, .kernel = false, .full = true};
+    flush_range(&range);
+}
+
+void tlb_batch_begin(uintptr_t root) {
+    tlb_batch_t *batch = &batches[cpu_id()];
+    batch->active = true;
+    batch->empty = true;
+    batch->range.root = root & ROOT_MASK;
+    batch->range.kernel = false;
+    batch->range.full = false;
+}
+
+void tlb_batch_end() {
+    tlb_batch_t *batch = &batches[cpu_id()];
+    batch->active = false;
+    if (!batch->empty) {
+        flush_range(&batch->range);
+    }
+}
+
+uint64_t tlb_lock(spinlock_t *lock) {
+    uint64_t flags = irq_save();
+    while (!spin_trylock(lock)) {
+        shootdown_service();
+        __asm__ volatile("pause");
+    }
+    return flags;
+}
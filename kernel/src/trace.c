@@ -0,0 +1,109 @@
+#include "trace.h"
+
+#include <string.h>
+
+#include "page.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "util.h"
+
+// A CPU's record ring. Only code running on that CPU writes it, with
+// interrupts disabled, and readers only consume up to the published head.
+typedef struct trace_ring {
+    volatile uint64_t head;  // records written
+    volatile uint64_t tail;  // records consumed
+    volatile uint32_t busy;  // set while this CPU's trace_emit is in the ring
+    trace_record_t records[TRACE_RING_SIZE];
+} __cacheline_aligned trace_ring_t;
+
+static trace_ring_t rings[MAX_CPUS];
+
+volatile uint32_t trace_mask = 0;
+
+__attribute__((cold, noinline)) void trace_emit(uint16_t event, uint64_t arg0, uint64_t arg1) {
+    // Keep interrupt handlers on this CPU from claiming the same slot
+    uint64_t flags = irq_save();
+    trace_ring_t *ring = &rings[cpu_id()];
+
+    // Tracing may have stopped since the caller checked. Mark the ring busy
+    // before checking again, so quiesce either sees us or we see the stop.
+    ring->busy = 1;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!(trace_mask & (1U << event))) {
+        ring->busy = 0;
+        irq_restore(flags);
+        return;
+    }
+
+    // Overwrite the oldest record when the reader has fallen behind
+    if (ring->head - ring->tail == TRACE_RING_SIZE) {
+        ring->tail++;
+    }
+
+    trace_record_t *record = &ring->records[ring->head % TRACE_RING_SIZE];
+    record->tsc = rdtsc();
+    record->cpu = cpu_id();
+    record->event = event;
+    record->args[0] = arg0;
+    record->args[1] = arg1;
+
+    // Publish the record
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+// Stop tracing and wait until no CPU is still writing a record, so the rings
+// can be touched from here
+static void quiesce() {
+    trace_mask = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < MAX_CPUS; i++) {
+        while (__atomic_load_n(&rings[i].busy, __ATOMIC_ACQUIRE)) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+uint64_t trace_pack_string(const char *s) {
+    uint64_t packed = 0;
+    size_t len = strlen(s);
+    memcpy(&packed, s, len < sizeof(packed) ? len : sizeof(packed));
+    return packed;
+}
+
+void trace_start(uint32_t mask) {
+    quiesce();
+
+    for (size_t i = 0; i < MAX_CPUS; i++) {
+        rings[i].tail = rings[i].head;
+    }
+
+    trace_mask = mask == 0 ? (1U << TRACE_EVENT_COUNT) - 1 : mask;
+}
+
+int trace_stop() {
+    uint32_t was_running = trace_mask;
+    quiesce();
+    return was_running != 0;
+}
+
+int64_t trace_read(trace_record_t *records, size_t count) {
+    size_t copied = 0;
+
+    for (size_t i = 0; i < MAX_CPUS && copied < count; i++) {
+        trace_ring_t *ring = &rings[i];
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        while (ring->tail < head && copied < count) {
+            trace_record_t *record = &ring->records[ring->tail % TRACE_RING_SIZE];
+            if (!copy_to_user(&records[copied], record, sizeof(*record))) {
+                return copied > 0 ? (int64_t)copied : -1;
+            }
+            copied++;
+            ring->tail++;
+        }
+    }
+
+    return copied;
+}
@@ -0,0 +1,19 @@
+.global user_copy
+.global user_copy_insn
+.global user_copy_fixup
+
+# size_t user_copy(void *dst, const void *src, size_t size)
+# Copy size bytes and return 0. A page fault the kernel can't resolve at
+# user_copy_insn resumes at user_copy_fixup instead, see page_fault_handler,
+# which returns the bytes left uncopied.
+user_copy:
+  mov %rdx, %rcx
+user_copy_insn:
+  rep movsb
+  xor %eax, %eax
+  ret
+
+# A faulting rep movsb leaves the bytes still to copy in %rcx
+user_copy_fixup:
+  mov %rcx, %rax
+  ret
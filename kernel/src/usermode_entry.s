@@ -1,11 +1,14 @@
 .global usermode_entry
 
 usermode_entry:
-  # Set data segment selectors (in first argument)
+  # Nothing may interrupt between swapgs and iretq, or it would run with the
+  # user's GS base
+  cli
+
+  # Set data segment selectors (in first argument). %gs already holds a user
+  # selector, and swapgs below gives it the user's base.
   mov %di, %ds
   mov %di, %es
-  mov %di, %fs
-  mov %di, %gs
 
   # Push the stack segment selector (in first argument)
   push %rdi
@@ -13,8 +16,9 @@ usermode_entry:
   # Push the stack pointer (in second argument)
   push %rsi
 
-  # Push flags
+  # Push flags, with interrupts on in user mode
   pushf
+  orq $0x200, (%rsp)
 
   # Push code selector (in third argument)
   push %rdx
@@ -30,5 +34,6 @@ usermode_entry:
   mov 64(%rsp), %r8
   mov 72(%rsp), %r9
 
-  # Use iret to jump away
+  # Leave this CPU's data in the kernel GS base, and use iret to jump away
+  swapgs
   iretq
@@ -0,0 +1,67 @@
+#include "vdso.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "clock.h"
+#include "page.h"
+
+// The code in src/vdso.s, copied into its page by vdso_init
+extern const uint8_t vdso_start[];
+extern const uint8_t vdso_end[];
+
+// src/vdso.s reads these at fixed offsets
+_Static_assert(offsetof(vdso_data_t, seq) == 0, "vdso.s expects seq at 0");
+_Static_assert(offsetof(vdso_data_t, tsc_base) == 16, "vdso.s expects tsc_base at 16");
+_Static_assert(offsetof(vdso_data_t, ns_base) == 24, "vdso.s expects ns_base at 24");
+_Static_assert(offsetof(vdso_data_t, mult) == 32, "vdso.s expects mult at 32");
+_Static_assert(offsetof(vdso_data_t, shift) == 36, "vdso.s expects shift at 36");
+_Static_assert(offsetof(vdso_data_t, tick_ns) == 48, "vdso.s expects tick_ns at 48");
+
+static uintptr_t code_phys;
+static uintptr_t data_phys;
+static vdso_data_t *data;
+
+void vdso_init() {
+    code_phys = pmem_alloc_zeroed();
+    memcpy((void *)add_virtual_offset(code_phys), vdso_start, vdso_end - vdso_start);
+
+    data_phys = pmem_alloc_zeroed();
+    data = (vdso_data_t *)add_virtual_offset(data_phys);
+}
+
+vdso_data_t *vdso_data() { return data; }
+
+void vdso_write_begin() {
+    data->seq++;
+    // x86 keeps stores in order, so only the compiler needs holding back
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+void vdso_write_end() {
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    data->seq++;
+}
+
+void vdso_tick() {
+    vdso_write_begin();
+    data->ticks++;
+    data->tick_ns = clock_monotonic_ns();
+    vdso_write_end();
+}
+
+bool vdso_map(uintptr_t root, int pid) {
+    uintptr_t proc_phys = pmem_alloc_zeroed();
+    if (proc_phys == 0) {
+        return false;
+    }
+    vdso_proc_t *proc = (vdso_proc_t *)add_virtual_offset(proc_phys);
+    proc->pid = pid;
+
+    if (!vm_map_owned(root, VDSO_PROC_ADDRESS, proc_phys, true, false, false)) {
+        pmem_free(proc_phys);
+        return false;
+    }
+    return vm_map_page(root, VDSO_CODE_ADDRESS, code_phys, true, false, true) &&
+           vm_map_page(root, VDSO_DATA_ADDRESS, data_phys, true, false, false);
+}
@@ -0,0 +1,90 @@
+# The vDSO's code, copied into a page mapped read-only and executable in
+# every process. It must be position-independent and may only touch the
+# vDSO's data pages, at the fixed addresses from include/vdso.h.
+
+.set VDSO_PROC_ADDRESS, 0x7FFFFFFE000
+.set VDSO_DATA_ADDRESS, 0x7FFFFFFF000
+
+# Offsets in vdso_data_t
+.set SEQ, 0
+.set TSC_BASE, 16
+.set NS_BASE, 24
+.set MULT, 32
+.set SHIFT, 36
+.set TICK_NS, 48
+
+# Segment whose limit is the CPU's index, see gdt.h
+.set CPU_NUMBER_SELECTOR, 0x3B
+
+.section .rodata
+.global vdso_start
+.global vdso_end
+
+.balign 16
+vdso_start:
+  # Entry points at the offsets in include/vdso.h
+  jmp monotonic_ns
+  .balign 8
+  jmp coarse_ns
+  .balign 8
+  jmp getcpu
+  .balign 8
+  jmp getpid
+  .balign 8
+
+monotonic_ns:
+  movabs $VDSO_DATA_ADDRESS, %rsi
+1:
+  # Wait out an update in progress
+  mov SEQ(%rsi), %r8d
+  test $1, %r8d
+  jnz 2f
+
+  # Keep rdtsc from running ahead of the seq load
+  lfence
+  rdtsc
+  shl $32, %rdx
+  or %rdx, %rax
+
+  # ns_base + ((cycles * mult) >> shift), with a 128-bit product
+  sub TSC_BASE(%rsi), %rax
+  mov MULT(%rsi), %ecx
+  mul %rcx
+  mov SHIFT(%rsi), %ecx
+  shrd %cl, %rdx, %rax
+  add NS_BASE(%rsi), %rax
+
+  # Loads aren't reordered with other loads on x86, so a matching seq means
+  # the fields above came from one update
+  cmp SEQ(%rsi), %r8d
+  jne 1b
+  ret
+2:
+  pause
+  jmp 1b
+
+coarse_ns:
+  movabs $VDSO_DATA_ADDRESS, %rsi
+1:
+  mov SEQ(%rsi), %r8d
+  test $1, %r8d
+  jnz 2f
+  mov TICK_NS(%rsi), %rax
+  cmp SEQ(%rsi), %r8d
+  jne 1b
+  ret
+2:
+  pause
+  jmp 1b
+
+getcpu:
+  mov $CPU_NUMBER_SELECTOR, %ecx
+  lsl %ecx, %eax
+  ret
+
+getpid:
+  movabs $VDSO_PROC_ADDRESS, %rsi
+  mov (%rsi), %eax
+  ret
+
+vdso_end:
@@ -0,0 +1,337 @@
+#include "vfs.h"
+
+#include <string.h>
+
+#include "kmalloc.h"
+#include "page.h"
+#include "sched.h"
+#include "stats.h"
+
+// Buckets in the dentry hash, a power of two
+#define DENTRY_HASH_SIZE 256
+
+static dentry_t *dentry_hash[DENTRY_HASH_SIZE];
+static dentry_t *root;
+static uint64_t next_ino = 1;
+
+static kmem_cache_t *file_cache;
+
+static stat_id_t stat_lookups;
+static stat_id_t stat_hash_probes;
+static stat_id_t stat_opens;
+
+// FNV-1a over the name, seeded with the parent so equal names in different
+// directories land in different buckets
+static size_t dentry_hash_index(const dentry_t *parent, const char *name, size_t len) {
+    uint64_t hash = 14695981039346656037ULL ^ (uintptr_t)parent;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return (hash ^ (hash >> 32)) & (DENTRY_HASH_SIZE - 1);
+}
+
+// Find the entry called name (len bytes, not terminated) in parent
+static dentry_t *dentry_find(const dentry_t *parent, const char *name, size_t len) {
+    dentry_t *d = dentry_hash[dentry_hash_index(parent, name, len)];
+    for (; d != NULL; d = d->hash_next) {
+        stats_inc(stat_hash_probes);
+        if (d->parent == parent && strlen(d->name) == len && memcmp(d->name, name, len) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+static bool is_dir(const dentry_t *d) { return (d->inode->mode & VFS_S_IFMT) == VFS_S_IFDIR; }
+
+static ssize_t vfs_file_read(file_t *file, void *buf, size_t count) {
+    inode_t *inode = file->dentry->inode;
+    if (is_dir(file->dentry)) {
+        return -1;
+    }
+    if (file->offset >= inode->size) {
+        return 0;
+    }
+
+    size_t left = inode->size - file->offset;
+    count = count < left ? count : left;
+    if (!copy_to_user(buf, inode->data + file->offset, count)) {
+        return -1;
+    }
+    file->offset += count;
+    return count;
+}
+
+static ssize_t vfs_file_write(file_t *file, const void *buf, size_t count) { return -1; }
+
+static const file_ops_t vfs_file_ops = {.read = vfs_file_read, .write = vfs_file_write};
+
+void vfs_init() {
+    stat_lookups = stats_register("vfs.lookups");
+    stat_hash_probes = stats_register("vfs.hash_probes");
+    stat_opens = stats_register("vfs.opens");
+
+    file_cache = kmem_cache_create("file", sizeof(file_t), 8, NULL);
+
+    root = kzalloc(sizeof(dentry_t));
+    root->inode = kzalloc(sizeof(inode_t));
+    root->inode->ino = next_ino++;
+    root->inode->mode = VFS_S_IFDIR | 0755;
+    root->parent = root;
+    root->name[0] = '/';
+}
+
+dentry_t *vfs_root() { return root; }
+
+dentry_t *vfs_lookup(const char *path) {
+    stats_inc(stat_lookups);
+
+    dentry_t *d = root;
+    while (*path != '\0') {
+        // Split off the next component
+        while (*path == '/') {
+            path++;
+        }
+        const char *name = path;
+        while (*path != '\0' && *path != '/') {
+            path++;
+        }
+        size_t len = path - name;
+
+        if (len == 0 || (len == 1 && name[0] == '.')) {
+            continue;
+        }
+        if (len == 2 && name[0] == '.' && name[1] == '.') {
+            d = d->parent;
+            continue;
+        }
+        if (!is_dir(d)) {
+            return NULL;
+        }
+
+        d = dentry_find(d, name, len);
+        if (d == NULL) {
+            return NULL;
+        }
+    }
+    return d;
+}
+
+dentry_t *vfs_create(dentry_t *parent, const char *name, uint32_t mode, const uint8_t *data,
+                     size_t size) {
+    size_t len = strlen(name);
+    len = len < VFS_NAME_MAX - 1 ? len : VFS_NAME_MAX - 1;
+    if (len == 0 || !is_dir(parent)) {
+        return NULL;
+    }
+
+    dentry_t *existing = dentry_find(parent, name, len);
+    if (existing != NULL) {
+        bool want_dir = (mode & VFS_S_IFMT) == VFS_S_IFDIR;
+        return want_dir && is_dir(existing) ? existing : NULL;
+    }
+
+    dentry_t *d = kzalloc(sizeof(dentry_t));
+    inode_t *inode = kzalloc(sizeof(inode_t));
+    if (d == NULL || inode == NULL) {
+        kfree(d);
+        kfree(inode);
+        return NULL;
+    }
+
+    inode->ino = next_ino++;
+    inode->mode = mode;
+    inode->data = data;
+    inode->size = (mode & VFS_S_IFMT) == VFS_S_IFDIR ? 0 : size;
+
+    memcpy(d->name, name, len);
+    d->inode = inode;
+    d->parent = parent;
+
+    // Keep directory listings in creation order
+    dentry_t **link = &parent->inode->children;
+    while (*link != NULL) {
+        link = &(*link)->sibling;
+    }
+    *link = d;
+    parent->inode->size++;
+
+    size_t bucket = dentry_hash_index(parent, name, len);
+    d->hash_next = dentry_hash[bucket];
+    dentry_hash[bucket] = d;
+
+    return d;
+}
+
+file_t *file_alloc(const file_ops_t *ops, dentry_t *dentry) {
+    file_t *file = kmem_cache_alloc(file_cache);
+    if (file == NULL) {
+        return NULL;
+    }
+    file->ops = ops;
+    file->dentry = dentry;
+    file->offset = 0;
+    file->refs = 1;
+    file->private = NULL;
+    return file;
+}
+
+file_t *file_get(file_t *file) {
+    __atomic_add_fetch(&file->refs, 1, __ATOMIC_RELAXED);
+    return file;
+}
+
+void file_put(file_t *file) {
+    if (__atomic_sub_fetch(&file->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (file->ops->release != NULL) {
+            file->ops->release(file);
+        }
+        kmem_cache_free(file_cache, file);
+    }
+}
+
+file_t *vfs_open(const char *path, int flags) {
+    if (flags != VFS_O_RDONLY) {
+        return NULL;
+    }
+
+    dentry_t *d = vfs_lookup(path);
+    if (d == NULL) {
+        return NULL;
+    }
+
+    stats_inc(stat_opens);
+    return file_alloc(&vfs_file_ops, d);
+}
+
+off_t vfs_seek(file_t *file, off_t offset, int whence) {
+    if (file->dentry == NULL) {
+        return -1;
+    }
+
+    off_t base;
+    switch (whence) {
+        case VFS_SEEK_SET:
+            base = 0;
+            break;
+        case VFS_SEEK_CUR:
+            base = file->offset;
+            break;
+        case VFS_SEEK_END:
+            base = file->dentry->inode->size;
+            break;
+        default:
+            return -1;
+    }
+
+    if (base + offset < 0) {
+        return -1;
+    }
+    file->offset = base + offset;
+    return file->offset;
+}
+
+void vfs_stat(dentry_t *dentry, vfs_stat_t *st) {
+    st->ino = dentry->inode->ino;
+    st->mode = dentry->inode->mode;
+    st->_unused = 0;
+    st->size = dentry->inode->size;
+}
+
+ssize_t vfs_getdents(file_t *file, vfs_dirent_t *dirents, size_t count) {
+    if (file->dentry == NULL || !is_dir(file->dentry)) {
+        return -1;
+    }
+
+    // The offset counts entries already returned
+    dentry_t *d = file->dentry->inode->children;
+    for (size_t i = 0; i < file->offset && d != NULL; i++) {
+        d = d->sibling;
+    }
+
+    size_t filled = 0;
+    for (; d != NULL && filled < count; d = d->sibling) {
+        vfs_dirent_t dirent = {.ino = d->inode->ino, .type = is_dir(d) ? VFS_DT_DIR : VFS_DT_REG};
+        memcpy(dirent.name, d->name, VFS_NAME_MAX);
+        if (!copy_to_user(&dirents[filled], &dirent, sizeof(dirent))) {
+            return -1;
+        }
+        filled++;
+    }
+    file->offset += filled;
+    return filled;
+}
+
+// The descriptor table belongs to the process's main task, shared by its threads
+
+int fd_install(file_t *file) {
+    task_t *task = sched_current()->group;
+    uint64_t flags = spin_lock_irqsave(&task->files_lock);
+    for (int fd = 0; fd < TASK_MAX_FILES; fd++) {
+        if (task->files[fd] == NULL) {
+            task->files[fd] = file;
+            spin_unlock_irqrestore(&task->files_lock, flags);
+            return fd;
+        }
+    }
+    spin_unlock_irqrestore(&task->files_lock, flags);
+    return -1;
+}
+
+file_t *fd_get(int fd) {
+    if (fd < 0 || fd >= TASK_MAX_FILES) {
+        return NULL;
+    }
+
+    // Take a reference under the lock, so another thread closing the
+    // descriptor can't free the file while we use it
+    task_t *task = sched_current()->group;
+    uint64_t flags = spin_lock_irqsave(&task->files_lock);
+    file_t *file = task->files[fd];
+    if (file != NULL) {
+        file_get(file);
+    }
+    spin_unlock_irqrestore(&task->files_lock, flags);
+    return file;
+}
+
+int fd_close(int fd) {
+    if (fd < 0 || fd >= TASK_MAX_FILES) {
+        return -1;
+    }
+
+    task_t *task = sched_current()->group;
+    uint64_t flags = spin_lock_irqsave(&task->files_lock);
+    file_t *file = task->files[fd];
+    task->files[fd] = NULL;
+    spin_unlock_irqrestore(&task->files_lock, flags);
+
+    if (file == NULL) {
+        return -1;
+    }
+    file_put(file);
+    return 0;
+}
+
+int fd_dup2(int old_fd, int new_fd) {
+    if (new_fd < 0 || new_fd >= TASK_MAX_FILES) {
+        return -1;
+    }
+    file_t *file = fd_get(old_fd);
+    if (file == NULL) {
+        return -1;
+    }
+
+    // Our reference from fd_get passes to new_fd
+    task_t *task = sched_current()->group;
+    uint64_t flags = spin_lock_irqsave(&task->files_lock);
+    file_t *old = task->files[new_fd];
+    task->files[new_fd] = file;
+    spin_unlock_irqrestore(&task->files_lock, flags);
+
+    if (old != NULL) {
+        file_put(old);
+    }
+    return new_fd;
+}
@@ -0,0 +1,88 @@
+#include "workqueue.h"
+
+#include "klog.h"
+#include "kstdio.h"
+#include "percpu.h"
+#include "sched.h"
+#include "stats.h"
+
+// A CPU's pending work. The wait queue's lock protects the list, and the
+// CPU's worker sleeps on it while the list is empty.
+typedef struct workqueue {
+    wait_queue_t wait;
+    work_t *head;
+    work_t *tail;
+    task_t *worker;
+} __cacheline_aligned workqueue_t;
+
+static workqueue_t workqueues[MAX_CPUS];
+
+static stat_id_t stat_queued;
+static stat_id_t stat_runs;
+
+// Body of a CPU's worker thread
+static void worker_main(void *arg) {
+    workqueue_t *wq = arg;
+
+    while (true) {
+        uint64_t flags = spin_lock_irqsave(&wq->wait.lock);
+        while (wq->head == NULL) {
+            wait_queue_sleep(&wq->wait);
+        }
+
+        // Take the whole list, so work queued meanwhile waits for the next round
+        work_t *work = wq->head;
+        wq->head = wq->tail = NULL;
+        spin_unlock_irqrestore(&wq->wait.lock, flags);
+
+        while (work != NULL) {
+            work_t *next = work->next;
+            work->next = NULL;
+            __atomic_store_n(&work->pending, false, __ATOMIC_RELEASE);
+            work->fn(work->arg);
+            stats_inc(stat_runs);
+            work = next;
+        }
+    }
+}
+
+void workqueue_init() {
+    stat_queued = stats_register("workqueue.queued");
+    stat_runs = stats_register("workqueue.runs");
+
+    for (size_t cpu = 0; cpu < cpu_count; cpu++) {
+        char name[16];
+        ksnprintf(name, sizeof(name), "kworker/%lu", cpu);
+
+        task_t *worker = sched_create(name, worker_main, &workqueues[cpu]);
+        if (worker == NULL) {
+            klog(KLOG_ERR, "workqueue: can't start a worker for CPU %lu\n", cpu);
+            continue;
+        }
+        workqueues[cpu].worker = worker;
+        sched_start_on(worker, cpu);
+    }
+}
+
+bool queue_work_on(size_t cpu, work_t *work) {
+    if (__atomic_exchange_n(&work->pending, true, __ATOMIC_ACQ_REL)) {
+        return false;
+    }
+
+    workqueue_t *wq = &workqueues[cpu];
+    uint64_t flags = spin_lock_irqsave(&wq->wait.lock);
+    work->next = NULL;
+    if (wq->tail != NULL) {
+        wq->tail->next = work;
+    } else {
+        wq->head = work;
+    }
+    wq->tail = work;
+    spin_unlock_irqrestore(&wq->wait.lock, flags);
+
+    stats_inc(stat_queued);
+    wake_up(&wq->wait);
+    return true;
+}
+
+bool queue_work(work_t *work) { return queue_work_on(cpu_id(), work); }
@@ -0,0 +1,70 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Entries fetched from the kernel per call
+#define BATCH 8
+
+#define PATH_MAX 256
+
+// Print every entry under path, one per line, recursing into directories
+static void list(char *path, size_t len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("ls: can't open %s\n", path);
+        return;
+    }
+
+    struct dirent entries[BATCH];
+    long count;
+    while ((count = getdents(fd, entries, BATCH)) > 0) {
+        for (long i = 0; i < count; i++) {
+            size_t name_len = strlen(entries[i].d_name);
+            if (len + 1 + name_len >= PATH_MAX) {
+                continue;
+            }
+
+            // Extend the path in place, it is cut back after the entry
+            path[len] = '/';
+            memcpy(path + len + 1, entries[i].d_name, name_len + 1);
+
+            struct stat st;
+            stat(path, &st);
+            if (S_ISDIR(st.st_mode)) {
+                printf("%8s  %s/\n", "-", path);
+                list(path, len + 1 + name_len);
+            } else {
+                printf("%8lu  %s\n", st.st_size, path);
+            }
+            path[len] = '\0';
+        }
+    }
+
+    close(fd);
+}
+
+void _start(int argc, char **argv) {
+    // List the directories named, or the whole initramfs
+    for (int i = argc > 1 ? 1 : 0; i < argc; i++) {
+        char path[PATH_MAX] = "";
+        size_t len = 0;
+        if (i > 0) {
+            len = strlen(argv[i]);
+            if (len >= PATH_MAX) {
+                printf("ls: %s: path too long\n", argv[i]);
+                continue;
+            }
+            memcpy(path, argv[i], len + 1);
+        }
+
+        // The entries get their own separator
+        while (len > 0 && path[len - 1] == '/') {
+            path[--len] = '\0';
+        }
+        list(path, len);
+    }
+    exit(0);
+}
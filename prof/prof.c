@@ -0,0 +1,35 @@
+#include <profile.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Samples fetched from the kernel per call
+#define BATCH 32
+
+// Ticks between samples
+#define INTERVAL 1
+
+void _start() {
+    // The first run starts the profiler, the next one stops it and dumps the samples
+    if (profile(PROFILE_STOP, 0, 0) == 0) {
+        profile(PROFILE_START, INTERVAL, 0);
+        printf("profiling started, run prof again to dump samples\n");
+        exit(0);
+    }
+
+    // One line per sample, for tools/profile.py:
+    //   S <cpu> <cr3> <image> <k|u> <pc> <return address>...
+    struct profile_sample samples[BATCH];
+    long count;
+    while ((count = profile(PROFILE_READ, (uint64_t)samples, BATCH)) > 0) {
+        for (long i = 0; i < count; i++) {
+            struct profile_sample *s = &samples[i];
+            printf("S %u %lx %s %c", s->cpu, s->cr3, s->image, s->user ? 'u' : 'k');
+            for (int j = 0; j < s->depth; j++) {
+                printf(" %lx", s->pcs[j]);
+            }
+            printf("\n");
+        }
+    }
+
+    exit(0);
+}
@@ -1,3 +1,11 @@
 #!/bin/bash
 
-qemu-system-x86_64 -m 2G -curses -cdrom boot.iso
+# The serial console is attached to stdio, so output can be piped or captured
+# and input typed or scripted. Pass --window to also see the framebuffer
+# console in a QEMU window. The kernel always asks for a framebuffer, so a
+# text-mode display such as -curses has nothing to show.
+if [ "$1" == "--window" ]; then
+    exec qemu-system-x86_64 -m 2G -smp 4 -serial stdio -cdrom boot.iso
+fi
+
+exec qemu-system-x86_64 -m 2G -smp 4 -display none -serial stdio -cdrom boot.iso
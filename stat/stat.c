@@ -0,0 +1,20 @@
+#include <stats.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define MAX_ENTRIES 128
+
+void _start() {
+    struct stat_entry entries[MAX_ENTRIES];
+    long count = stats(entries, MAX_ENTRIES);
+    if (count > MAX_ENTRIES) {
+        count = MAX_ENTRIES;
+    }
+
+    // One counter per line, aligned for reading
+    for (long i = 0; i < count; i++) {
+        printf("%-32s %ld\n", entries[i].name, entries[i].value);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,7 @@
+#include "dirent.h"
+
+#include "syscall.h"
+
+long getdents(int fd, struct dirent *dirents, size_t count) {
+    return syscall(SYS_getdents, fd, dirents, count);
+}
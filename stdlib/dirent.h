@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// See kernel/include/vfs.h
+#define NAME_MAX 64
+
+// Entry types in d_type
+#define DT_DIR 4
+#define DT_REG 8
+
+// One directory entry returned by getdents
+struct dirent {
+    uint64_t d_ino;
+    uint8_t d_type;
+    char d_name[NAME_MAX];
+};
+
+/**
+ * @brief getdents reads the next entries of a directory opened with open
+ *
+ * @param fd the directory's file descriptor
+ * @param dirents where to store the entries
+ * @param count capacity of dirents in entries
+ * @return long the number of entries stored, 0 at the end, -1 on error
+ */
+long getdents(int fd, struct dirent *dirents, size_t count);
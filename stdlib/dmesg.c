@@ -0,0 +1,5 @@
+#include "dmesg.h"
+
+#include "syscall.h"
+
+long dmesg(char *buf, size_t size) { return syscall(SYS_dmesg, buf, size); }
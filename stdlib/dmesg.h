@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief dmesg reads the kernel log, oldest line first
+ *
+ * @param buf where to store the text, which is not NUL terminated
+ * @param size size of buf in bytes
+ * @return long the number of bytes stored
+ */
+long dmesg(char *buf, size_t size);
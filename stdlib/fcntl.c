@@ -0,0 +1,5 @@
+#include "fcntl.h"
+
+#include "syscall.h"
+
+int open(const char *pathname, int flags) { return syscall(SYS_open, pathname, flags); }
@@ -0,0 +1,13 @@
+#pragma once
+
+// Flags accepted by open, see kernel/include/vfs.h. Files are read-only.
+#define O_RDONLY 0
+
+/**
+ * @brief open opens a file or directory
+ *
+ * @param pathname the path, relative paths start at the root
+ * @param flags O_RDONLY
+ * @return int the new file descriptor, or -1 on error
+ */
+int open(const char *pathname, int flags);
@@ -0,0 +1,467 @@
+#include "format.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "string.h"
+
+// Flags parsed from a conversion specification
+#define FLAG_LEFT 0x01   // '-': left-justify within the field
+#define FLAG_ZERO 0x02   // '0': pad numbers with leading zeros
+#define FLAG_PLUS 0x04   // '+': always print a sign
+#define FLAG_SPACE 0x08  // ' ': print a space in place of a '+' sign
+#define FLAG_ALT 0x10    // '#': prefix hex with 0x and octal with 0
+
+// Length modifiers, in increasing width
+typedef enum length {
+    LENGTH_HH,
+    LENGTH_H,
+    LENGTH_DEFAULT,
+    LENGTH_L,
+    LENGTH_LL,
+} length_t;
+
+// Output state threaded through the formatter
+typedef struct format_state {
+    char *buf;           // caller-provided staging buffer
+    size_t capacity;     // usable bytes in buf
+    size_t pos;          // bytes currently staged in buf
+    size_t total;        // bytes produced so far, including flushed ones
+    format_sink_t sink;  // where full buffers go, or NULL to truncate
+} format_state_t;
+
+// Every two-digit decimal number, so each division by 100 yields two digits
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char lower_digits[] = "0123456789abcdef";
+static const char upper_digits[] = "0123456789ABCDEF";
+
+static const uint64_t powers_of_10[] = {1ULL,
+                                        10ULL,
+                                        100ULL,
+                                        1000ULL,
+                                        10000ULL,
+                                        100000ULL,
+                                        1000000ULL,
+                                        10000000ULL,
+                                        100000000ULL,
+                                        1000000000ULL,
+                                        10000000000ULL,
+                                        100000000000ULL,
+                                        1000000000000ULL,
+                                        10000000000000ULL,
+                                        100000000000000ULL,
+                                        1000000000000000ULL,
+                                        10000000000000000ULL,
+                                        100000000000000000ULL,
+                                        1000000000000000000ULL,
+                                        10000000000000000000ULL};
+
+// Largest number of digits any conversion can produce (64-bit octal)
+#define MAX_DIGITS 22
+
+// Hand the staged bytes to the sink and start over at the front of the buffer
+static void flush(format_state_t *state) {
+    if (state->sink != NULL && state->pos > 0) {
+        state->sink(state->buf, state->pos);
+    }
+    state->pos = 0;
+}
+
+// Append len bytes of str to the output
+static void emit(format_state_t *state, const char *str, size_t len) {
+    state->total += len;
+
+    // With nowhere to stage output, pass it straight through
+    if (state->capacity == 0) {
+        if (state->sink != NULL && len > 0) {
+            state->sink(str, len);
+        }
+        return;
+    }
+
+    while (len > 0) {
+        if (state->pos == state->capacity) {
+            // Without a sink the rest is truncated, but still counted
+            if (state->sink == NULL) {
+                return;
+            }
+            flush(state);
+        }
+
+        size_t room = state->capacity - state->pos;
+        size_t chunk = len < room ? len : room;
+        memcpy(state->buf + state->pos, str, chunk);
+        state->pos += chunk;
+        str += chunk;
+        len -= chunk;
+    }
+}
+
+// Append count copies of c to the output
+static void emit_repeat(format_state_t *state, char c, size_t count) {
+    char run[16];
+    memset(run, c, sizeof(run));
+
+    while (count > 0) {
+        size_t chunk = count < sizeof(run) ? count : sizeof(run);
+        emit(state, run, chunk);
+        count -= chunk;
+    }
+}
+
+// Count the decimal digits in value, bounded by the power-of-ten table
+static size_t decimal_digits(uint64_t value) {
+    if (value < 10) {
+        return 1;
+    }
+
+    // Approximate log10 from the bit length (1233 / 4096 ~= log10(2)), then correct by one
+    size_t bits = 64 - __builtin_clzll(value | 1);
+    size_t guess = (bits * 1233) >> 12;
+    return guess + 1 - (value < powers_of_10[guess]);
+}
+
+// Write value in decimal ending just before end, and return the digit count
+static size_t utoa_decimal(uint64_t value, char *end) {
+    size_t digits = decimal_digits(value);
+    char *p = end;
+
+    while (value >= 100) {
+        size_t pair = (value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        p[0] = digit_pairs[pair];
+        p[1] = digit_pairs[pair + 1];
+    }
+
+    if (value >= 10) {
+        p -= 2;
+        p[0] = digit_pairs[value * 2];
+        p[1] = digit_pairs[value * 2 + 1];
+    } else {
+        *--p = '0' + value;
+    }
+
+    return digits;
+}
+
+// Write value in a power-of-two radix ending just before end, and return the digit count
+static size_t utoa_pow2(uint64_t value, size_t shift, const char *digit_map, char *end) {
+    size_t bits = 64 - __builtin_clzll(value | 1);
+    size_t digits = (bits + shift - 1) / shift;
+    uint64_t mask = (1 << shift) - 1;
+
+    char *p = end;
+    for (size_t i = 0; i < digits; i++) {
+        *--p = digit_map[value & mask];
+        value >>= shift;
+    }
+
+    return digits;
+}
+
+// Emit a number with its sign or radix prefix, precision and field padding
+static void emit_number(format_state_t *state, uint64_t value, bool negative, char conversion,
+                        int flags, int width, int precision) {
+    char digits_buf[MAX_DIGITS];
+    char *end = digits_buf + sizeof(digits_buf);
+    size_t digits;
+
+    switch (conversion) {
+        case 'x':
+        case 'p':
+            digits = utoa_pow2(value, 4, lower_digits, end);
+            break;
+        case 'X':
+            digits = utoa_pow2(value, 4, upper_digits, end);
+            break;
+        case 'o':
+            digits = utoa_pow2(value, 3, lower_digits, end);
+            break;
+        default:
+            digits = utoa_decimal(value, end);
+    }
+
+    // An explicit zero precision prints nothing for a zero value
+    if (precision == 0 && value == 0) {
+        digits = 0;
+    }
+
+    // Pick the sign or radix prefix
+    const char *prefix = "";
+    if (negative) {
+        prefix = "-";
+    } else if (flags & FLAG_PLUS) {
+        prefix = "+";
+    } else if (flags & FLAG_SPACE) {
+        prefix = " ";
+    }
+    if (conversion == 'p' || ((flags & FLAG_ALT) && value != 0)) {
+        if (conversion == 'x' || conversion == 'p') {
+            prefix = "0x";
+        } else if (conversion == 'X') {
+            prefix = "0X";
+        } else if (conversion == 'o' && precision <= (int)digits) {
+            prefix = "0";
+        }
+    }
+    size_t prefix_len = strlen(prefix);
+
+    // Leading zeros come from the precision, or from the field width with the '0' flag
+    size_t zeros = 0;
+    if (precision >= 0) {
+        zeros = (size_t)precision > digits ? precision - digits : 0;
+    } else if ((flags & FLAG_ZERO) && !(flags & FLAG_LEFT) && width > 0) {
+        size_t used = prefix_len + digits;
+        zeros = (size_t)width > used ? width - used : 0;
+    }
+
+    size_t length = prefix_len + zeros + digits;
+    size_t padding = width > 0 && (size_t)width > length ? width - length : 0;
+
+    if (!(flags & FLAG_LEFT)) {
+        emit_repeat(state, ' ', padding);
+    }
+    emit(state, prefix, prefix_len);
+    emit_repeat(state, '0', zeros);
+    emit(state, end - digits, digits);
+    if (flags & FLAG_LEFT) {
+        emit_repeat(state, ' ', padding);
+    }
+}
+
+// Emit a string, cut to precision characters and padded to width
+static void emit_string(format_state_t *state, const char *str, int flags, int width,
+                        int precision) {
+    if (str == NULL) {
+        str = "(null)";
+    }
+
+    // Bound the scan by the precision so unterminated buffers are safe to print
+    size_t len = 0;
+    while ((precision < 0 || len < (size_t)precision) && str[len] != '\0') {
+        len++;
+    }
+
+    size_t padding = width > 0 && (size_t)width > len ? width - len : 0;
+
+    if (!(flags & FLAG_LEFT)) {
+        emit_repeat(state, ' ', padding);
+    }
+    emit(state, str, len);
+    if (flags & FLAG_LEFT) {
+        emit_repeat(state, ' ', padding);
+    }
+}
+
+// Parse a run of decimal digits, advancing *format past them
+static int parse_int(const char **format) {
+    int value = 0;
+    while (**format >= '0' && **format <= '9') {
+        value = value * 10 + (**format - '0');
+        (*format)++;
+    }
+    return value;
+}
+
+int vformat(char *buf, size_t size, format_sink_t sink, const char *format, va_list args) {
+    format_state_t state = {
+        .buf = buf,
+        // Leave room for the terminator when the buffer is the final destination
+        .capacity = sink != NULL ? size : (size > 0 ? size - 1 : 0),
+        .pos = 0,
+        .total = 0,
+        .sink = sink,
+    };
+
+    while (*format != '\0') {
+        // Copy the literal run up to the next conversion in one go
+        const char *literal = format;
+        while (*format != '\0' && *format != '%') {
+            format++;
+        }
+        emit(&state, literal, format - literal);
+        if (*format == '\0') {
+            break;
+        }
+        format++;  // skip the '%'
+
+        // Flags
+        int flags = 0;
+        for (bool more = true; more;) {
+            switch (*format) {
+                case '-':
+                    flags |= FLAG_LEFT;
+                    break;
+                case '0':
+                    flags |= FLAG_ZERO;
+                    break;
+                case '+':
+                    flags |= FLAG_PLUS;
+                    break;
+                case ' ':
+                    flags |= FLAG_SPACE;
+                    break;
+                case '#':
+                    flags |= FLAG_ALT;
+                    break;
+                default:
+                    more = false;
+                    continue;
+            }
+            format++;
+        }
+
+        // Field width
+        int width = 0;
+        if (*format == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                flags |= FLAG_LEFT;
+                width = -width;
+            }
+            format++;
+        } else {
+            width = parse_int(&format);
+        }
+
+        // Precision (negative means none was given)
+        int precision = -1;
+        if (*format == '.') {
+            format++;
+            if (*format == '*') {
+                precision = va_arg(args, int);
+                format++;
+            } else {
+                precision = parse_int(&format);
+            }
+        }
+
+        // Length modifier
+        length_t length = LENGTH_DEFAULT;
+        switch (*format) {
+            case 'h':
+                format++;
+                length = LENGTH_H;
+                if (*format == 'h') {
+                    format++;
+                    length = LENGTH_HH;
+                }
+                break;
+            case 'l':
+                format++;
+                length = LENGTH_L;
+                if (*format == 'l') {
+                    format++;
+                    length = LENGTH_LL;
+                }
+                break;
+            case 'z':
+            case 't':
+            case 'j':
+                // size_t, ptrdiff_t and intmax_t are all 64 bits wide here
+                format++;
+                length = LENGTH_LL;
+                break;
+        }
+
+        char conversion = *format;
+        if (conversion == '\0') {
+            break;
+        }
+        format++;
+
+        switch (conversion) {
+            case '%':
+                emit(&state, "%", 1);
+                break;
+            case 'c': {
+                char c = va_arg(args, int);
+                size_t padding = width > 1 ? width - 1 : 0;
+                if (!(flags & FLAG_LEFT)) {
+                    emit_repeat(&state, ' ', padding);
+                }
+                emit(&state, &c, 1);
+                if (flags & FLAG_LEFT) {
+                    emit_repeat(&state, ' ', padding);
+                }
+                break;
+            }
+            case 's':
+                emit_string(&state, va_arg(args, const char *), flags, width, precision);
+                break;
+            case 'd':
+            case 'i': {
+                int64_t value;
+                switch (length) {
+                    case LENGTH_HH:
+                        value = (signed char)va_arg(args, int);
+                        break;
+                    case LENGTH_H:
+                        value = (short)va_arg(args, int);
+                        break;
+                    case LENGTH_DEFAULT:
+                        value = va_arg(args, int);
+                        break;
+                    default:
+                        value = va_arg(args, int64_t);
+                }
+                // Negate in unsigned arithmetic so INT64_MIN is handled
+                uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+                emit_number(&state, magnitude, value < 0, 'd', flags, width, precision);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o': {
+                uint64_t value;
+                switch (length) {
+                    case LENGTH_HH:
+                        value = (unsigned char)va_arg(args, unsigned int);
+                        break;
+                    case LENGTH_H:
+                        value = (unsigned short)va_arg(args, unsigned int);
+                        break;
+                    case LENGTH_DEFAULT:
+                        value = va_arg(args, unsigned int);
+                        break;
+                    default:
+                        value = va_arg(args, uint64_t);
+                }
+                // Signs only apply to signed conversions
+                flags &= ~(FLAG_PLUS | FLAG_SPACE);
+                emit_number(&state, value, false, conversion, flags, width, precision);
+                break;
+            }
+            case 'p':
+                flags &= ~(FLAG_PLUS | FLAG_SPACE);
+                emit_number(&state, (uintptr_t)va_arg(args, void *), false, 'p', flags, width,
+                            precision);
+                break;
+            default: {
+                const char *unsupported = "<not supported>";
+                emit(&state, unsupported, strlen(unsupported));
+            }
+        }
+    }
+
+    if (sink != NULL) {
+        flush(&state);
+    } else if (size > 0) {
+        buf[state.pos] = '\0';
+    }
+
+    return state.total;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/**
+ * @brief format_sink_t receives runs of formatted output. It is called
+ * whenever the caller's buffer fills up and once more at the end, so short
+ * strings reach the sink in a single call.
+ */
+typedef void (*format_sink_t)(const char *str, size_t len);
+
+/**
+ * @brief vformat is the printf core shared by kprintf and printf. It never
+ * allocates: output is staged in buf and handed to sink in whole chunks.
+ *
+ * Supported conversions are %c %s %d %i %u %x %X %o %p and %%, with the
+ * flags '-', '0', '+', ' ' and '#', a field width and precision (either
+ * may be '*'), and the hh, h, l, ll, z, t and j length modifiers.
+ *
+ * @param buf staging buffer for the formatted output
+ * @param size size of buf in bytes
+ * @param sink where to flush buf, or NULL to truncate output to size - 1
+ * bytes and NUL-terminate it (snprintf behavior)
+ * @param format the format string
+ * @param args the arguments to format
+ * @return int the number of characters in the complete output, which may
+ * exceed size when sink is NULL
+ */
+int vformat(char *buf, size_t size, format_sink_t sink, const char *format, va_list args);
@@ -0,0 +1,8 @@
+#include "futex.h"
+
+#include "syscall.h"
+
+long futex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout, uint32_t *addr2,
+           uint32_t val2) {
+    return syscall(SYS_futex, addr, op, val, timeout, addr2, val2);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "time.h"
+
+// Operations accepted by futex, see kernel/include/futex.h
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_REQUEUE 2
+
+/**
+ * @brief futex sleeps on or wakes tasks sleeping on a 32-bit word
+ *
+ * @param addr the futex word, 4-byte aligned in writable memory
+ * @param op FUTEX_WAIT, FUTEX_WAKE or FUTEX_REQUEUE
+ * @param val the value FUTEX_WAIT expects at addr, or how many tasks to wake
+ * @param timeout how long FUTEX_WAIT may sleep, NULL for no limit
+ * @param addr2 where FUTEX_REQUEUE moves the waiters it doesn't wake
+ * @param val2 how many waiters FUTEX_REQUEUE may move
+ * @return long 0 after a wakeup from FUTEX_WAIT, the number of tasks woken
+ * or moved by the others; -1 if *addr != val, on timeout, or on error
+ */
+long futex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout, uint32_t *addr2,
+           uint32_t val2);
@@ -3,5 +3,5 @@
 #include "syscall.h"
 
 void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
-    return syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+    return (void *)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
 }
\ No newline at end of file
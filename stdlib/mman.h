@@ -18,17 +18,23 @@
 #define MAP_ANON MAP_ANONYMOUS
 #define MAP_32BIT 0x40
 
+// Returned by mmap on error
+#define MAP_FAILED ((void *)-1)
+
 typedef long long off_t;
 
 /**
- * @brief mmap maps a page to the given memory address
+ * @brief mmap maps anonymous memory or a file into the address space. File
+ * pages are read in on first touch and shared with every other process that
+ * maps the same file; writes to a MAP_PRIVATE mapping go to a private copy.
  *
- * @param addr the virtual memory address
- * @param length ignored
- * @param prot ignored
- * @param flags ignored
- * @param fd ignored
- * @param offset ignored
- * @return void* the left page-aligned addr
+ * @param addr where to map, or NULL to let the kernel pick
+ * @param length bytes to map, rounded up to whole pages
+ * @param prot PROT_READ, PROT_WRITE and PROT_EXEC bits
+ * @param flags MAP_SHARED or MAP_PRIVATE, optionally with MAP_ANONYMOUS or MAP_FIXED.
+ * Files are read-only, so MAP_SHARED mappings of them can't be writable.
+ * @param fd the file to map, ignored with MAP_ANONYMOUS
+ * @param offset where the mapping starts in the file, a multiple of the page size
+ * @return void* the left page-aligned address, or MAP_FAILED
  */
 void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
\ No newline at end of file
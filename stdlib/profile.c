@@ -0,0 +1,5 @@
+#include "profile.h"
+
+#include "syscall.h"
+
+long profile(int op, uint64_t arg, uint64_t arg2) { return syscall(SYS_profile, op, arg, arg2); }
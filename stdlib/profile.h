@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// See kernel/include/profile.h
+#define PROFILE_MAX_DEPTH 12
+#define PROFILE_IMAGE_MAX 16
+
+#define PROFILE_START 0
+#define PROFILE_STOP 1
+#define PROFILE_READ 2
+
+// One sample taken by the kernel's sampling profiler
+struct profile_sample {
+    uint64_t tsc;
+    uint64_t cr3;
+    uint32_t cpu;
+    uint16_t depth;
+    uint8_t user;
+    uint8_t _unused;
+    char image[PROFILE_IMAGE_MAX];
+    uint64_t pcs[PROFILE_MAX_DEPTH];
+};
+
+/**
+ * @brief profile controls the kernel's sampling profiler
+ *
+ * @param op PROFILE_START, PROFILE_STOP or PROFILE_READ
+ * @param arg sampling interval in ticks for PROFILE_START, buffer for PROFILE_READ
+ * @param arg2 buffer capacity in samples for PROFILE_READ
+ * @return long 0 after PROFILE_START, whether it was running for
+ * PROFILE_STOP, and the number of samples for PROFILE_READ; -1 on error
+ */
+long profile(int op, uint64_t arg, uint64_t arg2);
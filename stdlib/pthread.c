@@ -0,0 +1,153 @@
+#include "pthread.h"
+
+#include <stddef.h>
+
+#include "futex.h"
+#include "stdlib.h"
+#include "string.h"
+#include "sync.h"
+#include "syscall.h"
+#include "unistd.h"
+
+// A thread's control block, which its FS base points at
+struct pthread {
+    struct pthread *self;  // first, so pthread_self is a single load from %fs:0
+    uint32_t tid;          // set by the kernel, cleared and woken once the thread has exited
+    void *(*start)(void *);
+    void *arg;
+    void *result;
+    void *specific[PTHREAD_KEYS_MAX];
+    struct pthread *next;  // free list link once joined
+};
+
+static struct pthread main_thread;
+
+// Set by the main thread before it starts the first thread, and never cleared
+static volatile int threaded = 0;
+
+// Protects the free list and the keys
+static mutex_t lock = MUTEX_INIT;
+static struct pthread *free_threads = NULL;
+static void (*destructors[PTHREAD_KEYS_MAX])(void *);
+static pthread_key_t keys_used = 0;
+
+pthread_t pthread_self() {
+    // Before the first pthread_create only the main thread exists, and its FS
+    // base isn't set up yet
+    if (!threaded) {
+        return &main_thread;
+    }
+    pthread_t self;
+    __asm__ volatile("mov %%fs:0, %0" : "=r"(self));
+    return self;
+}
+
+// Where a new thread enters user mode. It must not return.
+static void thread_start(void *arg) {
+    pthread_t self = arg;
+    pthread_exit(self->start(self->arg));
+}
+
+int pthread_create(pthread_t *thread, const void *attr, void *(*start)(void *), void *arg) {
+    if (attr != NULL) {
+        return -1;
+    }
+
+    if (!threaded) {
+        main_thread.self = &main_thread;
+        if (arch_prctl(ARCH_SET_FS, (uintptr_t)&main_thread) < 0) {
+            return -1;
+        }
+        threaded = 1;
+    }
+
+    mutex_lock(&lock);
+    pthread_t t = free_threads;
+    if (t != NULL) {
+        free_threads = t->next;
+    }
+    mutex_unlock(&lock);
+    if (t == NULL) {
+        t = malloc(sizeof(struct pthread));
+        if (t == NULL) {
+            return -1;
+        }
+    }
+
+    memset(t, 0, sizeof(struct pthread));
+    t->self = t;
+    t->start = start;
+    t->arg = arg;
+    if (syscall(SYS_clone, thread_start, t, t, &t->tid) < 0) {
+        mutex_lock(&lock);
+        t->next = free_threads;
+        free_threads = t;
+        mutex_unlock(&lock);
+        return -1;
+    }
+
+    *thread = t;
+    return 0;
+}
+
+int pthread_join(pthread_t thread, void **result) {
+    if (thread == &main_thread || thread == pthread_self()) {
+        return -1;
+    }
+
+    uint32_t tid;
+    while ((tid = __atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE)) != 0) {
+        futex(&thread->tid, FUTEX_WAIT, tid, NULL, NULL, 0);
+    }
+    if (result != NULL) {
+        *result = thread->result;
+    }
+
+    mutex_lock(&lock);
+    thread->next = free_threads;
+    free_threads = thread;
+    mutex_unlock(&lock);
+    return 0;
+}
+
+void pthread_exit(void *result) {
+    pthread_t self = pthread_self();
+    for (pthread_key_t key = 0; key < PTHREAD_KEYS_MAX; key++) {
+        void *value = self->specific[key];
+        if (value != NULL && destructors[key] != NULL) {
+            self->specific[key] = NULL;
+            destructors[key](value);
+        }
+    }
+
+    if (self == &main_thread) {
+        exit(0);
+    }
+    self->result = result;
+    syscall(SYS_thread_exit);
+    __builtin_unreachable();
+}
+
+int pthread_key_create(pthread_key_t *key, void (*destructor)(void *)) {
+    mutex_lock(&lock);
+    if (keys_used == PTHREAD_KEYS_MAX) {
+        mutex_unlock(&lock);
+        return -1;
+    }
+    destructors[keys_used] = destructor;
+    *key = keys_used++;
+    mutex_unlock(&lock);
+    return 0;
+}
+
+void *pthread_getspecific(pthread_key_t key) {
+    return key < PTHREAD_KEYS_MAX ? pthread_self()->specific[key] : NULL;
+}
+
+int pthread_setspecific(pthread_key_t key, const void *value) {
+    if (key >= PTHREAD_KEYS_MAX) {
+        return -1;
+    }
+    pthread_self()->specific[key] = (void *)value;
+    return 0;
+}
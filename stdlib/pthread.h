@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+// Thread-specific data keys a process may create
+#define PTHREAD_KEYS_MAX 16
+
+// A thread started by pthread_create, or the main thread
+typedef struct pthread *pthread_t;
+
+typedef unsigned int pthread_key_t;
+
+/**
+ * @brief pthread_create starts a thread running start(arg) in this process.
+ * It shares memory and files with the others and has its own stack and
+ * thread-specific data. Lock shared data with mutex_t and cond_t from sync.h.
+ *
+ * @param thread set to the new thread
+ * @param attr must be NULL, there are no attributes
+ * @param start the thread's function; returning from it is pthread_exit
+ * @param arg passed to start
+ * @return int 0 on success, -1 when the kernel can't start another thread
+ */
+int pthread_create(pthread_t *thread, const void *attr, void *(*start)(void *), void *arg);
+
+/**
+ * @brief pthread_join waits for a thread to exit and releases it. Each
+ * thread must be joined exactly once.
+ *
+ * @param thread a thread from pthread_create
+ * @param result where to store the value the thread exited with, or NULL
+ * @return int 0, or -1 when joining the main thread or the caller itself
+ */
+int pthread_join(pthread_t thread, void **result);
+
+// end the calling thread with result, running key destructors first. Ending
+// the main thread this way ends the process with status 0.
+void pthread_exit(void *result);
+
+// the calling thread
+pthread_t pthread_self();
+
+/**
+ * @brief pthread_key_create makes a key for thread-specific data, whose value
+ * starts out NULL in every thread
+ *
+ * @param key set to the new key
+ * @param destructor called with a thread's non-NULL value when it exits, or NULL
+ * @return int 0, or -1 once PTHREAD_KEYS_MAX keys exist
+ */
+int pthread_key_create(pthread_key_t *key, void (*destructor)(void *));
+
+// the calling thread's value for key
+void *pthread_getspecific(pthread_key_t key);
+
+// set the calling thread's value for key, returning 0 or -1 for a bad key
+int pthread_setspecific(pthread_key_t key, const void *value);
@@ -0,0 +1,91 @@
+#include "ring.h"
+
+#include "syscall.h"
+
+int ring_init(ring_t *ring, uint32_t entries, uint32_t flags) {
+    long addr = syscall(SYS_ring_setup, entries, flags);
+    if (addr < 0) {
+        return -1;
+    }
+    ring->header = (ring_header_t *)addr;
+    ring->sqes = (ring_sqe_t *)(ring->header + 1);
+    ring->cqes = (ring_cqe_t *)(ring->sqes + entries);
+    ring->mask = entries - 1;
+    ring->sqe_tail = 0;
+    ring->submitted = 0;
+    ring->flags = flags;
+    return 0;
+}
+
+ring_sqe_t *ring_get_sqe(ring_t *ring) {
+    uint32_t head = __atomic_load_n(&ring->header->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head > ring->mask) {
+        return NULL;
+    }
+    return &ring->sqes[ring->sqe_tail++ & ring->mask];
+}
+
+void ring_prep(ring_sqe_t *sqe, uint64_t nr, uint64_t user_data, uint64_t arg0, uint64_t arg1,
+               uint64_t arg2) {
+    sqe->nr = nr;
+    sqe->args[0] = arg0;
+    sqe->args[1] = arg1;
+    sqe->args[2] = arg2;
+    sqe->args[3] = 0;
+    sqe->args[4] = 0;
+    sqe->args[5] = 0;
+    sqe->user_data = user_data;
+}
+
+void ring_prep_read(ring_sqe_t *sqe, int fd, void *buf, size_t count, uint64_t user_data) {
+    ring_prep(sqe, SYS_read, user_data, fd, (uintptr_t)buf, count);
+}
+
+void ring_prep_write(ring_sqe_t *sqe, int fd, const void *buf, size_t count, uint64_t user_data) {
+    ring_prep(sqe, SYS_write, user_data, fd, (uintptr_t)buf, count);
+}
+
+// Publish the new entries and work out whether the kernel needs a call
+static uint32_t publish(ring_t *ring, uint32_t *enter_flags) {
+    uint32_t count = ring->sqe_tail - ring->submitted;
+    ring->submitted = ring->sqe_tail;
+    *enter_flags = 0;
+    if (!(ring->flags & RING_SETUP_SQPOLL)) {
+        __atomic_store_n(&ring->header->sq_tail, ring->submitted, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    // The poller sets its flag before looking at the tail one last time, so
+    // publishing the tail before reading the flag means one sees the other
+    __atomic_store_n(&ring->header->sq_tail, ring->submitted, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->header->flags, __ATOMIC_SEQ_CST) & RING_NEED_WAKEUP) {
+        *enter_flags = RING_ENTER_WAKEUP;
+    }
+    return count;
+}
+
+int ring_submit(ring_t *ring) { return ring_submit_and_wait(ring, 0); }
+
+int ring_submit_and_wait(ring_t *ring, uint32_t min) {
+    uint32_t enter_flags;
+    uint32_t count = publish(ring, &enter_flags);
+    if ((ring->flags & RING_SETUP_SQPOLL) && enter_flags == 0 && min == 0) {
+        return count;
+    }
+    if (syscall(SYS_ring_enter, count, min, enter_flags) < 0) {
+        return -1;
+    }
+    return count;
+}
+
+ring_cqe_t *ring_peek_cqe(ring_t *ring) {
+    uint32_t head = ring->header->cq_head;
+    if (head == __atomic_load_n(&ring->header->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->mask];
+}
+
+void ring_cqe_seen(ring_t *ring) {
+    __atomic_store_n(&ring->header->cq_head, ring->header->cq_head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Flags and limits, see kernel/include/ring.h
+#define RING_MAX_ENTRIES 1024
+#define RING_SETUP_SQPOLL 0x1
+#define RING_ENTER_WAKEUP 0x1
+#define RING_NEED_WAKEUP 0x1
+
+// The start of a ring's shared memory, laid out as in kernel/include/ring.h
+typedef struct ring_header {
+    uint32_t sq_head;
+    uint32_t sq_tail;
+    uint32_t flags;
+    uint32_t entries;
+    uint8_t _pad[48];
+    uint32_t cq_head;
+    uint32_t cq_tail;
+    uint8_t _pad2[56];
+} ring_header_t;
+
+// A request: a system call number from syscall.h and its arguments
+typedef struct ring_sqe {
+    uint64_t nr;
+    uint64_t args[6];
+    uint64_t user_data;
+} ring_sqe_t;
+
+// A finished request and what its system call returned
+typedef struct ring_cqe {
+    uint64_t user_data;
+    int64_t res;
+} ring_cqe_t;
+
+// A process's ring, as seen by the program. Its functions aren't
+// thread-safe; threads sharing a ring must lock around them.
+typedef struct ring {
+    ring_header_t *header;
+    ring_sqe_t *sqes;
+    ring_cqe_t *cqes;
+    uint32_t mask;       // entries - 1
+    uint32_t sqe_tail;   // one past the last entry ring_get_sqe handed out
+    uint32_t submitted;  // sq_tail as last published
+    uint32_t flags;      // from ring_init
+} ring_t;
+
+/**
+ * @brief ring_init sets up the process's ring, of which there is only one.
+ * Requests may be read, write, mmap, open, close, lseek, stat, getdents,
+ * pipe, dup2, futex, clock_gettime and nanosleep; others complete with -1.
+ *
+ * @param ring filled in to use with the functions below
+ * @param entries capacity of each queue, a power of two up to RING_MAX_ENTRIES
+ * @param flags RING_SETUP_SQPOLL to have a kernel thread take submissions as
+ * they appear, so most need no system call, or 0
+ * @return int 0, or -1 if the process already has a ring or entries is invalid
+ */
+int ring_init(ring_t *ring, uint32_t entries, uint32_t flags);
+
+// a free submission entry to fill in, or NULL when the queue is full
+ring_sqe_t *ring_get_sqe(ring_t *ring);
+
+/**
+ * @brief ring_prep fills in a submission entry for a system call
+ *
+ * @param sqe from ring_get_sqe
+ * @param nr the system call number, SYS_* from syscall.h
+ * @param user_data handed back in the completion
+ * @param args the call's first three arguments; set sqe->args for more
+ */
+void ring_prep(ring_sqe_t *sqe, uint64_t nr, uint64_t user_data, uint64_t arg0, uint64_t arg1,
+               uint64_t arg2);
+
+// fill in sqe for read(fd, buf, count)
+void ring_prep_read(ring_sqe_t *sqe, int fd, void *buf, size_t count, uint64_t user_data);
+
+// fill in sqe for write(fd, buf, count)
+void ring_prep_write(ring_sqe_t *sqe, int fd, const void *buf, size_t count, uint64_t user_data);
+
+/**
+ * @brief ring_submit hands the entries filled in since the last call to the
+ * kernel. Without RING_SETUP_SQPOLL this runs them in one system call; with
+ * it, the polling thread picks them up and a system call is only made to
+ * wake it once it has gone to sleep.
+ *
+ * @param ring the ring
+ * @return int the number of entries handed over, or -1 on error
+ */
+int ring_submit(ring_t *ring);
+
+// ring_submit, then wait until at least min completions are ready. Returns
+// the number of entries handed over or -1.
+int ring_submit_and_wait(ring_t *ring, uint32_t min);
+
+// the oldest completion not yet seen, or NULL if there is none
+ring_cqe_t *ring_peek_cqe(ring_t *ring);
+
+// mark the completion from ring_peek_cqe seen, making room for another
+void ring_cqe_seen(ring_t *ring);
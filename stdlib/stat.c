@@ -0,0 +1,5 @@
+#include "stat.h"
+
+#include "syscall.h"
+
+int stat(const char *pathname, struct stat *statbuf) { return syscall(SYS_stat, pathname, statbuf); }
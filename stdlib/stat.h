@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// File types in st_mode, see kernel/include/vfs.h
+#define S_IFMT 0170000
+#define S_IFDIR 0040000
+#define S_IFREG 0100000
+
+#define S_ISDIR(mode) (((mode)&S_IFMT) == S_IFDIR)
+#define S_ISREG(mode) (((mode)&S_IFMT) == S_IFREG)
+
+// What stat reports about a file
+struct stat {
+    uint64_t st_ino;
+    uint32_t st_mode;
+    uint32_t _unused;
+    uint64_t st_size;  // bytes in a file, entries in a directory
+};
+
+/**
+ * @brief stat looks up a file by path
+ *
+ * @param pathname the path, relative paths start at the root
+ * @param statbuf where to store what is known about the file
+ * @return int 0 on success, -1 if the path doesn't exist
+ */
+int stat(const char *pathname, struct stat *statbuf);
@@ -0,0 +1,5 @@
+#include "stats.h"
+
+#include "syscall.h"
+
+long stats(struct stat_entry *entries, size_t count) { return syscall(SYS_stats, entries, count); }
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATS_NAME_MAX 32
+
+// One kernel counter, as reported by stats
+struct stat_entry {
+    char name[STATS_NAME_MAX];
+    int64_t value;
+};
+
+/**
+ * @brief stats reads the kernel's counters
+ *
+ * @param entries where to store the counters
+ * @param count the number of entries available
+ * @return long the number of counters the kernel has, which may exceed count
+ */
+long stats(struct stat_entry *entries, size_t count);
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <stdarg.h>
 #include <stddef.h>
 
-// printf implementation support %c %x %d %x %p format character
-void printf(const char *format, ...);
\ No newline at end of file
+// printf implementation, see format.h for the supported conversions
+int printf(const char *format, ...);
+
+// format into buf, writing at most size bytes including the terminator
+int snprintf(char *buf, size_t size, const char *format, ...);
+
+int vsnprintf(char *buf, size_t size, const char *format, va_list args);
@@ -2,6 +2,7 @@
 
 #include "mman.h"
 #include "stdio.h"
+#include "sync.h"
 
 #define PAGE_SIZE 0x1000
 
@@ -11,9 +12,13 @@
 void* bump = NULL;
 size_t space_remaining = 0;
 
+// Threads share the bump region
+static mutex_t malloc_lock = MUTEX_INIT;
+
 void* malloc(size_t size) {
     // Round sz up to a multiple of 16
     size = ROUND_UP(size, 16);
+    mutex_lock(&malloc_lock);
 
     // Do we have enough space to satisfy this allocation?
     if (space_remaining < size) {
@@ -23,7 +28,8 @@ void* malloc(size_t size) {
             mmap(NULL, rounded_up, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
 
         // Check for errors
-        if (newmem == NULL) {
+        if (newmem == MAP_FAILED) {
+            mutex_unlock(&malloc_lock);
             return NULL;
         }
 
@@ -35,6 +41,7 @@ void* malloc(size_t size) {
     void* result = bump;
     bump += size;
     space_remaining -= size;
+    mutex_unlock(&malloc_lock);
 
     return result;
 }
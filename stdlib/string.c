@@ -33,4 +33,26 @@ void *memcpy(void *dest, const void *src, size_t n) {
     for (size_t i = 0; i < n; i++) {
         cdest[i] = csrc[i];
     }
-}
\ No newline at end of file
+}
+
+int memcmp(const void *s1, const void *s2, size_t n) {
+    const unsigned char *p1 = s1;
+    const unsigned char *p2 = s2;
+    for (size_t i = 0; i < n; i++) {
+        if (p1[i] != p2[i]) {
+            return p1[i] - p2[i];
+        }
+    }
+    return 0;
+}
+
+char *strchr(const char *str, int c) {
+    for (;; str++) {
+        if (*str == (char)c) {
+            return (char *)str;
+        }
+        if (*str == '\0') {
+            return NULL;
+        }
+    }
+}
@@ -40,4 +40,23 @@ void *memset(void *s, int c, size_t n);
  * @param n memory size
  * @return void*
  */
-void *memcpy(void *dest, const void *src, size_t n);
\ No newline at end of file
+void *memcpy(void *dest, const void *src, size_t n);
+
+/**
+ * @brief memcmp compares the first n bytes of s1 and s2
+ *
+ * @param s1
+ * @param s2
+ * @param n number of bytes to compare
+ * @return int 0 if the bytes are equal, <0 if s1 sorts first, >0 otherwise
+ */
+int memcmp(const void *s1, const void *s2, size_t n);
+
+/**
+ * @brief strchr finds the first occurrence of c in str
+ *
+ * @param str
+ * @param c the character to look for, which may be the terminator
+ * @return char* the occurrence, or NULL if there is none
+ */
+char *strchr(const char *str, int c);
@@ -0,0 +1,82 @@
+#include "sync.h"
+
+#include <stddef.h>
+
+#include "futex.h"
+
+// The mutex follows Drepper's "Futexes Are Tricky": the state records
+// whether anyone may be sleeping, so an unlock only enters the kernel then
+
+void mutex_init(mutex_t *mutex) { mutex->state = 0; }
+
+// Take the mutex marking it contended, for callers that may have company
+static void mutex_lock_contended(mutex_t *mutex) {
+    while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        futex(&mutex->state, FUTEX_WAIT, 2, NULL, NULL, 0);
+    }
+}
+
+void mutex_lock(mutex_t *mutex) {
+    uint32_t expected = 0;
+    if (__atomic_compare_exchange_n(&mutex->state, &expected, 1, false, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+        return;
+    }
+    mutex_lock_contended(mutex);
+}
+
+bool mutex_trylock(mutex_t *mutex) {
+    uint32_t expected = 0;
+    return __atomic_compare_exchange_n(&mutex->state, &expected, 1, false, __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED);
+}
+
+void mutex_unlock(mutex_t *mutex) {
+    if (__atomic_exchange_n(&mutex->state, 0, __ATOMIC_RELEASE) == 2) {
+        futex(&mutex->state, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+void cond_init(cond_t *cond) {
+    cond->seq = 0;
+    cond->waiters = 0;
+    cond->mutex = NULL;
+}
+
+void cond_wait(cond_t *cond, mutex_t *mutex) {
+    cond->mutex = mutex;
+    __atomic_add_fetch(&cond->waiters, 1, __ATOMIC_RELAXED);
+    uint32_t seq = __atomic_load_n(&cond->seq, __ATOMIC_ACQUIRE);
+
+    // A signal between the unlock and the sleep changes seq, so the wait
+    // returns at once instead of missing it
+    mutex_unlock(mutex);
+    futex(&cond->seq, FUTEX_WAIT, seq, NULL, NULL, 0);
+    __atomic_sub_fetch(&cond->waiters, 1, __ATOMIC_RELAXED);
+
+    // Broadcasts requeue waiters onto the mutex, so others may be asleep there
+    mutex_lock_contended(mutex);
+}
+
+void cond_signal(cond_t *cond) {
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_RELAXED) > 0) {
+        futex(&cond->seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+void cond_broadcast(cond_t *cond) {
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+
+    // Requeued waiters are only woken by an unlock that sees the mutex
+    // contended, so mark a held mutex that way first. A free one is taken as
+    // contended by the waiter woken here.
+    mutex_t *mutex = cond->mutex;
+    uint32_t locked = 1;
+    __atomic_compare_exchange_n(&mutex->state, &locked, 2, false, __ATOMIC_RELAXED,
+                                __ATOMIC_RELAXED);
+    futex(&cond->seq, FUTEX_REQUEUE, 1, NULL, &mutex->state, UINT32_MAX);
+}
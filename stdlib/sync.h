@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A sleeping lock. Taking and releasing it without contention stays in user
+// space; only tasks that have to wait enter the kernel.
+typedef struct mutex {
+    uint32_t state;  // 0 unlocked, 1 locked, 2 locked with waiters
+} mutex_t;
+
+#define MUTEX_INIT \
+    { .state = 0 }
+
+// A condition variable, used together with a mutex
+typedef struct cond {
+    uint32_t seq;      // bumped by every signal, the futex word waiters sleep on
+    uint32_t waiters;  // tasks in cond_wait, so signals without any skip the kernel
+    mutex_t *mutex;    // the mutex waiters hold, where broadcasts requeue them
+} cond_t;
+
+#define COND_INIT \
+    { .seq = 0, .waiters = 0, .mutex = NULL }
+
+void mutex_init(mutex_t *mutex);
+
+// take the mutex, sleeping while another task holds it
+void mutex_lock(mutex_t *mutex);
+
+// take the mutex if it is free, returning whether it was
+bool mutex_trylock(mutex_t *mutex);
+
+// release the mutex, waking a waiter if there is one
+void mutex_unlock(mutex_t *mutex);
+
+void cond_init(cond_t *cond);
+
+/**
+ * @brief cond_wait releases the mutex, sleeps until the condition is
+ * signalled and takes the mutex again. Wakeups may be spurious, so callers
+ * re-check their predicate in a loop.
+ *
+ * @param cond the condition to wait for
+ * @param mutex the mutex the caller holds; every waiter must use the same one
+ */
+void cond_wait(cond_t *cond, mutex_t *mutex);
+
+// wake one task waiting on the condition
+void cond_signal(cond_t *cond);
+
+// wake every task waiting on the condition. One is woken and the rest are
+// moved to the mutex's queue, so they wake one at a time as it is released.
+void cond_broadcast(cond_t *cond);
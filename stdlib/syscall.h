@@ -7,5 +7,29 @@
 #define SYS_mmap 2
 #define SYS_exec 3
 #define SYS_exit 4
+#define SYS_stats 5
+#define SYS_clock_gettime 6
+#define SYS_nanosleep 7
+#define SYS_profile 8
+#define SYS_dmesg 9
+#define SYS_trace 10
+#define SYS_open 11
+#define SYS_close 12
+#define SYS_lseek 13
+#define SYS_stat 14
+#define SYS_getdents 15
+#define SYS_pipe 16
+#define SYS_dup2 17
+#define SYS_spawn 18
+#define SYS_waitpid 19
+#define SYS_getpid 20
+#define SYS_futex 21
+#define SYS_clone 22
+#define SYS_thread_exit 23
+#define SYS_arch_prctl 24
+#define SYS_ring_setup 25
+#define SYS_ring_enter 26
+#define SYS_poweroff 27
 
-extern int syscall(uint64_t number, ...);
+// issue a system call, returning its full 64-bit result
+extern long syscall(uint64_t number, ...);
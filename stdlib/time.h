@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+#define CLOCK_MONOTONIC_COARSE 6  // as of the last 1 ms tick, cheaper still
+
+typedef int clockid_t;
+typedef int64_t time_t;
+
+struct timespec {
+    time_t tv_sec;
+    long tv_nsec;
+};
+
+/**
+ * @brief clock_gettime reads a clock. The monotonic clocks are read through
+ * the vDSO without a system call.
+ *
+ * @param clock_id CLOCK_MONOTONIC or CLOCK_MONOTONIC_COARSE
+ * @param tp where to store the time
+ * @return int 0 on success, -1 on error
+ */
+int clock_gettime(clockid_t clock_id, struct timespec *tp);
+
+/**
+ * @brief nanosleep suspends the program for at least the requested time
+ *
+ * @param req how long to sleep
+ * @param rem set to the unslept time, may be NULL
+ * @return int 0 on success, -1 on error
+ */
+int nanosleep(const struct timespec *req, struct timespec *rem);
@@ -0,0 +1,5 @@
+#include "trace.h"
+
+#include "syscall.h"
+
+long trace(int op, uint64_t arg, uint64_t arg2) { return syscall(SYS_trace, op, arg, arg2); }
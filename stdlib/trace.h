@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// See kernel/include/trace.h
+#define TRACE_SYSCALL_ENTER 0
+#define TRACE_SYSCALL_EXIT 1
+#define TRACE_EXEC 2
+#define TRACE_VM_MAP 3
+#define TRACE_PMEM_ALLOC 4
+#define TRACE_PAGE_FAULT 5
+#define TRACE_IRQ 6
+
+#define TRACE_START 0
+#define TRACE_STOP 1
+#define TRACE_READ 2
+#define TRACE_TSC_HZ 3
+
+// One event recorded by a kernel tracepoint
+struct trace_record {
+    uint64_t tsc;
+    uint32_t cpu;
+    uint16_t event;
+    uint16_t _unused;
+    uint64_t args[2];
+};
+
+/**
+ * @brief trace controls the kernel's tracepoints
+ *
+ * @param op TRACE_START, TRACE_STOP, TRACE_READ or TRACE_TSC_HZ
+ * @param arg event mask for TRACE_START (0 for all), buffer for TRACE_READ
+ * @param arg2 buffer capacity in records for TRACE_READ
+ * @return long 0 after TRACE_START, whether it was running for TRACE_STOP,
+ * the number of records for TRACE_READ and the TSC frequency for
+ * TRACE_TSC_HZ; -1 on error
+ */
+long trace(int op, uint64_t arg, uint64_t arg2);
@@ -3,11 +3,43 @@
 #include <stdint.h>
 
 #include "syscall.h"
+#include "vdso.h"
 
 ssize_t write(int fd, const void *buf, size_t count) { return syscall(SYS_write, fd, buf, count); }
 
 ssize_t read(int fd, void *buf, size_t count) { return syscall(SYS_read, fd, buf, count); }
 
-int exec(const char *file_name, char *const argv[]) { return syscall(SYS_exec, file_name, argv); }
+int close(int fd) { return syscall(SYS_close, fd); }
+
+int pipe(int fds[2]) { return syscall(SYS_pipe, fds); }
+
+int dup2(int old_fd, int new_fd) { return syscall(SYS_dup2, old_fd, new_fd); }
+
+off_t lseek(int fd, off_t offset, int whence) { return syscall(SYS_lseek, fd, offset, whence); }
+
+int exec(const char *file_name, char *const argv[]) { return execve(file_name, argv, NULL); }
+
+int execve(const char *file_name, char *const argv[], char *const envp[]) {
+    // Programs expect at least their name as argv[0]
+    char *const name_only[] = {(char *)file_name, NULL};
+    return syscall(SYS_exec, file_name, argv != NULL ? argv : name_only, envp);
+}
+
+int spawn(const char *file_name, char *const argv[]) {
+    char *const name_only[] = {(char *)file_name, NULL};
+    return syscall(SYS_spawn, file_name, argv != NULL ? argv : name_only, NULL);
+}
+
+int waitpid(int pid, int *status, int options) {
+    return syscall(SYS_waitpid, pid, status, options);
+}
+
+int getpid() { return VDSO_CALL(int, VDSO_GETPID); }
+
+int sched_getcpu() { return VDSO_CALL(int, VDSO_GETCPU); }
+
+int arch_prctl(int code, uintptr_t addr) { return syscall(SYS_arch_prctl, code, addr); }
+
+int poweroff(int status) { return syscall(SYS_poweroff, status); }
 
 int exit(int status) { return syscall(SYS_exit, status); }
\ No newline at end of file
@@ -2,16 +2,69 @@
 
 #include <stddef.h>
 
+#include <stdint.h>
+
 typedef long ssize_t;
+typedef long long off_t;
+
+// Origins accepted by lseek
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
 
-// write content buf with size count to terminal
+// Codes accepted by arch_prctl
+#define ARCH_SET_FS 0x1002
+#define ARCH_GET_FS 0x1003
+
+// write content buf with size count to the file fd, 1 being the terminal
 ssize_t write(int fd, const void *buf, size_t count);
 
-// read content with size count from keyboard input to buf
+// read up to count bytes from the file fd to buf, 0 being the keyboard
 ssize_t read(int fd, void *buf, size_t count);
 
-// execute submodule with file_name
+// close a file descriptor
+int close(int fd);
+
+// make a pipe, storing its read end in fds[0] and its write end in fds[1]
+int pipe(int fds[2]);
+
+// make new_fd refer to the same open file as old_fd, closing new_fd first
+int dup2(int old_fd, int new_fd);
+
+// move the read offset of fd to offset bytes from whence, returning the new offset
+off_t lseek(int fd, off_t offset, int whence);
+
+// execute the program at file_name, or /bin/file_name, or the module named file_name.
+// argv is NULL-terminated and starts with the program's name; NULL passes just file_name.
 int exec(const char *file_name, char *const argv[]);
 
-// execute init submodule
+// exec with a NULL-terminated environment as well, or NULL for none
+int execve(const char *file_name, char *const argv[], char *const envp[]);
+
+// run a program like exec but as a child process alongside this one, sharing
+// fds 0-2, returning the child's pid or -1
+int spawn(const char *file_name, char *const argv[]);
+
+// wait for child pid, or any child if pid is -1, to exit and store its exit
+// status; returns the child's pid, or -1 if there is no such child
+int waitpid(int pid, int *status, int options);
+
+// the calling process's pid, read through the vDSO
+int getpid();
+
+// the CPU the caller was running on when it asked, read through the vDSO;
+// it may have moved by the time this returns
+int sched_getcpu();
+
+// set the calling thread's FS base to addr with ARCH_SET_FS, or store it at
+// addr with ARCH_GET_FS; returns 0 or -1
+int arch_prctl(int code, uintptr_t addr);
+
+// end the process and all its threads, handing status to its parent; init
+// restarts instead
 int exit(int status);
+
+// stop the machine once the serial console has drained, exiting QEMU with
+// (status << 1) | 1 when it has an isa-debug-exit device; only init may,
+// others get -1
+int poweroff(int status);
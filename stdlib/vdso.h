@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// Where the kernel maps the vDSO's code page, see kernel/include/vdso.h
+#define VDSO_CODE_ADDRESS 0x7FFFFFFD000
+
+// Entry points, at these offsets in the code page
+#define VDSO_MONOTONIC_NS 0x00
+#define VDSO_COARSE_NS 0x08
+#define VDSO_GETCPU 0x10
+#define VDSO_GETPID 0x18
+
+// call the vDSO entry point at offset, which returns an integer without a
+// system call
+#define VDSO_CALL(type, offset) (((type(*)())(VDSO_CODE_ADDRESS + (offset)))())
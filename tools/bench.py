@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Run the benchmark ISO headless in QEMU and save its results as JSON.
+
+Usage: tools/bench.py ISO [-o OUT] [--timeout SECONDS]
+
+The bench program boots as init with its output on the serial console. When it
+prints "BENCH-INPUT <n>" this types n characters into the serial line, one at a
+time, for the input latency benchmark. The results come back between the
+BENCH-JSON-BEGIN and BENCH-JSON-END lines, and bench powers the machine off
+through QEMU's isa-debug-exit device.
+
+Every time is in TSC cycles; divide by tsc_hz for seconds.
+"""
+
+import argparse
+import json
+import subprocess
+import sys
+import threading
+import time
+
+# See kernel/src/syscall.c
+DEBUG_EXIT_PORT = 0xF4
+
+# isa-debug-exit exits QEMU with (value << 1) | 1, and bench writes 0
+EXIT_SUCCESS = 1
+
+# Gap between typed characters, so each one gets a read of its own
+TYPE_DELAY = 0.05
+
+
+def qemu_command(iso):
+    return ["qemu-system-x86_64", "-m", "2G", "-smp", "4", "-display", "none",
+            "-serial", "stdio", "-device",
+            "isa-debug-exit,iobase=%#x,iosize=0x04" % DEBUG_EXIT_PORT, "-cdrom", iso]
+
+
+def type_input(qemu, count):
+    for _ in range(count):
+        time.sleep(TYPE_DELAY)
+        qemu.stdin.write(b"x")
+        qemu.stdin.flush()
+
+
+def run(iso, timeout):
+    """Boot the ISO and return the console lines and QEMU's exit status."""
+    qemu = subprocess.Popen(qemu_command(iso), stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    timer = threading.Timer(timeout, qemu.kill)
+    timer.start()
+
+    lines = []
+    try:
+        for raw in qemu.stdout:
+            line = raw.decode(errors="replace").rstrip("\r\n")
+            lines.append(line)
+            if line.startswith("BENCH-INPUT "):
+                count = int(line.split()[1])
+                threading.Thread(target=type_input, args=(qemu, count), daemon=True).start()
+        status = qemu.wait()
+    finally:
+        timer.cancel()
+    return lines, status
+
+
+def extract(lines):
+    """Return the JSON printed between the markers, or None."""
+    try:
+        begin = lines.index("BENCH-JSON-BEGIN")
+        end = lines.index("BENCH-JSON-END", begin)
+    except ValueError:
+        return None
+    return json.loads("\n".join(lines[begin + 1:end]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("iso", help="the ISO built by make bench.iso")
+    parser.add_argument("-o", "--output", help="output file (default: stdout)")
+    parser.add_argument("--timeout", type=float, default=300,
+                        help="seconds before giving up on QEMU (default: 300)")
+    args = parser.parse_args()
+
+    lines, status = run(args.iso, args.timeout)
+    results = extract(lines)
+    if results is None:
+        sys.stderr.write("\n".join(lines[-20:]) + "\n")
+        sys.exit("bench.py: no results, QEMU exited with %d" % status)
+    if status != EXIT_SUCCESS:
+        sys.exit("bench.py: QEMU exited with %d" % status)
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    json.dump(results, out, indent=2)
+    out.write("\n")
+    if args.output:
+        out.close()
+        for result in results["results"]:
+            print("%-16s median %10d  p99 %10d cycles" %
+                  (result["name"], result["median_cycles"], result["p99_cycles"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Symbolize samples dumped by the prof program into flamegraph folded stacks.
+
+Usage: tools/profile.py CAPTURE [-o OUT]
+
+CAPTURE is console output containing lines printed by prof:
+
+    S <cpu> <cr3> <image> <k|u> <pc> <return address>...
+
+Kernel frames are symbolized against kernel/kernel.elf and user frames against
+the ELF of the module named in the sample (<image>/<image>). The output has one
+line per distinct stack, outermost frame first, followed by its sample count, as
+expected by flamegraph.pl and speedscope.
+"""
+
+import argparse
+import bisect
+import collections
+import os
+import shutil
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+KERNEL_HALF_START = 0xFFFF800000000000
+
+
+class SymbolTable:
+    """Function symbols of one ELF file, sorted for address lookups."""
+
+    def __init__(self, path):
+        self.addresses = []
+        self.names = []
+        if not os.path.exists(path):
+            return
+
+        nm = shutil.which("x86_64-elf-nm") or "nm"
+        output = subprocess.run([nm, "-n", "--defined-only", path],
+                                capture_output=True, text=True, check=True).stdout
+        for line in output.splitlines():
+            fields = line.split()
+            if len(fields) == 3 and fields[1] in "tTwW":
+                self.addresses.append(int(fields[0], 16))
+                self.names.append(fields[2])
+
+    def lookup(self, address):
+        index = bisect.bisect_right(self.addresses, address) - 1
+        if index < 0:
+            return None
+        return self.names[index]
+
+
+class Symbolizer:
+    def __init__(self):
+        self.tables = {}
+
+    def table(self, image):
+        if image not in self.tables:
+            if image == "kernel":
+                path = os.path.join(ROOT, "kernel", "kernel.elf")
+            else:
+                path = os.path.join(ROOT, image, image)
+            self.tables[image] = SymbolTable(path)
+        return self.tables[image]
+
+    def symbolize(self, image, address, is_return):
+        # A return address points after the call, so look up the call itself
+        lookup = address - 1 if is_return else address
+        owner = "kernel" if address >= KERNEL_HALF_START else image
+        name = self.table(owner).lookup(lookup)
+        return name if name is not None else "%s+0x%x" % (owner, address)
+
+
+def fold(lines, symbolizer):
+    stacks = collections.Counter()
+    for line in lines:
+        fields = line.split()
+        if len(fields) < 6 or fields[0] != "S":
+            continue
+
+        image = fields[3]
+        pcs = [int(pc, 16) for pc in fields[5:]]
+        frames = [symbolizer.symbolize(image, pc, i > 0) for i, pc in enumerate(pcs)]
+
+        # Samples list the innermost frame first; folded stacks start at the root
+        frames.reverse()
+        stacks[";".join([image] + frames)] += 1
+    return stacks
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="console capture containing prof output")
+    parser.add_argument("-o", "--output", help="write folded stacks here instead of stdout")
+    args = parser.parse_args()
+
+    with open(args.capture, errors="replace") as f:
+        stacks = fold(f, Symbolizer())
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    for stack, count in sorted(stacks.items()):
+        out.write("%s %d\n" % (stack, count))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""Convert records dumped by the trace program into Chrome trace JSON.
+
+Usage: tools/trace.py CAPTURE [-o OUT]
+
+CAPTURE is console output containing lines printed by trace:
+
+    F <tsc hz>
+    T <tsc> <cpu> <event> <arg0> <arg1>
+
+Each CPU becomes a thread of one process. Syscalls become duration events from
+their entry to their exit record; everything else becomes an instant event.
+Load the output in chrome://tracing or https://ui.perfetto.dev.
+"""
+
+import argparse
+import json
+import sys
+
+# See kernel/include/trace.h
+SYSCALL_ENTER = 0
+SYSCALL_EXIT = 1
+EXEC = 2
+VM_MAP = 3
+PMEM_ALLOC = 4
+PAGE_FAULT = 5
+IRQ = 6
+
+# See kernel/include/syscall.h
+SYSCALLS = ["read", "write", "mmap", "exec", "exit", "stats", "clock_gettime", "nanosleep",
+            "profile", "dmesg", "trace", "open", "close", "lseek", "stat", "getdents", "pipe",
+            "dup2", "spawn", "waitpid", "getpid", "futex", "clone", "thread_exit", "arch_prctl",
+            "ring_setup", "ring_enter", "poweroff"]
+
+IRQS = {0x21: "keyboard", 0x24: "serial"}
+
+
+def syscall_name(nr):
+    return SYSCALLS[nr] if nr < len(SYSCALLS) else "syscall %d" % nr
+
+
+def unpack_string(value):
+    """Undo trace_pack_string: up to 8 little-endian bytes, NUL padded."""
+    return value.to_bytes(8, "little").rstrip(b"\0").decode(errors="replace")
+
+
+def to_signed(value):
+    return value - (1 << 64) if value >= 1 << 63 else value
+
+
+def describe(event, arg0, arg1):
+    """The name, category and arguments shown for one record."""
+    if event == SYSCALL_ENTER:
+        return syscall_name(arg0), "syscall", {"arg0": hex(arg1)}
+    if event == SYSCALL_EXIT:
+        return syscall_name(arg0), "syscall", {"ret": to_signed(arg1)}
+    if event == EXEC:
+        return "exec", "exec", {"module": unpack_string(arg1), "entry": hex(arg0)}
+    if event == VM_MAP:
+        return "vm_map", "vm", {"root": hex(arg0), "address": hex(arg1)}
+    if event == PMEM_ALLOC:
+        return "pmem_alloc", "vm", {"frame": hex(arg0)}
+    if event == PAGE_FAULT:
+        return "page_fault", "vm", {"address": hex(arg0), "ip": hex(arg1)}
+    if event == IRQ:
+        return IRQS.get(arg0, "irq 0x%x" % arg0), "irq", {"vector": arg0, "data": hex(arg1)}
+    return "event %d" % event, "unknown", {"arg0": hex(arg0), "arg1": hex(arg1)}
+
+
+def convert(lines):
+    tsc_hz = None
+    records = []
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 2 and fields[0] == "F":
+            tsc_hz = int(fields[1])
+        elif len(fields) == 6 and fields[0] == "T":
+            tsc, cpu, event = int(fields[1]), int(fields[2]), int(fields[3])
+            records.append((tsc, cpu, event, int(fields[4], 16), int(fields[5], 16)))
+
+    if not tsc_hz:
+        sys.exit("no F line with the TSC frequency in the capture")
+
+    # Each CPU's ring is dumped separately, so put them back in time order
+    records.sort()
+    start = records[0][0] if records else 0
+
+    events = []
+    for cpu in sorted({r[1] for r in records}):
+        events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": cpu,
+                       "args": {"name": "cpu %d" % cpu}})
+
+    # Syscalls that never return (exec, exit) or that blocked and finished on
+    # another CPU leave their entry open; close it when the CPU enters the next one
+    open_syscalls = set()
+    for tsc, cpu, event, arg0, arg1 in records:
+        name, category, args = describe(event, arg0, arg1)
+        ts = (tsc - start) * 1e6 / tsc_hz
+        entry = {"name": name, "cat": category, "pid": 0, "tid": cpu, "ts": ts, "args": args}
+        if event == SYSCALL_ENTER:
+            if cpu in open_syscalls:
+                events.append({"ph": "E", "pid": 0, "tid": cpu, "ts": ts})
+            open_syscalls.add(cpu)
+            entry["ph"] = "B"
+        elif event == SYSCALL_EXIT:
+            if cpu not in open_syscalls:
+                continue
+            open_syscalls.discard(cpu)
+            entry["ph"] = "E"
+        else:
+            entry["ph"] = "i"
+            entry["s"] = "t"
+        events.append(entry)
+
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="console capture containing trace output")
+    parser.add_argument("-o", "--output", help="write the JSON here instead of stdout")
+    args = parser.parse_args()
+
+    with open(args.capture, errors="replace") as f:
+        trace = convert(f)
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    json.dump(trace, out)
+    out.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <trace.h>
+#include <unistd.h>
+
+// Records fetched from the kernel per call
+#define BATCH 32
+
+void _start() {
+    // The first run starts tracing every event, the next one stops it and dumps the records
+    if (trace(TRACE_STOP, 0, 0) == 0) {
+        trace(TRACE_START, 0, 0);
+        printf("tracing started, run trace again to dump records\n");
+        exit(0);
+    }
+
+    // The timestamp frequency, then one line per record, for tools/trace.py:
+    //   F <tsc hz>
+    //   T <tsc> <cpu> <event> <arg0> <arg1>
+    printf("F %ld\n", trace(TRACE_TSC_HZ, 0, 0));
+
+    struct trace_record records[BATCH];
+    long count;
+    while ((count = trace(TRACE_READ, (uint64_t)records, BATCH)) > 0) {
+        for (long i = 0; i < count; i++) {
+            struct trace_record *r = &records[i];
+            printf("T %lu %u %u %lx %lx\n", r->tsc, r->cpu, r->event, r->args[0], r->args[1]);
+        }
+    }
+
+    exit(0);
+}
@@ -0,0 +1,31 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Read stdin a page at a time, so a pipe hands over everything buffered at once
+#define BLOCK 4096
+
+void _start() {
+    static char buf[BLOCK];
+    unsigned long lines = 0, words = 0, bytes = 0;
+    bool in_word = false;
+
+    long count;
+    while ((count = read(0, buf, sizeof(buf))) > 0) {
+        bytes += count;
+        for (long i = 0; i < count; i++) {
+            char ch = buf[i];
+            if (ch == '\n') {
+                lines++;
+            }
+            bool space = ch == ' ' || ch == '\n' || ch == '\t';
+            if (!space && !in_word) {
+                words++;
+            }
+            in_word = !space;
+        }
+    }
+
+    printf("%7lu %7lu %7lu\n", lines, words, bytes);
+    exit(0);
+}